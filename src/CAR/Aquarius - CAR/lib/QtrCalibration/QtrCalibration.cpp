@@ -0,0 +1,167 @@
+#include <AquariusRecord.h>
+
+#include "QtrCalibration.h"
+
+QtrCalibration::QtrCalibration(QTRSensors &_qtr, uint8_t _count)
+    : qtr(_qtr), count(_count > QTR_MAX_SENSORS ? QTR_MAX_SENSORS : _count),
+      recalibrating(false), sampled_at(0) {
+  memset(&record, 0, sizeof(record));
+  record.count = count;
+}
+
+/**
+ * This function is responsible for handing the record to QTRSensors, the same
+ * way its own calibrate() would, without reading a single sensor.
+ */
+void QtrCalibration::apply() {
+  if (!qtr.calibrationOn.initialized) {
+    qtr.calibrationOn.minimum = (uint16_t *)realloc(qtr.calibrationOn.minimum,
+                                                    sizeof(uint16_t) * count);
+    qtr.calibrationOn.maximum = (uint16_t *)realloc(qtr.calibrationOn.maximum,
+                                                    sizeof(uint16_t) * count);
+    if (qtr.calibrationOn.minimum == NULL ||
+        qtr.calibrationOn.maximum == NULL) {
+      return;
+    }
+  }
+  memcpy(qtr.calibrationOn.minimum, record.minimum, sizeof(uint16_t) * count);
+  memcpy(qtr.calibrationOn.maximum, record.maximum, sizeof(uint16_t) * count);
+  qtr.calibrationOn.initialized = true;
+}
+
+/**
+ * This function is responsible for copying QTRSensors' calibration into the
+ * record.
+ */
+void QtrCalibration::capture() {
+  memcpy(record.minimum, qtr.calibrationOn.minimum, sizeof(uint16_t) * count);
+  memcpy(record.maximum, qtr.calibrationOn.maximum, sizeof(uint16_t) * count);
+  record.count = count;
+  record.patrols = 0;
+}
+
+/**
+ * This function is responsible for booting from the stored record. Returns
+ * false if there is none or it is not valid for this firmware.
+ */
+bool QtrCalibration::load() {
+  qtr_record stored;
+  if (!aq_record_load(QTR_CALIBRATION_ADDRESS, QTR_CALIBRATION_MAGIC,
+                      QTR_CALIBRATION_VERSION, &stored, sizeof(stored)) ||
+      stored.count != count) {
+    return false;
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    if (stored.maximum[i] <= stored.minimum[i]) {
+      return false;
+    }
+  }
+
+  record = stored;
+  apply();
+  return true;
+}
+
+void QtrCalibration::store() {
+  aq_record_store(QTR_CALIBRATION_ADDRESS, QTR_CALIBRATION_MAGIC,
+                  QTR_CALIBRATION_VERSION, &record, sizeof(record));
+}
+
+void QtrCalibration::erase() { aq_record_erase(QTR_CALIBRATION_ADDRESS); }
+
+/**
+ * This function is responsible for the stationary calibration, about 5
+ * seconds of reads while step moves the sensors across the line. Stored right
+ * away so it only ever runs once.
+ */
+void QtrCalibration::sweep(void (*step)(int iteration)) {
+  qtr.resetCalibration();
+  for (int i = 0; i < QTR_SWEEP_ITERATIONS; i++) {
+    step(i);
+    qtr.calibrate();
+  }
+  capture();
+  store();
+}
+
+/**
+ * This function is responsible for telling whether the record is old enough
+ * to be refreshed while driving.
+ */
+bool QtrCalibration::due() { return record.patrols >= QTR_RECALIBRATE_PATROLS; }
+
+/**
+ * This function is responsible for counting a patrol. The count is kept in
+ * RAM and only stored once it makes the record due, so the EEPROM is not
+ * rewritten every patrol; a reset meanwhile only puts the refresh off.
+ */
+void QtrCalibration::patrolled() {
+  if (record.patrols < 255) {
+    record.patrols++;
+  }
+  if (record.patrols == QTR_RECALIBRATE_PATROLS) {
+    store();
+  }
+}
+
+/**
+ * These functions are responsible for recalibrating in the field. Between
+ * beginRecalibration and endRecalibration, sample is called from the line
+ * follower; line following keeps using the current calibration meanwhile.
+ */
+
+void QtrCalibration::beginRecalibration() {
+  for (uint8_t i = 0; i < count; i++) {
+    candidate_min[i] = 0xFFFF;
+    candidate_max[i] = 0;
+  }
+  sampled_at = millis() - QTR_RECALIBRATE_INTERVAL;
+  recalibrating = true;
+}
+
+bool QtrCalibration::isRecalibrating() { return recalibrating; }
+
+void QtrCalibration::sample(bool force) {
+  if (!recalibrating ||
+      (!force && millis() - sampled_at < QTR_RECALIBRATE_INTERVAL)) {
+    return;
+  }
+  sampled_at = millis();
+
+  uint16_t raw[QTR_MAX_SENSORS];
+  qtr.read(raw);
+  for (uint8_t i = 0; i < count; i++) {
+    if (raw[i] < candidate_min[i])
+      candidate_min[i] = raw[i];
+    if (raw[i] > candidate_max[i])
+      candidate_max[i] = raw[i];
+  }
+}
+
+/**
+ * This function is responsible for adopting and storing what was seen since
+ * beginRecalibration, provided every sensor saw both the floor and the line.
+ * Returns false if the old calibration was kept.
+ */
+bool QtrCalibration::endRecalibration() {
+  if (!recalibrating) {
+    return false;
+  }
+  recalibrating = false;
+
+  for (uint8_t i = 0; i < count; i++) {
+    if (candidate_max[i] < candidate_min[i] + QTR_MIN_CONTRAST) {
+      return false;
+    }
+  }
+
+  memcpy(record.minimum, candidate_min, sizeof(uint16_t) * count);
+  memcpy(record.maximum, candidate_max, sizeof(uint16_t) * count);
+  record.patrols = 0;
+  apply();
+  store();
+  return true;
+}
+
+const qtr_record &QtrCalibration::getRecord() { return record; }
@@ -0,0 +1,59 @@
+#ifndef __QTR_CALIBRATION__
+#define __QTR_CALIBRATION__
+
+#include <QTRSensors.h>
+
+#define QTR_CALIBRATION_ADDRESS 0
+#define QTR_CALIBRATION_MAGIC 0x5154 // "QT"
+#define QTR_CALIBRATION_VERSION 1
+#define QTR_MAX_SENSORS 8
+
+// A sweep is only used when there is no valid record at all
+#define QTR_SWEEP_ITERATIONS 200
+// In-field recalibration: how often it runs, how often it samples and how
+// much contrast each sensor must have seen for the result to be kept
+#define QTR_RECALIBRATE_PATROLS 20
+#define QTR_RECALIBRATE_INTERVAL 20
+#define QTR_MIN_CONTRAST 200
+
+typedef struct {
+  uint8_t count;
+  uint8_t patrols;
+  uint16_t minimum[QTR_MAX_SENSORS];
+  uint16_t maximum[QTR_MAX_SENSORS];
+} qtr_record;
+
+class QtrCalibration {
+private:
+  QTRSensors &qtr;
+  uint8_t count;
+  qtr_record record;
+
+  bool recalibrating;
+  unsigned long sampled_at;
+  uint16_t candidate_min[QTR_MAX_SENSORS];
+  uint16_t candidate_max[QTR_MAX_SENSORS];
+
+  void apply();
+  void capture();
+
+public:
+  QtrCalibration(QTRSensors &_qtr, uint8_t _count);
+
+  bool load();
+  void store();
+  void erase();
+  void sweep(void (*step)(int iteration));
+
+  bool due();
+  void patrolled();
+
+  void beginRecalibration();
+  bool isRecalibrating();
+  void sample(bool force = false);
+  bool endRecalibration();
+
+  const qtr_record &getRecord();
+};
+
+#endif
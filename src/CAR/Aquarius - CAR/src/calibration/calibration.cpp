@@ -0,0 +1,136 @@
+#include <QTRSensors.h>
+#include <QtrCalibration.h>
+
+#define IR_QTR_COUNT 5 // number of sensors used
+
+byte ir1 = 26;
+byte ir2 = 27;
+byte ir3 = 28;
+byte ir4 = 29;
+byte ir5 = 30;
+QTRSensors qtr;
+QtrCalibration qtr_calibration(qtr, IR_QTR_COUNT);
+
+void calibrateQTR();
+void readQTR();
+void storeQTR();
+void recallQTR();
+void eraseQTR();
+
+void setup()
+{
+  qtr.setTypeRC();
+  const uint8_t ir_sensors[] = {ir1, ir2, ir3, ir4, ir5};
+  qtr.setSensorPins(ir_sensors, IR_QTR_COUNT);
+  Serial.begin(9600);
+  Serial.println("QTR Sensor Calibration. (C)alibrate, (R)ead, (S)tore to EEPROM, R(E)call from EEPROM, (X) erase EEPROM");
+}
+
+
+void loop()
+{
+
+  if (Serial.available())
+  {
+    char ch = Serial.read();
+
+    if (ch == 'c' || ch == 'C')
+    {
+      calibrateQTR();
+    }
+    else if (ch == 'r' || ch == 'R')
+    {
+      readQTR();
+    }
+    else if (ch == 's' || ch == 'S')
+    {
+      storeQTR();
+    }
+    else if (ch == 'e' || ch == 'E')
+    {
+      recallQTR();
+    }
+    else if (ch == 'x' || ch == 'X')
+    {
+      eraseQTR();
+    }
+  }
+
+}
+
+void sweepStep(int iteration)
+{
+  if (iteration % 50 == 0)
+  {
+    Serial.print('.');
+  }
+}
+
+void calibrateQTR()
+{
+  Serial.println();
+  Serial.println("Beginning Calibration Process... move the sensors across the line");
+
+  qtr_calibration.sweep(sweepStep); // 200 calls, ~25 ms each; also stores the record
+
+  Serial.println();
+  Serial.println("Calibration Complete");
+
+}
+
+void readQTR()
+{
+  const qtr_record &record = qtr_calibration.getRecord();
+
+  Serial.println();
+  Serial.println("Reading Calibration Data...");
+
+  for (int i = 0; i < IR_QTR_COUNT; i++)
+  {
+    Serial.print(record.minimum[i]);
+    Serial.print(' ');
+  }
+  Serial.println();
+
+  for (int i = 0; i < IR_QTR_COUNT; i++)
+  {
+    Serial.print(record.maximum[i]);
+    Serial.print(' ');
+  }
+  Serial.println();
+
+  Serial.print("Patrols since calibration: ");
+  Serial.println(record.patrols);
+}
+
+void storeQTR()
+{
+  Serial.println();
+  Serial.println("Storing Calibration Data into EEPROM...");
+
+  qtr_calibration.store();
+
+  Serial.println("EEPROM Storage Complete");
+}
+
+void recallQTR()
+{
+  Serial.println();
+  Serial.println("Recalling Calibration Data from EEPROM...");
+
+  if (qtr_calibration.load())
+  {
+    Serial.println("EEPROM Recall Complete");
+  }
+  else
+  {
+    Serial.println("No valid calibration record in EEPROM");
+  }
+}
+
+void eraseQTR()
+{
+  Serial.println();
+  qtr_calibration.erase();
+  Serial.println("EEPROM calibration record erased");
+}
@@ -1,33 +1,47 @@
 #include <AFMotor.h>
 #include <Aquarius.h>
-#include <EEPROMex.h>
-#include <HCSR04.h>
+#include <AquariusFixed.h>
+#include <AquariusLink.h>
+#include <AquariusRecord.h>
+#include <AquariusRoute.h>
+#include <AquariusStack.h>
+#include <AquariusTime.h>
+#include <AquariusWatchdog.h>
 #include <QTRSensors.h>
+#include <QtrCalibration.h>
 #include <RF24.h>
+#include <RF24Mesh.h>
 #include <RF24Network.h>
 #include <SPI.h>
 
+// Which car of the fleet this is, set per env in platformio.ini
+#ifndef CAR_INDEX
+#define CAR_INDEX 0
+#endif
+#define CURRENT (MESH_ID_CAR + CAR_INDEX)
+
+#define RADIO_PA_LEVEL RF24_PA_MAX
+
 #define IR_SENSOR_THRESHOLD 10
 
 #define MIN_SPEED 100
 #define MAX_SPEED 220
-
-#define EEPROM_ADDR_MIN_ON 0
-#define EEPROM_ADDR_MAX_ON 100
+// Between markers with nothing to water
+#define CRUISE_SPEED 180
 
 #define IR_QTR_COUNT 5
 
 #define STP_STEPS 512
 
-#define VOLTAGE_OFFSET 20
-#define VOLTAGE_TRESHOLD 11.1
+#define VOLTAGE_TRESHOLD_MV 11100
+#define VOLTAGE_CHECK_PERIOD 10000
 
-#define ADDR_CALIBRATED_MINIMUM_ON 0
-#define ADDR_CALIBRATED_MAXIMUM_ON 100
+// A renewal takes at most this long, so two fit well within the watchdog
+#define MESH_RENEW_TIMEOUT 5000
 
-#define WATERING_TIME 4000
-
-#define MIN_EMPTY_DIST 4
+#define MIN_EMPTY_DIST_MM 40
+#define MAX_VALID_DIST_MM 200
+#define WATER_LEVEL_SAMPLES 1024
 
 // Line follower QTR
 byte ir1 = 26;
@@ -36,8 +50,9 @@ byte ir3 = 28;
 byte ir4 = 29;
 byte ir5 = 30;
 QTRSensors qtr;
-unsigned int raw_ir_data[IR_QTR_COUNT];
+uint16_t raw_ir_data[IR_QTR_COUNT];
 bool ir_data[IR_QTR_COUNT];
+QtrCalibration qtr_calibration(qtr, IR_QTR_COUNT);
 
 // Stepper
 int stp0 = 36, stp1 = 37, stp2 = 38, stp3 = 39;
@@ -51,16 +66,34 @@ int voltage = A15;
 // NRF24L01
 RF24 radio(2, 53);
 RF24Network network(radio);
+RF24Mesh mesh(radio, network);
 AquariusNetworkCommunicator anc(network);
 
-RF24NetworkHeader car_header(NODE_CAR);
 RF24NetworkHeader ct_header(NODE_CT);
-RF24NetworkHeader h1_header(NODE_H1);
-RF24NetworkHeader h2_header(NODE_H2);
-int signal;
+aq_signal signal;
+LinkMonitor link_monitor(radio, MESH_CHANNEL, LINK_RATE_1MBPS);
+
+typedef union {
+  aq_signal signal;
+  protocol_hello hello;
+  time_sync time;
+  link_switch link;
+  refill_message refill;
+  patrol_start patrol;
+} request;
+
+// Time, from the CT
+AquariusClock wall_clock;
 
-// Water level (trig = 23, echo = 22)
-HCSR04 water_level(23, 22);
+// Battery
+unsigned long voltage_checked_at;
+
+// Mesh
+unsigned long mesh_checked_at;
+
+// Water level
+byte water_trig = 23;
+byte water_echo = 22;
 
 // Motors
 AF_DCMotor fl_motor(3);
@@ -74,7 +107,147 @@ enum direction { forward, left, right, stop };
 // Data
 bool needs_water[POTS];
 bool is_patrolling;
-int stop_counter, column_counter;
+int stop_counter;
+int patrol_speed;
+
+// The marker to wait at for the cars ahead, the dock's if none is out
+uint8_t hold_stop = ROUTE_DOCK;
+
+// Checkpoint: the patrol under way, kept in RAM on every marker before the car
+// works it, and stored after the QTR calibration record when the patrol
+// starts, leaves its hold or ends, so the EEPROM is not worn marker by
+// marker. A car reset on the track goes on from the next marker, so no pot is
+// watered twice; after a power cycle only the stored one is left, and the
+// car goes on from where the patrol or the hold began. After
+// CHECKPOINT_MAX_RESUMES resets on the same patrol it gives up on it. A car
+// that gave up is lost until it is reset other than by the watchdog, which is
+// taken as someone having brought it back to the dock.
+#define CHECKPOINT_ADDRESS 64
+#define CHECKPOINT_MAGIC 0x5043 // "CP"
+#define CHECKPOINT_VERSION 3
+#define CHECKPOINT_MAX_RESUMES 3
+typedef struct {
+  bool patrolling;
+  bool lost;
+  uint8_t next_stop;
+  uint8_t resumes;
+  uint8_t hold_stop;
+  bool needs_water[POTS];
+} car_checkpoint;
+static_assert(QTR_CALIBRATION_ADDRESS + RECORD_SIZE(sizeof(qtr_record)) <=
+                  CHECKPOINT_ADDRESS,
+              "The checkpoint overlaps the QTR calibration record");
+typedef struct {
+  record_header header;
+  car_checkpoint state;
+} kept_checkpoint;
+kept_checkpoint kept_patrol AQ_NOINIT;
+uint8_t patrol_resumes;
+bool lost_on_track = false;
+
+/**
+ * This function is responsible for prefixing a log line with the wall clock
+ * time, once the CT has sent it.
+ */
+void print_time() {
+  if (wall_clock.synced(millis())) {
+    Serial.print("[");
+    Serial.print(wall_clock.unixTime(millis()));
+    Serial.print("] ");
+  }
+}
+
+/**
+ * This function is responsible for printing how deep the stack has been and
+ * how much RAM was never touched.
+ */
+void print_stack() {
+  Serial.print("Stack: peak ");
+  Serial.print(stack_peak());
+  Serial.print(", headroom ");
+  Serial.print(stack_headroom());
+  Serial.print(", free ");
+  Serial.println(stack_free());
+}
+
+/**
+ * This function is responsible for the radio while the communicator waits.
+ */
+void network_update() { network.update(); }
+
+/**
+ * This function is responsible for getting a new address from the CT when the
+ * car lost its place in the mesh, at most once per MESH_CHECK_PERIOD.
+ */
+void check_mesh() {
+  if (millis() - mesh_checked_at < MESH_CHECK_PERIOD) {
+    return;
+  }
+  mesh_checked_at = millis();
+  print_stack();
+  if (!mesh.checkConnection()) {
+    Serial.println("WARNING: Lost the mesh, renewing the address!");
+    mesh.renewAddress(MESH_RENEW_TIMEOUT);
+    // The CT may have gone back home without us
+    if (!mesh.checkConnection() && !link_monitor.isHome()) {
+      link_monitor.goHome();
+      mesh.renewAddress(MESH_RENEW_TIMEOUT);
+    }
+  }
+}
+
+void on_write(RF24NetworkHeader &header, const void *data, int data_size,
+              bool delivered) {
+  link_monitor.sent(header.to_node, delivered);
+}
+
+/**
+ * This function is responsible for answering a survey request with our own
+ * survey and link totals.
+ */
+bool send_link_report() {
+  link_report report;
+  report.signal = SIG_LINK_REPORT;
+  link_monitor.fillReport(&report);
+  link_monitor.survey(report.busy);
+  return anc.writeTimeout(ct_header, &report, sizeof(report));
+}
+
+/**
+ * This function is responsible for answering the CT's hello with the protocol
+ * the car runs, and for saying so when the CT runs another one.
+ */
+bool send_hello(uint8_t version) {
+  if (version != PROTOCOL_VERSION) {
+    Serial.print("ERROR: The CT runs protocol ");
+    Serial.print(version);
+    Serial.print(", the car ");
+    Serial.println(PROTOCOL_VERSION);
+  }
+  protocol_hello hello;
+  hello.signal = SIG_HELLO;
+  hello.version = PROTOCOL_VERSION;
+  return anc.writeTimeout(ct_header, &hello, sizeof(hello));
+}
+
+/**
+ * This function is responsible for applying a channel switch from the CT once
+ * it is due and confirming it. If the CT cannot be reached on the new
+ * settings the car goes back home.
+ */
+void update_link() {
+  if (!link_monitor.due(millis())) {
+    return;
+  }
+
+  link_report report;
+  report.signal = SIG_LINK_REPORT;
+  link_monitor.fillReport(&report);
+  if (!anc.writeTimeout(ct_header, &report, sizeof(report))) {
+    Serial.println("WARNING: Link switch not confirmed, going home!");
+    link_monitor.goHome();
+  }
+}
 
 /**
  *  This function is responsible mapping raw qtr data to bools
@@ -84,17 +257,14 @@ void read_line() {
   for (int i = 0; i < IR_QTR_COUNT; i++) {
     ir_data[i] = raw_ir_data[i] < IR_SENSOR_THRESHOLD;
   }
+  qtr_calibration.sample();
 }
 
 /**
  * This function is responsible for reading the current voltage of the battery
+ * in millivolts
  */
-double read_voltage() {
-  int voltage_raw;
-  voltage_raw = analogRead(voltage);
-  return (double)((double)map(voltage_raw, 0, 1023, 0, 2500) + VOLTAGE_OFFSET) /
-         100.0;
-}
+uint16_t read_voltage() { return aq_voltage_mv(analogRead(voltage)); }
 
 /**
  * These functions are responsible for controlling the stepper
@@ -236,52 +406,89 @@ void water_pot_right() {
   }
 }
 
-double read_water_level() {
-  int read_times = 0;
-  double s = 0, level;
-  for (int i = 0; i < 1024; i++) {
-    level = water_level.dist();
-    if (level == 0.0 || level > 20) {
-      read_times--;
-    } else {
+/**
+ * This function is responsible for a single ultrasonic ping. Echoes beyond
+ * MAX_VALID_DIST_MM time out early and read as 0.
+ */
+uint16_t ping_water_level() {
+  digitalWrite(water_trig, LOW);
+  delayMicroseconds(2);
+  digitalWrite(water_trig, HIGH);
+  delayMicroseconds(10);
+  digitalWrite(water_trig, LOW);
+  unsigned long echo = pulseIn(water_echo, HIGH,
+                               2 * aq_mm_to_echo_us(MAX_VALID_DIST_MM));
+  return aq_echo_to_mm(echo);
+}
+
+/**
+ * This function is responsible for reading the distance between the sensor and
+ * the water surface in millimeters, averaged over the valid pings. Returns 0
+ * when no ping was valid.
+ */
+uint16_t read_water_level() {
+  uint16_t read_times = 0;
+  uint32_t s = 0;
+  uint16_t level;
+  for (int i = 0; i < WATER_LEVEL_SAMPLES; i++) {
+    level = ping_water_level();
+    if (level != 0 && level <= MAX_VALID_DIST_MM) {
       s += level;
+      read_times++;
     }
   }
+  if (read_times == 0)
+    return 0;
   return s / read_times;
 }
 
 /**
- * This function is responsible for handling the automatic refill
+ * This function is responsible for whether the tank holds needed_ml, or is as
+ * full as it may get, with the water surface level_mm below the sensor.
  */
-void refill() {
-  RF24NetworkHeader aux;
+bool tank_holds(uint16_t level_mm, uint16_t needed_ml) {
+  return level_mm < MIN_EMPTY_DIST_MM || aq_tank_ml(level_mm) >= needed_ml;
+}
 
-  // We ACK only if the water level is not close to the MIN_EMPTY_DIST;
-  // In case a read is not 100% precise the loop might desynchronize the CT and
-  // the CAR
-  if (read_water_level() - MIN_EMPTY_DIST < 0.3) {
+/**
+ * This function is responsible for handling the automatic refill, up to the
+ * water the CT says the next patrol needs.
+ */
+void refill(uint16_t needed_ml) {
+  // We ACK only if the tank lacks water and is not close to the
+  // MIN_EMPTY_DIST; In case a read is not 100% precise the loop might
+  // desynchronize the CT and the CAR
+  refill_message answer;
+  uint16_t level = read_water_level();
+  answer.ml = level == 0 ? 0 : aq_tank_ml(level);
+  if (level == 0) {
+    Serial.println("ERROR: Cannot read the water level, not refilling!");
+    answer.signal = SIG_REFILL_FAULT;
+  } else if (level < MIN_EMPTY_DIST_MM + 3 || answer.ml >= needed_ml) {
     Serial.println("No water needed!");
-    Serial.println("The water is to close to the maximum value");
-    return;
+    answer.signal = SIG_REFILL_STOP;
+  } else {
+    answer.signal = SIG_REFILL_ACK;
   }
 
-  signal = SIG_REFILL_ACK;
-
-  if (!anc.writeTimeout(ct_header, &signal, sizeof(signal))) {
+  if (!anc.writeTimeout(ct_header, &answer, sizeof(answer))) {
     Serial.println("ERROR: Response SIG_NEED_WATER_* not sent!");
     return;
   }
+  if (answer.signal != SIG_REFILL_ACK) {
+    return;
+  }
 
   delay(1000);
 
   Serial.println("Pouring water!");
   unsigned long currentMillis = millis();
-  int level;
   while (millis() - currentMillis <= MAX_REFILL_MILLIS + 6000) {
 
     level = read_water_level();
-    if (level != 0.0 && level - MIN_EMPTY_DIST < 0) {
-      // IF THIS HAPPENS THIS IS REALLY BAD BE CAREFULL
+    if (level != 0 && tank_holds(level, needed_ml)) {
+      // If the CT does not hear this the pump keeps going, which close to
+      // MIN_EMPTY_DIST IS REALLY BAD BE CAREFULL
       signal = SIG_REFILL_STOP;
       if (!anc.writeTimeout(ct_header, &signal, sizeof(signal))) {
         Serial.println("ERROR: STOP REFILL NOT SENT!");
@@ -294,11 +501,7 @@ void refill() {
       return;
     }
 
-    network.update();
-
-    if (network.available()) {
-      network.read(aux, &signal, sizeof(signal));
-    }
+    anc.pollControl(&signal, sizeof(signal));
 
     if (signal == SIG_REFILL_STOP) {
       Serial.println("Refill succeeded!");
@@ -333,8 +536,10 @@ bool read_watering_data() {
 }
 
 bool finish_patrol() {
-  signal = SIG_PATROL_STOP;
-  Serial.println("Finish patrol!");
+  signal = lost_on_track ? SIG_PATROL_LOST : SIG_PATROL_STOP;
+  print_time();
+  Serial.println(lost_on_track ? "Telling the CT we are lost!"
+                               : "Finish patrol!");
   if (!anc.writeTimeout(ct_header, &signal, sizeof(signal))) {
     Serial.println("ERROR: Tell CT patrol ended failed!");
     return false;
@@ -342,58 +547,180 @@ bool finish_patrol() {
   return true;
 }
 
-void patrol() {
+/**
+ * This function is responsible for the patrol checkpoint: the marker the car
+ * heads for next, or no patrol once it is back. Always kept in RAM, stored
+ * too unless durable is false.
+ */
+void checkpoint_patrol(bool patrolling, bool durable = true) {
+  car_checkpoint &checkpoint = kept_patrol.state;
+  checkpoint.patrolling = patrolling;
+  checkpoint.lost = lost_on_track;
+  checkpoint.next_stop = stop_counter;
+  checkpoint.resumes = patrol_resumes;
+  checkpoint.hold_stop = hold_stop;
+  memcpy(checkpoint.needs_water, needs_water, sizeof(needs_water));
+  aq_record_seal(&kept_patrol.header, CHECKPOINT_MAGIC, CHECKPOINT_VERSION,
+                 &checkpoint, sizeof(checkpoint));
+  if (durable) {
+    aq_record_store(CHECKPOINT_ADDRESS, CHECKPOINT_MAGIC, CHECKPOINT_VERSION,
+                    &checkpoint, sizeof(checkpoint));
+  }
+}
 
-  set_speed_all(MIN_SPEED);
+/**
+ * This function is responsible for finishing an in-field recalibration on the
+ * first marker, where every sensor sees black.
+ */
+void end_recalibration() {
+  qtr_calibration.sample(true);
+  if (qtr_calibration.endRecalibration()) {
+    Serial.println("QTR recalibrated on the first straight!");
+  } else {
+    Serial.println("WARNING: QTR recalibration rejected, keeping the old one!");
+  }
+}
+
+/**
+ * This function is responsible for the speed on the way to the given marker:
+ * slow when the car has to stop there, cruising otherwise.
+ */
+int approach_speed(int stop) {
+  if (stop >= ROUTE_DOCK || route_work(needs_water, stop)) {
+    return MIN_SPEED;
+  }
+  return CRUISE_SPEED;
+}
+
+/**
+ * This function is responsible for watering whatever the plan has at the
+ * current stop.
+ */
+void work_stop(uint8_t work) {
+  set_direction(stop);
+  if (work & ROUTE_LEFT) {
+    water_pot_left();
+    delay(500);
+  }
+  if (work & ROUTE_RIGHT) {
+    water_pot_right();
+    delay(500);
+  }
+}
+
+/**
+ * This function is responsible for waiting at the hold marker until the CT
+ * says the cars ahead are back at the dock. Returns false if the lap runs out
+ * of time meanwhile.
+ */
+bool hold_for_cars(unsigned long started) {
+  set_direction(stop);
+  Serial.println("Holding for the cars ahead!");
+  while (hold_stop != ROUTE_DOCK) {
+    aq_watchdog_feed();
+    if (millis() - started > MAX_PATROL_MILLIS) {
+      return false;
+    }
+    aq_signal go;
+    if (anc.pollControl(&go, sizeof(go)) == sizeof(go) &&
+        go == SIG_PATROL_GO) {
+      hold_stop = ROUTE_DOCK;
+    }
+  }
+  checkpoint_patrol(true);
+  return true;
+}
+
+bool all_black() {
+  return ir_data[0] && ir_data[1] && ir_data[2] && ir_data[3] && ir_data[4];
+}
+
+/**
+ * This function is responsible for driving the patrol from the given marker
+ * on. A lap that takes longer than MAX_PATROL_MILLIS is given up where the
+ * car is; it is lost and someone has to bring it home.
+ */
+void patrol_from(int first_stop) {
+
+  // Refresh the calibration on the way to the first marker when it is old
+  if (qtr_calibration.due()) {
+    qtr_calibration.beginRecalibration();
+  }
+
+  int last_stop = route_last_stop(needs_water);
+  Serial.print("Planned patrol: ");
+  Serial.print(route_dry_pots(needs_water));
+  Serial.print(" pots, last stop ");
+  Serial.println(last_stop);
+
+  stop_counter = first_stop;
+  checkpoint_patrol(true);
+  unsigned long started = millis();
+
+  // A reset while holding resumes on the hold marker, still holding
+  if (first_stop == hold_stop + 1) {
+    hold_for_cars(started);
+  }
+
+  aq_watchdog_feed();
+  patrol_speed = approach_speed(stop_counter);
+  set_speed_all(patrol_speed);
   set_direction(forward);
 
+  // Off the marker the car stands on
   delay(500);
 
   while (true) {
-    read_line();
-    if (ir_data[0] && ir_data[1] && ir_data[2] && ir_data[3] && ir_data[4]) {
+    if (millis() - started > MAX_PATROL_MILLIS) {
       set_direction(stop);
+      stop_counter = 0;
+      hold_stop = ROUTE_DOCK;
+      lost_on_track = true;
+      checkpoint_patrol(false);
+      Serial.println("ERROR: Patrol timed out, the car is lost!");
+      return;
+    }
 
-      column_counter = stop_counter / 4;
-
-      switch (column_counter) {
-      case 0:
-        if (needs_water[stop_counter]) {
-          water_pot_left();
-          delay(500);
-        }
+    read_line();
+    if (all_black()) {
+      aq_watchdog_feed();
+      if (qtr_calibration.isRecalibrating()) {
+        end_recalibration();
+      }
 
-        break;
-      case 1:
-        if (needs_water[stop_counter]) {
-          water_pot_left();
-          delay(500);
-        }
-        if (needs_water[stop_counter + 4]) {
-          water_pot_right();
-          delay(500);
-        }
-        break;
-      case 2:
-        if (needs_water[stop_counter + 4]) {
-          water_pot_right();
-          delay(500);
-        }
-        break;
-      case 3:
-        column_counter = 0;
+      if (stop_counter == ROUTE_DOCK) {
+        set_direction(stop);
         stop_counter = 0;
+        hold_stop = ROUTE_DOCK;
+        checkpoint_patrol(false);
         Serial.println("Finish patrol!");
         return;
       }
 
-      stop_counter++;
+      // Checkpointed past this marker before working it: a reset while
+      // watering goes on from the next one
+      int marker = stop_counter++;
+      checkpoint_patrol(true, false);
 
-      set_speed_all(MIN_SPEED);
+      // Past the last stop with work the car only counts markers on its way
+      // back to the dock
+      uint8_t work = route_work(needs_water, marker);
+      if (work) {
+        work_stop(work);
+      }
+      if (marker == last_stop) {
+        Serial.println("Work done, returning to the dock!");
+      }
+      // Given up at the top of the loop if the lap ran out meanwhile
+      if (marker == hold_stop && !hold_for_cars(started)) {
+        continue;
+      }
+
+      patrol_speed = approach_speed(stop_counter);
+      set_speed_all(patrol_speed);
       set_direction(forward);
 
-      while (ir_data[0] && ir_data[1] && ir_data[2] && ir_data[3] &&
-             ir_data[4]) {
+      while (all_black()) {
         read_line();
       }
       continue;
@@ -405,7 +732,7 @@ void patrol() {
       while (!ir_data[3]) {
         read_line();
       }
-      set_speed_all(MIN_SPEED);
+      set_speed_all(patrol_speed);
       set_direction(forward);
       continue;
     }
@@ -415,7 +742,7 @@ void patrol() {
       while (!ir_data[1]) {
         read_line();
       }
-      set_speed_all(MIN_SPEED);
+      set_speed_all(patrol_speed);
       set_direction(forward);
       continue;
     }
@@ -431,13 +758,108 @@ void patrol() {
       continue;
     }
     if (ir_data[2]) {
-      set_speed_all(MIN_SPEED);
+      set_speed_all(patrol_speed);
       set_direction(forward);
       continue;
     }
   }
 }
 
+void patrol() { patrol_from(0); }
+
+/**
+ * This function is responsible for telling the CT the car is back, or lost,
+ * for at most PATROL_FINISH_MILLIS; the CT stops waiting for it after that
+ * anyway.
+ */
+void report_patrol_end() {
+  unsigned long started = millis();
+  while (!finish_patrol()) {
+    aq_watchdog_feed();
+    if (millis() - started > PATROL_FINISH_MILLIS) {
+      Serial.println("ERROR: The CT did not hear the patrol end!");
+      return;
+    }
+  }
+}
+
+/**
+ * This function is responsible for a patrol from the given marker to the
+ * dock, or to where the car got lost, and for reporting its end.
+ */
+void run_patrol(int first_stop) {
+  patrol_from(first_stop);
+  patrol_resumes = 0;
+  qtr_calibration.patrolled();
+  report_patrol_end();
+}
+
+/**
+ * This function is responsible for finishing the patrol a reset cut short,
+ * from the checkpoint it left in RAM if that outlived the reset, else from
+ * the stored one.
+ */
+void resume_patrol() {
+  car_checkpoint checkpoint;
+  if (aq_record_valid(&kept_patrol.header, CHECKPOINT_MAGIC,
+                      CHECKPOINT_VERSION, &kept_patrol.state,
+                      sizeof(kept_patrol.state))) {
+    checkpoint = kept_patrol.state;
+  } else if (!aq_record_load(CHECKPOINT_ADDRESS, CHECKPOINT_MAGIC,
+                             CHECKPOINT_VERSION, &checkpoint,
+                             sizeof(checkpoint))) {
+    return;
+  }
+
+  if (checkpoint.lost) {
+    if (aq_watchdog_fired()) {
+      Serial.println("WARNING: Watchdog reset while lost, still lost!");
+      lost_on_track = true;
+      return;
+    }
+    Serial.println("Reset after being lost, back at the dock!");
+    checkpoint_patrol(false);
+    report_patrol_end();
+    return;
+  }
+  if (!checkpoint.patrolling) {
+    return;
+  }
+
+  memcpy(needs_water, checkpoint.needs_water, sizeof(needs_water));
+  hold_stop = checkpoint.hold_stop;
+  stop_counter = 0;
+  if (checkpoint.resumes >= CHECKPOINT_MAX_RESUMES) {
+    Serial.println("ERROR: Patrol keeps resetting, giving it up, lost!");
+    patrol_resumes = 0;
+    hold_stop = ROUTE_DOCK;
+    lost_on_track = true;
+    checkpoint_patrol(false);
+    report_patrol_end();
+    return;
+  }
+  patrol_resumes = checkpoint.resumes + 1;
+
+  Serial.print(aq_watchdog_fired() ? "Watchdog reset" : "Reset");
+  Serial.print(" on patrol, resuming at marker ");
+  Serial.println(checkpoint.next_stop);
+  run_patrol(checkpoint.next_stop);
+}
+
+/**
+ * This function is responsible for rocking the car over the line during a
+ * sweep calibration: left, right, right, left, so it ends where it started.
+ */
+void sweep_step(int iteration) {
+  int segment = QTR_SWEEP_ITERATIONS / 4;
+  if (iteration % segment != 0) {
+    return;
+  }
+  int k = iteration / segment;
+  set_speed_all(MIN_SPEED);
+  set_direction(k == 0 || k == 3 ? left : right);
+}
+
 void setup() {
   Serial.begin(9600);
 
@@ -445,16 +867,25 @@ void setup() {
   qtr.setTypeRC();
   byte ir_sensors[] = {ir1, ir2, ir3, ir4, ir5};
   qtr.setSensorPins(ir_sensors, IR_QTR_COUNT);
-  qtr.calibrate();
-  EEPROM.readBlock<unsigned int>(EEPROM_ADDR_MIN_ON, qtr.calibrationOn.minimum,
-                                 IR_QTR_COUNT);
-  EEPROM.readBlock<unsigned int>(EEPROM_ADDR_MAX_ON, qtr.calibrationOn.maximum,
-                                 IR_QTR_COUNT);
+  if (!qtr_calibration.load()) {
+    Serial.println("WARNING: No valid QTR calibration, sweeping!");
+    qtr_calibration.sweep(sweep_step);
+    set_direction(stop);
+  }
+
+  // Water level
+  pinMode(water_trig, OUTPUT);
+  pinMode(water_echo, INPUT);
 
   // NRF24L01
   SPI.begin();
-  radio.begin();
-  network.begin(90, NODE_CAR);
+  mesh.setNodeID(CURRENT);
+  if (!mesh.begin(MESH_CHANNEL)) {
+    Serial.println("WARNING: Could not join the mesh yet!");
+  }
+  radio.setPALevel(RADIO_PA_LEVEL);
+  anc.setUpdate(network_update);
+  anc.setWriteHook(on_write);
 
   // Pump
   pinMode(pump, OUTPUT);
@@ -462,27 +893,62 @@ void setup() {
 
   // Motors
   set_speed_all(MIN_SPEED);
+
+  aq_watchdog_begin();
+  resume_patrol();
 }
 
 void loop() {
-  double voltage = read_voltage();
-  if (voltage < VOLTAGE_TRESHOLD) {
-    Serial.println("WARNING: Low battery level! Cannot operate!");
+  aq_watchdog_feed();
+  update_link();
+  check_mesh();
+
+  if (millis() - voltage_checked_at >= VOLTAGE_CHECK_PERIOD) {
+    voltage_checked_at = millis();
+    uint16_t voltage = read_voltage();
+    if (voltage < VOLTAGE_TRESHOLD_MV) {
+      Serial.println("WARNING: Low battery level! Cannot operate!");
+    }
   }
 
-  if (anc.readTimeout(&signal, sizeof(signal))) {
-    if (signal == SIG_REFILL_START) {
+  request message;
+  int size = anc.poll(&message, sizeof(message));
+  if (size >= (int)sizeof(message.signal)) {
+    signal = message.signal;
+
+    if (signal == SIG_TIME_SYNC && size == sizeof(message.time)) {
+      wall_clock.sync(message.time.seconds, message.time.milliseconds,
+                      millis());
+    }
+
+    if (signal == SIG_HELLO && size >= (int)sizeof(message.hello)) {
+      send_hello(message.hello.version);
+    }
+
+    if (signal == SIG_LINK_SURVEY) {
+      send_link_report();
+    }
+
+    if (signal == SIG_LINK_SWITCH && size == sizeof(message.link)) {
+      link_monitor.schedule(message.link, millis());
+    }
+
+    if (signal == SIG_REFILL_START && size == sizeof(message.refill)) {
+      print_time();
       Serial.println("Refilling!");
-      refill();
+      refill(message.refill.ml);
     }
 
-    if (signal == SIG_PATROL_START) {
+    if (signal == SIG_PATROL_START && size == sizeof(message.patrol)) {
+      hold_stop = message.patrol.hold_stop;
+      print_time();
       Serial.println("Patrolling!");
-      if (read_watering_data()) {
+      if (lost_on_track) {
+        read_watering_data();
+        Serial.println("ERROR: Lost, not patrolling until back at the dock!");
+      } else if (read_watering_data()) {
         if (confirm_start()) {
-          patrol();
-          while (!finish_patrol())
-            ;
+          run_patrol(0);
         }
       }
     }
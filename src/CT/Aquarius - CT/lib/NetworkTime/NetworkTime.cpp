@@ -0,0 +1,89 @@
+#include <AquariusTime.h>
+
+#include "NetworkTime.h"
+
+bool ntp_time(EthernetUDP &udp, const char *server, uint32_t *unix_s,
+              uint16_t *unix_ms) {
+  byte packet[NTP_PACKET_SIZE];
+  memset(packet, 0, sizeof(packet));
+  packet[0] = 0xE3; // Unsynchronized, version 4, client
+
+  udp.begin(NTP_LOCAL_PORT);
+  if (!udp.beginPacket(server, NTP_PORT)) {
+    udp.stop();
+    return false;
+  }
+  udp.write(packet, sizeof(packet));
+  udp.endPacket();
+
+  unsigned long sent = millis();
+  while (millis() - sent < NTP_TIMEOUT) {
+    if (udp.parsePacket() < NTP_PACKET_SIZE) {
+      continue;
+    }
+    udp.read(packet, sizeof(packet));
+    udp.stop();
+
+    uint32_t seconds = 0, fraction = 0;
+    for (int i = 0; i < 4; i++) {
+      seconds = seconds << 8 | packet[40 + i];
+      fraction = fraction << 8 | packet[44 + i];
+    }
+
+    // Transmit timestamp, plus half the round trip for the way back
+    uint32_t ms = (((fraction >> 16) * 1000UL) >> 16) + (millis() - sent) / 2;
+    *unix_s = seconds - NTP_UNIX_OFFSET + ms / 1000;
+    *unix_ms = ms % 1000;
+    return true;
+  }
+
+  udp.stop();
+  return false;
+}
+
+bool http_date_time(EthernetClient &client, const char *host,
+                    uint32_t *unix_s) {
+  if (!client.connect(host, 80)) {
+    return false;
+  }
+
+  client.println("HEAD / HTTP/1.1");
+  client.print("Host: ");
+  client.println(host);
+  client.println("Connection: close");
+  client.println();
+
+  char line[64];
+  byte length = 0;
+  bool found = false;
+  unsigned long start = millis();
+
+  while (millis() - start < HTTP_DATE_TIMEOUT &&
+         (client.connected() || client.available())) {
+    if (!client.available()) {
+      continue;
+    }
+
+    char c = client.read();
+    if (c != '\n') {
+      if (c != '\r' && length < sizeof(line) - 1) {
+        line[length++] = c;
+      }
+      continue;
+    }
+
+    line[length] = '\0';
+    if (strncmp(line, "Date:", 5) == 0) {
+      found = aq_parse_http_date(line + 5, unix_s);
+      break;
+    }
+    if (length == 0) {
+      // End of the headers
+      break;
+    }
+    length = 0;
+  }
+
+  client.stop();
+  return found;
+}
@@ -0,0 +1,24 @@
+#ifndef __NETWORK_TIME__
+#define __NETWORK_TIME__
+
+#include <Ethernet.h>
+#include <EthernetUdp.h>
+
+#define NTP_PACKET_SIZE 48
+#define NTP_PORT 123
+#define NTP_LOCAL_PORT 8888
+#define NTP_TIMEOUT 1500
+#define NTP_UNIX_OFFSET 2208988800UL
+
+#define HTTP_DATE_TIMEOUT 3000
+
+/**
+ * These functions are responsible for learning the wall clock time over
+ * Ethernet: SNTP first, the Date header of an HTTP response as a fallback.
+ */
+bool ntp_time(EthernetUDP &udp, const char *server, uint32_t *unix_s,
+              uint16_t *unix_ms);
+bool http_date_time(EthernetClient &client, const char *host,
+                    uint32_t *unix_s);
+
+#endif
@@ -1,6 +1,22 @@
 #include <Aquarius.h>
+#include <Aquarius_config.h>
+#include <AquariusDrying.h>
+#include <AquariusGateway.h>
+#include <AquariusHistory.h>
+#include <AquariusLink.h>
+#include <AquariusMetrics.h>
+#include <AquariusRecord.h>
+#include <AquariusRoute.h>
+#include <AquariusStack.h>
+#include <AquariusTime.h>
+#include <AquariusTrace.h>
+#include <AquariusValidity.h>
+#include <AquariusWatchdog.h>
 #include <Ethernet.h>
+#include <EthernetUdp.h>
+#include <NetworkTime.h>
 #include <RF24.h>
+#include <RF24Mesh.h>
 #include <RF24Network.h>
 #include <SPI.h>
 
@@ -26,22 +42,188 @@ byte pump = 47;
 // NRF24L01
 RF24 radio(49, 53);         // CE, CSN
 RF24Network network(radio); // Network
+RF24Mesh mesh(radio, network);
 AquariusNetworkCommunicator anc(network);
 
-RF24NetworkHeader car_header(NODE_CAR);
 RF24NetworkHeader ct_header(NODE_CT);
-RF24NetworkHeader h1_header(NODE_H1);
-RF24NetworkHeader h2_header(NODE_H2);
-int signal;
-
-// Ethernet
+aq_signal signal;
+
+// Protocol: what each node answered the hello with, by node ID. A node on
+// another protocol, or one that did not answer, is asked again after
+// PROTOCOL_RECHECK_PERIOD, in case it was updated meanwhile; one on ours
+// after a write to it timed out, in case it was reflashed.
+#define PROTOCOL_RECHECK_PERIOD 600000UL
+#define PROTOCOL_SILENT 0xFF
+uint8_t node_protocol[MESH_IDS];
+unsigned long protocol_checked_at;
+
+// Link: surveyed every LINK_SURVEY_PERIOD, or sooner when delivery drops.
+// Channel margins are in busy samples summed over every node.
+#define RADIO_PA_LEVEL RF24_PA_MAX
+#define LINK_SURVEY_PERIOD 21600000UL
+#define LINK_MIN_ATTEMPTS 100
+#define LINK_MIN_DELIVERY_PERMILLE 800
+#define LINK_CHANNEL_MARGIN 16
+#define LINK_SWITCH_LEAD_MS 1500
+// Switch confirmations per slot: as many as the communicator's bulk lane holds
+#define LINK_CONFIRM_WINDOW                                                    \
+  (LANE_BULK_BYTES / (1 + sizeof(RF24NetworkHeader) + sizeof(link_report)))
+#define LINK_NODES (MAX_HARVESTERS + MAX_CARS)
+#if LINK_SWITCH_LEAD_MS * (LINK_NODES + 1) / LINK_SWITCH_TICK_MS > 0xFFFF
+#error "A link switch lead is longer than link_switch can carry"
+#endif
+LinkMonitor link_monitor(radio, MESH_CHANNEL, LINK_RATE_1MBPS);
+unsigned long link_surveyed_at;
+bool link_surveyed = false;
+bool link_lost = false;
+bool link_told[LINK_NODES];
+bool link_confirmed[LINK_NODES];
+
+// Metrics: phase timers exclude the LED signalling, the cycle timer is wall
+// time from the first try of phase one to the end of phase five
+AquariusMetrics metrics;
+unsigned long cycle_started_at;
+bool cycle_running = false;
+
+// Traffic: every frame the communicator sends or reads and every phase start,
+// most recent TRACE_BUFFER bytes; 'T' on Serial dumps it
+AquariusTrace trace;
+
+// Ethernet: a DHCP server that does not answer holds a boot, and so a
+// resume, up for ETHERNET_DHCP_TIMEOUT
+#define ETHERNET_DHCP_TIMEOUT 10000
 byte mac[] = {0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED};
 EthernetClient client;
 bool have_written_db = false;
 
+// Time
+#define TIME_SYNC_PERIOD 3600000UL
+#define NTP_SERVER "pool.ntp.org"
+EthernetUDP udp;
+AquariusClock wall_clock;
+unsigned long wall_clock_synced_at;
+unsigned long time_sent_at[MAX_HARVESTERS];
+bool time_sent[MAX_HARVESTERS];
+
 // Harvesting
-byte pot_data[POTS];
-bool is_patrolling = false;
+#define DRY_HUMIDITY 30
+#define MAX_HARVEST_AGE 60000
+byte pot_data[MAX_HARVESTERS * POTS_PER_HARVESTER];
+
+// Harvesters in the mesh, deepest first, and which of them answered
+uint8_t harvesters;
+uint8_t harvester_order[MAX_HARVESTERS];
+uint16_t harvester_address[MAX_HARVESTERS];
+bool requested[MAX_HARVESTERS];
+unsigned long requested_at[MAX_HARVESTERS];
+bool harvested[MAX_HARVESTERS];
+
+// Harvest replies in flight at once: as many as the communicator's bulk lane
+// holds, so none is dropped while the CT is busy with the next request
+#define HARVEST_WINDOW                                                         \
+  (LANE_BULK_BYTES / (1 + sizeof(RF24NetworkHeader) + sizeof(harvest_data)))
+uint16_t bulk_dropped;
+
+// Sample ages, logged once the replies are in: at 9600 baud a line per reply
+// holds the CT long enough for replies relayed meanwhile to be lost
+uint32_t harvest_oldest;
+uint8_t harvest_stale;
+
+// Fleet: each car waters the stops of its own package; fleet_started_at to
+// fleet_finished_at is the whole fleet's completion time. A car sent while a
+// car on a farther package is out is held before that package until the
+// farther cars are back, as its way to the dock leads through it. A car that
+// said it is lost stays where it gave up: it is neither refilled nor sent
+// until it says it is back at the dock, and counts as out meanwhile.
+bool needs_water[POTS];
+int package_first_stop[CARS + 1];
+bool car_patrolling[CARS];
+bool car_held[CARS];
+bool car_lost[CARS];
+int fleet_cars;
+unsigned long fleet_started_at;
+unsigned long fleet_finished_at;
+
+// Backfill: next history seq to pull from each harvester
+uint16_t history_seq[MAX_HARVESTERS];
+
+// When each harvester took its snapshot, 0 while the clock is not synced
+uint32_t pot_time[MAX_HARVESTERS];
+
+// Drying model fitted from every reading with a wall clock time. Once it is
+// trusted for every pot, the next cycle starts CYCLE_LEAD_S before the first
+// pot is forecast dry instead of right away, and a patrol that goes out
+// anyway also waters the pots forecast dry within WATER_AHEAD_S. It takes
+// days to fit, so it is kept, sealed, in RAM that a reset does not clear.
+#define CYCLE_LEAD_S 600UL
+#define CYCLE_MAX_WAIT_S 3600UL
+#define WATER_AHEAD_S 10800UL
+// A cycle's backfill reaches back to the last one, a wait and a cycle ago
+#if CYCLE_MAX_WAIT_S + CYCLE_LEAD_S > HISTORY_SPAN_S
+#error "CYCLE_MAX_WAIT_S outlasts the harvesters' history"
+#endif
+#define DRYING_MAGIC 0x4D44 // "DM"
+typedef struct {
+  uint16_t magic;
+  uint16_t crc;
+  drying_pot pots[POTS];
+} kept_drying;
+kept_drying drying_pots AQ_NOINIT;
+DryingModel drying(drying_pots.pots, POTS);
+unsigned long cycle_ended_at;
+unsigned long cycle_wait;
+
+// Plausibility of each pot's readings. An implausible pot is planned as if
+// its harvester had not answered, kept out of the drying model and flagged
+// in the upload; pots off the track only get the range check.
+validity_pot validity_pots[POTS];
+ValidityModel validity(validity_pots, POTS);
+uint8_t implausible;
+
+// Checkpoint: the phase the cycle is in and what it has decided so far,
+// sealed in RAM a reset does not clear after every phase and every car sent
+// or back, so a watchdog reset resumes the cycle where it was. While a patrol
+// is on, or a car is lost, it goes to EEPROM too, as a power cut must not lose
+// the cars either; the phases before are cheaper to run again than an EEPROM
+// write per phase.
+#define CHECKPOINT_ADDRESS 0
+#define CHECKPOINT_MAGIC 0x5043 // "CP"
+#define CHECKPOINT_VERSION 3
+typedef struct {
+  uint8_t phase;
+  bool harvested[HARVESTERS];
+  uint8_t pot_data[POTS];
+  uint32_t pot_time[HARVESTERS];
+  uint16_t history_seq[MAX_HARVESTERS];
+  bool needs_water[POTS];
+  bool car_patrolling[CARS];
+  bool car_held[CARS];
+  bool car_lost[CARS];
+} ct_checkpoint;
+#ifdef __AVR__
+static_assert(CHECKPOINT_ADDRESS + RECORD_SIZE(sizeof(ct_checkpoint)) <=
+                  E2END + 1,
+              "The checkpoint does not fit in EEPROM");
+#endif
+typedef struct {
+  record_header header;
+  ct_checkpoint state;
+} kept_checkpoint;
+kept_checkpoint checkpoint AQ_NOINIT;
+bool checkpoint_stored = false;
+
+// Gateway, built with -DGATEWAY: while a host on Serial keeps saying hello,
+// the CT only bridges the mesh to it between cycles. Once it has been silent
+// GATEWAY_HOST_TIMEOUT the phases run on board again.
+#ifdef GATEWAY
+GatewayDecoder gateway;
+gateway_frame gateway_out;
+unsigned long host_heard_at;
+bool host_present = false;
+bool bridging = false;
+unsigned long pump_started_at;
+bool pump_on = false;
+#endif
 
 // Monitoring
 int red_light_pin = 7;
@@ -103,306 +285,1965 @@ void led_phase_success() {
 }
 
 /*******************************************************************************
-*********************************** Main Code **********************************
+*********************************** Metrics ************************************
 ********************************************************************************/
 
+void serial_emit(uint8_t byte) { Serial.write(byte); }
+
+// The hex of a dump goes out CLIENT_HEX_CHUNK characters per client.write,
+// from a buffer on post_metrics' stack, not one W5100 send per character
+#define CLIENT_HEX_CHUNK 64
+char *client_hex;
+uint8_t client_hex_size;
+
+void client_hex_flush() {
+  client.write((const uint8_t *)client_hex, client_hex_size);
+  client_hex_size = 0;
+}
+
+void client_hex_emit(uint8_t byte) {
+  const char *digits = "0123456789abcdef";
+  client_hex[client_hex_size++] = digits[byte >> 4];
+  client_hex[client_hex_size++] = digits[byte & 0x0F];
+  if (client_hex_size == CLIENT_HEX_CHUNK) {
+    client_hex_flush();
+  }
+}
+
 /**
- *  This function is responsible for requesting data from harvesters and storing
- * it in memory. These functions define phase_one.
+ * This function is responsible for the binary dumps over Serial: the metrics
+ * when 'M' is received, the traffic trace when 'T' is. They start with their
+ * magic, "AM" and "AT", so a reader can find them between the log lines, and
+ * end with their CRC.
  */
-bool harvest() {
-  Serial.println("Phase 1!");
+void serve_command(int command) {
+  switch (command) {
+  case 'M':
+    metrics.stackHeadroom(stack_headroom());
+    metrics.dump(millis(), serial_emit);
+    Serial.println();
+    break;
+  case 'T':
+    trace.dump(millis(), READ_TIMEOUT, WRITE_TIMEOUT, serial_emit);
+    Serial.println();
+    break;
+  }
+}
 
-  byte harvest[8];
-  byte null[8];
-  memset(null, 0, sizeof(null));
-  memset(pot_data, 0x00, POTS);
+void serve_serial() {
+  while (Serial.available()) {
+    serve_command(Serial.read());
+  }
+}
 
-  signal = SIG_HARVEST_START;
+/**
+ * This function is responsible for printing how deep the stack has been and
+ * how much RAM was never touched, i.e. how much pot_data and the queues can
+ * still grow.
+ */
+void print_stack() {
+  Serial.print("Stack: peak ");
+  Serial.print(stack_peak());
+  Serial.print(", headroom ");
+  Serial.print(stack_headroom());
+  Serial.print(", free ");
+  Serial.println(stack_free());
+}
 
-  yellow();
-  for (int i = 0; i < HARVESTERS; i++) {
+void print_metrics() {
+  const char *names[METRICS_PHASES] = {"harvest", "persist", "refill",
+                                       "patrol",  "await",   "cycle"};
+  const metrics_data &data = metrics.getData();
+  for (int i = 0; i < METRICS_PHASES; i++) {
+    const metrics_phase &p = data.phases[i];
+    Serial.print(names[i]);
+    Serial.print(": runs ");
+    Serial.print(p.count);
+    Serial.print(", failed ");
+    Serial.print(p.failures);
+    Serial.print(", min ");
+    Serial.print(p.min_ms);
+    Serial.print(", mean ");
+    Serial.print(metrics.mean(i));
+    Serial.print(", p90 ");
+    Serial.print(metrics.percentile(i, 90));
+    Serial.print(", max ");
+    Serial.println(p.max_ms);
+  }
+  print_stack();
+}
 
-    Serial.print("Harvester: ");
-    Serial.println(i + 1);
+/**
+ * This function is responsible for uploading the metrics dump, hex encoded.
+ * It is streamed to the client in chunks, it would not fit in a String.
+ */
+void post_metrics() {
+  client.println("POST /php/metrics.php? HTTP/1.1");
+  client.println("Host: si-aquarius.go.ro");
+  client.println("Content-Type: application/x-www-form-urlencoded");
+  client.print("Content-Length: ");
+  client.println(strlen("blob=") + 2 * METRICS_DUMP_SIZE);
+  client.println();
+  client.print("blob=");
+  metrics.stackHeadroom(stack_headroom());
+  char hex[CLIENT_HEX_CHUNK];
+  client_hex = hex;
+  client_hex_size = 0;
+  metrics.dump(millis(), client_hex_emit);
+  client_hex_flush();
+  client.println();
+}
 
-    RF24NetworkHeader header(NODE_H1 + i);
+/*******************************************************************************
+************************************* Time *************************************
+********************************************************************************/
 
-    if (!anc.writeTimeout(header, &signal, sizeof(signal))) {
-      Serial.print("TIMEOUT: Cannot start harvest for harvester: ");
-      Serial.println(i + 1);
-      led_phase_error(1);
-      return false;
-    }
+/**
+ * This function is responsible for keeping the wall clock synced, at most once
+ * per TIME_SYNC_PERIOD.
+ */
+void sync_wall_clock() {
+  if (wall_clock.synced(millis()) &&
+      millis() - wall_clock_synced_at < TIME_SYNC_PERIOD) {
+    return;
+  }
 
-    if (!anc.readTimeout(harvest, sizeof(harvest))) {
-      Serial.print("TIMEOUT: Could not read data from harvester: ");
-      Serial.println(i + 1);
-      led_phase_error(2);
-      return false;
-    }
+  uint32_t unix_s;
+  uint16_t unix_ms = 0;
+  if (!ntp_time(udp, NTP_SERVER, &unix_s, &unix_ms) &&
+      !http_date_time(client, "si-aquarius.go.ro", &unix_s)) {
+    Serial.println("WARNING: Could not get the time!");
+    return;
+  }
 
-    if (memcmp(harvest, null, sizeof(harvest)) == 0) {
-      Serial.print("ERROR: Data received is wrong for harvester: ");
-      Serial.println(i + 1);
-      led_phase_error(3);
-      return false;
-    }
+  wall_clock.sync(unix_s, unix_ms, millis());
+  wall_clock_synced_at = millis();
+  Serial.print("Time: ");
+  Serial.println(unix_s);
+}
 
-    memcpy(pot_data + i * sizeof(harvest), harvest, sizeof(harvest));
+/**
+ * This function is responsible for multicasting the time to every node one
+ * hop away. Multicasts are not acknowledged, so nodes that sleep also get it
+ * unicast through send_time.
+ */
+void broadcast_time() {
+  if (!wall_clock.synced(millis())) {
+    return;
   }
-  incolor();
-  led_phase_success();
-  return true;
+
+  time_sync message;
+  message.signal = SIG_TIME_SYNC;
+  wall_clock.toMessage(&message, millis());
+  RF24NetworkHeader header(NODE_CT);
+  network.multicast(header, &message, sizeof(message), 1);
 }
 
-void print_data() {
-  for (int i = 0; i < POTS; i++) {
-    Serial.print(pot_data[i]);
-    Serial.print(" ");
+/**
+ * This function is responsible for sending the time to one harvester, at most
+ * once per TIME_SYNC_PERIOD.
+ */
+void send_time(int harvester, RF24NetworkHeader &header) {
+  if (!wall_clock.synced(millis()) ||
+      (time_sent[harvester] &&
+       millis() - time_sent_at[harvester] < TIME_SYNC_PERIOD)) {
+    return;
+  }
+
+  time_sync message;
+  message.signal = SIG_TIME_SYNC;
+  wall_clock.toMessage(&message, millis());
+  if (anc.writeTimeout(header, &message, sizeof(message))) {
+    time_sent[harvester] = true;
+    time_sent_at[harvester] = millis();
+  }
+}
+
+/*******************************************************************************
+*********************************** Main Code **********************************
+********************************************************************************/
+
+/**
+ * This function is responsible for running the mesh and handing out addresses
+ * to the nodes that (re)join it. Every wait of the communicator calls it.
+ */
+void mesh_update() {
+  mesh.update();
+  mesh.DHCP();
+}
+
+/**
+ * This function is responsible for mapping a node address back to the car it
+ * belongs to, -1 for any other node.
+ */
+int car_index(uint16_t node) {
+  int k = mesh.getNodeID(node) - MESH_ID_CAR;
+  if (k < 0 || k >= CARS) {
+    return -1;
   }
-  Serial.print("\n");
+  return k;
 }
 
 /**
- * This function is responsible for saving the requested data in db. This
- * function defines phase_two.
+ * This function is responsible for booking a car back at the dock.
  */
-bool persist_data() {
+void car_returned(int car) {
+  if (car_lost[car]) {
+    car_lost[car] = false;
+    Serial.print("Lost car back at the dock: ");
+    Serial.println(car + 1);
+  }
+  if (!car_patrolling[car]) {
+    return;
+  }
+  car_patrolling[car] = false;
+  fleet_finished_at = millis();
+  Serial.print("Car ");
+  Serial.print(car + 1);
+  Serial.print(" back after (ms): ");
+  Serial.println(fleet_finished_at - fleet_started_at);
+}
 
-  Serial.println("Phase 2!");
+/**
+ * This function is responsible for booking a car that gave up on its lap as
+ * lost, out of the fleet until it is back at the dock.
+ */
+void car_gone_lost(int car) {
+  car_patrolling[car] = false;
+  car_lost[car] = true;
+  metrics.missed(MESH_ID_CAR + car, SIG_PATROL_STOP);
+  Serial.print("ERROR: Car lost on the track, left out until it is docked: ");
+  Serial.println(car + 1);
+}
 
-  if (client.connect("si-aquarius.go.ro", 80)) {
+/**
+ * This function is responsible for booking a patrol's end a car reported.
+ * Returns false for any other signal.
+ */
+bool book_patrol_end(int car, aq_signal signal) {
+  if (signal == SIG_PATROL_STOP) {
+    car_returned(car);
+  } else if (signal == SIG_PATROL_LOST) {
+    car_gone_lost(car);
+  } else {
+    return false;
+  }
+  return true;
+}
 
-    String data;
+/**
+ * This function is responsible for the protocol handshake on first contact
+ * with a node: the CT says hello with its version and the node answers with
+ * its own. Returns false for a node that runs another protocol, or did not
+ * answer a hello it got, so it is left out with an error instead of timing
+ * out. A node that could not be reached is not left out for it.
+ */
+bool node_compatible(uint8_t id, uint16_t address) {
+  if (id >= MESH_IDS) {
+    return false;
+  }
+  if (node_protocol[id] != PROTOCOL_UNKNOWN) {
+    return node_protocol[id] == PROTOCOL_VERSION;
+  }
 
-    magenta();
-    for (int i = 0; i < POTS; i++) {
-      int h = i / 8 + 1;
-      int p = i % 8 + 1;
-      data = "";
-      data.concat("harvester=");
-      data.concat(h);
-      data.concat("&pot=");
-      data.concat(p);
-      data.concat("&humidity=");
-      data.concat(pot_data[i]);
+  RF24NetworkHeader header(address);
+  protocol_hello hello;
+  hello.signal = SIG_HELLO;
+  hello.version = PROTOCOL_VERSION;
+  if (!anc.writeTimeout(header, &hello, sizeof(hello))) {
+    return true;
+  }
 
-      client.println("POST /php/data.php? HTTP/1.1");
-      client.println("Host: si-aquarius.go.ro");
-      client.println("Content-Type: application/x-www-form-urlencoded");
-      client.print("Content-Length: ");
-      client.println(data.length());
-      client.println();
-      client.print(data);
-      client.println();
-      Serial.print("Wrote record in database. Harvester: ");
-      Serial.print(h);
-      Serial.print(", Pot: ");
-      Serial.println(p);
+  node_protocol[id] = PROTOCOL_SILENT;
+  unsigned long started = millis();
+  while (millis() - started < READ_TIMEOUT) {
+    int size = anc.pollControl(&hello, sizeof(hello));
+    if (size == 0) {
+      continue;
     }
-    incolor();
-    client.stop();
+    if (size >= (int)sizeof(hello) && hello.signal == SIG_HELLO &&
+        anc.getReadHeader().from_node == address) {
+      node_protocol[id] = hello.version;
+      break;
+    }
+    // A car may say it is back while the CT greets another node
+    int car = car_index(anc.getReadHeader().from_node);
+    if (car >= 0 && size >= (int)sizeof(aq_signal) &&
+        book_patrol_end(car, hello.signal)) {
+      continue;
+    }
+    Serial.print("ERROR: Unexpected message from node: ");
+    Serial.println(anc.getReadHeader().from_node);
+  }
 
-    led_phase_success();
+  if (node_protocol[id] == PROTOCOL_VERSION) {
     return true;
+  }
+  Serial.print("ERROR: Leaving out node ");
+  Serial.print(id);
+  if (node_protocol[id] == PROTOCOL_SILENT) {
+    Serial.println(", it did not answer the hello!");
   } else {
-
-    Serial.println("Could not connect to the database!");
-    led_phase_error(1);
-    return false;
+    Serial.print(", it runs protocol ");
+    Serial.print(node_protocol[id]);
+    Serial.print(" and the CT ");
+    Serial.println(PROTOCOL_VERSION);
   }
+  return false;
 }
 
 /**
- * This function is responsible for refilling the tank until the car says stop.
- * This function defines phase_three.
+ * This function is responsible for saying hello to every node in the mesh
+ * that the CT has not heard the protocol of yet.
  */
-bool refill_tank() {
-  Serial.println("Phase 3!");
-
-  signal = SIG_REFILL_START;
-  if (!anc.writeTimeout(car_header, &signal, sizeof(signal))) {
-    Serial.println("TIMEOUT: Seinding SIG_REFILL_START failed!");
-    led_phase_error(1);
-    return false;
+void greet_nodes() {
+  if (millis() - protocol_checked_at >= PROTOCOL_RECHECK_PERIOD) {
+    protocol_checked_at = millis();
+    for (int id = 0; id < MESH_IDS; id++) {
+      if (node_protocol[id] != PROTOCOL_VERSION) {
+        node_protocol[id] = PROTOCOL_UNKNOWN;
+      }
+    }
   }
 
-  if (!anc.readTimeout(&signal, sizeof(signal))) {
-    Serial.println("TIMEOUT: Receiving acknowledgement failed!");
-    led_phase_error(2);
-    return false;
+  for (int n = 0; n < mesh.addrListTop; n++) {
+    aq_watchdog_feed();
+    node_compatible(mesh.addrList[n].nodeID, mesh.addrList[n].address);
   }
+}
 
-  if (signal != SIG_REFILL_ACK) {
-    RF24NetworkHeader aux = anc.getReadHeader();
-    Serial.print("ERROR: Incorrect response: ");
-    Serial.println(signal);
-    Serial.print("Message received from node: ");
-    Serial.println(aux.from_node);
-    led_phase_error(3);
-    return false;
+/**
+ * This function is responsible for the depth of a node in the tree, which is
+ * the number of octal digits of its address.
+ */
+int address_depth(uint16_t address) {
+  int depth = 0;
+  for (; address; address >>= 3) {
+    depth++;
   }
+  return depth;
+}
 
-  blue();
-  digitalWrite(pump, HIGH);
+/**
+ * This function is responsible for listing the harvesters that joined the
+ * mesh, deepest first: their requests and replies take the most hops, so
+ * sending them out first lets the ones near the root answer meanwhile.
+ */
+void discover_harvesters() {
+  harvesters = 0;
+  for (int n = 0; n < mesh.addrListTop; n++) {
+    aq_watchdog_feed();
+    int i = mesh.addrList[n].nodeID - MESH_ID_HARVESTER;
+    if (i < 0 || i >= MAX_HARVESTERS ||
+        !node_compatible(mesh.addrList[n].nodeID, mesh.addrList[n].address)) {
+      continue;
+    }
 
-  // Here synchronization is critical + MAX_REFILL_MILLIS and READ_TIMEOUT are
-  // different so we work without the library
-  RF24NetworkHeader aux;
-  unsigned long currentMillis = millis();
+    harvester_address[i] = mesh.addrList[n].address;
+    int depth = address_depth(harvester_address[i]);
+    int k = harvesters++;
+    while (k > 0 &&
+           address_depth(harvester_address[harvester_order[k - 1]]) < depth) {
+      harvester_order[k] = harvester_order[k - 1];
+      k--;
+    }
+    harvester_order[k] = i;
+  }
+}
 
-  while (millis() - currentMillis <= MAX_REFILL_MILLIS) {
-    network.update();
-    if (network.available()) {
+/**
+ * This function is responsible for mapping a node address back to the
+ * harvester it belongs to, -1 for any other node.
+ */
+int harvester_index(uint16_t address) {
+  int i = mesh.getNodeID(address) - MESH_ID_HARVESTER;
+  if (i < 0 || i >= MAX_HARVESTERS) {
+    return -1;
+  }
+  return i;
+}
 
-      network.read(aux, &signal, sizeof(signal));
+/*******************************************************************************
+************************************* Link *************************************
+********************************************************************************/
 
-      if (signal == SIG_REFILL_STOP) {
-        digitalWrite(pump, LOW);
-        incolor();
-        Serial.print("Received stop from car, as it is full!");
-        led_phase_success();
-        return true;
-      }
-    }
+/**
+ * This function is responsible for the node ID behind an address, 255 for an
+ * address the mesh does not know.
+ */
+uint8_t node_id(uint16_t address) {
+  int16_t id = mesh.getNodeID(address);
+  return id < 0 ? 255 : id;
+}
+
+/**
+ * This function is responsible for the type of a message, its signal.
+ */
+int message_type(const void *data, int data_size) {
+  aq_signal type = 0;
+  if (data_size >= (int)sizeof(type)) {
+    memcpy(&type, data, sizeof(type));
   }
+  return type;
+}
 
-  digitalWrite(pump, LOW);
-  incolor();
+void on_write(RF24NetworkHeader &header, const void *data, int data_size,
+              bool delivered) {
+  link_monitor.sent(header.to_node, delivered);
+  metrics.attempt(node_id(header.to_node), message_type(data, data_size),
+                  delivered);
+  trace.sent(millis(), header.to_node, header.type, data, data_size,
+             delivered);
+}
 
-  signal = SIG_REFILL_STOP;
+void on_read(RF24NetworkHeader &header, const void *data, int data_size) {
+  trace.received(millis(), header.from_node, header.type, data, data_size);
+}
 
-  if (!anc.writeTimeout(car_header, &signal, sizeof(signal))) {
-    Serial.println("Could not tell the car that the refill is over!");
-    Serial.println("Skipping phase as the car will timeout in 10 seconds!");
-    led_signal(cyan, 1000);
-    delay(6000);
+void on_timeout(RF24NetworkHeader *header, const void *data, int data_size) {
+  if (header) {
+    uint8_t id = node_id(header->to_node);
+    if (id < MESH_IDS && node_protocol[id] == PROTOCOL_VERSION) {
+      node_protocol[id] = PROTOCOL_UNKNOWN;
+    }
+    metrics.timeout(id, message_type(data, data_size));
+    trace.writeTimeout(millis(), header->to_node, header->type, data_size);
+  } else {
+    metrics.readTimeout();
+    trace.readTimeout(millis());
   }
+}
 
-  led_phase_success();
-  return true;
+int link_nodes() {
+  return mesh.addrListTop < LINK_NODES ? mesh.addrListTop : LINK_NODES;
 }
 
 /**
- * This function is responsible for sending the car in a patrol. This function
- * defines phase_four.
+ * This function is responsible for telling when the link needs a survey:
+ * periodically, when delivery dropped, or when nodes went missing after a
+ * switch.
  */
-bool send_car_patrol() {
-  Serial.println("Phase 4!");
+bool link_due() {
+  if (link_lost || !link_surveyed ||
+      millis() - link_surveyed_at >= LINK_SURVEY_PERIOD) {
+    return true;
+  }
 
-  int signal = SIG_PATROL_START;
+  uint16_t attempts, delivered, retries;
+  link_monitor.totals(&attempts, &delivered, &retries);
+  return attempts >= LINK_MIN_ATTEMPTS &&
+         link_delivery_permille(attempts, delivered) <
+             LINK_MIN_DELIVERY_PERMILLE;
+}
 
-  cyan();
-  if (!anc.writeTimeout(car_header, &signal, sizeof(signal))) {
-    Serial.println("Could not send car to patrol!");
-    led_phase_error(1);
-    return false;
+/**
+ * This function is responsible for waiting for a link_report from the node at
+ * the given address, dropping anything else.
+ */
+bool read_link_report(uint16_t address, link_report *report,
+                      unsigned long timeout) {
+  unsigned long started = millis();
+  while (millis() - started < timeout) {
+    int size = anc.poll(report, sizeof(*report));
+    if (size == sizeof(*report) && report->signal == SIG_LINK_REPORT &&
+        anc.getReadHeader().from_node == address) {
+      return true;
+    }
   }
+  return false;
+}
 
-  bool needs_water[POTS];
-  for (int i = 0; i < POTS; i++) {
-    needs_water[i] = pot_data[i] < 30;
+/**
+ * This function is responsible for telling every node that got a switch
+ * where to go instead, with no delay.
+ */
+void redirect_link(bool *nodes, uint8_t channel, uint8_t rate) {
+  link_switch message;
+  message.signal = SIG_LINK_SWITCH;
+  message.channel = channel;
+  message.rate = rate;
+  message.delay_ticks = 0;
+  message.confirm_slot = 0;
+  for (int n = 0; n < link_nodes(); n++) {
+    aq_watchdog_feed();
+    if (nodes[n]) {
+      RF24NetworkHeader header(mesh.addrList[n].address);
+      anc.writeTimeout(header, &message, sizeof(message));
+    }
+  }
+}
+
+/**
+ * This function is responsible for moving the whole mesh to a channel and
+ * rate. Every node is told when to switch, the CT switches with them and then
+ * waits for each node to confirm; if any does not, everyone goes back home.
+ */
+bool switch_link(uint8_t channel, uint8_t rate) {
+  int nodes = link_nodes();
+  unsigned long switch_at =
+      millis() + (unsigned long)LINK_SWITCH_LEAD_MS * (nodes + 1);
+
+  link_switch message;
+  message.signal = SIG_LINK_SWITCH;
+  message.channel = channel;
+  message.rate = rate;
+
+  bool all_told = true;
+  for (int n = 0; n < nodes; n++) {
+    aq_watchdog_feed();
+    RF24NetworkHeader header(mesh.addrList[n].address);
+    // Rounded up, so no node leaves before the CT does
+    message.delay_ticks =
+        (switch_at - millis() + LINK_SWITCH_TICK_MS - 1) / LINK_SWITCH_TICK_MS;
+    message.confirm_slot = n / LINK_CONFIRM_WINDOW;
+    link_told[n] = anc.writeTimeout(header, &message, sizeof(message));
+    all_told = all_told && link_told[n];
   }
 
-  if (!anc.writeTimeout(car_header, needs_water, sizeof(needs_water))) {
-    Serial.println("Could not send watering data!");
-    led_phase_error(2);
+  if (!all_told || (long)(switch_at - millis()) < 0) {
+    Serial.println("WARNING: Could not tell every node, link switch cancelled!");
+    redirect_link(link_told, link_monitor.getChannel(), link_monitor.getRate());
     return false;
   }
 
-  // Confirmation
-  if (!anc.readTimeout(&signal, sizeof(signal)) && signal != SIG_PATROL_START) {
-    Serial.println("Car did not confirm that it started!");
-    Serial.println("Check car status!");
-    led_phase_error(3);
+  // Bounded by the lead, checked above
+  while ((long)(switch_at - millis()) > 0) {
+    aq_watchdog_feed();
+    mesh_update();
+  }
+  link_monitor.apply(channel, rate);
+
+  memset(link_confirmed, 0, sizeof(link_confirmed));
+  int confirmed = 0;
+  link_report report;
+  unsigned long started = millis();
+  unsigned long confirm_ms =
+      LINK_CONFIRM_MS +
+      (unsigned long)(nodes / LINK_CONFIRM_WINDOW) * LINK_CONFIRM_SLOT_MS;
+  while (confirmed < nodes && millis() - started < confirm_ms) {
+    if (anc.poll(&report, sizeof(report)) != sizeof(report) ||
+        report.signal != SIG_LINK_REPORT) {
+      continue;
+    }
+    aq_watchdog_feed();
+    for (int n = 0; n < nodes; n++) {
+      if (!link_confirmed[n] &&
+          mesh.addrList[n].address == anc.getReadHeader().from_node) {
+        link_confirmed[n] = true;
+        confirmed++;
+      }
+    }
+  }
+
+  if (confirmed < nodes) {
+    Serial.print("WARNING: Link switch confirmed by ");
+    Serial.print(confirmed);
+    Serial.print(" of ");
+    Serial.print(nodes);
+    Serial.println(" nodes, going home!");
+    redirect_link(link_confirmed, MESH_CHANNEL, LINK_RATE_1MBPS);
+    link_monitor.goHome();
     return false;
   }
-  incolor();
 
-  led_phase_success();
+  Serial.print("Link switched to channel ");
+  Serial.print(channel);
+  Serial.print(", rate ");
+  Serial.println(rate);
   return true;
 }
 
 /**
- * This function is responsible for awaing for the car to finish a patrol
- * This should receive a meesage when a car finishes a patrol.
+ * This function is responsible for the coordinated survey: the CT and every
+ * node sample each candidate channel, the CT adds them up with everyone's
+ * delivery counters and moves the mesh to the best channel and rate.
  */
-void await_next_patrol() {
-  Serial.println("Phase 5!");
+void tune_link() {
+  if (!link_due()) {
+    return;
+  }
+  link_surveyed = true;
+  link_surveyed_at = millis();
+
+  if (link_lost && !link_monitor.isHome()) {
+    Serial.println("WARNING: Nodes went missing after a switch, going home!");
+    link_lost = false;
+    switch_link(MESH_CHANNEL, LINK_RATE_1MBPS);
+    link_monitor.goHome();
+    return;
+  }
+  link_lost = false;
 
-  magenta();
-  while (true) {
-    Serial.println("Waiting for the car to finish the patrol!");
-    if (anc.readTimeout(&signal, sizeof(signal))) {
-      if (signal == SIG_PATROL_STOP) {
-        incolor();
-        led_phase_success();
-        return;
-      } else {
-        RF24NetworkHeader aux = anc.getReadHeader();
-        Serial.print("ERROR: Incorrect response: ");
-        Serial.println(signal);
-        Serial.print("Message received from node: ");
-        Serial.println(aux.from_node);
-      }
-    }
+  uint16_t busy[LINK_CANDIDATES];
+  uint8_t own[LINK_CANDIDATES];
+  link_monitor.survey(own);
+  for (int c = 0; c < LINK_CANDIDATES; c++) {
+    busy[c] = own[c];
   }
-}
 
-void setup() {
-  Serial.begin(9600);
+  uint16_t a, d, r;
+  link_monitor.totals(&a, &d, &r);
+  uint32_t attempts = a, delivered = d, retries = r;
+  link_monitor.report();
+
+  signal = SIG_LINK_SURVEY;
+  link_report report;
+  for (int n = 0; n < link_nodes(); n++) {
+    aq_watchdog_feed();
+    RF24NetworkHeader header(mesh.addrList[n].address);
+    bool sent, read;
+    // A report dropped for want of room is asked for once more
+    for (int attempt = 0; attempt < 2; attempt++) {
+      uint16_t dropped = anc.getBulkDropped();
+      sent = anc.writeTimeout(header, &signal, sizeof(signal));
+      read = sent && read_link_report(mesh.addrList[n].address, &report,
+                                      READ_TIMEOUT);
+      if (read || anc.getBulkDropped() == dropped) {
+        break;
+      }
+    }
+    if (!read) {
+      if (sent) {
+        metrics.missed(mesh.addrList[n].nodeID, SIG_LINK_SURVEY);
+      }
+      Serial.print("WARNING: No link report from node: ");
+      Serial.println(mesh.addrList[n].nodeID);
+      continue;
+    }
 
-  pinMode(pump, OUTPUT);
+    for (int c = 0; c < LINK_CANDIDATES; c++) {
+      busy[c] += report.busy[c];
+    }
+    attempts += report.attempts;
+    delivered += report.delivered;
+    retries += report.retries;
+
+    Serial.print("Node ");
+    Serial.print(mesh.addrList[n].nodeID);
+    Serial.print(": delivered (permille) ");
+    Serial.print(link_delivery_permille(report.attempts, report.delivered));
+    Serial.print(", retries ");
+    Serial.println(report.retries);
+  }
 
-  pinMode(red_light_pin, OUTPUT);
-  pinMode(green_light_pin, OUTPUT);
-  pinMode(blue_light_pin, OUTPUT);
+  while (attempts > 0xFFFF) {
+    attempts >>= 1;
+    delivered >>= 1;
+    retries >>= 1;
+  }
+  uint16_t permille = link_delivery_permille(attempts, delivered);
+  uint16_t retries_x100 = attempts ? retries * 100 / attempts : 0;
+
+  uint8_t channel = link_pick_channel(busy, link_monitor.getChannel(),
+                                      LINK_CHANNEL_MARGIN);
+  uint8_t rate = link_pick_rate(link_monitor.getRate(), permille, retries_x100);
+
+  Serial.print("Link survey: delivered (permille) ");
+  Serial.print(permille);
+  Serial.print(", best channel ");
+  Serial.print(channel);
+  Serial.print(", rate ");
+  Serial.println(rate);
+
+  link_monitor.reset();
+  if (channel != link_monitor.getChannel() || rate != link_monitor.getRate()) {
+    switch_link(channel, rate);
+  }
+}
 
-  Serial.println("Init NRF24L01");
-  SPI.begin();
-  radio.begin();
-  network.begin(90, NODE_CT);
+int harvests_pending() {
+  int count = 0;
+  for (int i = 0; i < MAX_HARVESTERS; i++) {
+    count += requested[i] ? 1 : 0;
+  }
+  return count;
+}
 
-  Serial.println("Init Ethernet");
-  if (Ethernet.begin(mac) == 0) {
-    Serial.println("Failed to configure Ethernet");
+/**
+ * This function is responsible for how many harvest replies may still come
+ * in: requests that are neither answered nor older than READ_TIMEOUT.
+ */
+unsigned harvests_in_flight() {
+  unsigned count = 0;
+  for (int i = 0; i < MAX_HARVESTERS; i++) {
+    count += requested[i] && millis() - requested_at[i] < READ_TIMEOUT;
   }
+  return count;
 }
 
-void loop() {
-  led_phase_start(current_phase);
-  switch (current_phase) {
+/**
+ * This function is responsible for taking in a harvest reply from whichever
+ * harvester sent it, if one came in.
+ */
+void collect_harvest() {
+  harvest_data harvest;
+  int size = anc.poll(&harvest, sizeof(harvest));
+  if (size == 0) {
+    return;
+  }
+
+  RF24NetworkHeader aux = anc.getReadHeader();
+  int i = harvester_index(aux.from_node);
+  if (i < 0 || !requested[i] || size != sizeof(harvest)) {
+    Serial.print("ERROR: Unexpected message from node: ");
+    Serial.println(aux.from_node);
+    return;
+  }
+  requested[i] = false;
+
+  harvest_oldest = harvest.age > harvest_oldest ? harvest.age : harvest_oldest;
+  harvest_stale += harvest.age > MAX_HARVEST_AGE;
+
+  memcpy(pot_data + i * POTS_PER_HARVESTER, harvest.humidity,
+         POTS_PER_HARVESTER);
+  harvested[i] = true;
+
+  pot_time[i] = 0;
+  if (wall_clock.synced(millis())) {
+    pot_time[i] = wall_clock.unixTime(millis()) - harvest.age / 1000;
+  }
+
+  for (int p = 0; p < POTS_PER_HARVESTER; p++) {
+    int pot = i * POTS_PER_HARVESTER + p;
+    implausible += validity.check(pot, pot_time[i], harvest.humidity[p]) != 0;
+  }
+}
+
+/**
+ * This function is responsible for why a pot's last reading is implausible,
+ * 0 if it is not.
+ */
+uint8_t pot_flags(int pot) {
+  return pot < POTS ? validity.getFlags(pot) : validity_range(pot_data[pot]);
+}
+
+/**
+ *  This function is responsible for requesting data from harvesters and storing
+ * it in memory. Up to HARVEST_WINDOW requests are out before any reply is
+ * waited for, so the harvests overlap. These functions define phase_one.
+ */
+bool harvest() {
+  Serial.println("Phase 1!");
+
+  memset(pot_data, 0x00, sizeof(pot_data));
+  memset(requested, 0, sizeof(requested));
+  memset(harvested, 0, sizeof(harvested));
+  harvest_oldest = 0;
+  harvest_stale = 0;
+  implausible = 0;
+
+  sync_wall_clock();
+  broadcast_time();
+  tune_link();
+
+  greet_nodes();
+  discover_harvesters();
+  Serial.print("Harvesters in the mesh: ");
+  Serial.println(harvesters);
+  if (harvesters == 0) {
+    led_phase_error(1);
+    return false;
+  }
+
+  // Set only now: the link survey sends its own signal
+  signal = SIG_HARVEST_START;
+  yellow();
+  for (int k = 0; k < harvesters; k++) {
+    aq_watchdog_feed();
+    int i = harvester_order[k];
+    RF24NetworkHeader header(harvester_address[i]);
+
+    while (harvests_in_flight() >= HARVEST_WINDOW) {
+      collect_harvest();
+    }
+    if (!anc.writeTimeout(header, &signal, sizeof(signal))) {
+      Serial.print("TIMEOUT: Cannot start harvest for harvester: ");
+      Serial.println(i + 1);
+      link_lost = link_lost || !link_monitor.isHome();
+      continue;
+    }
+    requested[i] = true;
+    requested_at[i] = millis();
+    collect_harvest();
+  }
+
+  unsigned long started = millis();
+  while (harvests_pending() > 0 && millis() - started < READ_TIMEOUT) {
+    collect_harvest();
+  }
+
+  int answered = 0;
+  for (int k = 0; k < harvesters; k++) {
+    aq_watchdog_feed();
+    int i = harvester_order[k];
+    if (requested[i]) {
+      Serial.print("TIMEOUT: Could not read data from harvester: ");
+      Serial.println(i + 1);
+      metrics.missed(MESH_ID_HARVESTER + i, SIG_HARVEST_START);
+      link_lost = link_lost || !link_monitor.isHome();
+      requested[i] = false;
+    }
+    if (!harvested[i]) {
+      continue;
+    }
+    answered++;
+
+    RF24NetworkHeader header(harvester_address[i]);
+    send_time(i, header);
+  }
+
+  Serial.print("Harvesters answered: ");
+  Serial.print(answered);
+  Serial.print(", oldest sample age (ms): ");
+  Serial.println(harvest_oldest);
+  if (harvest_stale > 0) {
+    Serial.print("WARNING: Stale data from harvesters: ");
+    Serial.println(harvest_stale);
+  }
+  if (implausible > 0) {
+    Serial.print("WARNING: Implausible readings: ");
+    Serial.println(implausible);
+  }
+  for (int i = 0; i < POTS; i++) {
+    if (harvested[i / POTS_PER_HARVESTER] && !validity.plausible(i)) {
+      Serial.print("WARNING: Pot left out of the plan: ");
+      Serial.print(i);
+      Serial.print(", reading ");
+      Serial.print(pot_data[i]);
+      Serial.print(", flags ");
+      Serial.println(validity.getFlags(i));
+    }
+  }
+
+  for (int i = 0; i < HARVESTERS; i++) {
+    if (!harvested[i]) {
+      Serial.print("WARNING: No data, the car skips the pots of harvester: ");
+      Serial.println(i + 1);
+    }
+  }
+  if (anc.getBulkDropped() != bulk_dropped) {
+    Serial.print("WARNING: Bulk messages dropped for want of room: ");
+    Serial.println(anc.getBulkDropped() - bulk_dropped);
+    bulk_dropped = anc.getBulkDropped();
+  }
+  incolor();
+
+  if (answered == 0) {
+    led_phase_error(2);
+    return false;
+  }
+
+  led_phase_success();
+  return true;
+}
+
+void print_data() {
+  for (int i = 0; i < MAX_HARVESTERS; i++) {
+    if (!harvested[i]) {
+      continue;
+    }
+    Serial.print(i + 1);
+    Serial.print(": ");
+    for (int p = 0; p < POTS_PER_HARVESTER; p++) {
+      Serial.print(pot_data[i * POTS_PER_HARVESTER + p]);
+      Serial.print(" ");
+    }
+    Serial.print("\n");
+  }
+}
+
+/**
+ * This function is responsible for POSTing a form to the database server.
+ */
+void post_form(const char *request_line, String &data) {
+  client.println(request_line);
+  client.println("Host: si-aquarius.go.ro");
+  client.println("Content-Type: application/x-www-form-urlencoded");
+  client.print("Content-Length: ");
+  client.println(data.length());
+  client.println();
+  client.print(data);
+  client.println();
+}
+
+/**
+ * This function is responsible for uploading what the CT measured towards
+ * every node since the last survey, so timeouts can be matched with radio
+ * conditions.
+ */
+void post_link_stats() {
+  String data;
+  for (int i = 0; i < link_monitor.getPeerCount(); i++) {
+    const link_stats &peer = link_monitor.getPeer(i);
+    data = "";
+    data.concat("node=");
+    data.concat(mesh.getNodeID(peer.node));
+    data.concat("&channel=");
+    data.concat(link_monitor.getChannel());
+    data.concat("&rate=");
+    data.concat(link_monitor.getRate());
+    data.concat("&sent=");
+    data.concat(peer.attempts);
+    data.concat("&delivered=");
+    data.concat(peer.delivered);
+    data.concat("&retries=");
+    data.concat(peer.retries);
+    post_form("POST /php/link.php? HTTP/1.1", data);
+  }
+}
+
+/**
+ * This function is responsible for a history record's age in seconds, its age
+ * on the harvester's clock corrected for that clock's drift.
+ */
+int32_t history_age(history_record &record, history_frame &frame) {
+  return aq_drift_correct((frame.now - record.time) * 1000L,
+                          frame.drift_ppm) /
+         1000;
+}
+
+/**
+ * This function is responsible for sealing the drying model after a change,
+ * so that it outlives a reset.
+ */
+void seal_drying() {
+  drying_pots.magic = DRYING_MAGIC;
+  drying_pots.crc =
+      aq_crc16(0xFFFF, drying_pots.pots, sizeof(drying_pots.pots));
+}
+
+/**
+ * This function is responsible for feeding a harvester's readings taken at
+ * time to the drying model, but for the implausible ones.
+ */
+void observe_pots(int harvester, uint32_t time, const uint8_t *humidity) {
+  for (int p = 0; p < POTS_PER_HARVESTER; p++) {
+    int pot = harvester * POTS_PER_HARVESTER + p;
+    if (pot < POTS && validity.plausible(pot) &&
+        !validity_range(humidity[p])) {
+      drying.observe(pot, time, humidity[p]);
+    }
+  }
+  seal_drying();
+}
+
+/**
+ * This function is responsible for uploading one history record, with its
+ * wall clock time; without one the age in seconds is sent instead.
+ */
+void post_history(int harvester, history_record &record,
+                  history_frame &frame) {
+  int32_t age = history_age(record, frame);
+
+  String data = "";
+  data.concat("harvester=");
+  data.concat(harvester + 1);
+  data.concat("&seq=");
+  data.concat(record.seq);
+  if (wall_clock.synced(millis())) {
+    data.concat("&time=");
+    data.concat(wall_clock.unixTime(millis()) - age);
+  } else {
+    data.concat("&age=");
+    data.concat(age);
+  }
+  data.concat("&humidity=");
+  for (int p = 0; p < HISTORY_CHANNELS; p++) {
+    if (p > 0) {
+      data.concat(",");
+    }
+    data.concat(record.humidity[p]);
+  }
+  post_form("POST /php/batch.php? HTTP/1.1", data);
+}
+
+/**
+ * This function is responsible for pulling every reading a harvester took
+ * since the last backfill, one history_frame per round trip, and uploading
+ * it. history_seq only moves past what was uploaded, so a failed backfill is
+ * retried on the next cycle.
+ */
+bool backfill(int harvester) {
+  RF24NetworkHeader header(harvester_address[harvester]);
+  history_request request;
+  history_frame frame;
+  history_record record;
+  int records = 0;
+
+  request.signal = SIG_HISTORY_REQUEST;
+  do {
+    aq_watchdog_feed();
+    request.since = history_seq[harvester];
+    if (!anc.writeTimeout(header, &request, sizeof(request))) {
+      return false;
+    }
+    if (!anc.readTimeout(&frame, sizeof(frame)) ||
+        frame.signal != SIG_HISTORY_DATA) {
+      metrics.missed(MESH_ID_HARVESTER + harvester, SIG_HISTORY_REQUEST);
+      return false;
+    }
+
+    HistoryDecoder decoder(&frame);
+    while (decoder.next(&record)) {
+      post_history(harvester, record, frame);
+      if (wall_clock.synced(millis())) {
+        observe_pots(harvester,
+                     wall_clock.unixTime(millis()) - history_age(record, frame),
+                     record.humidity);
+      }
+      records++;
+    }
+    history_seq[harvester] = frame.first_seq + frame.count;
+  } while (frame.more);
+
+  Serial.print("Backfilled records: ");
+  Serial.println(records);
+  return true;
+}
+
+/**
+ * This function is responsible for saving the requested data in db. This
+ * function defines phase_two.
+ */
+bool persist_data() {
+
+  Serial.println("Phase 2!");
+
+  if (client.connect("si-aquarius.go.ro", 80)) {
+
+    String data;
+
+    magenta();
+    for (int i = 0; i < MAX_HARVESTERS * POTS_PER_HARVESTER; i++) {
+      if (!harvested[i / POTS_PER_HARVESTER]) {
+        continue;
+      }
+      aq_watchdog_feed();
+      int h = i / POTS_PER_HARVESTER + 1;
+      int p = i % POTS_PER_HARVESTER + 1;
+      data = "";
+      data.concat("harvester=");
+      data.concat(h);
+      data.concat("&pot=");
+      data.concat(p);
+      data.concat("&humidity=");
+      data.concat(pot_data[i]);
+      if (pot_time[i / POTS_PER_HARVESTER] != 0) {
+        data.concat("&time=");
+        data.concat(pot_time[i / POTS_PER_HARVESTER]);
+      }
+      if (pot_flags(i) != 0) {
+        data.concat("&flags=");
+        data.concat(pot_flags(i));
+      }
+
+      post_form("POST /php/data.php? HTTP/1.1", data);
+      Serial.print("Wrote record in database. Harvester: ");
+      Serial.print(h);
+      Serial.print(", Pot: ");
+      Serial.println(p);
+    }
+
+    for (int i = 0; i < MAX_HARVESTERS; i++) {
+      if (!harvested[i]) {
+        continue;
+      }
+      if (!backfill(i)) {
+        Serial.print("WARNING: Backfill failed for harvester: ");
+        Serial.println(i + 1);
+      }
+    }
+    post_link_stats();
+    post_metrics();
+    incolor();
+    client.stop();
+
+    led_phase_success();
+    return true;
+  } else {
+
+    Serial.println("Could not connect to the database!");
+    led_phase_error(1);
+    return false;
+  }
+}
+
+/*******************************************************************************
+************************************ Fleet *************************************
+********************************************************************************/
+
+/**
+ * This function is responsible for addressing a car. Returns false if the car
+ * has not joined the mesh.
+ */
+bool car_header(int car, RF24NetworkHeader &header) {
+  int16_t address = mesh.getAddress(MESH_ID_CAR + car);
+  if (address < 0) {
+    Serial.print("ERROR: Car is not in the mesh: ");
+    Serial.println(car + 1);
+    return false;
+  }
+  if (!node_compatible(MESH_ID_CAR + car, address)) {
+    return false;
+  }
+  header = RF24NetworkHeader(address);
+  return true;
+}
+
+bool any_car_lost() {
+  for (int k = 0; k < CARS; k++) {
+    if (car_lost[k]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+int cars_patrolling() {
+  int count = 0;
+  for (int k = 0; k < CARS; k++) {
+    count += car_patrolling[k] ? 1 : 0;
+  }
+  return count;
+}
+
+/**
+ * This function is responsible for reading the next message from one car, of
+ * at most size bytes, for at most timeout ms. Patrol ends other cars report
+ * meanwhile are booked instead of being lost; bulk messages are left for
+ * later.
+ */
+bool read_car_message(int car, void *message, int size,
+                      unsigned long timeout) {
+  aq_signal *value = (aq_signal *)message;
+  unsigned long started = millis();
+  while (millis() - started < timeout) {
+    if (anc.pollControl(message, size) < (int)sizeof(*value)) {
+      continue;
+    }
+
+    int from = car_index(anc.getReadHeader().from_node);
+    if (from == car) {
+      return true;
+    }
+    if (from >= 0 && book_patrol_end(from, *value)) {
+      continue;
+    }
+
+    Serial.print("ERROR: Unexpected signal: ");
+    Serial.print(*value);
+    Serial.print(" from node: ");
+    Serial.println(anc.getReadHeader().from_node);
+  }
+  return false;
+}
+
+bool read_car_signal(int car, aq_signal *value, unsigned long timeout) {
+  return read_car_message(car, value, sizeof(*value), timeout);
+}
+
+/**
+ * This function is responsible for which pots need water. A pot is dry if it
+ * was read dry, or, with a trusted forecast, if it is due by the next cycle or
+ * its harvester did not answer and it is forecast dry by now. If any pot is
+ * dry, the ones forecast dry within WATER_AHEAD_S are watered too, so they do
+ * not need a trip of their own.
+ */
+void plan_water() {
+  bool synced = wall_clock.synced(millis());
+  uint32_t now = synced ? wall_clock.unixTime(millis()) : 0;
+  bool any = false;
+
+  for (int h = 0; h < harvesters; h++) {
+    if (harvested[h] && pot_time[h] != 0) {
+      observe_pots(h, pot_time[h], pot_data + h * POTS_PER_HARVESTER);
+    }
+  }
+
+  for (int i = 0; i < POTS; i++) {
+    bool read = harvested[i / POTS_PER_HARVESTER] && validity.plausible(i);
+    uint32_t due = synced && drying.trusted(i)
+                       ? drying.crossing(i, DRY_HUMIDITY)
+                       : DRYING_NEVER;
+    needs_water[i] = read ? pot_data[i] < DRY_HUMIDITY ||
+                                due <= now + CYCLE_LEAD_S
+                          : due <= now;
+    any = any || needs_water[i];
+  }
+  if (!any) {
+    return;
+  }
+
+  for (int i = 0; i < POTS; i++) {
+    if (needs_water[i] || !synced || !drying.trusted(i)) {
+      continue;
+    }
+    uint32_t due = drying.crossing(i, DRY_HUMIDITY);
+    if (due <= now + WATER_AHEAD_S) {
+      needs_water[i] = true;
+      Serial.print("Watering ahead pot ");
+      Serial.print(i);
+      Serial.print(", dry in (min): ");
+      Serial.println((due - now) / 60);
+    }
+  }
+}
+
+/**
+ * This function is responsible for splitting the dry pots between the cars.
+ * Package k goes to car k; the cars with the farthest packages leave first so
+ * that on the way out no car has to get past one that is working.
+ */
+void plan_fleet() {
+  plan_water();
+  route_split(needs_water, NULL, CARS, package_first_stop);
+
+  for (int k = 0; k < CARS; k++) {
+    Serial.print("Car ");
+    Serial.print(k + 1);
+    Serial.print(": stops ");
+    Serial.print(package_first_stop[k]);
+    Serial.print(" to ");
+    Serial.print(package_first_stop[k + 1] - 1);
+    Serial.println(car_lost[k] ? ", lost, they stay dry" : "");
+  }
+}
+
+/**
+ * This function is responsible for the part of the plan one car waters.
+ * Returns false if there is nothing in it.
+ */
+bool car_package(int car, bool *package) {
+  route_mask(needs_water, package_first_stop[car], package_first_stop[car + 1],
+             package);
+  return route_last_stop(package) != ROUTE_NO_STOP;
+}
+
+/**
+ * This function is responsible for the first car to leave, -1 if there is
+ * no work for any car that is not lost.
+ */
+int first_car() {
+  bool package[POTS];
+  for (int k = CARS - 1; k >= 0; k--) {
+    if (!car_lost[k] && car_package(k, package)) {
+      return k;
+    }
+  }
+  return -1;
+}
+
+/**
+ * This function is responsible for the water a car's package needs, in ml.
+ */
+uint16_t package_ml(const bool *package) {
+  return route_dry_pots(package) * POT_DOSE_ML + REFILL_MARGIN_ML;
+}
+
+/**
+ * This function is responsible for refilling one car's tank with what its
+ * package needs, running the pump for what the car lacks or until the car
+ * says stop.
+ */
+bool refill_car(int car) {
+  RF24NetworkHeader header;
+  if (!car_header(car, header)) {
+    led_phase_error(1);
+    return false;
+  }
+
+  bool package[POTS];
+  car_package(car, package);
+  refill_message refill;
+  refill.signal = SIG_REFILL_START;
+  refill.ml = package_ml(package);
+
+  Serial.print("Refilling car: ");
+  Serial.print(car + 1);
+  Serial.print(", needs (ml): ");
+  Serial.println(refill.ml);
+
+  if (!anc.writeTimeout(header, &refill, sizeof(refill))) {
+    Serial.println("TIMEOUT: Seinding SIG_REFILL_START failed!");
+    led_phase_error(1);
+    return false;
+  }
+
+  uint16_t needed = refill.ml;
+  if (!read_car_message(car, &refill, sizeof(refill), READ_TIMEOUT)) {
+    Serial.println("TIMEOUT: Receiving acknowledgement failed!");
+    metrics.missed(MESH_ID_CAR + car, SIG_REFILL_START);
+    led_phase_error(2);
+    return false;
+  }
+
+  if (refill.signal == SIG_REFILL_STOP) {
+    Serial.println("Car holds enough water, skipping the refill!");
+    return true;
+  }
+
+  if (refill.signal == SIG_REFILL_FAULT) {
+    Serial.print("ERROR: Water level sensor fault on car: ");
+    Serial.println(car + 1);
+    led_phase_error(4);
+    return false;
+  }
+
+  if (refill.signal != SIG_REFILL_ACK) {
+    Serial.print("ERROR: Incorrect response: ");
+    Serial.println(refill.signal);
+    led_phase_error(3);
+    return false;
+  }
+
+  uint16_t lacking = needed > refill.ml ? needed - refill.ml : 0;
+  unsigned long pump_ms = lacking * 1000UL / REFILL_ML_PER_S;
+  pump_ms = pump_ms < MAX_REFILL_MILLIS ? pump_ms : MAX_REFILL_MILLIS;
+  Serial.print("Car holds (ml): ");
+  Serial.print(refill.ml);
+  Serial.print(", pumping (ms): ");
+  Serial.println(pump_ms);
+
+  blue();
+  digitalWrite(pump, HIGH);
+
+  // Here synchronization is critical + pump_ms and READ_TIMEOUT are
+  // different so only the car's own signals count
+  unsigned long currentMillis = millis();
+
+  while (true) {
+    // Read once, so the time left cannot wrap if the clock ticks past pump_ms
+    unsigned long elapsed = millis() - currentMillis;
+    if (elapsed >= pump_ms) {
+      break;
+    }
+    if (read_car_signal(car, &signal, pump_ms - elapsed) &&
+        signal == SIG_REFILL_STOP) {
+      digitalWrite(pump, LOW);
+      incolor();
+      Serial.print("Received stop from car, as it is full!");
+      return true;
+    }
+  }
+
+  digitalWrite(pump, LOW);
+  incolor();
+
+  signal = SIG_REFILL_STOP;
+
+  if (!anc.writeTimeout(header, &signal, sizeof(signal))) {
+    Serial.println("Could not tell the car that the refill is over!");
+    Serial.println("Skipping phase as the car will timeout in 10 seconds!");
+    led_signal(cyan, 1000);
+    delay(6000);
+  }
+
+  return true;
+}
+
+/**
+ * This function is responsible for whether a car on a package past the given
+ * car's is still out.
+ */
+bool farther_car_out(int car) {
+  for (int k = car + 1; k < CARS; k++) {
+    if (car_patrolling[k] || car_lost[k]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * This function is responsible for where a car waits for the cars ahead: the
+ * last marker before the next package while any farther car is out, the dock
+ * otherwise.
+ */
+uint8_t hold_stop(int car) {
+  return farther_car_out(car) ? package_first_stop[car + 1] - 1 : ROUTE_DOCK;
+}
+
+/**
+ * This function is responsible for sending one car its package.
+ */
+bool dispatch_car(int car, bool *package) {
+  RF24NetworkHeader header;
+  if (!car_header(car, header)) {
+    led_phase_error(1);
+    return false;
+  }
+
+  Serial.print("Patrol for car ");
+  Serial.print(car + 1);
+  Serial.print(": ");
+  Serial.print(route_dry_pots(package));
+  Serial.print(" pots, last stop ");
+  Serial.print(route_last_stop(package));
+  Serial.print(", holds at ");
+  Serial.println(hold_stop(car));
+
+  patrol_start start;
+  start.signal = SIG_PATROL_START;
+  start.hold_stop = hold_stop(car);
+
+  cyan();
+  if (!anc.writeTimeout(header, &start, sizeof(start))) {
+    Serial.println("Could not send car to patrol!");
+    led_phase_error(1);
+    return false;
+  }
+
+  if (!anc.writeTimeout(header, package, sizeof(bool) * POTS)) {
+    Serial.println("Could not send watering data!");
+    led_phase_error(2);
+    return false;
+  }
+
+  // Confirmation, past the stop of a refill the car and the pump timer both
+  // ended
+  bool confirmed = read_car_signal(car, &signal, READ_TIMEOUT);
+  if (confirmed && signal == SIG_REFILL_STOP) {
+    confirmed = read_car_signal(car, &signal, READ_TIMEOUT);
+  }
+  if (!confirmed || signal != SIG_PATROL_START) {
+    Serial.println("Car did not confirm that it started!");
+    metrics.missed(MESH_ID_CAR + car, SIG_PATROL_START);
+    Serial.println("Check car status!");
+    led_phase_error(3);
+    return false;
+  }
+  incolor();
+
+  car_patrolling[car] = true;
+  car_held[car] = start.hold_stop != ROUTE_DOCK;
+  return true;
+}
+
+/**
+ * This function is responsible for letting the held cars drive on once every
+ * car on a farther package is back. A car not reached is tried again on the
+ * next call.
+ */
+void release_cars() {
+  for (int k = 0; k < CARS; k++) {
+    if (!car_held[k] || farther_car_out(k)) {
+      continue;
+    }
+    if (car_patrolling[k]) {
+      RF24NetworkHeader header;
+      signal = SIG_PATROL_GO;
+      if (!car_header(k, header) ||
+          !anc.writeTimeout(header, &signal, sizeof(signal))) {
+        continue;
+      }
+      Serial.print("Track ahead is clear for car: ");
+      Serial.println(k + 1);
+    }
+    car_held[k] = false;
+  }
+}
+
+/*******************************************************************************
+********************************** Checkpoint **********************************
+********************************************************************************/
+
+/**
+ * This function is responsible for checkpointing the cycle: in RAM always, in
+ * EEPROM while a patrol is planned or out or a car is lost, and once more to
+ * clear it there.
+ */
+void save_checkpoint() {
+  ct_checkpoint &state = checkpoint.state;
+  state.phase = current_phase;
+  memcpy(state.harvested, harvested, sizeof(state.harvested));
+  memcpy(state.pot_data, pot_data, sizeof(state.pot_data));
+  memcpy(state.pot_time, pot_time, sizeof(state.pot_time));
+  memcpy(state.history_seq, history_seq, sizeof(state.history_seq));
+  memcpy(state.needs_water, needs_water, sizeof(state.needs_water));
+  memcpy(state.car_patrolling, car_patrolling, sizeof(state.car_patrolling));
+  memcpy(state.car_held, car_held, sizeof(state.car_held));
+  memcpy(state.car_lost, car_lost, sizeof(state.car_lost));
+  aq_record_seal(&checkpoint.header, CHECKPOINT_MAGIC, CHECKPOINT_VERSION,
+                 &state, sizeof(state));
+
+  bool patrol = cars_patrolling() > 0 || any_car_lost() ||
+                (current_phase == phase_four && first_car() >= 0);
+  if (patrol || checkpoint_stored) {
+    aq_record_store(CHECKPOINT_ADDRESS, CHECKPOINT_MAGIC, CHECKPOINT_VERSION,
+                    &state, sizeof(state));
+    checkpoint_stored = patrol;
+  }
+}
+
+/**
+ * This function is responsible for picking the cycle up after a reset, from
+ * the checkpoint in RAM if it outlived the reset, else from the one in
+ * EEPROM. The phase it was in runs again from its start: the mesh and the
+ * database see a harvest or an upload twice at worst, and cars are not sent
+ * twice. The drying model is kept if it outlived the reset too.
+ */
+void resume_checkpoint() {
+  if (drying_pots.magic != DRYING_MAGIC ||
+      drying_pots.crc !=
+          aq_crc16(0xFFFF, drying_pots.pots, sizeof(drying_pots.pots))) {
+    drying.reset();
+    seal_drying();
+  }
+
+  ct_checkpoint state;
+  checkpoint_stored = aq_record_load(CHECKPOINT_ADDRESS, CHECKPOINT_MAGIC,
+                                     CHECKPOINT_VERSION, &state, sizeof(state));
+  if (aq_record_valid(&checkpoint.header, CHECKPOINT_MAGIC,
+                      CHECKPOINT_VERSION, &checkpoint.state,
+                      sizeof(checkpoint.state))) {
+    state = checkpoint.state;
+  } else if (!checkpoint_stored) {
+    return;
+  }
+  // Lost cars stay lost whatever phase the cycle was in
+  memcpy(car_lost, state.car_lost, sizeof(state.car_lost));
+  if (state.phase == phase_one || state.phase >= NUMBER_OF_PHASES) {
+    return;
+  }
+
+  memcpy(harvested, state.harvested, sizeof(state.harvested));
+  memcpy(pot_data, state.pot_data, sizeof(state.pot_data));
+  memcpy(pot_time, state.pot_time, sizeof(state.pot_time));
+  memcpy(history_seq, state.history_seq, sizeof(state.history_seq));
+  memcpy(needs_water, state.needs_water, sizeof(state.needs_water));
+  memcpy(car_patrolling, state.car_patrolling, sizeof(state.car_patrolling));
+  memcpy(car_held, state.car_held, sizeof(state.car_held));
+  route_split(needs_water, NULL, CARS, package_first_stop);
+  current_phase = (program_phase)state.phase;
+  cycle_started_at = millis();
+  cycle_running = true;
+
+  Serial.print(aq_watchdog_fired() ? "Watchdog reset" : "Reset");
+  Serial.print(", resuming at phase ");
+  Serial.print(current_phase + 1);
+  Serial.print(" with cars out: ");
+  Serial.println(cars_patrolling());
+}
+
+/*******************************************************************************
+*********************************** Patrols ************************************
+********************************************************************************/
+
+/**
+ * This function is responsible for planning the patrols and refilling the
+ * first car to leave; the others are refilled while it drives. This function
+ * defines phase_three.
+ */
+bool refill_tank() {
+  Serial.println("Phase 3!");
+
+  plan_fleet();
+
+  int car = first_car();
+  if (car < 0) {
+    Serial.println("No pot needs water, skipping the refill!");
+    led_phase_success();
+    return true;
+  }
+
+  if (!refill_car(car)) {
+    return false;
+  }
+
+  led_phase_success();
+  return true;
+}
+
+/**
+ * This function is responsible for sending the cars in a patrol, farthest
+ * package first, refilling each car after the first while the ones before it
+ * drive. Cars already out, when the phase runs again after a reset, are not
+ * sent again. This function defines phase_four.
+ */
+bool send_car_patrol() {
+  Serial.println("Phase 4!");
+
+  int first = first_car();
+  if (first < 0) {
+    Serial.println("No pot needs water, skipping the patrol!");
+    led_phase_success();
+    return true;
+  }
+
+  fleet_started_at = millis();
+  fleet_cars = 0;
+
+  bool package[POTS];
+  for (int k = first; k >= 0; k--) {
+    aq_watchdog_feed();
+    if (car_patrolling[k] || car_lost[k] || !car_package(k, package)) {
+      continue;
+    }
+
+    // The first car was refilled in phase three
+    if (k != first && !refill_car(k)) {
+      Serial.print("WARNING: Refill failed, car stays home: ");
+      Serial.println(k + 1);
+      continue;
+    }
+
+    if (dispatch_car(k, package)) {
+      fleet_cars++;
+      for (int i = 0; i < POTS; i++) {
+        if (package[i]) {
+          validity.watered(i);
+        }
+      }
+      if (wall_clock.synced(millis())) {
+        for (int i = 0; i < POTS; i++) {
+          if (package[i]) {
+            drying.watered(i, wall_clock.unixTime(millis()));
+          }
+        }
+        seal_drying();
+      }
+      save_checkpoint();
+    }
+  }
+
+  if (cars_patrolling() == 0) {
+    return false;
+  }
+
+  led_phase_success();
+  return true;
+}
+
+/**
+ * This function is responsible for awaing for every car sent out to finish
+ * its patrol. This should receive a meesage when a car finishes a patrol. A
+ * car that has not after it gave up on its lap and on telling us is booked
+ * back as missed, so one lost message does not hold every cycle after.
+ */
+void await_next_patrol() {
+  Serial.println("Phase 5!");
+
+  magenta();
+  unsigned long started = millis();
+  int out = cars_patrolling();
+  while (cars_patrolling() > 0) {
+    aq_watchdog_feed();
+    release_cars();
+    if (cars_patrolling() != out) {
+      out = cars_patrolling();
+      save_checkpoint();
+    }
+    if (millis() - started > MAX_PATROL_MILLIS + PATROL_FINISH_MILLIS) {
+      for (int k = 0; k < CARS; k++) {
+        if (car_patrolling[k]) {
+          Serial.print("TIMEOUT: No patrol end from car: ");
+          Serial.println(k + 1);
+          metrics.missed(MESH_ID_CAR + k, SIG_PATROL_STOP);
+          car_returned(k);
+        }
+      }
+      break;
+    }
+
+    Serial.println("Waiting for the cars to finish the patrol!");
+    if (anc.readTimeout(&signal, sizeof(signal))) {
+      RF24NetworkHeader aux = anc.getReadHeader();
+      int car = car_index(aux.from_node);
+      if (car < 0 || !book_patrol_end(car, signal)) {
+        Serial.print("ERROR: Incorrect response: ");
+        Serial.println(signal);
+        Serial.print("Message received from node: ");
+        Serial.println(aux.from_node);
+      }
+    }
+  }
+  incolor();
+
+  if (fleet_cars > 0) {
+    Serial.print("Fleet completion time (ms): ");
+    Serial.println(fleet_finished_at - fleet_started_at);
+    fleet_cars = 0;
+  }
+
+  led_phase_success();
+}
+
+/**
+ * This function is responsible for when the next cycle starts: CYCLE_LEAD_S
+ * before the first pot is forecast dry, at most CYCLE_MAX_WAIT_S from now.
+ * A pot without a trusted forecast, or no wall clock, makes it right away.
+ */
+void schedule_cycle() {
+  cycle_ended_at = millis();
+  cycle_wait = 0;
+  if (!wall_clock.synced(cycle_ended_at)) {
+    return;
+  }
+
+  uint32_t now = wall_clock.unixTime(cycle_ended_at);
+  uint32_t next = drying.next(now, DRY_HUMIDITY);
+  uint32_t wait = next - now;
+  if (next == DRYING_NEVER || wait > CYCLE_MAX_WAIT_S + CYCLE_LEAD_S) {
+    wait = CYCLE_MAX_WAIT_S;
+  } else {
+    wait = wait > CYCLE_LEAD_S ? wait - CYCLE_LEAD_S : 0;
+  }
+  cycle_wait = wait * 1000UL;
+
+  Serial.print("Next cycle in (s): ");
+  Serial.println(wait);
+  if (next != DRYING_NEVER && next != now) {
+    Serial.print("First pot forecast dry in (min): ");
+    Serial.println((next - now) / 60);
+  }
+}
+
+/*******************************************************************************
+*********************************** Gateway ************************************
+********************************************************************************/
+
+#ifdef GATEWAY
+/**
+ * This function is responsible for one write attempt the host asked for, in
+ * the lane writeTimeout would pick. The host retries, so the CT never blocks
+ * on a node while bridging.
+ */
+bool gateway_send(const gateway_frame &frame) {
+  RF24NetworkHeader header(frame.node, frame.type);
+  if (header.type == LANE_BULK || header.type == LANE_CONTROL) {
+    header.type = frame.size <= CONTROL_MAX_SIZE ? LANE_CONTROL : LANE_BULK;
+  }
+  bool delivered = network.write(header, frame.payload, frame.size);
+  on_write(header, frame.payload, frame.size, delivered);
+  return delivered;
+}
+
+/**
+ * This function is responsible for listing the mesh for the host, node ID
+ * and address of every node that joined it.
+ */
+uint8_t gateway_nodes(uint8_t *out) {
+  uint8_t size = 0;
+  for (int n = 0; n < mesh.addrListTop && size + 3 <= GATEWAY_PAYLOAD_MAX;
+       n++) {
+    out[size++] = mesh.addrList[n].nodeID;
+    out[size++] = mesh.addrList[n].address & 0xFF;
+    out[size++] = mesh.addrList[n].address >> 8;
+  }
+  return size;
+}
+
+void set_pump(bool on) {
+  digitalWrite(pump, on ? HIGH : LOW);
+  pump_on = on;
+  pump_started_at = millis();
+}
+
+/**
+ * This function is responsible for answering a frame from the host. Writes
+ * and the pump are refused while a cycle runs on board.
+ */
+void gateway_answer(const gateway_frame &frame) {
+  host_heard_at = millis();
+  host_present = true;
+
+  gateway_out.kind = frame.kind;
+  gateway_out.seq = frame.seq;
+  gateway_out.node = frame.node;
+  gateway_out.type = frame.type;
+  gateway_out.size = 0;
+  switch (frame.kind) {
+  case GATEWAY_HELLO: {
+    gateway_hello *hello = (gateway_hello *)gateway_out.payload;
+    hello->version = GATEWAY_VERSION;
+    hello->protocol = PROTOCOL_VERSION;
+    hello->bridging = bridging;
+    hello->pots = POTS;
+    hello->cars = CARS;
+    hello->pots_per_harvester = POTS_PER_HARVESTER;
+    hello->max_harvesters = MAX_HARVESTERS;
+    gateway_out.size = sizeof(*hello);
+    break;
+  }
+  case GATEWAY_TX:
+    gateway_out.kind = GATEWAY_TX_RESULT;
+    gateway_out.payload[0] = bridging && gateway_send(frame);
+    gateway_out.size = 1;
+    break;
+  case GATEWAY_NODES:
+    gateway_out.size = gateway_nodes(gateway_out.payload);
+    break;
+  case GATEWAY_PUMP:
+    if (bridging && frame.size == 1) {
+      set_pump(frame.payload[0]);
+    }
+    gateway_out.payload[0] = pump_on;
+    gateway_out.size = 1;
+    break;
+  default:
+    return;
+  }
+  gateway_write(gateway_out, serial_emit);
+}
+
+/**
+ * This function is responsible for Serial in gateway mode: frames go to
+ * gateway_answer, bytes outside of one are still commands.
+ */
+void gateway_serve() {
+  while (Serial.available()) {
+    uint8_t byte = Serial.read();
+    if (gateway.feed(byte)) {
+      gateway_answer(gateway.getFrame());
+    } else if (gateway.idle()) {
+      serve_command(byte);
+    }
+  }
+}
+
+/**
+ * This function is responsible for forwarding what the mesh delivers to the
+ * host, and for the pump, which stops by itself after MAX_REFILL_MILLIS like
+ * an on board refill. Returns false while the phases run on board.
+ */
+bool gateway_bridge() {
+  if (host_present && millis() - host_heard_at > GATEWAY_HOST_TIMEOUT) {
+    host_present = false;
+    cycle_wait = 0;
+    Serial.println("WARNING: Host is gone, running the phases on board!");
+  }
+  bridging = host_present && !cycle_running;
+  if (pump_on &&
+      (!bridging || millis() - pump_started_at > MAX_REFILL_MILLIS)) {
+    set_pump(false);
+  }
+  if (!bridging) {
+    return false;
+  }
+
+  int size = anc.poll(gateway_out.payload, GATEWAY_PAYLOAD_MAX);
+  if (size > 0) {
+    RF24NetworkHeader header = anc.getReadHeader();
+    gateway_out.kind = GATEWAY_RX;
+    gateway_out.seq = 0;
+    gateway_out.node = header.from_node;
+    gateway_out.type = header.type;
+    gateway_out.size = size;
+    gateway_write(gateway_out, serial_emit);
+  }
+  return true;
+}
+#endif
+
+void setup() {
+#ifdef GATEWAY
+  Serial.begin(GATEWAY_BAUD);
+#else
+  Serial.begin(9600);
+#endif
+
+  pinMode(pump, OUTPUT);
+
+  pinMode(red_light_pin, OUTPUT);
+  pinMode(green_light_pin, OUTPUT);
+  pinMode(blue_light_pin, OUTPUT);
+
+  Serial.println("Init NRF24L01");
+  SPI.begin();
+  mesh.setNodeID(NODE_CT);
+  mesh.begin(MESH_CHANNEL);
+  anc.setUpdate(mesh_update);
+  anc.setWriteHook(on_write);
+  anc.setTimeoutHook(on_timeout);
+  anc.setReadHook(on_read);
+  radio.setPALevel(RADIO_PA_LEVEL);
+
+  Serial.println("Init Ethernet");
+  if (Ethernet.begin(mac, ETHERNET_DHCP_TIMEOUT) == 0) {
+    Serial.println("Failed to configure Ethernet");
+  }
+
+  resume_checkpoint();
+  aq_watchdog_begin();
+}
+
+/**
+ * This function is responsible for running one phase. Returns false if it
+ * failed and has to be retried.
+ */
+bool run_phase(program_phase phase) {
+  switch (phase) {
   case phase_one:
     if (!harvest()) {
       Serial.println("PHASE-ERROR: Harvest failed!");
-      return;
+      return false;
     }
     print_data();
     break;
   case phase_two:
     if (!persist_data()) {
       Serial.println("PHASE-ERROR: Persisting data failed!");
-      return;
+      return false;
     }
     break;
   case phase_three:
     if (!refill_tank()) {
       Serial.println("PHASE-ERROR: Refilling failed!");
-      return;
+      return false;
     }
     break;
   case phase_four:
     if (!send_car_patrol()) {
       Serial.println("PHASE-ERROR: Patrol failed!");
-      return;
+      return false;
     }
     break;
   case phase_five:
     await_next_patrol();
     break;
   }
+  return true;
+}
+
+void loop() {
+  aq_watchdog_feed();
+  mesh_update();
+#ifdef GATEWAY
+  gateway_serve();
+  if (gateway_bridge()) {
+    return;
+  }
+#else
+  serve_serial();
+#endif
+  if (current_phase == phase_one && !cycle_running &&
+      millis() - cycle_ended_at < cycle_wait) {
+    return;
+  }
+  led_phase_start(current_phase);
+
+  unsigned long started = millis();
+  if (current_phase == phase_one && !cycle_running) {
+    cycle_started_at = started;
+    cycle_running = true;
+  }
+
+  trace.mark(started, current_phase);
+  bool ok = run_phase(current_phase);
+  metrics.phase(current_phase, ok, millis() - started);
+  if (!ok) {
+    return;
+  }
+
+  if (current_phase == phase_five) {
+    metrics.phase(METRICS_CYCLE, true, millis() - cycle_started_at);
+    cycle_running = false;
+    print_metrics();
+    schedule_cycle();
+  }
+
   current_phase = next_phase();
+  save_checkpoint();
   led_phase_change();
   delay(3000);
 }
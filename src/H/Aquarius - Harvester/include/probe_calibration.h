@@ -0,0 +1,16 @@
+#ifndef __PROBE_CALIBRATION__
+#define __PROBE_CALIBRATION__
+
+#include <AquariusFixed.h>
+#include <MoistureScanner.h>
+
+// Per probe calibration curves, indexed by the analog input the probe is wired
+// to. A probe without its own curve uses the datasheet one; to calibrate a
+// probe, record its raw reading (MoistureScanner::getRaw) in dry air and in
+// water and add an AQ_CURVE_POINTS table in Q8.8 percent here.
+const uint16_t *const probe_curves[SCAN_CHANNELS] = {
+    AQ_MOISTURE_CURVE_Q8, AQ_MOISTURE_CURVE_Q8, AQ_MOISTURE_CURVE_Q8,
+    AQ_MOISTURE_CURVE_Q8, AQ_MOISTURE_CURVE_Q8, AQ_MOISTURE_CURVE_Q8,
+    AQ_MOISTURE_CURVE_Q8, AQ_MOISTURE_CURVE_Q8};
+
+#endif
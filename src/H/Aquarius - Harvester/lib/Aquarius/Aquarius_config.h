@@ -1,8 +0,0 @@
-#ifndef __AQUARIUS_CONFIG_H__
-#define __AQUARIUS_CONFIG_H__
-
-// Communication
-#define READ_TIMEOUT 6000
-#define WRITE_TIMEOUT 5000
-
-#endif
@@ -0,0 +1,189 @@
+#include <AquariusFixed.h>
+
+#include "MoistureScanner.h"
+
+MoistureScanner::MoistureScanner(const uint16_t *const *_curves)
+    : curves(_curves), settle_us(SCAN_SETTLE_US),
+      oversample_shift(SCAN_OVERSAMPLE_SHIFT), power_pin(SCAN_NO_POWER_PIN),
+      warmup_ms(0), state(idle), channel(0),
+      samples(0), sum(0), armed_at(0), started_at(0), scan_micros(0) {
+  memset(raw, 0, sizeof(raw));
+  memset(humidity, 0, sizeof(humidity));
+}
+
+/**
+ * This function is responsible for setting the per channel settling time and
+ * the number of conversions (1 << shift) averaged into one reading. At most 64
+ * conversions fit the 16 bit accumulator.
+ */
+void MoistureScanner::configure(uint16_t _settle_us, uint8_t _oversample_shift) {
+  settle_us = _settle_us;
+  oversample_shift = _oversample_shift > 6 ? 6 : _oversample_shift;
+}
+
+/**
+ * This function is responsible for switching the probes through power_pin, so
+ * they are only powered while a scan runs. Scans start with warmup_ms for the
+ * probes' oscillators to settle.
+ */
+void MoistureScanner::setPower(uint8_t _power_pin, uint16_t _warmup_ms) {
+  power_pin = _power_pin;
+  warmup_ms = _warmup_ms;
+  pinMode(power_pin, OUTPUT);
+  digitalWrite(power_pin, LOW);
+}
+
+/**
+ * These functions are responsible for driving the ADC. On the AVR they talk to
+ * the registers directly so a conversion can run while the scan does other
+ * work; elsewhere they fall back to analogRead.
+ */
+
+void MoistureScanner::arm(uint8_t next) {
+#ifdef __AVR__
+  // A conversion latches its channel one ADC clock after ADSC is set, see
+  // wait_latched. A new ADMUX after that only takes effect for the next
+  // conversion, so the mux can be switched while the current one still runs
+  ADMUX = (ADMUX & 0xF0) | (next & 0x07);
+#endif
+  armed_at = micros();
+}
+
+void MoistureScanner::start_conversion() {
+#ifdef __AVR__
+  ADCSRA |= _BV(ADSC);
+#endif
+}
+
+void MoistureScanner::wait_latched() {
+#ifdef __AVR__
+  // One ADC clock, at whatever prescaler ADPS selects (0 divides by 2)
+  uint8_t prescaler = ADCSRA & 0x07;
+  uint16_t clocks = prescaler ? 1 << prescaler : 2;
+  delayMicroseconds((clocks + F_CPU / 1000000 - 1) / (F_CPU / 1000000));
+#endif
+}
+
+bool MoistureScanner::conversion_done() {
+#ifdef __AVR__
+  return !(ADCSRA & _BV(ADSC));
+#else
+  return true;
+#endif
+}
+
+uint16_t MoistureScanner::conversion_result() {
+#ifdef __AVR__
+  return ADC;
+#else
+  return analogRead(A0 + channel);
+#endif
+}
+
+/**
+ * This function is responsible for starting a scan of all the probes.
+ */
+void MoistureScanner::begin() {
+#ifdef __AVR__
+  // Same reference analogRead uses
+  ADMUX = _BV(REFS0);
+#endif
+  channel = 0;
+  samples = 0;
+  sum = 0;
+  started_at = micros();
+  arm(0);
+  state = settling;
+
+  if (power_pin != SCAN_NO_POWER_PIN) {
+    digitalWrite(power_pin, HIGH);
+    state = warming;
+  }
+}
+
+/**
+ * This function is responsible for advancing the scan without blocking. The
+ * settling time of channel N + 1 starts as soon as the last conversion of
+ * channel N is under way, so the two overlap. Returns true once every probe
+ * has a fresh reading.
+ */
+bool MoistureScanner::poll() {
+  switch (state) {
+  case idle:
+    return true;
+
+  case warming:
+    if (micros() - started_at < (unsigned long)warmup_ms * 1000)
+      return false;
+    arm(0);
+    state = settling;
+    return false;
+
+  case settling:
+    if (micros() - armed_at < settle_us)
+      return false;
+    state = converting;
+    start_conversion();
+    return false;
+
+  case converting:
+    if (!conversion_done())
+      return false;
+
+    sum += conversion_result();
+    samples++;
+
+    if (samples < (1 << oversample_shift)) {
+      start_conversion();
+      if (samples == (1 << oversample_shift) - 1 &&
+          channel + 1 < SCAN_CHANNELS) {
+        wait_latched();
+        arm(channel + 1);
+      }
+      return false;
+    }
+
+    // Decimate back to 10 bits with rounding
+    if (oversample_shift > 0)
+      sum += 1 << (oversample_shift - 1);
+    raw[channel] = sum >> oversample_shift;
+    humidity[channel] = aq_moisture_percent(curves[channel], raw[channel]);
+
+    channel++;
+    samples = 0;
+    sum = 0;
+
+    if (channel == SCAN_CHANNELS) {
+      if (power_pin != SCAN_NO_POWER_PIN)
+        digitalWrite(power_pin, LOW);
+      scan_micros = micros() - started_at;
+      state = idle;
+      return true;
+    }
+
+    if (oversample_shift == 0)
+      arm(channel);
+    state = settling;
+    return false;
+  }
+  return false;
+}
+
+bool MoistureScanner::busy() { return state != idle; }
+
+/**
+ * This function is responsible for running a whole scan and copying the
+ * humidity of every probe into data.
+ */
+void MoistureScanner::scan(byte *data) {
+  begin();
+  while (!poll())
+    ;
+  memcpy(data, humidity, sizeof(humidity));
+}
+
+const byte *MoistureScanner::getHumidity() { return humidity; }
+
+const uint16_t *MoistureScanner::getRaw() { return raw; }
+
+unsigned long MoistureScanner::getScanMicros() { return scan_micros; }
@@ -0,0 +1,58 @@
+#ifndef __MOISTURE_SCANNER__
+#define __MOISTURE_SCANNER__
+
+#include <Arduino.h>
+
+// Probes are wired to A0..A7 and selected through the ADC input multiplexer
+#define SCAN_CHANNELS 8
+
+// Defaults
+#define SCAN_SETTLE_US 200
+#define SCAN_OVERSAMPLE_SHIFT 4 // 16 conversions per probe
+#define SCAN_NO_POWER_PIN 0xFF
+
+class MoistureScanner {
+private:
+  typedef enum { idle, warming, settling, converting } scan_state;
+
+  const uint16_t *const *curves;
+  uint16_t settle_us;
+  uint8_t oversample_shift;
+  uint8_t power_pin;
+  uint16_t warmup_ms;
+
+  scan_state state;
+  uint8_t channel;
+  uint8_t samples;
+  uint16_t sum;
+  unsigned long armed_at;
+  unsigned long started_at;
+  unsigned long scan_micros;
+
+  uint16_t raw[SCAN_CHANNELS];
+  byte humidity[SCAN_CHANNELS];
+
+  void arm(uint8_t next);
+  void start_conversion();
+  void wait_latched();
+  bool conversion_done();
+  uint16_t conversion_result();
+
+public:
+  MoistureScanner(const uint16_t *const *_curves);
+
+  void configure(uint16_t _settle_us, uint8_t _oversample_shift);
+  void setPower(uint8_t _power_pin, uint16_t _warmup_ms);
+
+  void begin();
+  bool poll();
+  bool busy();
+
+  void scan(byte *data);
+
+  const byte *getHumidity();
+  const uint16_t *getRaw();
+  unsigned long getScanMicros();
+};
+
+#endif
@@ -0,0 +1,199 @@
+#include "PowerManager.h"
+
+#ifdef __AVR__
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#endif
+
+static const uint16_t wdt_period_ms[] = {16,  32,   64,   128,  256,
+                                         512, 1024, 2048, 4096, 8192};
+static const unsigned long state_ua[PM_STATES] = {PM_SLEEP_UA, PM_LISTEN_UA,
+                                                  PM_ACTIVE_UA, PM_SAMPLE_UA};
+
+static volatile bool radio_irq = false;
+static uint8_t radio_irq_number;
+
+static void on_radio_irq() {
+  radio_irq = true;
+  // Level triggered, as it is the only kind that wakes from power-down; the
+  // line stays low until the radio's RX_DR flag is cleared
+  detachInterrupt(radio_irq_number);
+}
+
+#ifdef __AVR__
+ISR(WDT_vect) { wdt_disable(); }
+#endif
+
+PowerManager::PowerManager(RF24 &_radio, uint8_t _irq_pin)
+    : radio(_radio), irq_pin(_irq_pin), awake_state(pm_active),
+      awake_since(0), slept_ms(0), wake_us(0), woken_by_radio(false),
+      replies(0), reply_us_sum(0), reply_us_max(0) {
+  memset(state_ms, 0, sizeof(state_ms));
+}
+
+/**
+ * This function is responsible for setting up the radio so its IRQ line only
+ * fires for received data.
+ */
+void PowerManager::begin() {
+  pinMode(irq_pin, INPUT);
+  radio_irq_number = digitalPinToInterrupt(irq_pin);
+  radio.maskIRQ(true, true, false);
+  awake_since = millis();
+}
+
+/**
+ * This function is responsible for keeping time across sleeps. millis() stops
+ * in power-down, so every watchdog sleep is added back. A sleep cut short by
+ * the radio is not, which costs at most one watchdog period per radio wake.
+ */
+unsigned long PowerManager::now() { return millis() + slept_ms; }
+
+void PowerManager::credit(pm_state state, unsigned long ms) {
+  state_ms[state] += ms;
+}
+
+/**
+ * This function is responsible for attributing the time spent awake so far to
+ * the previous state before switching to the given one.
+ */
+void PowerManager::setState(pm_state state) {
+  unsigned long current = millis();
+  credit(awake_state, current - awake_since);
+  awake_since = current;
+  awake_state = state;
+}
+
+bool PowerManager::power_down(uint8_t wdt_period, bool radio_wake) {
+  setState(awake_state);
+  Serial.flush();
+
+  radio_irq = false;
+  if (radio_wake) {
+    attachInterrupt(radio_irq_number, on_radio_irq, LOW);
+  }
+
+#ifdef __AVR__
+  byte adcsra = ADCSRA;
+  ADCSRA = 0;
+
+  cli();
+  wdt_reset();
+  MCUSR &= ~_BV(WDRF);
+  WDTCSR = _BV(WDCE) | _BV(WDE);
+  WDTCSR = _BV(WDIE) | (wdt_period & 0x07) | ((wdt_period & 0x08) ? _BV(WDP3) : 0);
+
+  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  sleep_enable();
+  sleep_bod_disable();
+  sei();
+  sleep_cpu();
+  sleep_disable();
+  wdt_disable();
+
+  ADCSRA = adcsra;
+#else
+  unsigned long start = millis();
+  while (!radio_irq && millis() - start < wdt_period_ms[wdt_period])
+    ;
+#endif
+
+  if (radio_wake) {
+    detachInterrupt(radio_irq_number);
+  }
+
+  wake_us = micros();
+  awake_since = millis();
+  woken_by_radio = radio_irq;
+  if (!woken_by_radio) {
+#ifdef __AVR__
+    slept_ms += wdt_period_ms[wdt_period];
+#endif
+    credit(radio_wake ? pm_listen : pm_sleep, wdt_period_ms[wdt_period]);
+  }
+  return woken_by_radio;
+}
+
+/**
+ * This function is responsible for sleeping with the radio powered down. Only
+ * the watchdog can wake the node.
+ */
+void PowerManager::sleep(uint8_t wdt_period) {
+  radio.powerDown();
+  power_down(wdt_period, false);
+}
+
+/**
+ * This function is responsible for sleeping with the radio listening. Returns
+ * true if a frame woke the node before the watchdog did.
+ */
+bool PowerManager::listen(uint8_t wdt_period) {
+  radio.powerUp();
+  if (!digitalRead(irq_pin)) {
+    wake_us = micros();
+    woken_by_radio = true;
+    return true;
+  }
+  return power_down(wdt_period, true);
+}
+
+/**
+ * This function is responsible for idling the MCU until the next interrupt.
+ * Timer0 keeps running, so millis() and micros() stay valid.
+ */
+void PowerManager::idle() {
+#ifdef __AVR__
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+  sleep_cpu();
+  sleep_disable();
+#endif
+}
+
+/**
+ * This function is responsible for recording the wake-to-reply latency of a
+ * request that woke the node.
+ */
+void PowerManager::replied() {
+  if (!woken_by_radio)
+    return;
+  unsigned long us = micros() - wake_us;
+  replies++;
+  reply_us_sum += us;
+  if (us > reply_us_max)
+    reply_us_max = us;
+  woken_by_radio = false;
+}
+
+unsigned long PowerManager::averageMicroAmps() {
+  unsigned long long charge = 0, total = 0;
+  for (int i = 0; i < PM_STATES; i++) {
+    charge += (unsigned long long)state_ms[i] * state_ua[i];
+    total += state_ms[i];
+  }
+  return total == 0 ? 0 : charge / total;
+}
+
+unsigned long PowerManager::meanReplyMicros() {
+  return replies == 0 ? 0 : reply_us_sum / replies;
+}
+
+unsigned long PowerManager::maxReplyMicros() { return reply_us_max; }
+
+void PowerManager::report() {
+  setState(awake_state);
+  Serial.print("Power: ");
+  Serial.print(averageMicroAmps());
+  Serial.print(" uA avg, sleep/listen/active/sample (ms): ");
+  for (int i = 0; i < PM_STATES; i++) {
+    Serial.print(state_ms[i]);
+    Serial.print(i + 1 < PM_STATES ? "/" : "\n");
+  }
+  Serial.print("Wake to reply (us): ");
+  Serial.print(meanReplyMicros());
+  Serial.print(" mean, ");
+  Serial.print(maxReplyMicros());
+  Serial.print(" max over ");
+  Serial.print(replies);
+  Serial.println(" requests");
+}
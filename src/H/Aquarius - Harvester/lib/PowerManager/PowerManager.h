@@ -0,0 +1,70 @@
+#ifndef __POWER_MANAGER__
+#define __POWER_MANAGER__
+
+#include <Arduino.h>
+#include <RF24.h>
+
+#ifdef __AVR__
+#include <avr/wdt.h>
+#else
+#define WDTO_15MS 0
+#define WDTO_30MS 1
+#define WDTO_60MS 2
+#define WDTO_120MS 3
+#define WDTO_250MS 4
+#define WDTO_500MS 5
+#define WDTO_1S 6
+#define WDTO_2S 7
+#define WDTO_4S 8
+#define WDTO_8S 9
+#endif
+
+// Supply current per state in uA, for a Nano with the power LED removed and
+// fed straight into 5V. Used to estimate the average current from the time
+// spent in each state.
+#define PM_SLEEP_UA 7       // MCU power-down + WDT, radio power-down
+#define PM_LISTEN_UA 13500  // MCU power-down, radio RX
+#define PM_ACTIVE_UA 25500  // MCU active, radio RX/TX
+#define PM_SAMPLE_UA 52000  // MCU active, radio power-down, 8 probes on
+
+typedef enum { pm_sleep, pm_listen, pm_active, pm_sample, PM_STATES } pm_state;
+
+class PowerManager {
+private:
+  RF24 &radio;
+  uint8_t irq_pin;
+
+  pm_state awake_state;
+  unsigned long awake_since;
+  unsigned long slept_ms;
+  unsigned long state_ms[PM_STATES];
+
+  unsigned long wake_us;
+  bool woken_by_radio;
+  unsigned long replies;
+  unsigned long reply_us_sum;
+  unsigned long reply_us_max;
+
+  void credit(pm_state state, unsigned long ms);
+  bool power_down(uint8_t wdt_period, bool radio_wake);
+
+public:
+  PowerManager(RF24 &_radio, uint8_t _irq_pin);
+
+  void begin();
+  unsigned long now();
+
+  void setState(pm_state state);
+  void sleep(uint8_t wdt_period);
+  bool listen(uint8_t wdt_period);
+  void idle();
+
+  void replied();
+
+  unsigned long averageMicroAmps();
+  unsigned long meanReplyMicros();
+  unsigned long maxReplyMicros();
+  void report();
+};
+
+#endif
@@ -1,42 +1,381 @@
 #include <RF24.h>
+#include <RF24Mesh.h>
 #include <RF24Network.h>
 #include <SPI.h>
 
 #include <Aquarius.h>
+#include <AquariusHistory.h>
+#include <AquariusLink.h>
+#include <AquariusStack.h>
+#include <AquariusTime.h>
+#include <MoistureScanner.h>
+#include <PowerManager.h>
+#include <probe_calibration.h>
 
-#define CURRENT NODE_H2
+// Which harvester this is; its pots are HARVESTER_INDEX * POTS_PER_HARVESTER
+// onwards on the CT
+#ifndef HARVESTER_INDEX
+#define HARVESTER_INDEX 1
+#endif
+#define CURRENT (MESH_ID_HARVESTER + HARVESTER_INDEX)
 
-byte pots[] = {40, 10, 40, 65, 95, 20, 100, 35};
+// Nanos fed from their own 3.3V regulator brown out on RF24_PA_MAX
+#define RADIO_PA_LEVEL RF24_PA_HIGH
+
+// Sampling
+#define SAMPLE_PERIOD 10000
+#define FILTER_SHIFT 2 // EMA weight of a new scan is 1 / (1 << FILTER_SHIFT)
+
+// Low power mode: the radio sleeps for SLEEP_TICK and listens for LISTEN_TICK.
+// The CT retries a write for WRITE_TIMEOUT, which spans several ticks, so a
+// request is answered within one SLEEP_TICK + LISTEN_TICK.
+#define SLEEP_TICK WDTO_1S
+#define LISTEN_TICK WDTO_30MS
+#define REPORT_PERIOD 600000
+#define RADIO_IRQ_PIN 2
+#define PROBE_POWER_PIN 4
+#define PROBE_WARMUP_MS 100
+
+MoistureScanner scanner(probe_curves);
+
+// Latest filtered readings, in Q8.8 percent, and when they were taken
+uint16_t filtered[SCAN_CHANNELS];
+unsigned long sampled_at;
+bool has_sample = false;
+
+// A snapshot every HISTORY_PERIOD_S, kept until the CT backfills it
+HistoryRing history;
+unsigned long recorded_at;
+bool has_record = false;
+
+// Wall clock from the CT, only used to learn how far our own clock drifts
+AquariusClock wall_clock;
+
+typedef union {
+  aq_signal signal;
+  protocol_hello hello;
+  history_request history;
+  time_sync time;
+  link_switch link;
+} request;
 
 RF24 radio(7, 8);
 RF24Network network(radio);
+RF24Mesh mesh(radio, network);
 AquariusNetworkCommunicator anc(network);
+unsigned long mesh_checked_at;
+LinkMonitor link_monitor(radio, MESH_CHANNEL, LINK_RATE_1MBPS);
+#ifdef LOW_POWER
+PowerManager pm(radio, RADIO_IRQ_PIN);
+unsigned long reported_at;
+#endif
 
-RF24NetworkHeader car_header(NODE_CAR);
 RF24NetworkHeader ct_header(NODE_CT);
-RF24NetworkHeader h1_header(NODE_H1);
-RF24NetworkHeader h2_header(NODE_H2);
 
-void read_data() {}
+/**
+ * This function is responsible for the node's clock, which keeps running while
+ * the MCU sleeps in low power mode.
+ */
+unsigned long clock_ms() {
+#ifdef LOW_POWER
+  return pm.now();
+#else
+  return millis();
+#endif
+}
+
+/**
+ * This function is responsible for rounding the filtered snapshot to whole
+ * percents.
+ */
+void snapshot_humidity(byte *humidity) {
+  for (int i = 0; i < SCAN_CHANNELS; i++) {
+    humidity[i] = (filtered[i] + 0x80) >> 8;
+  }
+}
+
+/**
+ * This function is responsible for folding a finished scan into the filtered
+ * snapshot, and for recording it every HISTORY_PERIOD_S.
+ */
+void update_snapshot(const byte *humidity) {
+  for (int i = 0; i < SCAN_CHANNELS; i++) {
+    uint16_t h = (uint16_t)humidity[i] << 8;
+    if (!has_sample) {
+      filtered[i] = h;
+    } else if (h > filtered[i]) {
+      filtered[i] += (h - filtered[i]) >> FILTER_SHIFT;
+    } else {
+      filtered[i] -= (filtered[i] - h) >> FILTER_SHIFT;
+    }
+  }
+  sampled_at = clock_ms();
+  has_sample = true;
+
+  if (has_record && sampled_at - recorded_at < HISTORY_PERIOD_S * 1000UL) {
+    return;
+  }
+  recorded_at = sampled_at;
+  has_record = true;
+
+  byte snapshot[SCAN_CHANNELS];
+  snapshot_humidity(snapshot);
+  history.append(sampled_at / 1000, snapshot);
+}
+
+/**
+ * This function is responsible for sampling the probes every SAMPLE_PERIOD in
+ * the background. It never blocks for longer than a single ADC conversion.
+ */
+void sample_data() {
+  if (scanner.busy()) {
+    if (scanner.poll()) {
+      update_snapshot(scanner.getHumidity());
+    }
+    return;
+  }
+
+  if (!has_sample || clock_ms() - sampled_at >= SAMPLE_PERIOD) {
+    scanner.begin();
+  }
+}
+
+#ifdef LOW_POWER
+/**
+ * This function is responsible for sampling in low power mode. The probes are
+ * only powered for the scan and the MCU idles while they warm up.
+ */
+void sample_data_low_power() {
+  if (has_sample && clock_ms() - sampled_at < SAMPLE_PERIOD)
+    return;
+
+  pm.setState(pm_sample);
+  scanner.begin();
+  while (!scanner.poll()) {
+    pm.idle();
+  }
+  update_snapshot(scanner.getHumidity());
+  pm.setState(pm_active);
+}
+#endif
+
+/**
+ * This function is responsible for answering a harvest request straight from
+ * the snapshot. Only the very first request after boot waits for a scan.
+ */
+bool send_data() {
+  if (!has_sample) {
+    byte humidity[SCAN_CHANNELS];
+    scanner.scan(humidity);
+    update_snapshot(humidity);
+  }
+
+  harvest_data data;
+  snapshot_humidity(data.humidity);
+  data.age = clock_ms() - sampled_at;
+
+  return anc.writeTimeout(ct_header, &data, sizeof(data));
+}
+
+/**
+ * This function is responsible for answering a backfill request with the
+ * next frame of history.
+ */
+bool send_history(uint16_t since) {
+  history_frame frame;
+  history.fill(&frame, since, clock_ms() / 1000);
+  frame.signal = SIG_HISTORY_DATA;
+  frame.drift_ppm = wall_clock.driftPpm();
+  return anc.writeTimeout(ct_header, &frame, sizeof(frame));
+}
+
+/**
+ * This function is responsible for printing how deep the stack has been and
+ * how much RAM was never touched.
+ */
+void print_stack() {
+  Serial.print("Stack: peak ");
+  Serial.print(stack_peak());
+  Serial.print(", headroom ");
+  Serial.print(stack_headroom());
+  Serial.print(", free ");
+  Serial.println(stack_free());
+}
+
+/**
+ * This function is responsible for getting a new address from the CT when the
+ * harvester lost its place in the mesh, at most once per MESH_CHECK_PERIOD.
+ */
+void check_mesh() {
+  if (clock_ms() - mesh_checked_at < MESH_CHECK_PERIOD) {
+    return;
+  }
+  mesh_checked_at = clock_ms();
+  print_stack();
+  if (!mesh.checkConnection()) {
+    Serial.println("WARNING: Lost the mesh, renewing the address!");
+    mesh.renewAddress();
+    // The CT may have gone back home without us
+    if (!mesh.checkConnection() && !link_monitor.isHome()) {
+      link_monitor.goHome();
+      mesh.renewAddress();
+    }
+  }
+}
+
+void on_write(RF24NetworkHeader &header, const void *data, int data_size,
+              bool delivered) {
+  link_monitor.sent(header.to_node, delivered);
+}
+
+/**
+ * This function is responsible for answering a survey request with our own
+ * survey and link totals.
+ */
+bool send_link_report() {
+  link_report report;
+  report.signal = SIG_LINK_REPORT;
+  link_monitor.fillReport(&report);
+  link_monitor.survey(report.busy);
+  return anc.writeTimeout(ct_header, &report, sizeof(report));
+}
+
+/**
+ * This function is responsible for answering the CT's hello with the protocol
+ * this harvester runs, and for saying so when the CT runs another one.
+ */
+bool send_hello(uint8_t version) {
+  if (version != PROTOCOL_VERSION) {
+    Serial.print("ERROR: The CT runs protocol ");
+    Serial.print(version);
+    Serial.print(", this harvester ");
+    Serial.println(PROTOCOL_VERSION);
+  }
+  protocol_hello hello;
+  hello.signal = SIG_HELLO;
+  hello.version = PROTOCOL_VERSION;
+  return anc.writeTimeout(ct_header, &hello, sizeof(hello));
+}
+
+/**
+ * This function is responsible for applying a channel switch from the CT once
+ * it is due and confirming it. If the CT cannot be reached on the new
+ * settings we go back home.
+ */
+void update_link() {
+  if (!link_monitor.due(clock_ms())) {
+    return;
+  }
+
+  link_report report;
+  report.signal = SIG_LINK_REPORT;
+  link_monitor.fillReport(&report);
+  if (!anc.writeTimeout(ct_header, &report, sizeof(report))) {
+    Serial.println("WARNING: Link switch not confirmed, going home!");
+    link_monitor.goHome();
+  }
+}
+
+void log_send(bool sent) {
+  if (sent) {
+    Serial.println("Data sent to control tower!");
+  } else {
+    Serial.println("Could not send data to control tower!");
+  }
+}
+
+void replied(bool sent) {
+#ifdef LOW_POWER
+  pm.replied();
+#endif
+  log_send(sent);
+}
+
+/**
+ * This function is responsible for dispatching a message from the CT.
+ */
+void handle_request(request &message, int size) {
+  if (size < (int)sizeof(message.signal))
+    return;
+
+  switch (message.signal) {
+  case SIG_HARVEST_START:
+    replied(send_data());
+    break;
+  case SIG_HISTORY_REQUEST:
+    if (size == sizeof(message.history)) {
+      replied(send_history(message.history.since));
+    }
+    break;
+  case SIG_HELLO:
+    if (size >= (int)sizeof(message.hello)) {
+      replied(send_hello(message.hello.version));
+    }
+    break;
+  case SIG_LINK_SURVEY:
+    replied(send_link_report());
+    break;
+  case SIG_LINK_SWITCH:
+    if (size == sizeof(message.link)) {
+      link_monitor.schedule(message.link, clock_ms());
+    }
+    break;
+  case SIG_TIME_SYNC:
+    if (size == sizeof(message.time)) {
+      wall_clock.sync(message.time.seconds, message.time.milliseconds,
+                      clock_ms());
+    }
+    break;
+  }
+}
 
 void setup() {
   Serial.begin(9600);
+  scanner.configure(SCAN_SETTLE_US, SCAN_OVERSAMPLE_SHIFT);
   SPI.begin();
-  radio.begin();
-  network.begin(90, CURRENT);
+  mesh.setNodeID(CURRENT);
+  if (!mesh.begin(MESH_CHANNEL)) {
+    Serial.println("WARNING: Could not join the mesh yet!");
+  }
+  radio.setPALevel(RADIO_PA_LEVEL);
+  anc.setWriteHook(on_write);
+
+
+#ifdef LOW_POWER
+  // A sleeping node cannot route, so it must never become anyone's parent
+  network.networkFlags |= FLAG_NO_POLL;
+  scanner.setPower(PROBE_POWER_PIN, PROBE_WARMUP_MS);
+  pm.begin();
+#endif
 }
 
 void loop() {
-  int signal;
-  if (anc.readTimeout(&signal, sizeof(signal))) {
-    if (signal == SIG_HARVEST_START) {
-      Serial.println("Reading sensors!");
-      read_data();
-      if (anc.writeTimeout(ct_header, pots, sizeof(pots))) {
-        Serial.println("Data sent to control tower!");
-      } else {
-        Serial.println("Could not send data to control tower!");
-      }
+  request message;
+  int size;
+#ifdef LOW_POWER
+  pm.sleep(SLEEP_TICK);
+  sample_data_low_power();
+
+  if (pm.listen(LISTEN_TICK)) {
+    while ((size = anc.poll(&message, sizeof(message))) > 0) {
+      handle_request(message, size);
     }
   }
+
+  update_link();
+  check_mesh();
+
+  if (clock_ms() - reported_at >= REPORT_PERIOD) {
+    pm.report();
+    link_monitor.report();
+    reported_at = clock_ms();
+  }
+#else
+  if ((size = anc.poll(&message, sizeof(message))) > 0) {
+    handle_request(message, size);
+  }
+  sample_data();
+  update_link();
+  check_mesh();
+#endif
 }
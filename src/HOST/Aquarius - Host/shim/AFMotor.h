@@ -0,0 +1,36 @@
+#ifndef __HOST_AFMOTOR__
+#define __HOST_AFMOTOR__
+
+// The part of the Adafruit Motor Shield library the car uses. Motors are
+// told apart by their port, as on the shield; the tool linking it provides
+// what they drive.
+
+#include <Arduino.h>
+
+#define FORWARD 1
+#define BACKWARD 2
+#define BRAKE 3
+#define RELEASE 4
+
+void host_motor(uint8_t port, uint8_t command, int speed);
+
+class AF_DCMotor {
+private:
+  uint8_t port;
+  uint8_t command;
+  uint8_t speed;
+
+public:
+  AF_DCMotor(uint8_t _port, uint8_t freq = 1)
+      : port(_port), command(RELEASE), speed(0) {}
+  void run(uint8_t _command) {
+    command = _command;
+    host_motor(port, command, -1);
+  }
+  void setSpeed(uint8_t _speed) {
+    speed = _speed;
+    host_motor(port, 0, speed);
+  }
+};
+
+#endif
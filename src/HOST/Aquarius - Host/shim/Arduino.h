@@ -0,0 +1,163 @@
+#ifndef __HOST_ARDUINO__
+#define __HOST_ARDUINO__
+
+// Just enough of Arduino.h to build node code on the host. The tool linking
+// it provides what is behind it: the clock, the pins and where Serial goes.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define A0 54
+#define A15 69
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define F(text) (text)
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+unsigned long pulseIn(uint8_t pin, uint8_t state,
+                      unsigned long timeout = 1000000UL);
+
+// Where Serial output goes
+void host_serial_write(const char *text);
+
+// Arduino's String, as far as the nodes use it: numbers concat as decimals,
+// as there
+class String {
+private:
+  std::string text;
+
+public:
+  String(const char *_text = "") : text(_text) {}
+
+  void concat(const char *more) { text += more; }
+  void concat(const String &more) { text += more.text; }
+  void concat(char c) { text += c; }
+  void concat(unsigned char value) { text += std::to_string(value); }
+  void concat(int value) { text += std::to_string(value); }
+  void concat(unsigned int value) { text += std::to_string(value); }
+  void concat(long value) { text += std::to_string(value); }
+  void concat(unsigned long value) { text += std::to_string(value); }
+  String &operator+=(const char *more) {
+    concat(more);
+    return *this;
+  }
+
+  unsigned length() const { return text.size(); }
+  const char *c_str() const { return text.c_str(); }
+};
+
+// Arduino's Print, for the streams other than Serial: every print is one
+// write() of its text, as on the board, so a tool can charge for each
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(const uint8_t *buffer, size_t size) = 0;
+  size_t write(uint8_t byte) { return write(&byte, 1); }
+
+  size_t print(const char *text) {
+    return write((const uint8_t *)text, strlen(text));
+  }
+  size_t print(const String &text) {
+    return write((const uint8_t *)text.c_str(), text.length());
+  }
+  size_t print(long value) { return print(std::to_string(value).c_str()); }
+  size_t print(unsigned long value) {
+    return print(std::to_string(value).c_str());
+  }
+  size_t print(int value) { return print((long)value); }
+  size_t print(unsigned int value) { return print((unsigned long)value); }
+
+  size_t println() { return print("\r\n"); }
+  template <typename T> size_t println(T value) {
+    size_t n = print(value);
+    return n + println();
+  }
+};
+
+class HardwareSerial {
+private:
+  template <typename T> void format(const char *spec, T value) {
+    char text[24];
+    snprintf(text, sizeof(text), spec, value);
+    host_serial_write(text);
+  }
+
+  void number(unsigned long value, int base) {
+    char text[40];
+    int i = sizeof(text) - 1;
+    text[i] = '\0';
+    do {
+      text[--i] = "0123456789abcdef"[value % base];
+      value /= base;
+    } while (value && i > 0);
+    host_serial_write(text + i);
+  }
+
+public:
+  void begin(unsigned long baud) {}
+  int available() { return 0; }
+  int read() { return -1; }
+  size_t write(uint8_t byte) {
+    char text[2] = {(char)byte, '\0'};
+    host_serial_write(text);
+    return 1;
+  }
+
+  void print(const char *text) { host_serial_write(text); }
+  void print(char c) { write(c); }
+  void print(double value, int digits = 2) { format("%.2f", value); }
+  void print(long value, int base = DEC) {
+    if (base == DEC) {
+      format("%ld", value);
+    } else {
+      number(value, base);
+    }
+  }
+  void print(unsigned long value, int base = DEC) { number(value, base); }
+  void print(int value, int base = DEC) { print((long)value, base); }
+  void print(unsigned int value, int base = DEC) {
+    number(value, base);
+  }
+  void print(unsigned char value, int base = DEC) { number(value, base); }
+
+  template <typename T> void println(T value) {
+    print(value);
+    println();
+  }
+  template <typename T> void println(T value, int base) {
+    print(value, base);
+    println();
+  }
+  void println() { host_serial_write("\n"); }
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef __HOST_ETHERNET__
+#define __HOST_ETHERNET__
+
+// The part of the Ethernet library the CT uses. The tool linking it provides
+// the network behind it.
+
+#include <Arduino.h>
+
+class EthernetClient : public Print {
+public:
+  int connect(const char *host, uint16_t port);
+  uint8_t connected();
+  int available();
+  int read();
+  void stop();
+  size_t write(const uint8_t *buffer, size_t size);
+  using Print::write;
+};
+
+class EthernetClass {
+public:
+  int begin(uint8_t *mac, unsigned long timeout = 60000,
+            unsigned long responseTimeout = 4000);
+};
+
+extern EthernetClass Ethernet;
+
+#endif
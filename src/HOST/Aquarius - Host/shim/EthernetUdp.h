@@ -0,0 +1,20 @@
+#ifndef __HOST_ETHERNETUDP__
+#define __HOST_ETHERNETUDP__
+
+// The part of EthernetUDP the CT uses, for SNTP. The tool linking it provides
+// the server behind it.
+
+#include <Ethernet.h>
+
+class EthernetUDP {
+public:
+  uint8_t begin(uint16_t port);
+  int beginPacket(const char *host, uint16_t port);
+  size_t write(const uint8_t *buffer, size_t size);
+  int endPacket();
+  int parsePacket();
+  int read(unsigned char *buffer, size_t size);
+  void stop();
+};
+
+#endif
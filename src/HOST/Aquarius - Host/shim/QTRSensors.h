@@ -0,0 +1,101 @@
+#ifndef __HOST_QTRSENSORS__
+#define __HOST_QTRSENSORS__
+
+// The part of Pololu's QTRSensors the car uses. Calibration and line
+// position work as in the library; the tool linking it provides the raw
+// reading of each sensor.
+
+#include <Arduino.h>
+
+#define QTR_RC_TIMEOUT 2500
+#define QTR_CALIBRATE_READS 10
+
+enum class QTRReadMode : uint8_t { Off, On };
+
+// Raw RC time of one sensor, 0 to QTR_RC_TIMEOUT
+uint16_t host_qtr_read(uint8_t sensor);
+
+class QTRSensors {
+private:
+  uint8_t count;
+
+public:
+  struct CalibrationData {
+    bool initialized = false;
+    uint16_t *minimum = nullptr;
+    uint16_t *maximum = nullptr;
+  };
+  CalibrationData calibrationOn;
+
+  QTRSensors() : count(0) {}
+
+  void setTypeRC() {}
+  void setSensorPins(const uint8_t *pins, uint8_t _count) { count = _count; }
+
+  void read(uint16_t *values, QTRReadMode mode = QTRReadMode::On) {
+    for (uint8_t i = 0; i < count; i++) {
+      values[i] = host_qtr_read(i);
+    }
+  }
+
+  void resetCalibration() {
+    for (uint8_t i = 0; calibrationOn.initialized && i < count; i++) {
+      calibrationOn.minimum[i] = QTR_RC_TIMEOUT;
+      calibrationOn.maximum[i] = 0;
+    }
+  }
+
+  void calibrate(QTRReadMode mode = QTRReadMode::On) {
+    if (!calibrationOn.initialized) {
+      calibrationOn.minimum =
+          (uint16_t *)realloc(calibrationOn.minimum, sizeof(uint16_t) * count);
+      calibrationOn.maximum =
+          (uint16_t *)realloc(calibrationOn.maximum, sizeof(uint16_t) * count);
+      calibrationOn.initialized = true;
+      resetCalibration();
+    }
+    uint16_t values[8], low[8], high[8];
+    for (uint8_t i = 0; i < count; i++) {
+      low[i] = QTR_RC_TIMEOUT;
+      high[i] = 0;
+    }
+    for (uint8_t r = 0; r < QTR_CALIBRATE_READS; r++) {
+      read(values);
+      for (uint8_t i = 0; i < count; i++) {
+        low[i] = values[i] < low[i] ? values[i] : low[i];
+        high[i] = values[i] > high[i] ? values[i] : high[i];
+      }
+    }
+    // As the library: only what was seen on every read counts
+    for (uint8_t i = 0; i < count; i++) {
+      if (low[i] > calibrationOn.maximum[i]) {
+        calibrationOn.maximum[i] = low[i];
+      }
+      if (high[i] < calibrationOn.minimum[i]) {
+        calibrationOn.minimum[i] = high[i];
+      }
+    }
+  }
+
+  void readCalibrated(uint16_t *values, QTRReadMode mode = QTRReadMode::On) {
+    read(values);
+    for (uint8_t i = 0; calibrationOn.initialized && i < count; i++) {
+      uint16_t lo = calibrationOn.minimum[i], hi = calibrationOn.maximum[i];
+      long v = hi > lo ? ((long)values[i] - lo) * 1000 / (hi - lo) : 0;
+      values[i] = v < 0 ? 0 : v > 1000 ? 1000 : v;
+    }
+  }
+
+  uint16_t readLineBlack(uint16_t *values,
+                         QTRReadMode mode = QTRReadMode::On) {
+    readCalibrated(values);
+    uint32_t sum = 0, weight = 0;
+    for (uint8_t i = 0; i < count; i++) {
+      sum += (uint32_t)values[i] * 1000 * i;
+      weight += values[i];
+    }
+    return weight ? sum / weight : 0;
+  }
+};
+
+#endif
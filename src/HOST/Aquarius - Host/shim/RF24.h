@@ -0,0 +1,42 @@
+#ifndef __HOST_RF24__
+#define __HOST_RF24__
+
+// The part of RF24 the nodes use, an idle radio: nothing on the air, every
+// setting taken
+
+#include <Arduino.h>
+
+typedef enum { RF24_1MBPS = 0, RF24_2MBPS, RF24_250KBPS } rf24_datarate_e;
+typedef enum {
+  RF24_PA_MIN = 0,
+  RF24_PA_LOW,
+  RF24_PA_HIGH,
+  RF24_PA_MAX,
+  RF24_PA_ERROR
+} rf24_pa_dbm_e;
+
+class RF24 {
+private:
+  uint8_t channel;
+  rf24_datarate_e rate;
+
+public:
+  RF24(uint16_t ce, uint16_t csn) : channel(76), rate(RF24_1MBPS) {}
+  bool begin() { return true; }
+  void setChannel(uint8_t _channel) { channel = _channel; }
+  uint8_t getChannel() { return channel; }
+  bool setDataRate(rf24_datarate_e _rate) {
+    rate = _rate;
+    return true;
+  }
+  rf24_datarate_e getDataRate() { return rate; }
+  void setPALevel(uint8_t level, bool lna = true) {}
+  uint8_t getARC() { return 0; }
+  bool testRPD() { return false; }
+  void startListening() {}
+  void stopListening() {}
+  void powerDown() {}
+  void powerUp() {}
+};
+
+#endif
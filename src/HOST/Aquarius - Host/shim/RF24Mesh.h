@@ -0,0 +1,60 @@
+#ifndef __HOST_RF24MESH__
+#define __HOST_RF24MESH__
+
+// The part of RF24Mesh the nodes use, always connected. On the master the
+// tool linking it fills addrList with the nodes that joined.
+
+#include <RF24Network.h>
+
+struct addrListStruct {
+  uint8_t nodeID;
+  uint16_t address;
+};
+
+class RF24Mesh {
+private:
+  RF24Network &network;
+  uint8_t own_id;
+
+public:
+  addrListStruct *addrList;
+  uint8_t addrListTop;
+
+  RF24Mesh(RF24 &radio, RF24Network &_network)
+      : network(_network), own_id(0), addrList(NULL), addrListTop(0) {}
+  void setNodeID(uint8_t id) { own_id = id; }
+  bool begin(uint8_t channel = 97, rf24_datarate_e rate = RF24_1MBPS,
+             uint32_t timeout = 7500) {
+    return true;
+  }
+  uint8_t update() { return network.update(); }
+  void DHCP() {}
+  bool checkConnection() { return true; }
+  uint16_t renewAddress(uint32_t timeout = 7500) { return 0; }
+
+  int16_t getNodeID(uint16_t address = 0xFFFF) {
+    if (address == 0xFFFF || address == 0) {
+      return address == 0 ? 0 : own_id;
+    }
+    for (int n = 0; n < addrListTop; n++) {
+      if (addrList[n].address == address) {
+        return addrList[n].nodeID;
+      }
+    }
+    return -1;
+  }
+
+  int16_t getAddress(uint8_t id) {
+    if (id == 0) {
+      return 0;
+    }
+    for (int n = 0; n < addrListTop; n++) {
+      if (addrList[n].nodeID == id) {
+        return addrList[n].address;
+      }
+    }
+    return -1;
+  }
+};
+
+#endif
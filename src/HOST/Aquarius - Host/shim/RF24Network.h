@@ -0,0 +1,39 @@
+#ifndef __HOST_RF24NETWORK__
+#define __HOST_RF24NETWORK__
+
+// The part of RF24Network the nodes use. The tool linking it provides the
+// radio behind it, e.g. one scripted from a recorded trace.
+
+#include <RF24.h>
+
+struct RF24NetworkHeader {
+  uint16_t from_node;
+  uint16_t to_node;
+  uint16_t id;
+  unsigned char type;
+  unsigned char reserved;
+
+  RF24NetworkHeader() : from_node(0), to_node(0), id(0), type(0), reserved(0) {}
+  RF24NetworkHeader(uint16_t _to, unsigned char _type = 0)
+      : from_node(0), to_node(_to), id(0), type(_type), reserved(0) {}
+};
+
+#define FLAG_NO_POLL 8
+
+class RF24Network {
+public:
+  uint8_t networkFlags;
+
+  RF24Network() : networkFlags(0) {}
+  RF24Network(RF24 &radio) : networkFlags(0) {}
+
+  uint8_t update();
+  bool available();
+  uint16_t peek(RF24NetworkHeader &header);
+  uint16_t read(RF24NetworkHeader &header, void *message, uint16_t maxlen);
+  bool write(RF24NetworkHeader &header, const void *message, uint16_t len);
+  bool multicast(RF24NetworkHeader &header, const void *message, uint16_t len,
+                 uint8_t level);
+};
+
+#endif
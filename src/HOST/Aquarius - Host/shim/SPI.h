@@ -0,0 +1,11 @@
+#ifndef __HOST_SPI__
+#define __HOST_SPI__
+
+class SPIClass {
+public:
+  void begin() {}
+};
+
+extern SPIClass SPI;
+
+#endif
@@ -0,0 +1,126 @@
+#include <AquariusFixed.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLE_UNIT "cycles"
+static inline uint64_t now_cycles() { return __rdtsc(); }
+#else
+#define CYCLE_UNIT "ns"
+static inline uint64_t now_cycles() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+#endif
+
+#define ROUNDS 2000
+
+volatile uint32_t sink;
+
+/*******************************************************************************
+****************************** Reference Versions ******************************
+********************************************************************************/
+
+// What the nodes did before AquariusFixed, kept bit for bit
+
+static long map(long x, long in_min, long in_max, long out_min, long out_max) {
+  return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+__attribute__((noinline)) double ref_voltage(int adc) {
+  return (double)((double)map(adc, 0, 1023, 0, 2500) + 20) / 100.0;
+}
+
+__attribute__((noinline)) double ref_distance(uint16_t echo_us) {
+  return echo_us / 58.2;
+}
+
+__attribute__((noinline)) double ref_moisture(int adc) {
+  double h = (576.0 - adc) * 100.0 / 320.0;
+  return h < 0 ? 0 : h > 100 ? 100 : h;
+}
+
+/*******************************************************************************
+*********************************** Benchmark **********************************
+********************************************************************************/
+
+typedef struct {
+  const char *name;
+  double ref_cycles;
+  double fixed_cycles;
+  double max_error;
+  const char *unit;
+} result;
+
+template <typename F> double cycles_per_call(F f, int n) {
+  uint64_t start = now_cycles();
+  for (int r = 0; r < ROUNDS; r++)
+    for (int i = 0; i < n; i++)
+      f(i);
+  return (double)(now_cycles() - start) / ((double)ROUNDS * n);
+}
+
+result bench_voltage() {
+  result res = {"voltage", 0, 0, 0, "V"};
+  for (int adc = 0; adc < 1024; adc++) {
+    double err = fabs(ref_voltage(adc) - aq_voltage_mv(adc) / 1000.0);
+    if (err > res.max_error)
+      res.max_error = err;
+  }
+  res.ref_cycles =
+      cycles_per_call([](int i) { sink += (uint32_t)ref_voltage(i); }, 1024);
+  res.fixed_cycles =
+      cycles_per_call([](int i) { sink += aq_voltage_mv(i); }, 1024);
+  return res;
+}
+
+result bench_distance() {
+  result res = {"distance", 0, 0, 0, "mm"};
+  for (int us = 0; us < 1200; us++) {
+    double err = fabs(ref_distance(us) * 10.0 - aq_echo_to_mm(us));
+    if (err > res.max_error)
+      res.max_error = err;
+  }
+  res.ref_cycles =
+      cycles_per_call([](int i) { sink += (uint32_t)ref_distance(i); }, 1200);
+  res.fixed_cycles =
+      cycles_per_call([](int i) { sink += aq_echo_to_mm(i); }, 1200);
+  return res;
+}
+
+result bench_moisture() {
+  result res = {"moisture", 0, 0, 0, "%"};
+  for (int adc = 0; adc < 1024; adc++) {
+    double err = fabs(ref_moisture(adc) -
+                      aq_moisture_percent(AQ_MOISTURE_CURVE_Q8, adc));
+    if (err > res.max_error)
+      res.max_error = err;
+  }
+  res.ref_cycles =
+      cycles_per_call([](int i) { sink += (uint32_t)ref_moisture(i); }, 1024);
+  res.fixed_cycles = cycles_per_call(
+      [](int i) { sink += aq_moisture_percent(AQ_MOISTURE_CURVE_Q8, i); },
+      1024);
+  return res;
+}
+
+int main() {
+  result results[] = {bench_voltage(), bench_distance(), bench_moisture()};
+
+  printf("%-10s %14s %14s %8s %12s\n", "conversion", "double " CYCLE_UNIT,
+         "fixed " CYCLE_UNIT, "speedup", "max error");
+  for (unsigned i = 0; i < sizeof(results) / sizeof(results[0]); i++) {
+    result r = results[i];
+    printf("%-10s %14.2f %14.2f %7.2fx %9.3f %s\n", r.name, r.ref_cycles,
+           r.fixed_cycles, r.ref_cycles / r.fixed_cycles, r.max_error, r.unit);
+  }
+
+  // Host FPUs hide most of the gap; on the ATmega2560 every double operation
+  // above is a soft-float library call
+  return 0;
+}
@@ -0,0 +1,3 @@
+// The car's firmware, unmodified. The shims stand in for its hardware and
+// hal.cpp drives them from the model.
+#include "../../../../CAR/Aquarius - CAR/src/main.cpp"
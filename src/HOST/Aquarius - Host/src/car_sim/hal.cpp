@@ -0,0 +1,367 @@
+#include <AFMotor.h>
+#include <Arduino.h>
+#include <QTRSensors.h>
+#include <RF24Network.h>
+#include <SPI.h>
+#include <math.h>
+
+#include "sim.h"
+
+// Everything the shims ask for, driven by one model of the car on the track.
+// Time only moves when the firmware waits or reads a sensor; the model then
+// advances in 1 ms steps.
+
+HardwareSerial Serial;
+SPIClass SPI;
+
+/*******************************************************************************
+************************************ Model *************************************
+********************************************************************************/
+
+static struct {
+  uint64_t clock_us;
+  uint64_t stepped_us;
+
+  // Pose of the middle of the axle, mm and radians
+  double x, y, heading;
+  double travelled_s; // sensor row along the line, counted over laps
+  double last_s;
+
+  // Per motor port
+  uint8_t command[5];
+  uint8_t speed[5];
+  double wheel[5];
+
+  // Stepper coils and the arm they drive
+  bool coil[4];
+  int last_coil;
+  int arm;
+  int arm_home;
+  bool arm_out;
+  bool arm_reached;
+  uint64_t arm_stepped_at;
+  uint64_t arm_moved_at;
+  uint64_t arm_reached_at;
+  uint64_t arm_us;
+  sim_watering watering;
+
+  // Pump, on while its pin is low
+  bool pump_on;
+  uint64_t pump_on_at;
+  uint64_t pump_us;
+
+  bool patrolling;
+  uint64_t patrol_started_us;
+  double max_offset;
+  std::vector<sim_watering> waterings;
+
+  double noise;
+  uint32_t seed;
+  uint16_t raw[SIM_SENSORS];
+
+  bool log;
+} sim;
+
+void sim_log(bool enabled) { sim.log = enabled; }
+
+unsigned long sim_now_ms() { return sim.clock_us / 1000; }
+
+static double speed_of(uint8_t port) {
+  double v = sim.speed[port] * SIM_TOP_SPEED_MM_S / 255;
+  switch (sim.command[port]) {
+  case FORWARD:
+    return v;
+  case BACKWARD:
+    return -v;
+  default:
+    return 0;
+  }
+}
+
+static void sensor_position(int sensor, double *x, double *y) {
+  double left = (SIM_SENSORS / 2 - sensor) * SIM_SENSOR_PITCH_MM;
+  *x = sim.x + cos(sim.heading) * SIM_SENSOR_AHEAD_MM - sin(sim.heading) * left;
+  *y = sim.y + sin(sim.heading) * SIM_SENSOR_AHEAD_MM + cos(sim.heading) * left;
+}
+
+static double car_speed() {
+  double left = (sim.wheel[SIM_PORT_FL] + sim.wheel[SIM_PORT_BL]) / 2;
+  double right = (sim.wheel[SIM_PORT_FR] + sim.wheel[SIM_PORT_BR]) / 2;
+  return (left + right) / 2;
+}
+
+/**
+ * This function is responsible for one millisecond of driving: each wheel
+ * follows its motor with a lag, the skid steer turns by part of the speed
+ * difference between its sides.
+ */
+static void step_1ms() {
+  const double dt = 0.001;
+  for (int port = 1; port <= 4; port++) {
+    sim.wheel[port] +=
+        (speed_of(port) - sim.wheel[port]) * (1.0 / SIM_MOTOR_TAU_MS);
+  }
+  double left = (sim.wheel[SIM_PORT_FL] + sim.wheel[SIM_PORT_BL]) / 2;
+  double right = (sim.wheel[SIM_PORT_FR] + sim.wheel[SIM_PORT_BR]) / 2;
+  double v = (left + right) / 2;
+  double w = SIM_SKID * (right - left) / SIM_TRACK_WIDTH_MM;
+
+  sim.x += v * cos(sim.heading) * dt;
+  sim.y += v * sin(sim.heading) * dt;
+  sim.heading += w * dt;
+
+  double x, y;
+  sensor_position(SIM_SENSORS / 2, &x, &y);
+  track_point p = track_locate(x, y);
+  double ds = p.s - sim.last_s;
+  if (ds < -track_length() / 2) {
+    ds += track_length();
+  } else if (ds > track_length() / 2) {
+    ds -= track_length();
+  }
+  sim.travelled_s += ds;
+  sim.last_s = p.s;
+
+  if (!sim.patrolling) {
+    return;
+  }
+  if (fabs(p.offset) > sim.max_offset) {
+    sim.max_offset = fabs(p.offset);
+  }
+  if (fabs(p.offset) > SIM_LOST_MM) {
+    throw sim_failure("lost the line");
+  }
+  if (sim.clock_us - sim.patrol_started_us > SIM_PATROL_LIMIT_MS * 1000ULL) {
+    throw sim_failure("patrol never ended");
+  }
+}
+
+static void advance_us(uint64_t us) {
+  sim.clock_us += us;
+  while (sim.stepped_us + 1000 <= sim.clock_us) {
+    sim.stepped_us += 1000;
+    step_1ms();
+  }
+}
+
+void sim_reset(double noise) {
+  bool log = sim.log;
+  uint64_t clock_us = sim.clock_us;
+  sim = {};
+  sim.log = log;
+  sim.clock_us = sim.stepped_us = clock_us;
+  sim.noise = noise;
+  sim.seed = 12345;
+  sim.last_coil = -1;
+
+  // Sensor row just past the dock marker, on the line
+  double x, y, heading;
+  track_pose(SIM_DOCK_MM + SIM_MARKER_MM * 2 - SIM_SENSOR_AHEAD_MM, &x, &y,
+             &heading);
+  sim.x = x;
+  sim.y = y;
+  sim.heading = heading;
+  sim.last_s = SIM_DOCK_MM + SIM_MARKER_MM * 2;
+  sim.travelled_s = sim.last_s;
+}
+
+void sim_begin_patrol() {
+  sim.patrolling = true;
+  sim.patrol_started_us = sim.clock_us;
+}
+
+sim_result sim_end_patrol() {
+  sim.patrolling = false;
+  sim_result result;
+  result.lap_ms = (sim.clock_us - sim.patrol_started_us) / 1000;
+  result.arm_ms = sim.arm_us / 1000;
+  result.pump_ms = sim.pump_us / 1000;
+  result.end_s = sim.travelled_s;
+  result.max_offset_mm = sim.max_offset;
+  result.arm_drift = sim.arm;
+  result.waterings = sim.waterings;
+  return result;
+}
+
+/*******************************************************************************
+************************************ Clock *************************************
+********************************************************************************/
+
+unsigned long millis() { return sim.clock_us / 1000; }
+
+unsigned long micros() { return sim.clock_us; }
+
+void delay(unsigned long ms) { advance_us(ms * 1000ULL); }
+
+void delayMicroseconds(unsigned int us) { advance_us(us); }
+
+/*******************************************************************************
+************************************* Pins *************************************
+********************************************************************************/
+
+/**
+ * This function is responsible for following the arm through one step. A
+ * swing starts with the first step after a rest, from where the arm rested,
+ * and ends when it is back within SIM_ARM_SLACK of it. A stepper that loses
+ * or gains steps on the way shows as drift.
+ */
+static void step_arm(int delta) {
+  uint64_t now = sim.clock_us;
+  if (!sim.arm_out && now - sim.arm_stepped_at > SIM_ARM_REST_MS * 1000ULL) {
+    sim.arm_home = sim.arm;
+    sim.arm_moved_at = now;
+  }
+  sim.arm += delta;
+  sim.arm_stepped_at = now;
+
+  int reach = abs(sim.arm - sim.arm_home);
+  if (!sim.arm_out && reach > SIM_ARM_SLACK) {
+    sim.arm_out = true;
+    sim.watering = sim_watering();
+  }
+  if (sim.arm_out && !sim.arm_reached &&
+      reach >= SIM_ARM_STEPS - SIM_ARM_SLACK) {
+    sim.arm_reached = true;
+    sim.arm_reached_at = now;
+    sim.watering.left = sim.arm < sim.arm_home;
+    sim.watering.s = sim.travelled_s;
+    sim.watering.speed = fabs(car_speed());
+    sim.watering.reach_ms = (now - sim.arm_moved_at) / 1000;
+  }
+  if (sim.arm_reached && reach < SIM_ARM_STEPS - SIM_ARM_SLACK &&
+      sim.watering.dose_ms == 0) {
+    sim.watering.dose_ms = (now - sim.arm_reached_at) / 1000;
+  }
+  if (sim.arm_out && reach <= SIM_ARM_SLACK) {
+    if (sim.arm_reached) {
+      sim.waterings.push_back(sim.watering);
+    }
+    sim.arm_us += now - sim.arm_moved_at;
+    sim.arm_out = false;
+    sim.arm_reached = false;
+  }
+}
+
+/**
+ * This function is responsible for turning the coils into steps: a coil
+ * energised next to the last one is a step towards it.
+ */
+static void update_coils() {
+  int on = -1;
+  for (int i = 0; i < 4; i++) {
+    if (sim.coil[i]) {
+      if (on >= 0) {
+        return;
+      }
+      on = i;
+    }
+  }
+  if (on < 0 || on == sim.last_coil) {
+    return;
+  }
+  int delta = sim.last_coil < 0 ? 0 : (on - sim.last_coil + 4) % 4;
+  sim.last_coil = on;
+  if (delta == 1) {
+    step_arm(1);
+  } else if (delta == 3) {
+    step_arm(-1);
+  }
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin >= SIM_STEPPER_PIN && pin < SIM_STEPPER_PIN + 4) {
+    sim.coil[pin - SIM_STEPPER_PIN] = value == HIGH;
+    update_coils();
+  }
+  if (pin == SIM_PUMP_PIN) {
+    bool on = value == LOW;
+    if (on && !sim.pump_on) {
+      sim.pump_on_at = sim.clock_us;
+    } else if (!on && sim.pump_on) {
+      uint64_t us = sim.clock_us - sim.pump_on_at;
+      sim.pump_us += us;
+      if (sim.arm_reached) {
+        sim.watering.pump_ms += us / 1000;
+      }
+    }
+    sim.pump_on = on;
+  }
+}
+
+int digitalRead(uint8_t pin) { return LOW; }
+
+// A full battery
+int analogRead(uint8_t pin) { return 900; }
+
+// No echo, the tank level is not modelled
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout) {
+  advance_us(timeout);
+  return 0;
+}
+
+/*******************************************************************************
+*********************************** Devices ************************************
+********************************************************************************/
+
+void host_motor(uint8_t port, uint8_t command, int speed) {
+  if (port < 1 || port > 4) {
+    return;
+  }
+  if (command) {
+    sim.command[port] = command;
+  }
+  if (speed >= 0) {
+    sim.speed[port] = speed;
+  }
+}
+
+static double next_noise() {
+  sim.seed = sim.seed * 1103515245 + 12345;
+  return ((sim.seed >> 16) & 0x7FFF) / 32767.0 - 0.5;
+}
+
+/**
+ * This function is responsible for a raw QTR reading. The whole row is read at
+ * once when sensor 0 is asked for, which takes as long as the slowest
+ * sensor's RC time. A module switches at half coverage, noise moves that
+ * point.
+ */
+uint16_t host_qtr_read(uint8_t sensor) {
+  if (sensor == 0) {
+    uint16_t slowest = 0;
+    for (int i = 0; i < SIM_SENSORS; i++) {
+      double x, y;
+      sensor_position(i, &x, &y);
+      double black = track_coverage(x, y) + sim.noise * next_noise();
+      sim.raw[i] = black > 0.5 ? SIM_RAW_BLACK : SIM_RAW_WHITE;
+      slowest = sim.raw[i] > slowest ? sim.raw[i] : slowest;
+    }
+    advance_us(slowest + SIM_QTR_OVERHEAD_US);
+  }
+  return sensor < SIM_SENSORS ? sim.raw[sensor] : SIM_RAW_WHITE;
+}
+
+void host_serial_write(const char *text) {
+  if (sim.log) {
+    fprintf(stderr, "%s", text);
+  }
+}
+
+// The radio is idle: nothing comes in, everything sent is acknowledged
+uint8_t RF24Network::update() { return 0; }
+
+bool RF24Network::available() { return false; }
+
+uint16_t RF24Network::peek(RF24NetworkHeader &header) { return 0; }
+
+uint16_t RF24Network::read(RF24NetworkHeader &header, void *message,
+                           uint16_t maxlen) {
+  return 0;
+}
+
+bool RF24Network::write(RF24NetworkHeader &header, const void *message,
+                        uint16_t len) {
+  return true;
+}
@@ -0,0 +1,204 @@
+#include <Aquarius.h>
+#include <AquariusRecord.h>
+#include <AquariusRoute.h>
+#include <QtrCalibration.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "sim.h"
+
+// Drives the car's own patrol() around a simulated track for a set of
+// watering plans and reports, per plan, the lap time, the time the arm was
+// out, the pump time and every planned stop the car did not water.
+//
+// Usage: car_sim [-v] [-n noise] [-r random_plans]
+//   -v  print the car's Serial output
+//   -n  sensor noise, as a fraction of a spot, e.g. 0.3
+//   -r  how many random plans to add, seeded the same every run
+//
+// Exits with 1 if any plan lost the line, did not end on the dock or missed a
+// stop, so it can gate a CI run.
+
+// From the car's firmware
+extern bool needs_water[POTS];
+void setup();
+void patrol();
+
+#define SIM_RANDOM_SEED 2024
+
+typedef struct {
+  const char *name;
+  bool pots[POTS];
+} plan;
+
+/**
+ * This function is responsible for seeding the car's EEPROM with the record
+ * an ideal sweep would give, so setup() loads it instead of sweeping.
+ */
+static void seed_calibration() {
+  qtr_record record;
+  memset(&record, 0, sizeof(record));
+  record.count = SIM_SENSORS;
+  for (int i = 0; i < SIM_SENSORS; i++) {
+    record.minimum[i] = SIM_RAW_BLACK;
+    record.maximum[i] = SIM_RAW_WHITE;
+  }
+  aq_record_store(QTR_CALIBRATION_ADDRESS, QTR_CALIBRATION_MAGIC,
+                  QTR_CALIBRATION_VERSION, &record, sizeof(record));
+}
+
+static std::vector<plan> build_plans(int random_plans) {
+  std::vector<plan> plans;
+  plan p;
+
+  p.name = "none";
+  memset(p.pots, 0, sizeof(p.pots));
+  plans.push_back(p);
+
+  p.name = "all";
+  for (int i = 0; i < POTS; i++) {
+    p.pots[i] = true;
+  }
+  plans.push_back(p);
+
+  p.name = "even";
+  for (int i = 0; i < POTS; i++) {
+    p.pots[i] = i % 2 == 0;
+  }
+  plans.push_back(p);
+
+  p.name = "first";
+  for (int i = 0; i < POTS; i++) {
+    p.pots[i] = i < POTS_PER_HARVESTER;
+  }
+  plans.push_back(p);
+
+  p.name = "last";
+  memset(p.pots, 0, sizeof(p.pots));
+  p.pots[POTS - 1] = true;
+  plans.push_back(p);
+
+  uint32_t seed = SIM_RANDOM_SEED;
+  for (int r = 0; r < random_plans; r++) {
+    p.name = "random";
+    for (int i = 0; i < POTS; i++) {
+      seed = seed * 1103515245 + 12345;
+      p.pots[i] = (seed >> 16) % 3 == 0;
+    }
+    plans.push_back(p);
+  }
+  return plans;
+}
+
+/**
+ * This function is responsible for matching the swings to the plan: each one
+ * is credited to the closest marker it is within SIM_STOP_TOLERANCE_MM of.
+ * Returns the planned stops left unwatered; wrong counts swings where there
+ * was nothing to water.
+ */
+static int missed_stops(const bool *pots, const sim_result &result,
+                        int *wrong, double *worst_mm) {
+  uint8_t done[ROUTE_STOPS] = {0};
+  double lap = track_length();
+  *wrong = 0;
+  *worst_mm = 0;
+
+  for (size_t i = 0; i < result.waterings.size(); i++) {
+    const sim_watering &w = result.waterings[i];
+    double s = fmod(w.s, lap);
+    int stop = -1;
+    double best = SIM_STOP_TOLERANCE_MM;
+    for (int m = 0; m < ROUTE_STOPS; m++) {
+      double d = fabs(s - track_marker(m));
+      if (d < best) {
+        best = d;
+        stop = m;
+      }
+    }
+    uint8_t side = w.left ? ROUTE_LEFT : ROUTE_RIGHT;
+    if (stop < 0 || !(route_work(pots, stop) & side)) {
+      (*wrong)++;
+      continue;
+    }
+    done[stop] |= side;
+    *worst_mm = best > *worst_mm ? best : *worst_mm;
+  }
+
+  int missed = 0;
+  for (int m = 0; m < ROUTE_STOPS; m++) {
+    uint8_t work = route_work(pots, m);
+    for (uint8_t side = ROUTE_LEFT; side <= ROUTE_RIGHT; side <<= 1) {
+      if ((work & side) && !(done[m] & side)) {
+        missed++;
+      }
+    }
+  }
+  return missed;
+}
+
+int main(int argc, char **argv) {
+  bool verbose = false;
+  double noise = 0;
+  int random_plans = 5;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-v") == 0) {
+      verbose = true;
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      noise = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      random_plans = atoi(argv[++i]);
+    }
+  }
+
+  sim_log(verbose);
+  seed_calibration();
+  sim_reset(noise);
+  setup();
+
+  std::vector<plan> plans = build_plans(random_plans);
+  printf("%-7s %5s %9s %8s %8s %7s %6s %6s %8s %6s  %s\n", "plan", "pots",
+         "lap ms", "arm ms", "pump ms", "swings", "missed", "wrong",
+         "stop mm", "drift", "result");
+
+  int failed = 0;
+  for (size_t i = 0; i < plans.size(); i++) {
+    const plan &p = plans[i];
+    memcpy(needs_water, p.pots, sizeof(needs_water));
+    sim_reset(noise);
+
+    std::string outcome = "ok";
+    sim_begin_patrol();
+    try {
+      patrol();
+    } catch (const sim_failure &e) {
+      outcome = e.what();
+    }
+    sim_result result = sim_end_patrol();
+
+    int wrong;
+    double worst_mm;
+    int missed = missed_stops(p.pots, result, &wrong, &worst_mm);
+    double dock = track_length() + track_marker(ROUTE_DOCK);
+    if (outcome == "ok") {
+      if (fabs(result.end_s - dock) > SIM_STOP_TOLERANCE_MM) {
+        outcome = "did not end on the dock";
+      } else if (missed || wrong) {
+        outcome = "stops missed";
+      }
+    }
+    if (outcome != "ok") {
+      failed++;
+    }
+
+    printf("%-7s %5d %9lu %8lu %8lu %7zu %6d %6d %8.1f %6d  %s\n", p.name,
+           route_dry_pots(p.pots), result.lap_ms, result.arm_ms,
+           result.pump_ms, result.waterings.size(), missed, wrong, worst_mm,
+           result.arm_drift, outcome.c_str());
+  }
+
+  printf("\n%zu plans, %d failed\n", plans.size(), failed);
+  return failed ? 1 : 0;
+}
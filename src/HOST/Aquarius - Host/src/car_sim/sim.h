@@ -0,0 +1,96 @@
+#ifndef __CAR_SIM__
+#define __CAR_SIM__
+
+#include <stdint.h>
+
+#include <stdexcept>
+#include <vector>
+
+// Track: a stadium, two straights joined by half circles, with the line down
+// its middle. s is the distance along the line from the start of the first
+// straight. The dock marker is at its start, stops 0 to 5 along it and stops
+// 6 to 11 along the second straight.
+#define SIM_STRAIGHT_MM 2000.0
+#define SIM_RADIUS_MM 400.0
+#define SIM_LINE_MM 19.0
+#define SIM_MARKER_MM 25.0
+#define SIM_MARKER_WIDTH_MM 120.0
+#define SIM_DOCK_MM 100.0
+#define SIM_FIRST_STOP_MM 400.0
+#define SIM_STOP_SPACING_MM 300.0
+
+// Car: skid steered, four wheels, QTR row ahead of the axle, sensor 0 on the
+// left. The motor ports are the ones the car is wired to.
+#define SIM_PORT_FL 3
+#define SIM_PORT_FR 2
+#define SIM_PORT_BL 4
+#define SIM_PORT_BR 1
+#define SIM_TRACK_WIDTH_MM 150.0
+#define SIM_SKID 0.35
+#define SIM_TOP_SPEED_MM_S 600.0
+#define SIM_MOTOR_TAU_MS 40.0
+#define SIM_SENSORS 5
+#define SIM_SENSOR_AHEAD_MM 90.0
+#define SIM_SENSOR_PITCH_MM 15.0
+#define SIM_SENSOR_SPOT_MM 4.0
+
+// The TCRT5000 modules pull the RC line low over black, so black reads as a
+// short RC time and white times out
+#define SIM_RAW_BLACK 40
+#define SIM_RAW_WHITE 2500
+#define SIM_QTR_OVERHEAD_US 50
+
+// Arm stepper, pump and their pins
+#define SIM_STEPPER_PIN 36
+#define SIM_ARM_STEPS 512
+#define SIM_ARM_SLACK 16
+#define SIM_ARM_REST_MS 100
+#define SIM_PUMP_PIN 34
+
+// A run fails past these
+#define SIM_LOST_MM 100.0
+#define SIM_STOP_TOLERANCE_MM 60.0
+#define SIM_PATROL_LIMIT_MS 600000UL
+
+typedef struct {
+  double s;      // along the line, 0 to track_length()
+  double offset; // from the line, positive to the left
+} track_point;
+
+double track_length();
+track_point track_locate(double x, double y);
+void track_pose(double s, double *x, double *y, double *heading);
+double track_marker(int marker);
+double track_coverage(double x, double y);
+
+// One arm swing, out and back
+typedef struct {
+  bool left;
+  double s;        // where the sensor row was when the arm got out
+  double speed;    // how fast the car still moved then, mm/s
+  unsigned long reach_ms; // from the first step to full reach
+  unsigned long dose_ms;  // held out
+  unsigned long pump_ms;  // pump on meanwhile
+} sim_watering;
+
+typedef struct {
+  unsigned long lap_ms;
+  unsigned long arm_ms;
+  unsigned long pump_ms;
+  double end_s;
+  double max_offset_mm;
+  int arm_drift;
+  std::vector<sim_watering> waterings;
+} sim_result;
+
+struct sim_failure : std::runtime_error {
+  sim_failure(const char *what) : std::runtime_error(what) {}
+};
+
+void sim_reset(double noise);
+void sim_begin_patrol();
+sim_result sim_end_patrol();
+void sim_log(bool enabled);
+unsigned long sim_now_ms();
+
+#endif
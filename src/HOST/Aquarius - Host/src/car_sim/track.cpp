@@ -0,0 +1,124 @@
+#include <AquariusRoute.h>
+#include <math.h>
+
+#include "sim.h"
+
+// Pieces of the stadium, in order along s: first straight heading +x along
+// y = -R, right half circle around (L, 0), second straight heading -x along
+// y = R, left half circle around (0, 0)
+#define L SIM_STRAIGHT_MM
+#define R SIM_RADIUS_MM
+#define ARC (M_PI * SIM_RADIUS_MM)
+
+double track_length() { return 2 * L + 2 * ARC; }
+
+/**
+ * This function is responsible for the position and heading of the line at s.
+ */
+void track_pose(double s, double *x, double *y, double *heading) {
+  s = fmod(s, track_length());
+  if (s < 0) {
+    s += track_length();
+  }
+
+  if (s < L) {
+    *x = s;
+    *y = -R;
+    *heading = 0;
+  } else if (s < L + ARC) {
+    double a = -M_PI / 2 + (s - L) / R;
+    *x = L + R * cos(a);
+    *y = R * sin(a);
+    *heading = a + M_PI / 2;
+  } else if (s < 2 * L + ARC) {
+    *x = L - (s - L - ARC);
+    *y = R;
+    *heading = M_PI;
+  } else {
+    double a = M_PI / 2 + (s - 2 * L - ARC) / R;
+    *x = R * cos(a);
+    *y = R * sin(a);
+    *heading = a + M_PI / 2;
+  }
+}
+
+/**
+ * This function is responsible for the closest point of the line: how far
+ * along it and how far to its left.
+ */
+track_point track_locate(double x, double y) {
+  track_point best = {0, 1e9};
+  double candidates[4][2];
+
+  // Straights
+  double cx = x < 0 ? 0 : x > L ? L : x;
+  candidates[0][0] = cx;
+  candidates[0][1] = y + R; // left of +x is +y
+  candidates[1][0] = 2 * L + ARC - cx;
+  candidates[1][1] = R - y;
+  if (x != cx) {
+    candidates[0][1] = candidates[1][1] = 1e9;
+  }
+
+  // Half circles, the left of the line is their inside
+  double a = atan2(y, x - L);
+  double d = hypot(x - L, y);
+  candidates[2][0] = L + (a + M_PI / 2) * R;
+  candidates[2][1] = R - d;
+  if (x < L) {
+    candidates[2][1] = 1e9;
+  }
+  a = atan2(y, x);
+  if (a < -M_PI / 2) {
+    a += 2 * M_PI;
+  }
+  d = hypot(x, y);
+  candidates[3][0] = 2 * L + ARC + (a - M_PI / 2) * R;
+  candidates[3][1] = R - d;
+  if (x > 0) {
+    candidates[3][1] = 1e9;
+  }
+
+  for (int i = 0; i < 4; i++) {
+    if (fabs(candidates[i][1]) < fabs(best.offset)) {
+      best.s = candidates[i][0];
+      best.offset = candidates[i][1];
+    }
+  }
+  return best;
+}
+
+/**
+ * This function is responsible for where a marker is along s. Marker
+ * ROUTE_DOCK is the dock.
+ */
+double track_marker(int marker) {
+  if (marker >= ROUTE_DOCK) {
+    return SIM_DOCK_MM;
+  }
+  int half = ROUTE_STOPS / 2;
+  double base = marker < half ? 0 : L + ARC;
+  return base + SIM_FIRST_STOP_MM + (marker % half) * SIM_STOP_SPACING_MM;
+}
+
+static double band(double distance, double half_width) {
+  double c = (half_width - distance) / SIM_SENSOR_SPOT_MM + 0.5;
+  return c < 0 ? 0 : c > 1 ? 1 : c;
+}
+
+/**
+ * This function is responsible for how much of a sensor's spot is black: the
+ * line, or a marker across it.
+ */
+double track_coverage(double x, double y) {
+  track_point p = track_locate(x, y);
+  double black = band(fabs(p.offset), SIM_LINE_MM / 2);
+
+  double across = band(fabs(p.offset), SIM_MARKER_WIDTH_MM / 2);
+  for (int m = 0; m <= ROUTE_DOCK && across > 0; m++) {
+    double along = fabs(p.s - track_marker(m));
+    double c = across * band(along, SIM_MARKER_MM / 2);
+    black = c > black ? c : black;
+  }
+  return black;
+}
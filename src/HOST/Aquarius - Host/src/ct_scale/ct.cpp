@@ -0,0 +1,37 @@
+// The CT's firmware, unmodified, and what the harness reads out of it. The
+// shims stand in for its hardware and hal.cpp and radio.cpp drive them.
+#include "../../../../CT/Aquarius - CT/src/main.cpp"
+
+#include "sim.h"
+
+int ct_answered() {
+  int count = 0;
+  for (int i = 0; i < MAX_HARVESTERS; i++) {
+    count += harvested[i] ? 1 : 0;
+  }
+  return count;
+}
+
+uint16_t ct_bulk_dropped() { return anc.getBulkDropped(); }
+
+// As laid out on the Mega, where unsigned long is 4 bytes: elements per
+// harvester times their size
+#define AVR_BYTES(a)                                                           \
+  (sizeof(a) / sizeof((a)[0]) / MAX_HARVESTERS *                               \
+   (sizeof((a)[0]) > 4 ? 4 : sizeof((a)[0])))
+
+/**
+ * This function is responsible for the RAM the CT sets aside per harvester:
+ * every array sized by MAX_HARVESTERS, or by MESH_IDS and LINK_NODES which
+ * grow with it, and the entry RF24Mesh adds to addrList on the heap.
+ */
+unsigned ct_bytes_per_harvester() {
+  return AVR_BYTES(pot_data) + AVR_BYTES(harvester_order) +
+         AVR_BYTES(harvester_address) + AVR_BYTES(requested) +
+         AVR_BYTES(requested_at) + AVR_BYTES(harvested) +
+         AVR_BYTES(time_sent_at) + AVR_BYTES(time_sent) +
+         AVR_BYTES(history_seq) + AVR_BYTES(checkpoint.state.history_seq) +
+         AVR_BYTES(pot_time) + AVR_BYTES(node_protocol) +
+         AVR_BYTES(link_told) + AVR_BYTES(link_confirmed) +
+         SIM_ADDR_LIST_ENTRY;
+}
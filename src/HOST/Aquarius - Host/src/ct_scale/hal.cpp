@@ -0,0 +1,144 @@
+#include <Arduino.h>
+#include <Ethernet.h>
+#include <EthernetUdp.h>
+#include <SPI.h>
+
+#include "sim.h"
+
+// The CT's board on a virtual clock: it moves when the firmware asks for the
+// time, waits, or blocks on Serial or Ethernet. The radio is in radio.cpp.
+
+HardwareSerial Serial;
+SPIClass SPI;
+EthernetClass Ethernet;
+
+static struct {
+  uint64_t clock_us;
+  uint64_t serial_drained_at; // when what is in Serial's buffer is out
+  uint64_t ntp_answer_at;
+  bool verbose;
+} hal;
+
+void sim_reset_clock(bool verbose) {
+  hal = {};
+  hal.verbose = verbose;
+}
+
+uint64_t sim_now_us() { return hal.clock_us; }
+
+void sim_advance_us(uint64_t us) { hal.clock_us += us; }
+
+/*******************************************************************************
+************************************ Clock *************************************
+********************************************************************************/
+
+unsigned long millis() {
+  hal.clock_us += SIM_MILLIS_US;
+  return hal.clock_us / 1000;
+}
+
+unsigned long micros() {
+  hal.clock_us += SIM_MILLIS_US;
+  return hal.clock_us;
+}
+
+void delay(unsigned long ms) { hal.clock_us += ms * 1000ULL; }
+
+void delayMicroseconds(unsigned int us) { hal.clock_us += us; }
+
+/*******************************************************************************
+************************************* Pins *************************************
+********************************************************************************/
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t value) {}
+
+int digitalRead(uint8_t pin) { return LOW; }
+
+int analogRead(uint8_t pin) { return 0; }
+
+void analogWrite(uint8_t pin, int value) {}
+
+unsigned long pulseIn(uint8_t pin, uint8_t state, unsigned long timeout) {
+  hal.clock_us += timeout;
+  return 0;
+}
+
+/**
+ * This function is responsible for Serial at 9600 baud: a print only returns
+ * once what does not fit the buffer any more went out.
+ */
+void host_serial_write(const char *text) {
+  for (const char *c = text; *c; c++) {
+    uint64_t start = hal.serial_drained_at > hal.clock_us
+                         ? hal.serial_drained_at
+                         : hal.clock_us;
+    hal.serial_drained_at = start + SIM_SERIAL_BYTE_US;
+    uint64_t full = SIM_SERIAL_BUFFER * (uint64_t)SIM_SERIAL_BYTE_US;
+    if (hal.serial_drained_at - hal.clock_us > full) {
+      hal.clock_us = hal.serial_drained_at - full;
+    }
+  }
+  if (hal.verbose) {
+    fprintf(stderr, "%s", text);
+  }
+}
+
+/*******************************************************************************
+*********************************** Ethernet ***********************************
+********************************************************************************/
+
+// The database takes every form; nothing is read back
+int EthernetClient::connect(const char *host, uint16_t port) {
+  hal.clock_us += SIM_ETHERNET_CONNECT_US;
+  return 1;
+}
+
+uint8_t EthernetClient::connected() { return 0; }
+
+int EthernetClient::available() { return 0; }
+
+int EthernetClient::read() { return -1; }
+
+void EthernetClient::stop() {}
+
+size_t EthernetClient::write(const uint8_t *buffer, size_t size) {
+  hal.clock_us += SIM_ETHERNET_WRITE_US + size * SIM_ETHERNET_BYTE_US;
+  return size;
+}
+
+int EthernetClass::begin(uint8_t *mac, unsigned long timeout,
+                         unsigned long responseTimeout) {
+  return 1;
+}
+
+// An SNTP server SIM_NTP_US away, whose clock started at SIM_EPOCH
+uint8_t EthernetUDP::begin(uint16_t port) { return 1; }
+
+int EthernetUDP::beginPacket(const char *host, uint16_t port) { return 1; }
+
+size_t EthernetUDP::write(const uint8_t *buffer, size_t size) { return size; }
+
+int EthernetUDP::endPacket() {
+  hal.ntp_answer_at = hal.clock_us + SIM_NTP_US;
+  return 1;
+}
+
+int EthernetUDP::parsePacket() {
+  return hal.ntp_answer_at && hal.clock_us >= hal.ntp_answer_at ? 48 : 0;
+}
+
+int EthernetUDP::read(unsigned char *buffer, size_t size) {
+  uint8_t packet[48];
+  memset(packet, 0, sizeof(packet));
+  uint32_t seconds = SIM_EPOCH + 2208988800UL + hal.clock_us / 1000000;
+  for (int i = 0; i < 4; i++) {
+    packet[40 + i] = seconds >> (24 - 8 * i);
+  }
+  hal.ntp_answer_at = 0;
+  memcpy(buffer, packet, size < sizeof(packet) ? size : sizeof(packet));
+  return size < sizeof(packet) ? size : sizeof(packet);
+}
+
+void EthernetUDP::stop() {}
@@ -0,0 +1,278 @@
+#include <AquariusProtocol.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "sim.h"
+
+// Runs the CT's own phases against a simulated mesh of N harvesters and one
+// car, for every N of a sweep, and reports how phase one and the rest of the
+// cycle scale: time, harvesters answered, what was lost on the way and the
+// RAM the CT sets aside for that many harvesters. The CT is built once with
+// MAX_HARVESTERS as large as node IDs allow; each N runs in a process of its
+// own so it starts from a fresh CT.
+//
+// The first cycle also says hello to every node and surveys and switches the
+// link, so it is reported apart from the steady cycles after it.
+//
+// Usage: ct_scale [-v] [-n list] [-c cycles] [-r hop_us] [-l loss_percent]
+//                 [-g gate] [-o file.csv]
+//   -v  print the CT's Serial output
+//   -n  harvester counts, comma separated
+//   -c  cycles per count, the first included
+//   -r  forwarding delay per hop, on top of the airtime
+//   -l  packets lost per hop, after the radio's retries
+//   -g  counts up to this one must have every harvester answer in every
+//       steady cycle, and every phase succeed
+//   -o  also write the rows as CSV
+//
+// Exits with 1 if a count up to the gate did not, so it can gate a CI run
+// after a change to the CT. Run the gate without -l.
+
+#define SCALE_COUNTS "2,4,8,16,32,64,128,239,500"
+#define SCALE_CYCLES 3
+#define SCALE_HOP_US 2000
+#define SCALE_GATE 32
+#define SCALE_CHART_WIDTH 32
+
+typedef struct {
+  int harvesters;
+  bool addressable;
+  bool crashed;
+  int depth;
+  unsigned long first_ms;  // phase one of the first cycle
+  unsigned long steady_ms; // median phase one after it
+  unsigned long persist_ms;
+  unsigned long dispatch_ms; // phases three and four
+  int answered;              // over the steady cycles
+  int asked;
+  int phases_failed;
+  unsigned ram_bytes;
+  uint16_t bulk_dropped;
+  sim_stats stats;
+} scale_row;
+
+static unsigned long elapsed_ms(uint64_t since) {
+  return (sim_now_us() - since) / 1000;
+}
+
+/**
+ * This function is responsible for one count: the CT's setup and its cycles,
+ * phase by phase as loop() runs them, in the process the row is for.
+ */
+static void run_count(const sim_options &options, int cycles,
+                      scale_row *row) {
+  sim_reset_clock(options.verbose);
+  sim_reset_mesh(options);
+  setup();
+
+  std::vector<unsigned long> steady, persist, dispatch;
+  for (int c = 0; c < cycles; c++) {
+    uint64_t started = sim_now_us();
+    row->phases_failed += !harvest();
+    unsigned long harvest_ms = elapsed_ms(started);
+    if (c == 0) {
+      row->first_ms = harvest_ms;
+    } else {
+      steady.push_back(harvest_ms);
+      row->answered += ct_answered();
+      row->asked += options.harvesters;
+    }
+
+    started = sim_now_us();
+    row->phases_failed += !persist_data();
+    persist.push_back(elapsed_ms(started));
+
+    started = sim_now_us();
+    row->phases_failed += !refill_tank();
+    row->phases_failed += !send_car_patrol();
+    dispatch.push_back(elapsed_ms(started));
+
+    await_next_patrol();
+    sim_advance_us(3000000);
+  }
+
+  std::sort(steady.begin(), steady.end());
+  std::sort(persist.begin(), persist.end());
+  std::sort(dispatch.begin(), dispatch.end());
+  row->steady_ms = steady.empty() ? row->first_ms : steady[steady.size() / 2];
+  row->persist_ms = persist[persist.size() / 2];
+  row->dispatch_ms = dispatch[dispatch.size() / 2];
+  row->depth = sim_get_stats().depth;
+  row->ram_bytes = options.harvesters * ct_bytes_per_harvester();
+  row->bulk_dropped = ct_bulk_dropped();
+  row->stats = sim_get_stats();
+}
+
+/**
+ * This function is responsible for running one count in a child process, as
+ * the CT's globals only start fresh in one.
+ */
+static scale_row measure(const sim_options &options, int cycles) {
+  scale_row row;
+  memset(&row, 0, sizeof(row));
+  row.harvesters = options.harvesters;
+  row.addressable = MESH_ID_HARVESTER + options.harvesters <= MESH_IDS;
+  if (!row.addressable) {
+    return row;
+  }
+
+  int fds[2];
+  if (pipe(fds) < 0) {
+    row.crashed = true;
+    return row;
+  }
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    run_count(options, cycles, &row);
+    bool written = write(fds[1], &row, sizeof(row)) == sizeof(row);
+    _exit(written ? 0 : 1);
+  }
+  close(fds[1]);
+  bool complete = pid > 0 && read(fds[0], &row, sizeof(row)) == sizeof(row);
+  close(fds[0]);
+  if (pid > 0) {
+    waitpid(pid, NULL, 0);
+  }
+  row.crashed = !complete;
+  return row;
+}
+
+static std::vector<int> parse_counts(const char *list) {
+  std::vector<int> counts;
+  for (const char *p = list; *p;) {
+    int n = atoi(p);
+    if (n > 0) {
+      counts.push_back(n);
+    }
+    p = strchr(p, ',');
+    if (!p) {
+      break;
+    }
+    p++;
+  }
+  return counts;
+}
+
+static double answered_percent(const scale_row &row) {
+  return row.asked ? 100.0 * row.answered / row.asked : 0;
+}
+
+static void print_row(const scale_row &row, unsigned long longest) {
+  if (!row.addressable) {
+    printf("%5d  not addressable: mesh node IDs are 8 bit, at most %d "
+           "harvesters\n",
+           row.harvesters, MESH_IDS - MESH_ID_HARVESTER);
+    return;
+  }
+  if (row.crashed) {
+    printf("%5d  crashed\n", row.harvesters);
+    return;
+  }
+  int bar = longest ? row.steady_ms * SCALE_CHART_WIDTH / longest : 0;
+  printf("%5d %5d %9lu %9lu %9lu %9lu %6.1f %6d %7u %6lu %6lu %6u  %s\n",
+         row.harvesters, row.depth, row.first_ms, row.steady_ms,
+         row.persist_ms, row.dispatch_ms, answered_percent(row),
+         row.phases_failed, row.ram_bytes,
+         (unsigned long)row.stats.lost_air,
+         (unsigned long)row.stats.lost_full, row.bulk_dropped,
+         std::string(bar, '#').c_str());
+}
+
+static void write_csv(const char *path, const std::vector<scale_row> &rows) {
+  FILE *out = fopen(path, "w");
+  if (!out) {
+    fprintf(stderr, "Cannot write %s\n", path);
+    return;
+  }
+  fprintf(out, "harvesters,depth,first_ms,steady_ms,persist_ms,dispatch_ms,"
+               "answered_percent,phases_failed,ram_bytes,lost_air,"
+               "lost_full,bulk_dropped,messages,channel_ms\n");
+  for (size_t i = 0; i < rows.size(); i++) {
+    const scale_row &row = rows[i];
+    if (!row.addressable || row.crashed) {
+      fprintf(out, "%d,,,,,,,,,,,,,\n", row.harvesters);
+      continue;
+    }
+    fprintf(out, "%d,%d,%lu,%lu,%lu,%lu,%.1f,%d,%u,%lu,%lu,%u,%lu,%lu\n",
+            row.harvesters, row.depth, row.first_ms, row.steady_ms,
+            row.persist_ms, row.dispatch_ms, answered_percent(row),
+            row.phases_failed, row.ram_bytes,
+            (unsigned long)row.stats.lost_air,
+            (unsigned long)row.stats.lost_full, row.bulk_dropped,
+            (unsigned long)row.stats.messages,
+            (unsigned long)(row.stats.channel_us / 1000));
+  }
+  fclose(out);
+}
+
+int main(int argc, char **argv) {
+  sim_options options;
+  memset(&options, 0, sizeof(options));
+  options.hop_us = SCALE_HOP_US;
+  const char *list = SCALE_COUNTS;
+  const char *csv = NULL;
+  int cycles = SCALE_CYCLES;
+  int gate = SCALE_GATE;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-v") == 0) {
+      options.verbose = true;
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      list = argv[++i];
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      cycles = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      options.hop_us = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+      options.loss_percent = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+      gate = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      csv = argv[++i];
+    }
+  }
+  cycles = cycles < 1 ? 1 : cycles;
+
+  std::vector<scale_row> rows;
+  std::vector<int> counts = parse_counts(list);
+  for (size_t i = 0; i < counts.size(); i++) {
+    options.harvesters = counts[i];
+    rows.push_back(measure(options, cycles));
+  }
+
+  unsigned long longest = 0;
+  for (size_t i = 0; i < rows.size(); i++) {
+    longest = std::max(longest, rows[i].steady_ms);
+  }
+  printf("%5s %5s %9s %9s %9s %9s %6s %6s %7s %6s %6s %6s  %s\n", "N",
+         "hops", "first ms", "phase1 ms", "phase2 ms", "3+4 ms", "ans %",
+         "failed", "ram B", "air", "full", "bulk", "phase one");
+
+  int failed = 0;
+  for (size_t i = 0; i < rows.size(); i++) {
+    const scale_row &row = rows[i];
+    print_row(row, longest);
+    if (row.harvesters <= gate &&
+        (row.crashed || row.answered < row.asked || row.phases_failed)) {
+      failed++;
+    }
+  }
+  printf("\nram B is what the CT sets aside for N harvesters. air counts "
+         "messages lost on a hop,\nfull ones that found the CT's radio full "
+         "too long, bulk replies the CT had no room for.\n");
+  if (csv) {
+    write_csv(csv, rows);
+  }
+
+  printf("\n%zu counts, %d failed up to %d harvesters\n", rows.size(), failed,
+         gate);
+  return failed ? 1 : 0;
+}
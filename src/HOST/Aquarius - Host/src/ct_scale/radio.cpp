@@ -0,0 +1,364 @@
+#include <Aquarius_config.h>
+#include <AquariusHistory.h>
+#include <AquariusLink.h>
+#include <AquariusProtocol.h>
+#include <RF24Mesh.h>
+#include <RF24Network.h>
+
+#include <algorithm>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <vector>
+
+#include "sim.h"
+
+// The mesh around the CT: every node joined, at the address RF24Mesh would
+// have handed it, and answers the way its firmware does. A message goes hop
+// by hop over one shared channel; the CT only sees what reached its radio.
+
+extern RF24 radio;
+extern RF24Mesh mesh;
+
+typedef struct {
+  uint8_t id;
+  uint16_t address;
+  int depth;
+  bool car;
+  uint8_t humidity[POTS_PER_HARVESTER];
+  uint16_t attempts;
+  uint16_t delivered;
+  bool package_next; // the car's next message is its package
+} sim_node;
+
+typedef struct {
+  RF24NetworkHeader header;
+  std::vector<uint8_t> data;
+  int packets;
+  int depth; // of the sender
+} sim_frame;
+
+static struct {
+  sim_options options;
+  sim_stats stats;
+  uint32_t seed;
+  std::vector<sim_node> nodes;
+  std::vector<addrListStruct> addr_list;
+  std::map<uint64_t, uint64_t> busy; // channel, start to end
+  std::multimap<uint64_t, sim_frame> arriving; // at the CT's radio
+  std::deque<sim_frame> received;              // read out of it
+} mesh_sim;
+
+static bool lost() {
+  mesh_sim.seed ^= mesh_sim.seed << 13;
+  mesh_sim.seed ^= mesh_sim.seed >> 17;
+  mesh_sim.seed ^= mesh_sim.seed << 5;
+  return (int)(mesh_sim.seed % 100) < mesh_sim.options.loss_percent;
+}
+
+static int address_depth(uint16_t address) {
+  int depth = 0;
+  for (; address; address >>= 3) {
+    depth++;
+  }
+  return depth;
+}
+
+/**
+ * This function is responsible for placing the nodes as RF24Mesh does: each
+ * node in turn takes the first free child address of the shallowest node,
+ * five children to a node. The car joins first, then the harvesters.
+ */
+void sim_reset_mesh(const sim_options &options) {
+  mesh_sim.options = options;
+  mesh_sim.stats = sim_stats();
+  mesh_sim.seed = SIM_SEED;
+  mesh_sim.nodes.clear();
+  mesh_sim.addr_list.clear();
+  mesh_sim.busy.clear();
+  mesh_sim.arriving.clear();
+  mesh_sim.received.clear();
+
+  std::deque<uint16_t> parents(1, 0);
+  int children = 0;
+  for (int n = 0; n <= options.harvesters; n++) {
+    if (children == 5) {
+      parents.pop_front();
+      children = 0;
+    }
+    uint16_t parent = parents.front();
+    uint16_t address =
+        parent | (uint16_t)(++children) << (3 * address_depth(parent));
+    parents.push_back(address);
+
+    sim_node node = sim_node();
+    node.car = n == 0;
+    node.id = node.car ? MESH_ID_CAR : MESH_ID_HARVESTER + n - 1;
+    node.address = address;
+    node.depth = address_depth(address);
+    for (int p = 0; p < POTS_PER_HARVESTER; p++) {
+      node.humidity[p] = SIM_WET - (n * POTS_PER_HARVESTER + p) * 7 % 60;
+    }
+    mesh_sim.nodes.push_back(node);
+    mesh_sim.addr_list.push_back({node.id, node.address});
+    if (node.depth > mesh_sim.stats.depth) {
+      mesh_sim.stats.depth = node.depth;
+    }
+  }
+  mesh.addrList = mesh_sim.addr_list.data();
+  mesh.addrListTop = mesh_sim.addr_list.size();
+}
+
+const sim_stats &sim_get_stats() { return mesh_sim.stats; }
+
+/*******************************************************************************
+*********************************** Channel ************************************
+********************************************************************************/
+
+static uint64_t airtime_us(int packets) {
+  switch (radio.getDataRate()) {
+  case RF24_250KBPS:
+    return packets * SIM_AIRTIME_US * 4;
+  case RF24_2MBPS:
+    return packets * SIM_AIRTIME_US / 2;
+  default:
+    return packets * SIM_AIRTIME_US;
+  }
+}
+
+static int packets_of(size_t size) {
+  return size <= SIM_PACKET_PAYLOAD
+             ? 1
+             : (size + SIM_PACKET_PAYLOAD - 1) / SIM_PACKET_PAYLOAD;
+}
+
+/**
+ * This function is responsible for the channel: the end of the first gap of
+ * length us that starts at ready or later.
+ */
+static uint64_t transmit(uint64_t ready, uint64_t us) {
+  std::map<uint64_t, uint64_t>::iterator next =
+      mesh_sim.busy.lower_bound(ready);
+  if (next != mesh_sim.busy.begin()) {
+    std::map<uint64_t, uint64_t>::iterator before = std::prev(next);
+    ready = before->second > ready ? before->second : ready;
+  }
+  for (; next != mesh_sim.busy.end() && next->first < ready + us; ++next) {
+    ready = next->second > ready ? next->second : ready;
+  }
+  mesh_sim.busy[ready] = ready + us;
+  mesh_sim.stats.channel_us += us;
+
+  // What ended long ago cannot be in the way any more
+  while (!mesh_sim.busy.empty() &&
+         mesh_sim.busy.begin()->second + 60000000ULL < sim_now_us()) {
+    mesh_sim.busy.erase(mesh_sim.busy.begin());
+  }
+  return ready + us;
+}
+
+/**
+ * This function is responsible for a node's message to the CT, sent when it
+ * is ready, in the lane its size puts it in.
+ */
+static void reply(sim_node &node, uint64_t ready, const void *data,
+                  size_t size) {
+  sim_frame frame;
+  frame.header = RF24NetworkHeader(NODE_CT);
+  frame.header.from_node = node.address;
+  frame.header.type = size <= CONTROL_MAX_SIZE ? LANE_CONTROL : LANE_BULK;
+  frame.data.assign((const uint8_t *)data, (const uint8_t *)data + size);
+  frame.packets = packets_of(size);
+  frame.depth = node.depth;
+  mesh_sim.stats.messages++;
+  node.attempts++;
+
+  uint64_t at = ready;
+  for (int hop = 0; hop < node.depth; hop++) {
+    at = transmit(hop ? at + mesh_sim.options.hop_us : at,
+                  airtime_us(frame.packets));
+    if (lost()) {
+      mesh_sim.stats.lost_air++;
+      return;
+    }
+  }
+  node.delivered++;
+  mesh_sim.arriving.insert(std::make_pair(at, frame));
+}
+
+static void reply_signal(sim_node &node, uint64_t ready, aq_signal value) {
+  reply(node, ready, &value, sizeof(value));
+}
+
+static void reply_link(sim_node &node, uint64_t ready) {
+  link_report report;
+  memset(&report, 0, sizeof(report));
+  report.signal = SIG_LINK_REPORT;
+  report.channel = radio.getChannel();
+  report.attempts = node.attempts;
+  report.delivered = node.delivered;
+  reply(node, ready, &report, sizeof(report));
+}
+
+/**
+ * This function is responsible for what a node does with a message from the
+ * CT that reached it at the given time.
+ */
+static void answer(sim_node &node, uint64_t at, const uint8_t *data,
+                   size_t size) {
+  if (node.car && node.package_next) {
+    node.package_next = false;
+    reply_signal(node, at + 10000, SIG_PATROL_START);
+    reply_signal(node, at + SIM_PATROL_US, SIG_PATROL_STOP);
+    return;
+  }
+
+  aq_signal value = 0;
+  memcpy(&value, data, size < sizeof(value) ? size : sizeof(value));
+  switch (value) {
+  case SIG_HELLO: {
+    protocol_hello hello;
+    hello.signal = SIG_HELLO;
+    hello.version = PROTOCOL_VERSION;
+    reply(node, at + 2000, &hello, sizeof(hello));
+    break;
+  }
+  case SIG_LINK_SURVEY:
+    reply_link(node, at + SIM_SURVEY_US);
+    break;
+  case SIG_LINK_SWITCH: {
+    link_switch message;
+    memcpy(&message, data, sizeof(message));
+    reply_link(node, at + message.delay_ticks * LINK_SWITCH_TICK_MS * 1000ULL +
+                         message.confirm_slot * LINK_CONFIRM_SLOT_MS * 1000ULL +
+                         2000);
+    break;
+  }
+  case SIG_HARVEST_START: {
+    harvest_data harvest;
+    for (int p = 0; p < POTS_PER_HARVESTER; p++) {
+      node.humidity[p] -= node.humidity[p] > 10 ? (p + node.id) % 4 : 0;
+      harvest.humidity[p] = node.humidity[p];
+    }
+    harvest.age = 1000;
+    reply(node, at + SIM_HARVEST_US, &harvest, sizeof(harvest));
+    break;
+  }
+  case SIG_HISTORY_REQUEST: {
+    history_frame frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.signal = SIG_HISTORY_DATA;
+    memcpy(&frame.first_seq, data + sizeof(value), sizeof(frame.first_seq));
+    reply(node, at + 5000, &frame, sizeof(frame));
+    break;
+  }
+  case SIG_REFILL_START: {
+    // The car comes back empty and says stop as its level sensor reads what
+    // was asked, a little before the CT's pump timer runs out
+    refill_message refill;
+    memcpy(&refill, data, sizeof(refill));
+    uint64_t fill_us = refill.ml * 1000000ULL / REFILL_ML_PER_S;
+    refill.signal = SIG_REFILL_ACK;
+    refill.ml = 0;
+    reply(node, at + 5000, &refill, sizeof(refill));
+    reply_signal(node, at + std::min<uint64_t>(fill_us, SIM_REFILL_US),
+                 SIG_REFILL_STOP);
+    break;
+  }
+  case SIG_PATROL_START:
+    node.package_next = true;
+    break;
+  }
+}
+
+/*******************************************************************************
+********************************* RF24Network **********************************
+********************************************************************************/
+
+/**
+ * This function is responsible for what reached the CT's radio since the last
+ * update. SIM_RADIO_FIFO packets of it fit the radio; a sender whose packet
+ * did not retries, for WRITE_TIMEOUT if it is a child of the CT, which
+ * writes with writeTimeout, and for SIM_RETRY_US if it relays.
+ */
+uint8_t RF24Network::update() {
+  sim_advance_us(SIM_UPDATE_US);
+  uint64_t now = sim_now_us();
+  int fifo = 0;
+  while (!mesh_sim.arriving.empty() &&
+         mesh_sim.arriving.begin()->first <= now) {
+    uint64_t at = mesh_sim.arriving.begin()->first;
+    sim_frame &frame = mesh_sim.arriving.begin()->second;
+    uint64_t retry =
+        frame.depth == 1 ? WRITE_TIMEOUT * 1000ULL : SIM_RETRY_US;
+    if (fifo + frame.packets <= SIM_RADIO_FIFO || now - at <= retry) {
+      mesh_sim.received.push_back(frame);
+    } else {
+      mesh_sim.stats.lost_full++;
+    }
+    fifo += frame.packets;
+    mesh_sim.arriving.erase(mesh_sim.arriving.begin());
+  }
+  return 0;
+}
+
+bool RF24Network::available() { return !mesh_sim.received.empty(); }
+
+uint16_t RF24Network::peek(RF24NetworkHeader &header) {
+  header = mesh_sim.received.front().header;
+  return mesh_sim.received.front().data.size();
+}
+
+uint16_t RF24Network::read(RF24NetworkHeader &header, void *message,
+                           uint16_t maxlen) {
+  sim_frame &frame = mesh_sim.received.front();
+  header = frame.header;
+  uint16_t size = frame.data.size() < maxlen ? frame.data.size() : maxlen;
+  if (size > 0) {
+    memcpy(message, frame.data.data(), size);
+  }
+  mesh_sim.received.pop_front();
+  return size;
+}
+
+/**
+ * This function is responsible for a write from the CT. It returns once the
+ * first hop is acknowledged, or the radio gave up on it; the hops after it
+ * happen meanwhile.
+ */
+bool RF24Network::write(RF24NetworkHeader &header, const void *message,
+                        uint16_t len) {
+  mesh_sim.stats.messages++;
+  int packets = packets_of(len);
+  uint64_t at = transmit(sim_now_us(), airtime_us(packets));
+  sim_node *node = NULL;
+  for (size_t n = 0; n < mesh_sim.nodes.size(); n++) {
+    if (mesh_sim.nodes[n].address == header.to_node) {
+      node = &mesh_sim.nodes[n];
+    }
+  }
+  if (!node || lost()) {
+    mesh_sim.stats.lost_air += node != NULL;
+    sim_advance_us(at - sim_now_us() + SIM_RETRY_US);
+    return false;
+  }
+  sim_advance_us(at - sim_now_us());
+
+  for (int hop = 1; hop < node->depth; hop++) {
+    at = transmit(at + mesh_sim.options.hop_us, airtime_us(packets));
+    if (lost()) {
+      mesh_sim.stats.lost_air++;
+      return true;
+    }
+  }
+  answer(*node, at, (const uint8_t *)message, len);
+  return true;
+}
+
+// Not acknowledged, and nodes get the time unicast as well
+bool RF24Network::multicast(RF24NetworkHeader &header, const void *message,
+                            uint16_t len, uint8_t level) {
+  uint64_t at = transmit(sim_now_us(), airtime_us(packets_of(len)));
+  sim_advance_us(at - sim_now_us());
+  return true;
+}
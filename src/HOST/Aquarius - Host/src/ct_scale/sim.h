@@ -0,0 +1,79 @@
+#ifndef __CT_SCALE__
+#define __CT_SCALE__
+
+#include <stdint.h>
+
+// Radio: one channel the whole mesh shares, and every hop of every packet
+// takes SIM_AIRTIME_US of it. RF24Network sends a message as packets of at
+// most SIM_PACKET_PAYLOAD bytes. Between two network updates the CT's radio
+// holds SIM_RADIO_FIFO packets; a sender whose packet finds it full retries
+// for SIM_RETRY_US, 15 retries 1500 us apart, and then it is lost.
+#define SIM_AIRTIME_US 600
+#define SIM_PACKET_PAYLOAD 24
+#define SIM_RADIO_FIFO 3
+#define SIM_RETRY_US 22500
+
+// CPU time of one network update (mesh.update() and mesh.DHCP()), and of one
+// millis() call with the busy wait it usually sits in
+#define SIM_UPDATE_US 150
+#define SIM_MILLIS_US 2
+
+// Nodes: how long each takes to answer. Harvester humidity starts at
+// SIM_WET and loses up to 3 points per harvest.
+#define SIM_HARVEST_US 4000
+#define SIM_SURVEY_US 60000
+#define SIM_REFILL_US 3000000
+#define SIM_PATROL_US 1000000
+#define SIM_WET 80
+#define SIM_SEED 2024
+
+// Ethernet (W5100): every write() call goes out as one packet
+#define SIM_ETHERNET_CONNECT_US 5000
+#define SIM_ETHERNET_WRITE_US 800
+#define SIM_ETHERNET_BYTE_US 2
+#define SIM_NTP_US 20000
+#define SIM_EPOCH 1700000000UL
+
+// Serial at 9600 baud behind its 64 byte buffer
+#define SIM_SERIAL_BYTE_US 1042
+#define SIM_SERIAL_BUFFER 64
+
+// RF24Mesh's addrList entry per node, on the master's heap
+#define SIM_ADDR_LIST_ENTRY 3
+
+typedef struct {
+  int harvesters;
+  unsigned hop_us;  // forwarding delay per hop, on top of the airtime
+  int loss_percent; // of the packets on each hop, after the radio's retries
+  bool verbose;
+} sim_options;
+
+typedef struct {
+  uint64_t messages;   // sent by anyone
+  uint64_t lost_air;   // on a hop
+  uint64_t lost_full;  // found the CT's radio full for SIM_RETRY_US
+  uint64_t channel_us; // the channel was busy
+  int depth;           // hops to the deepest node
+} sim_stats;
+
+// hal.cpp
+void sim_reset_clock(bool verbose);
+uint64_t sim_now_us();
+void sim_advance_us(uint64_t us);
+
+// radio.cpp
+void sim_reset_mesh(const sim_options &options);
+const sim_stats &sim_get_stats();
+
+// ct.cpp, from the CT's firmware
+void setup();
+bool harvest();
+bool persist_data();
+bool refill_tank();
+bool send_car_patrol();
+void await_next_patrol();
+int ct_answered();
+uint16_t ct_bulk_dropped();
+unsigned ct_bytes_per_harvester();
+
+#endif
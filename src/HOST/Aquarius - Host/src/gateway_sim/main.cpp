@@ -0,0 +1,541 @@
+#include <Aquarius.h>
+#include <AquariusGateway.h>
+#include <AquariusRoute.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <queue>
+#include <string>
+#include <vector>
+
+// Stands in for a CT built as env:gateway, and for the mesh behind it, on a
+// pseudo terminal, so gatewayd can be run without the hardware. It prints the
+// pty to give gatewayd as -d and answers frames as the CT's gateway_answer
+// and gateway_bridge do, with log lines in between like the CT's.
+//
+// Harvesters answer a harvest after -r ms per hop, their pots losing a few
+// points each time; with -d 1 every pot starts dry, so each car gets a package
+// and the ones before the farthest hold. Cars start with an empty tank, ack a refill they lack
+// water for and say stop SIM_ACK_MS after the pump has filled in what was
+// asked, -f ms after it came on at most; so the host's pump timer usually
+// stops the refill first. They confirm a patrol and come back -t ms later
+// with the package watered, POT_DOSE_ML a pot out of their tank, or -t ms
+// after SIG_PATROL_GO when told to hold. The last -s cars cannot read their
+// water level and answer a refill with a fault. Writes go in the lane the
+// CT's gateway_send picks, and a car waiting for the pump or at its hold
+// reads only the control lane, as the car does; what it misses is counted.
+// -l percent of the writes are not delivered, so gatewayd has to retry.
+// Every node answers the protocol hello; the last -o harvesters run the
+// next PROTOCOL_VERSION, so gatewayd has to leave them out.
+//
+// When the host has been silent GATEWAY_HOST_TIMEOUT the CT would run the
+// phases on board again; the simulation reports what it saw and exits.
+//
+// Usage: gateway_sim [-h harvesters] [-c cars] [-r reply_ms] [-f refill_ms]
+//                    [-t patrol_ms] [-l loss_percent] [-o outdated]
+//                    [-s sensor_faults] [-d dry_start]
+
+#define SIM_DRY 30
+#define SIM_WATER 45 // points a patrol adds
+#define SIM_ACK_MS 20
+
+static struct {
+  int harvesters;
+  int cars;
+  int reply_ms;
+  int refill_ms;
+  int patrol_ms;
+  int loss_percent;
+  int outdated;
+  int sensor_faults;
+  int dry_start;
+} options = {HARVESTERS, CARS, 40, 800, 3000, 0, 0, 0, 0};
+
+typedef struct {
+  uint64_t due;
+  uint16_t from;
+  std::string payload;
+} sim_message;
+
+struct later {
+  bool operator()(const sim_message &a, const sim_message &b) const {
+    return a.due > b.due;
+  }
+};
+
+static int pty;
+static uint64_t clock_start;
+static std::priority_queue<sim_message, std::vector<sim_message>, later>
+    outbox;
+
+// Mesh: node IDs in join order, addresses handed out as RF24Mesh does, five
+// children per node
+static std::vector<uint8_t> node_ids;
+static std::vector<uint16_t> node_addresses;
+
+static uint8_t humidity[MAX_HARVESTERS * POTS_PER_HARVESTER];
+
+typedef struct {
+  bool pump_wait; // acked a refill, fills once the pump is on
+  bool package_next;
+  bool hold_next;
+  bool held;
+  bool out;
+  uint64_t held_since;
+  uint64_t filled_at;
+  uint64_t filling_since;
+  uint16_t ml; // in the tank
+  uint16_t needed;
+} sim_car;
+static sim_car fleet[MAX_CARS];
+
+static bool host_present = false;
+static uint64_t host_heard_at;
+static bool pump_on = false;
+static uint64_t pump_started_at;
+
+static struct {
+  uint64_t frames;
+  uint64_t attempts;
+  uint64_t lost;
+  uint64_t harvests;
+  uint64_t time_syncs;
+  uint64_t hellos;
+  uint64_t refills;
+  uint64_t refills_skipped;
+  uint64_t refill_faults;
+  uint64_t timer_stops;
+  uint64_t pump_cutoffs;
+  uint64_t patrols;
+  uint64_t holds;
+  uint64_t releases;
+  uint64_t lost_cars;
+  uint64_t missed;
+  uint64_t watered;
+  uint64_t dry_readings;
+  uint64_t readings;
+} stats;
+
+static uint64_t now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000 - clock_start;
+}
+
+static void emit(uint8_t byte) {
+  while (write(pty, &byte, 1) < 0) {
+  }
+}
+
+static void log_line(const char *line) {
+  for (const char *c = line; *c; c++) {
+    emit(*c);
+  }
+  emit('\r');
+  emit('\n');
+}
+
+static void send(uint8_t kind, uint8_t seq, uint16_t node, const void *data,
+                 uint8_t size) {
+  gateway_frame frame;
+  frame.kind = kind;
+  frame.seq = seq;
+  frame.node = node;
+  frame.type = 0;
+  frame.size = size;
+  memcpy(frame.payload, data, size);
+  gateway_write(frame, emit);
+}
+
+/*******************************************************************************
+************************************* Mesh *************************************
+********************************************************************************/
+
+static void join(uint8_t id) {
+  size_t n = node_ids.size();
+  uint16_t address = n < 5 ? n + 1 : (((n - 5) % 5 + 1) << 3) | (n / 5);
+  node_ids.push_back(id);
+  node_addresses.push_back(address);
+}
+
+static int node_index(uint16_t address) {
+  for (size_t n = 0; n < node_addresses.size(); n++) {
+    if (node_addresses[n] == address) {
+      return n;
+    }
+  }
+  return -1;
+}
+
+static int hops(uint16_t address) {
+  int depth = 0;
+  for (; address; address >>= 3) {
+    depth++;
+  }
+  return depth;
+}
+
+static void reply(uint16_t from, const void *data, size_t size,
+                  uint64_t delay) {
+  sim_message message;
+  message.due = now_ms() + delay;
+  message.from = from;
+  message.payload.assign((const char *)data, size);
+  outbox.push(message);
+}
+
+static void reply_signal(uint16_t from, int16_t signal, uint64_t delay) {
+  uint8_t message[2] = {(uint8_t)(signal & 0xFF), (uint8_t)(signal >> 8)};
+  reply(from, message, sizeof(message), delay);
+}
+
+static void reply_hello(uint16_t from, uint8_t version) {
+  protocol_hello hello;
+  hello.signal = SIG_HELLO;
+  hello.version = version;
+  stats.hellos++;
+  reply(from, &hello, sizeof(hello), SIM_ACK_MS);
+}
+
+static void harvester_got(int h, uint16_t address, const uint8_t *data,
+                          uint8_t size) {
+  int16_t signal = data[0] | data[1] << 8;
+  if (signal == SIG_HELLO) {
+    bool outdated = h >= options.harvesters - options.outdated;
+    reply_hello(address, PROTOCOL_VERSION + outdated);
+    return;
+  }
+  if (signal == SIG_TIME_SYNC) {
+    stats.time_syncs++;
+    return;
+  }
+  if (signal != SIG_HARVEST_START) {
+    return;
+  }
+
+  uint8_t message[POTS_PER_HARVESTER + 4];
+  for (int p = 0; p < POTS_PER_HARVESTER; p++) {
+    uint8_t &pot = humidity[h * POTS_PER_HARVESTER + p];
+    pot = pot > 3 ? pot - 1 - rand() % 3 : 1;
+    message[p] = pot;
+    stats.readings++;
+    stats.dry_readings += pot < SIM_DRY;
+  }
+  uint32_t age = 500 + rand() % 1000;
+  memcpy(message + POTS_PER_HARVESTER, &age, sizeof(age));
+  stats.harvests++;
+  reply(address, message, sizeof(message), options.reply_ms * hops(address));
+}
+
+static void car_got(int k, uint16_t address, const uint8_t *data,
+                    uint8_t size, uint8_t lane) {
+  sim_car &car = fleet[k];
+  if ((car.pump_wait || car.held) && lane != LANE_CONTROL) {
+    stats.missed++;
+    return;
+  }
+  if (car.package_next && size == POTS) {
+    car.package_next = false;
+    car.out = true;
+    stats.patrols++;
+    for (int i = 0; i < POTS; i++) {
+      if (data[i]) {
+        int watered = humidity[i] + SIM_WATER;
+        humidity[i] = watered > 100 ? 100 : watered;
+        car.ml = car.ml > POT_DOSE_ML ? car.ml - POT_DOSE_ML : 0;
+        stats.watered++;
+      }
+    }
+    reply_signal(address, SIG_PATROL_START, SIM_ACK_MS);
+    if (car.hold_next) {
+      car.held = true;
+      car.held_since = now_ms();
+      stats.holds++;
+      return;
+    }
+    reply_signal(address, SIG_PATROL_STOP, options.patrol_ms);
+    return;
+  }
+
+  int16_t signal = data[0] | data[1] << 8;
+  switch (signal) {
+  case SIG_HELLO:
+    reply_hello(address, PROTOCOL_VERSION);
+    break;
+  case SIG_REFILL_START: {
+    refill_message refill;
+    if (size != sizeof(refill)) {
+      break;
+    }
+    memcpy(&refill, data, sizeof(refill));
+    stats.refills++;
+    if (k >= options.cars - options.sensor_faults) {
+      stats.refill_faults++;
+      reply_signal(address, SIG_REFILL_FAULT, SIM_ACK_MS);
+      break;
+    }
+    if (car.ml >= refill.ml) {
+      stats.refills_skipped++;
+      reply_signal(address, SIG_REFILL_STOP, SIM_ACK_MS);
+      break;
+    }
+    car.pump_wait = true;
+    car.filled_at = 0;
+    car.needed = refill.ml;
+    refill.signal = SIG_REFILL_ACK;
+    refill.ml = car.ml;
+    reply(address, &refill, sizeof(refill), SIM_ACK_MS);
+    break;
+  }
+  case SIG_REFILL_STOP:
+    if (car.pump_wait && car.filling_since) {
+      stats.timer_stops++;
+      uint64_t ml = car.ml + (now_ms() - car.filling_since) *
+                                 REFILL_ML_PER_S / 1000;
+      car.ml = ml < car.needed ? ml : car.needed;
+    }
+    car.pump_wait = false;
+    car.filling_since = 0;
+    break;
+  case SIG_PATROL_START:
+    car.package_next = true;
+    car.hold_next = size == sizeof(patrol_start) &&
+                    ((const patrol_start *)data)->hold_stop != ROUTE_DOCK;
+    break;
+  case SIG_PATROL_GO:
+    if (car.held) {
+      car.held = false;
+      stats.releases++;
+      reply_signal(address, SIG_PATROL_STOP, options.patrol_ms);
+    }
+    break;
+  }
+}
+
+/**
+ * This function is responsible for one write attempt into the mesh, in the
+ * lane the CT's gateway_send picks.
+ */
+static bool deliver(uint16_t address, uint8_t type, const uint8_t *data,
+                    uint8_t size) {
+  stats.attempts++;
+  int n = node_index(address);
+  if (n < 0 || size < 2 || rand() % 100 < options.loss_percent) {
+    stats.lost++;
+    return false;
+  }
+  int id = node_ids[n];
+  if (id >= MESH_ID_HARVESTER) {
+    harvester_got(id - MESH_ID_HARVESTER, address, data, size);
+  } else {
+    uint8_t lane = type;
+    if (type == LANE_BULK || type == LANE_CONTROL) {
+      lane = size <= CONTROL_MAX_SIZE ? LANE_CONTROL : LANE_BULK;
+    }
+    car_got(id - MESH_ID_CAR, address, data, size, lane);
+  }
+  return true;
+}
+
+/*******************************************************************************
+************************************** CT **************************************
+********************************************************************************/
+
+static void answer(const gateway_frame &frame) {
+  stats.frames++;
+  if (!host_present) {
+    log_line("Host said hello, bridging");
+  }
+  host_present = true;
+  host_heard_at = now_ms();
+
+  uint8_t out[GATEWAY_PAYLOAD_MAX];
+  uint8_t size = 0;
+  uint8_t kind = frame.kind;
+  switch (frame.kind) {
+  case GATEWAY_HELLO: {
+    gateway_hello hello = {GATEWAY_VERSION,    1, POTS, (uint8_t)options.cars,
+                           POTS_PER_HARVESTER, MAX_HARVESTERS,
+                           PROTOCOL_VERSION};
+    memcpy(out, &hello, sizeof(hello));
+    size = sizeof(hello);
+    break;
+  }
+  case GATEWAY_TX:
+    kind = GATEWAY_TX_RESULT;
+    out[0] = deliver(frame.node, frame.type, frame.payload, frame.size);
+    size = 1;
+    break;
+  case GATEWAY_NODES:
+    for (size_t n = 0; n < node_ids.size(); n++) {
+      out[size++] = node_ids[n];
+      out[size++] = node_addresses[n] & 0xFF;
+      out[size++] = node_addresses[n] >> 8;
+    }
+    break;
+  case GATEWAY_PUMP:
+    pump_on = frame.payload[0];
+    pump_started_at = now_ms();
+    for (int k = 0; k < options.cars; k++) {
+      sim_car &car = fleet[k];
+      if (pump_on && car.pump_wait) {
+        uint64_t fill_ms =
+            (car.needed - car.ml) * 1000 / REFILL_ML_PER_S + SIM_ACK_MS;
+        car.filling_since = now_ms();
+        car.filled_at = now_ms() + (fill_ms < (uint64_t)options.refill_ms
+                                        ? fill_ms
+                                        : options.refill_ms);
+      }
+    }
+    out[0] = pump_on;
+    size = 1;
+    break;
+  default:
+    return;
+  }
+  send(kind, frame.seq, frame.node, out, size);
+}
+
+/**
+ * This function is responsible for what happens without the host: cars
+ * filling, the pump cutoff, and messages the mesh delivers.
+ */
+static void step() {
+  uint64_t now = now_ms();
+  if (pump_on && now - pump_started_at > MAX_REFILL_MILLIS) {
+    pump_on = false;
+    stats.pump_cutoffs++;
+    log_line("WARNING: Pump on for too long, turned off");
+  }
+  for (int k = 0; k < options.cars; k++) {
+    sim_car &car = fleet[k];
+    if (car.pump_wait && pump_on && car.filled_at && now >= car.filled_at) {
+      car.pump_wait = false;
+      car.filling_since = 0;
+      car.ml = car.needed;
+      reply_signal(node_addresses[options.harvesters + k], SIG_REFILL_STOP, 0);
+    }
+    if (car.held && now - car.held_since > MAX_PATROL_MILLIS) {
+      car.held = false;
+      stats.lost_cars++;
+      reply_signal(node_addresses[options.harvesters + k], SIG_PATROL_LOST, 0);
+    }
+  }
+  while (!outbox.empty() && outbox.top().due <= now) {
+    const sim_message &message = outbox.top();
+    send(GATEWAY_RX, 0, message.from, message.payload.data(),
+         message.payload.size());
+    outbox.pop();
+  }
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    int value = atoi(argv[i + 1]);
+    if (strcmp(argv[i], "-h") == 0) {
+      options.harvesters = value;
+    } else if (strcmp(argv[i], "-c") == 0) {
+      options.cars = value;
+    } else if (strcmp(argv[i], "-r") == 0) {
+      options.reply_ms = value;
+    } else if (strcmp(argv[i], "-f") == 0) {
+      options.refill_ms = value;
+    } else if (strcmp(argv[i], "-t") == 0) {
+      options.patrol_ms = value;
+    } else if (strcmp(argv[i], "-l") == 0) {
+      options.loss_percent = value;
+    } else if (strcmp(argv[i], "-o") == 0) {
+      options.outdated = value;
+    } else if (strcmp(argv[i], "-s") == 0) {
+      options.sensor_faults = value;
+    } else if (strcmp(argv[i], "-d") == 0) {
+      options.dry_start = value;
+    }
+  }
+  if (options.harvesters > MAX_HARVESTERS) {
+    options.harvesters = MAX_HARVESTERS;
+  }
+  if (options.cars > MAX_CARS) {
+    options.cars = MAX_CARS;
+  }
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  srand(1);
+  clock_start = 0;
+  clock_start = now_ms();
+
+  pty = posix_openpt(O_RDWR | O_NOCTTY);
+  if (pty < 0 || grantpt(pty) < 0 || unlockpt(pty) < 0) {
+    perror("pty");
+    return 1;
+  }
+  // Raw until gatewayd opens it, so nothing is echoed back meanwhile
+  struct termios tio;
+  int peer = open(ptsname(pty), O_RDWR | O_NOCTTY);
+  tcgetattr(peer, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(peer, TCSANOW, &tio);
+
+  for (int h = 0; h < options.harvesters; h++) {
+    join(MESH_ID_HARVESTER + h);
+    for (int p = 0; p < POTS_PER_HARVESTER; p++) {
+      humidity[h * POTS_PER_HARVESTER + p] =
+          options.dry_start ? SIM_DRY / 2 : 40 + rand() % 50;
+    }
+  }
+  for (int k = 0; k < options.cars; k++) {
+    join(MESH_ID_CAR + k);
+  }
+  printf("CT on %s: %d harvesters, %d cars, %d%% of writes lost\n",
+         ptsname(pty), options.harvesters, options.cars,
+         options.loss_percent);
+
+  GatewayDecoder decoder;
+  uint8_t buffer[512];
+  while (!host_present || now_ms() - host_heard_at <= GATEWAY_HOST_TIMEOUT) {
+    struct pollfd p = {pty, POLLIN, 0};
+    if (poll(&p, 1, 5) > 0) {
+      ssize_t n = read(pty, buffer, sizeof(buffer));
+      for (ssize_t i = 0; i < n; i++) {
+        if (decoder.feed(buffer[i])) {
+          answer(decoder.getFrame());
+        }
+      }
+    }
+    step();
+  }
+  log_line("WARNING: Host is gone, running the phases on board!");
+  close(peer);
+
+  printf("Host gone, the CT would run the phases on board now\n");
+  printf("Frames: %llu, %u bad\n", (unsigned long long)stats.frames,
+         decoder.getErrors());
+  printf("Writes: %llu, %llu lost\n", (unsigned long long)stats.attempts,
+         (unsigned long long)stats.lost);
+  printf("Harvests: %llu, time syncs %llu, hellos %llu\n",
+         (unsigned long long)stats.harvests,
+         (unsigned long long)stats.time_syncs,
+         (unsigned long long)stats.hellos);
+  printf("Refills: %llu, %llu skipped, %llu faults, %llu stopped by the "
+         "timer, pump cutoffs %llu\n",
+         (unsigned long long)stats.refills,
+         (unsigned long long)stats.refills_skipped,
+         (unsigned long long)stats.refill_faults,
+         (unsigned long long)stats.timer_stops,
+         (unsigned long long)stats.pump_cutoffs);
+  printf("Patrols: %llu, %llu pots watered\n",
+         (unsigned long long)stats.patrols, (unsigned long long)stats.watered);
+  printf("Holds: %llu, %llu released, %llu lost\n",
+         (unsigned long long)stats.holds, (unsigned long long)stats.releases,
+         (unsigned long long)stats.lost_cars);
+  printf("Missed by waiting cars: %llu\n", (unsigned long long)stats.missed);
+  printf("Dry readings: %llu of %llu\n",
+         (unsigned long long)stats.dry_readings,
+         (unsigned long long)stats.readings);
+  return 0;
+}
@@ -0,0 +1,334 @@
+#include "link.h"
+
+#include <AquariusProtocol.h>
+#include <Aquarius_config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chrono>
+
+uint64_t now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static speed_t baud_speed(int baud) {
+  switch (baud) {
+  case 9600:
+    return B9600;
+  case 115200:
+    return B115200;
+  case 230400:
+    return B230400;
+  case 460800:
+    return B460800;
+  case 500000:
+    return B500000;
+  case 1000000:
+    return B1000000;
+  default:
+    return B0;
+  }
+}
+
+/**
+ * This function is responsible for opening the CT's port raw, 8N1 at baud.
+ * A pty takes the settings and ignores the speed.
+ */
+int serial_open(const char *path, int baud) {
+  int fd = open(path, O_RDWR | O_NOCTTY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct termios tio;
+  if (tcgetattr(fd, &tio) == 0) {
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    speed_t speed = baud_speed(baud);
+    if (speed != B0) {
+      cfsetispeed(&tio, speed);
+      cfsetospeed(&tio, speed);
+    }
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+  return fd;
+}
+
+GatewayLink::GatewayLink(int fd, bool verbose)
+    : fd(fd), verbose(verbose), stopping(false), next_seq(0), hello_at(0),
+      frames(0), attempts(0), delivered(0) {
+  memset(&hello, 0, sizeof(hello));
+}
+
+GatewayLink::~GatewayLink() { stop(); }
+
+void GatewayLink::start() {
+  reader = std::thread(&GatewayLink::readLoop, this);
+  heartbeat = std::thread(&GatewayLink::heartbeatLoop, this);
+}
+
+void GatewayLink::stop() {
+  stopping = true;
+  if (reader.joinable()) {
+    reader.join();
+  }
+  if (heartbeat.joinable()) {
+    heartbeat.join();
+  }
+}
+
+/*******************************************************************************
+*********************************** Framing ************************************
+********************************************************************************/
+
+static std::string *emitting;
+
+static void emit(uint8_t byte) { emitting->push_back(byte); }
+
+void GatewayLink::send(const gateway_frame &frame) {
+  std::lock_guard<std::mutex> guard(write_lock);
+  std::string out;
+  emitting = &out;
+  gateway_write(frame, emit);
+  for (size_t done = 0; done < out.size();) {
+    ssize_t n = ::write(fd, out.data() + done, out.size() - done);
+    if (n < 0 && errno != EINTR && errno != EAGAIN) {
+      return;
+    }
+    done += n > 0 ? n : 0;
+  }
+}
+
+/**
+ * This function is responsible for sending a frame and waiting for the CT's
+ * answer to it. Returns false if none came in LINK_ANSWER_TIMEOUT.
+ */
+bool GatewayLink::request(gateway_frame &frame, gateway_frame *answer) {
+  std::unique_lock<std::mutex> guard(lock);
+  do {
+    frame.seq = ++next_seq;
+  } while (frame.seq == 0 || waiting.count(frame.seq));
+  waiting.insert(frame.seq);
+  guard.unlock();
+
+  send(frame);
+
+  guard.lock();
+  bool answered = changed.wait_for(
+      guard, std::chrono::milliseconds(LINK_ANSWER_TIMEOUT),
+      [&] { return answers.count(frame.seq) > 0; });
+  if (answered) {
+    *answer = answers[frame.seq];
+    answers.erase(frame.seq);
+  }
+  waiting.erase(frame.seq);
+  return answered;
+}
+
+/**
+ * This function is responsible for a frame from the CT: answers go to whoever
+ * waits for them, messages from nodes to the inbox.
+ */
+void GatewayLink::receive(const gateway_frame &frame) {
+  std::lock_guard<std::mutex> guard(lock);
+  frames++;
+  uint64_t now = now_ms();
+  switch (frame.kind) {
+  case GATEWAY_HELLO:
+    if (frame.size >= sizeof(hello)) {
+      memcpy(&hello, frame.payload, sizeof(hello));
+      hello_at = now;
+    }
+    break;
+  case GATEWAY_RX: {
+    link_message message;
+    message.at_ms = now;
+    message.node = frame.node;
+    message.size = frame.size;
+    memcpy(message.payload, frame.payload, frame.size);
+    inbox.push_back(message);
+    break;
+  }
+  default:
+    if (waiting.count(frame.seq)) {
+      answers[frame.seq] = frame;
+    }
+    break;
+  }
+  while (!inbox.empty() && now - inbox.front().at_ms > LINK_INBOX_MS) {
+    inbox.pop_front();
+  }
+  changed.notify_all();
+}
+
+/**
+ * This function is responsible for the CT's log lines, the bytes between
+ * frames, printed with -v.
+ */
+void GatewayLink::log(uint8_t byte) {
+  if (byte == '\n') {
+    if (verbose && !log_line.empty()) {
+      printf("CT: %s\n", log_line.c_str());
+    }
+    log_line.clear();
+  } else if (byte >= ' ' && log_line.size() < 256) {
+    log_line.push_back(byte);
+  }
+}
+
+void GatewayLink::readLoop() {
+  uint8_t buffer[512];
+  while (!stopping) {
+    struct pollfd p = {fd, POLLIN, 0};
+    if (poll(&p, 1, 100) <= 0) {
+      continue;
+    }
+    ssize_t n = ::read(fd, buffer, sizeof(buffer));
+    if (n <= 0) {
+      // A pty whose other end closed keeps polling readable
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      continue;
+    }
+    for (ssize_t i = 0; i < n; i++) {
+      bool was_idle = decoder.idle();
+      if (decoder.feed(buffer[i])) {
+        receive(decoder.getFrame());
+      } else if (was_idle && decoder.idle()) {
+        log(buffer[i]);
+      }
+    }
+  }
+}
+
+void GatewayLink::heartbeatLoop() {
+  gateway_frame frame;
+  memset(&frame, 0, sizeof(frame));
+  frame.kind = GATEWAY_HELLO;
+  while (!stopping) {
+    send(frame);
+    for (int t = 0; t < GATEWAY_HEARTBEAT / 100 && !stopping; t++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+  }
+}
+
+/*******************************************************************************
+************************************* Mesh *************************************
+********************************************************************************/
+
+/**
+ * This function is responsible for whether the CT bridges for this host. A
+ * CT that stopped answering hello does not.
+ */
+bool GatewayLink::bridging(gateway_hello *out) {
+  std::lock_guard<std::mutex> guard(lock);
+  if (out) {
+    *out = hello;
+  }
+  return hello_at != 0 &&
+         now_ms() - hello_at < GATEWAY_HEARTBEAT + LINK_ANSWER_TIMEOUT &&
+         hello.bridging;
+}
+
+/**
+ * This function is responsible for the mesh as the CT sees it, address by
+ * node ID.
+ */
+bool GatewayLink::nodes(std::map<uint8_t, uint16_t> &out) {
+  gateway_frame frame, answer;
+  memset(&frame, 0, sizeof(frame));
+  frame.kind = GATEWAY_NODES;
+  if (!request(frame, &answer)) {
+    return false;
+  }
+  out.clear();
+  for (int i = 0; i + 3 <= answer.size; i += 3) {
+    out[answer.payload[i]] =
+        answer.payload[i + 1] | (uint16_t)answer.payload[i + 2] << 8;
+  }
+  return true;
+}
+
+/**
+ * This function is responsible for writing to a node as writeTimeout does on
+ * the CT: attempt after attempt for WRITE_TIMEOUT. The attempts of several
+ * threads interleave.
+ */
+bool GatewayLink::write(uint16_t node, const void *data, uint8_t size) {
+  gateway_frame frame, answer;
+  frame.kind = GATEWAY_TX;
+  frame.node = node;
+  frame.type = LANE_BULK; // the CT moves it to the control lane if it fits
+  frame.size = size;
+  memcpy(frame.payload, data, size);
+
+  uint64_t started = now_ms();
+  while (now_ms() - started < WRITE_TIMEOUT && !stopping) {
+    bool ok = request(frame, &answer) && answer.size == 1 && answer.payload[0];
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      attempts++;
+      delivered += ok;
+    }
+    if (ok) {
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(LINK_RETRY_MS));
+  }
+  return false;
+}
+
+/**
+ * This function is responsible for the next message from node, waiting at
+ * most timeout_ms for it. Copies at most size bytes of it and returns its
+ * whole size, 0 if none came.
+ */
+int GatewayLink::read(uint16_t node, void *data, uint8_t size,
+                      unsigned timeout_ms) {
+  std::unique_lock<std::mutex> guard(lock);
+  std::deque<link_message>::iterator found;
+  auto from_node = [&] {
+    for (found = inbox.begin(); found != inbox.end(); ++found) {
+      if (found->node == node) {
+        return true;
+      }
+    }
+    return false;
+  };
+  if (!changed.wait_for(guard, std::chrono::milliseconds(timeout_ms),
+                        from_node)) {
+    return 0;
+  }
+  int n = found->size;
+  memcpy(data, found->payload, n < size ? n : size);
+  inbox.erase(found);
+  return n;
+}
+
+/**
+ * This function is responsible for turning the CT's pump on or off. The CT
+ * turns it off by itself after MAX_REFILL_MILLIS, or if this host goes away.
+ */
+bool GatewayLink::pump(bool on) {
+  gateway_frame frame, answer;
+  memset(&frame, 0, sizeof(frame));
+  frame.kind = GATEWAY_PUMP;
+  frame.size = 1;
+  frame.payload[0] = on;
+  for (int attempt = 0; attempt < 3; attempt++) {
+    if (request(frame, &answer) && answer.size == 1 &&
+        answer.payload[0] == on) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,85 @@
+#ifndef __GATEWAYD_LINK__
+#define __GATEWAYD_LINK__
+
+#include <AquariusGateway.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+// Host end of the gateway on a serial port or pty. A reader thread decodes
+// what the CT sends and a heartbeat thread says hello; any number of threads
+// can write to nodes and wait for what their nodes send at the same time.
+// Messages are matched to readers by the node they come from.
+
+#define LINK_ANSWER_TIMEOUT 500 // ms for the CT to answer a frame
+#define LINK_RETRY_MS 10        // between write attempts that failed
+#define LINK_INBOX_MS 30000     // messages nobody read are dropped after
+
+int serial_open(const char *path, int baud);
+
+typedef struct {
+  uint64_t at_ms;
+  uint16_t node;
+  uint8_t size;
+  uint8_t payload[GATEWAY_PAYLOAD_MAX];
+} link_message;
+
+class GatewayLink {
+private:
+  int fd;
+  bool verbose;
+  std::atomic<bool> stopping;
+  GatewayDecoder decoder;
+  std::thread reader;
+  std::thread heartbeat;
+
+  std::mutex write_lock;
+  std::mutex lock;
+  std::condition_variable changed;
+  uint8_t next_seq;
+  std::set<uint8_t> waiting;
+  std::map<uint8_t, gateway_frame> answers;
+  std::deque<link_message> inbox;
+  gateway_hello hello;
+  uint64_t hello_at;
+  uint64_t frames;
+  uint64_t attempts;
+  uint64_t delivered;
+  std::string log_line;
+
+  void send(const gateway_frame &frame);
+  bool request(gateway_frame &frame, gateway_frame *answer);
+  void receive(const gateway_frame &frame);
+  void log(uint8_t byte);
+  void readLoop();
+  void heartbeatLoop();
+
+public:
+  GatewayLink(int fd, bool verbose);
+  ~GatewayLink();
+
+  void start();
+  void stop();
+
+  bool bridging(gateway_hello *out);
+  bool nodes(std::map<uint8_t, uint16_t> &out);
+  bool write(uint16_t node, const void *data, uint8_t size);
+  int read(uint16_t node, void *data, uint8_t size, unsigned timeout_ms);
+  bool pump(bool on);
+
+  uint64_t getFrames() { return frames; }
+  uint32_t getErrors() { return decoder.getErrors(); }
+  uint64_t getAttempts() { return attempts; }
+  uint64_t getDelivered() { return delivered; }
+};
+
+uint64_t now_ms();
+
+#endif
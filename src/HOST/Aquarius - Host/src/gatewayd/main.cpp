@@ -0,0 +1,683 @@
+#include <Aquarius.h>
+#include <Aquarius_config.h>
+#include <AquariusDrying.h>
+#include <AquariusRoute.h>
+#include <AquariusTime.h>
+#include <AquariusValidity.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "link.h"
+#include "upload.h"
+
+// Runs the CT's cycle for a CT built as env:gateway, which only bridges the
+// mesh to this host over Serial. The cycle is the CT's own, with what the
+// Mega could not do:
+//
+// - every harvester is asked at once and waited for by a thread of its own;
+// - readings are uploaded by a thread of their own, in pipelined batches,
+//   while the cars are refilled and sent;
+// - each car's return is awaited by a thread of its own, so the next harvest
+//   does not wait for the patrol. A new patrol waits for every car to be
+//   back, so no car has to get past another.
+//
+// Stop it and the CT runs the phases on board again after
+// GATEWAY_HOST_TIMEOUT. gateway_sim stands in for the CT on a pty.
+//
+// Usage: gatewayd -d device [-b baud] [-a address] [-p port] [-n cycles]
+//                 [-w max_wait_s] [-v]
+
+// As on the CT
+#define DRY_HUMIDITY 30
+#define MAX_HARVEST_AGE 60000
+#define TIME_SYNC_PERIOD 3600000UL
+#define CYCLE_LEAD_S 600UL
+#define CYCLE_MAX_WAIT_S 3600UL
+#define WATER_AHEAD_S 10800UL
+
+// A car that has not said it is back after this long is taken to be
+#define PATROL_TIMEOUT 1800000UL
+#define RETRY_MS 3000
+
+// Nodes on another protocol, or that did not answer the hello, are asked
+// again after this long, as on the CT
+#define PROTOCOL_RECHECK_MS 600000ULL
+
+static struct {
+  const char *device;
+  int baud;
+  const char *address;
+  int port;
+  int cycles;
+  int max_wait;
+  bool verbose;
+} options = {NULL, GATEWAY_BAUD, "127.0.0.1", 8080, 0, CYCLE_MAX_WAIT_S,
+             false};
+
+static volatile sig_atomic_t stopping = 0;
+
+static void on_signal(int) { stopping = 1; }
+
+static GatewayLink *gateway;
+static Uploader *uploader;
+static std::map<uint8_t, uint16_t> mesh;
+
+// Protocol each node answered the hello with, and when it was asked
+typedef struct {
+  uint8_t version;
+  uint64_t asked_at;
+} node_hello;
+static std::mutex protocol_lock;
+static std::map<uint8_t, node_hello> node_protocol;
+
+// Harvest, as on the CT
+static uint8_t pot_data[MAX_HARVESTERS * POTS_PER_HARVESTER];
+static bool harvested[MAX_HARVESTERS];
+static uint32_t pot_time[MAX_HARVESTERS];
+static uint64_t time_sent_at[MAX_HARVESTERS];
+static validity_pot validity_pots[POTS];
+static ValidityModel validity(validity_pots, POTS);
+
+// Fleet: car_out is cleared by the car's waiter thread
+static drying_pot drying_pots[POTS];
+static DryingModel drying(drying_pots, POTS);
+static bool needs_water[POTS];
+static int first_stop[MAX_CARS + 1];
+static int cars;
+static std::atomic<bool> car_out[MAX_CARS];
+static std::thread car_waiters[MAX_CARS];
+
+// Cars held before a farther package until its car is back, and cars lost on
+// the track until they say they are back at the dock, as on the CT
+static std::atomic<bool> car_lost[MAX_CARS];
+static std::mutex held_lock;
+static bool car_held[MAX_CARS];
+static uint16_t car_address[MAX_CARS];
+
+static uint32_t unix_now() { return time(NULL); }
+
+static bool write_signal(uint16_t node, aq_signal signal) {
+  return gateway->write(node, &signal, sizeof(signal));
+}
+
+static bool read_signal(uint16_t node, aq_signal *signal,
+                        unsigned timeout_ms) {
+  return gateway->read(node, signal, sizeof(*signal), timeout_ms) ==
+         sizeof(*signal);
+}
+
+/**
+ * This function is responsible for the protocol handshake on first contact
+ * with a node, as node_compatible on the CT. Returns false for a node that
+ * runs another protocol or did not answer the hello.
+ */
+static bool node_compatible(uint8_t id, uint16_t address) {
+  {
+    std::lock_guard<std::mutex> guard(protocol_lock);
+    auto known = node_protocol.find(id);
+    if (known != node_protocol.end() &&
+        (known->second.version == PROTOCOL_VERSION ||
+         now_ms() - known->second.asked_at < PROTOCOL_RECHECK_MS)) {
+      return known->second.version == PROTOCOL_VERSION;
+    }
+  }
+
+  protocol_hello hello;
+  hello.signal = SIG_HELLO;
+  hello.version = PROTOCOL_VERSION;
+  if (!gateway->write(address, &hello, sizeof(hello))) {
+    return true;
+  }
+  node_hello answer = {PROTOCOL_UNKNOWN, now_ms()};
+  if (gateway->read(address, &hello, sizeof(hello), READ_TIMEOUT) >=
+          (int)sizeof(hello) &&
+      hello.signal == SIG_HELLO) {
+    answer.version = hello.version;
+  }
+  {
+    std::lock_guard<std::mutex> guard(protocol_lock);
+    node_protocol[id] = answer;
+  }
+
+  if (answer.version == PROTOCOL_VERSION) {
+    return true;
+  }
+  if (answer.version == PROTOCOL_UNKNOWN) {
+    printf("ERROR: Leaving out node %d, it did not answer the hello!\n", id);
+  } else {
+    printf("ERROR: Leaving out node %d, it runs protocol %d and we %d\n", id,
+           answer.version, PROTOCOL_VERSION);
+  }
+  return false;
+}
+
+/*******************************************************************************
+*********************************** Harvest ************************************
+********************************************************************************/
+
+/**
+ * This function is responsible for one harvester's part of the harvest, on a
+ * thread of its own, and for sending it the time once per TIME_SYNC_PERIOD.
+ */
+static void harvest_one(int i, uint16_t address) {
+  if (!node_compatible(MESH_ID_HARVESTER + i, address)) {
+    return;
+  }
+  if (!write_signal(address, SIG_HARVEST_START)) {
+    printf("TIMEOUT: Cannot start harvest for harvester: %d\n", i + 1);
+    return;
+  }
+
+  harvest_data reply;
+  if (gateway->read(address, &reply, sizeof(reply), READ_TIMEOUT) !=
+      sizeof(reply)) {
+    printf("TIMEOUT: Could not read data from harvester: %d\n", i + 1);
+    return;
+  }
+  if (reply.age > MAX_HARVEST_AGE) {
+    printf("WARNING: Stale data from harvester: %d\n", i + 1);
+  }
+  memcpy(pot_data + i * POTS_PER_HARVESTER, reply.humidity,
+         POTS_PER_HARVESTER);
+  pot_time[i] = unix_now() - reply.age / 1000;
+  harvested[i] = true;
+
+  if (time_sent_at[i] == 0 || now_ms() - time_sent_at[i] >= TIME_SYNC_PERIOD) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    time_sync message;
+    message.signal = SIG_TIME_SYNC;
+    message.seconds = ts.tv_sec;
+    message.milliseconds = ts.tv_nsec / 1000000;
+    if (gateway->write(address, &message, sizeof(message))) {
+      time_sent_at[i] = now_ms();
+    }
+  }
+}
+
+/**
+ * This function is responsible for asking every harvester in the mesh at
+ * once. Returns how many answered.
+ */
+static int harvest() {
+  memset(pot_data, 0, sizeof(pot_data));
+  memset(harvested, 0, sizeof(harvested));
+
+  std::vector<std::thread> threads;
+  for (const auto &node : mesh) {
+    int i = node.first - MESH_ID_HARVESTER;
+    if (i >= 0 && i < MAX_HARVESTERS) {
+      threads.push_back(std::thread(harvest_one, i, node.second));
+    }
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+
+  int answered = 0;
+  int implausible = 0;
+  for (int i = 0; i < MAX_HARVESTERS; i++) {
+    if (!harvested[i]) {
+      continue;
+    }
+    answered++;
+    for (int pot = i * POTS_PER_HARVESTER;
+         pot < (i + 1) * POTS_PER_HARVESTER && pot < POTS; pot++) {
+      implausible += validity.check(pot, pot_time[i], pot_data[pot]) != 0;
+    }
+    printf("%d:", i + 1);
+    for (int p = 0; p < POTS_PER_HARVESTER; p++) {
+      printf(" %d", pot_data[i * POTS_PER_HARVESTER + p]);
+    }
+    printf("\n");
+  }
+  printf("Harvesters: %d of %zu answered\n", answered, threads.size());
+  if (implausible > 0) {
+    printf("WARNING: Implausible readings: %d\n", implausible);
+    for (int i = 0; i < POTS; i++) {
+      if (harvested[i / POTS_PER_HARVESTER] && !validity.plausible(i)) {
+        printf("WARNING: Pot left out of the plan: %d, reading %d, flags %d\n",
+               i, pot_data[i], validity.getFlags(i));
+      }
+    }
+  }
+  return answered;
+}
+
+/**
+ * This function is responsible for why a pot's last reading is implausible,
+ * as pot_flags on the CT.
+ */
+static uint8_t pot_flags(int pot) {
+  return pot < POTS ? validity.getFlags(pot) : validity_range(pot_data[pot]);
+}
+
+/**
+ * This function is responsible for queueing the readings for upload, as
+ * persist_data does on the CT.
+ */
+static void persist() {
+  char data[96];
+  for (int i = 0; i < MAX_HARVESTERS * POTS_PER_HARVESTER; i++) {
+    int h = i / POTS_PER_HARVESTER;
+    if (!harvested[h]) {
+      continue;
+    }
+    snprintf(data, sizeof(data), "harvester=%d&pot=%d&humidity=%d&time=%u",
+             h + 1, i % POTS_PER_HARVESTER + 1, pot_data[i], pot_time[h]);
+    if (pot_flags(i) != 0) {
+      size_t used = strlen(data);
+      snprintf(data + used, sizeof(data) - used, "&flags=%d", pot_flags(i));
+    }
+    uploader->post("POST /php/data.php? HTTP/1.1", data);
+  }
+}
+
+/*******************************************************************************
+************************************ Fleet *************************************
+********************************************************************************/
+
+/**
+ * This function is responsible for which pots need water, as plan_water on
+ * the CT, with the host's clock always synced.
+ */
+static void plan_water() {
+  uint32_t now = unix_now();
+  bool any = false;
+
+  for (int h = 0; h < MAX_HARVESTERS; h++) {
+    if (harvested[h]) {
+      for (int p = 0; p < POTS_PER_HARVESTER; p++) {
+        int pot = h * POTS_PER_HARVESTER + p;
+        if (pot < POTS && validity.plausible(pot) &&
+            !validity_range(pot_data[pot])) {
+          drying.observe(pot, pot_time[h], pot_data[pot]);
+        }
+      }
+    }
+  }
+
+  for (int i = 0; i < POTS; i++) {
+    bool read = harvested[i / POTS_PER_HARVESTER] && validity.plausible(i);
+    uint32_t due =
+        drying.trusted(i) ? drying.crossing(i, DRY_HUMIDITY) : DRYING_NEVER;
+    needs_water[i] = read ? pot_data[i] < DRY_HUMIDITY ||
+                                due <= now + CYCLE_LEAD_S
+                          : due <= now;
+    any = any || needs_water[i];
+  }
+  if (!any) {
+    return;
+  }
+
+  for (int i = 0; i < POTS; i++) {
+    if (!needs_water[i] && drying.trusted(i) &&
+        drying.crossing(i, DRY_HUMIDITY) <= now + WATER_AHEAD_S) {
+      needs_water[i] = true;
+      printf("Watering ahead pot %d\n", i);
+    }
+  }
+}
+
+/**
+ * This function is responsible for refilling one car's tank with what its
+ * package needs, running the pump for what the car lacks or until the car
+ * says stop, as refill_car on the CT.
+ */
+static bool refill_car(int car, uint16_t address, const bool *package) {
+  refill_message refill;
+  refill.signal = SIG_REFILL_START;
+  refill.ml = route_dry_pots(package) * POT_DOSE_ML + REFILL_MARGIN_ML;
+  uint16_t needed = refill.ml;
+  printf("Refilling car: %d, needs (ml): %u\n", car + 1, needed);
+  if (!gateway->write(address, &refill, sizeof(refill))) {
+    printf("TIMEOUT: Sending SIG_REFILL_START failed!\n");
+    return false;
+  }
+  if (gateway->read(address, &refill, sizeof(refill), READ_TIMEOUT) <
+      (int)sizeof(refill.signal)) {
+    printf("TIMEOUT: Receiving acknowledgement failed!\n");
+    return false;
+  }
+  if (refill.signal == SIG_REFILL_STOP) {
+    printf("Car holds enough water, skipping the refill!\n");
+    return true;
+  }
+  if (refill.signal == SIG_REFILL_FAULT) {
+    printf("ERROR: Water level sensor fault on car: %d\n", car + 1);
+    return false;
+  }
+  if (refill.signal != SIG_REFILL_ACK) {
+    printf("ERROR: Incorrect response: %d\n", refill.signal);
+    return false;
+  }
+  uint16_t lacking = needed > refill.ml ? needed - refill.ml : 0;
+  uint64_t pump_ms = lacking * 1000ULL / REFILL_ML_PER_S;
+  pump_ms = pump_ms < MAX_REFILL_MILLIS ? pump_ms : MAX_REFILL_MILLIS;
+  printf("Car holds (ml): %u, pumping (ms): %llu\n", refill.ml,
+         (unsigned long long)pump_ms);
+  aq_signal signal;
+
+  if (!gateway->pump(true)) {
+    printf("ERROR: The CT did not turn the pump on!\n");
+    return false;
+  }
+  uint64_t started = now_ms();
+  bool full = false;
+  while (!full) {
+    uint64_t elapsed = now_ms() - started;
+    if (elapsed >= pump_ms) {
+      break;
+    }
+    full = read_signal(address, &signal, pump_ms - elapsed) &&
+           signal == SIG_REFILL_STOP;
+  }
+  gateway->pump(false);
+  printf("Refill took (ms): %llu%s\n",
+         (unsigned long long)(now_ms() - started),
+         full ? ", the car said stop" : "");
+
+  if (!full && !write_signal(address, SIG_REFILL_STOP)) {
+    printf("Could not tell the car that the refill is over!\n");
+  }
+  return true;
+}
+
+static bool farther_car_out(int car) {
+  for (int k = car + 1; k < cars; k++) {
+    if (car_out[k] || car_lost[k]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * This function is responsible for letting the held cars drive on once every
+ * car on a farther package is back, as release_cars on the CT. Called by
+ * every car's waiter, so a car not reached is tried again.
+ */
+static void release_cars() {
+  std::lock_guard<std::mutex> guard(held_lock);
+  for (int k = 0; k < cars; k++) {
+    if (!car_held[k] || farther_car_out(k)) {
+      continue;
+    }
+    if (car_out[k]) {
+      if (!write_signal(car_address[k], SIG_PATROL_GO)) {
+        continue;
+      }
+      printf("Track ahead is clear for car: %d\n", k + 1);
+    }
+    car_held[k] = false;
+  }
+}
+
+/**
+ * This function is responsible for sending one car its package and for
+ * starting the thread that waits for it to come back.
+ */
+static bool dispatch_car(int car, uint16_t address, bool *package) {
+  patrol_start start;
+  start.signal = SIG_PATROL_START;
+  start.hold_stop =
+      farther_car_out(car) ? first_stop[car + 1] - 1 : ROUTE_DOCK;
+  printf("Patrol for car %d: %d pots, last stop %d, holds at %d\n", car + 1,
+         route_dry_pots(package), route_last_stop(package), start.hold_stop);
+
+  uint8_t message[POTS];
+  for (int i = 0; i < POTS; i++) {
+    message[i] = package[i];
+  }
+  aq_signal signal;
+  if (!gateway->write(address, &start, sizeof(start)) ||
+      !gateway->write(address, message, sizeof(message))) {
+    printf("Could not send car to patrol!\n");
+    return false;
+  }
+  bool confirmed = read_signal(address, &signal, READ_TIMEOUT);
+  if (confirmed && signal == SIG_REFILL_STOP) {
+    confirmed = read_signal(address, &signal, READ_TIMEOUT);
+  }
+  if (!confirmed || signal != SIG_PATROL_START) {
+    printf("Car did not confirm that it started!\n");
+    return false;
+  }
+
+  if (car_waiters[car].joinable()) {
+    car_waiters[car].join();
+  }
+  {
+    std::lock_guard<std::mutex> guard(held_lock);
+    car_held[car] = start.hold_stop != ROUTE_DOCK;
+    car_address[car] = address;
+  }
+  car_out[car] = true;
+  uint64_t started = now_ms();
+  car_waiters[car] = std::thread([car, address, started] {
+    aq_signal signal;
+    while (!stopping && now_ms() - started < PATROL_TIMEOUT) {
+      release_cars();
+      if (!read_signal(address, &signal, 1000)) {
+        continue;
+      }
+      if (signal == SIG_PATROL_STOP) {
+        printf("Car %d back after (ms): %llu\n", car + 1,
+               (unsigned long long)(now_ms() - started));
+        break;
+      }
+      if (signal == SIG_PATROL_LOST) {
+        printf("ERROR: Car %d lost on the track, left out until it is docked\n",
+               car + 1);
+        car_lost[car] = true;
+        break;
+      }
+    }
+    car_out[car] = false;
+    release_cars();
+  });
+  return true;
+}
+
+/**
+ * This function is responsible for the patrol: planning it and refilling and
+ * sending each car, farthest package first. Skipped while a car is out.
+ */
+static void patrol() {
+  for (int k = 0; k < cars; k++) {
+    if (car_out[k]) {
+      printf("Car %d is still out, the patrol waits\n", k + 1);
+      return;
+    }
+  }
+
+  plan_water();
+  route_split(needs_water, NULL, cars, first_stop);
+
+  bool package[POTS];
+  for (int k = cars - 1; k >= 0; k--) {
+    route_mask(needs_water, first_stop[k], first_stop[k + 1], package);
+    if (route_last_stop(package) == ROUTE_NO_STOP) {
+      continue;
+    }
+    auto car = mesh.find(MESH_ID_CAR + k);
+    if (car == mesh.end()) {
+      printf("ERROR: Car is not in the mesh: %d\n", k + 1);
+      continue;
+    }
+    aq_signal signal;
+    if (car_lost[k] &&
+        (!read_signal(car->second, &signal, 0) || signal != SIG_PATROL_STOP)) {
+      printf("Car %d is lost, its stops stay dry\n", k + 1);
+      continue;
+    }
+    if (car_lost[k]) {
+      printf("Lost car back at the dock: %d\n", k + 1);
+      car_lost[k] = false;
+    }
+    if (!node_compatible(car->first, car->second) ||
+        !refill_car(k, car->second, package) ||
+        !dispatch_car(k, car->second, package)) {
+      continue;
+    }
+    for (int i = 0; i < POTS; i++) {
+      if (package[i]) {
+        drying.watered(i, unix_now());
+        validity.watered(i);
+      }
+    }
+  }
+}
+
+/**
+ * This function is responsible for how long to wait for the next cycle, as
+ * schedule_cycle on the CT, at most -w seconds.
+ */
+static uint32_t next_wait() {
+  uint32_t now = unix_now();
+  uint32_t next = drying.next(now, DRY_HUMIDITY);
+  uint32_t wait = next - now;
+  if (next == DRYING_NEVER || wait > CYCLE_MAX_WAIT_S + CYCLE_LEAD_S) {
+    wait = CYCLE_MAX_WAIT_S;
+  } else {
+    wait = wait > CYCLE_LEAD_S ? wait - CYCLE_LEAD_S : 0;
+  }
+  return wait < (uint32_t)options.max_wait ? wait : options.max_wait;
+}
+
+static void sleep_ms(uint64_t ms) {
+  uint64_t until = now_ms() + ms;
+  while (!stopping && now_ms() < until) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    const char *value = i + 1 < argc ? argv[i + 1] : "";
+    if (strcmp(argv[i], "-v") == 0) {
+      options.verbose = true;
+      continue;
+    }
+    if (strcmp(argv[i], "-d") == 0) {
+      options.device = value;
+    } else if (strcmp(argv[i], "-b") == 0) {
+      options.baud = atoi(value);
+    } else if (strcmp(argv[i], "-a") == 0) {
+      options.address = value;
+    } else if (strcmp(argv[i], "-p") == 0) {
+      options.port = atoi(value);
+    } else if (strcmp(argv[i], "-n") == 0) {
+      options.cycles = atoi(value);
+    } else if (strcmp(argv[i], "-w") == 0) {
+      options.max_wait = atoi(value);
+    }
+    i++;
+  }
+  if (!options.device) {
+    fprintf(stderr, "Usage: gatewayd -d device [-b baud] [-a address] "
+                    "[-p port] [-n cycles] [-w max_wait_s] [-v]\n");
+    return 2;
+  }
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  drying.reset();
+
+  int fd = serial_open(options.device, options.baud);
+  if (fd < 0) {
+    perror(options.device);
+    return 1;
+  }
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  gateway = new GatewayLink(fd, options.verbose);
+  uploader = new Uploader(options.address, options.port);
+  gateway->start();
+  uploader->start();
+
+  int status = 0;
+  bool waiting = false;
+  for (int cycle = 0;
+       !stopping && (options.cycles == 0 || cycle < options.cycles);) {
+    gateway_hello hello;
+    if (!gateway->bridging(&hello)) {
+      if (!waiting) {
+        printf("Waiting for the CT to bridge\n");
+      }
+      waiting = true;
+      sleep_ms(100);
+      continue;
+    }
+    waiting = false;
+    if (hello.version != GATEWAY_VERSION || hello.pots != POTS ||
+        hello.pots_per_harvester != POTS_PER_HARVESTER ||
+        hello.protocol != PROTOCOL_VERSION) {
+      fprintf(stderr,
+              "CT speaks gateway %d, protocol %d with %d pots, expected %d, "
+              "%d, %d\n",
+              hello.version, hello.protocol, hello.pots, GATEWAY_VERSION,
+              PROTOCOL_VERSION, POTS);
+      status = 1;
+      break;
+    }
+    cars = hello.cars < MAX_CARS ? hello.cars : MAX_CARS;
+
+    uint64_t started = now_ms();
+    if (!gateway->nodes(mesh)) {
+      printf("ERROR: The CT did not list the mesh!\n");
+      continue;
+    }
+    if (harvest() == 0) {
+      printf("PHASE-ERROR: Harvest failed!\n");
+      sleep_ms(RETRY_MS);
+      continue;
+    }
+    uint64_t harvest_ms = now_ms() - started;
+    persist();
+    patrol();
+    cycle++;
+
+    uint32_t wait = next_wait();
+    printf("Cycle %d: harvest %llu ms, cycle %llu ms, %zu uploads pending, "
+           "next in %u s\n",
+           cycle, (unsigned long long)harvest_ms,
+           (unsigned long long)(now_ms() - started), uploader->getPending(),
+           wait);
+    if (options.cycles == 0 || cycle < options.cycles) {
+      sleep_ms(wait * 1000ULL);
+    }
+  }
+
+  for (int k = 0; k < MAX_CARS; k++) {
+    if (car_waiters[k].joinable()) {
+      car_waiters[k].join();
+    }
+  }
+  uploader->stop();
+  gateway->stop();
+  printf("Gateway: %llu frames, %u bad, %llu of %llu writes delivered\n",
+         (unsigned long long)gateway->getFrames(), gateway->getErrors(),
+         (unsigned long long)gateway->getDelivered(),
+         (unsigned long long)gateway->getAttempts());
+  printf("Uploads: %llu posted, %llu rejected, %llu dropped, %llu batches\n",
+         (unsigned long long)uploader->getPosted(),
+         (unsigned long long)uploader->getRejected(),
+         (unsigned long long)uploader->getDropped(),
+         (unsigned long long)uploader->getBatches());
+  delete uploader;
+  delete gateway;
+  close(fd);
+  return status;
+}
@@ -0,0 +1,192 @@
+#include "upload.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+
+Uploader::Uploader(const char *address, int port)
+    : address(address), port(port), fd(-1), stopping(false), posted(0),
+      rejected(0), dropped(0), batches(0) {}
+
+Uploader::~Uploader() { stop(); }
+
+void Uploader::start() { worker = std::thread(&Uploader::run, this); }
+
+/**
+ * This function is responsible for stopping once what is queued went out, or
+ * failed to.
+ */
+void Uploader::stop() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  changed.notify_all();
+  if (worker.joinable()) {
+    worker.join();
+  }
+  if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+void Uploader::post(const char *request_line, const std::string &data) {
+  std::string request = request_line;
+  request += "\r\nHost: si-aquarius.go.ro\r\n"
+             "Content-Type: application/x-www-form-urlencoded\r\n"
+             "Content-Length: ";
+  request += std::to_string(data.size());
+  request += "\r\n\r\n";
+  request += data;
+  request += "\r\n";
+
+  std::lock_guard<std::mutex> guard(lock);
+  if (queue.size() >= UPLOAD_QUEUE_MAX) {
+    dropped++;
+    return;
+  }
+  queue.push_back(request);
+  changed.notify_all();
+}
+
+size_t Uploader::getPending() {
+  std::lock_guard<std::mutex> guard(lock);
+  return queue.size();
+}
+
+bool Uploader::connect() {
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in to;
+  memset(&to, 0, sizeof(to));
+  to.sin_family = AF_INET;
+  to.sin_port = htons(port);
+  inet_pton(AF_INET, address.c_str(), &to.sin_addr);
+  if (fd < 0 || ::connect(fd, (struct sockaddr *)&to, sizeof(to)) < 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    fd = -1;
+    return false;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return true;
+}
+
+/**
+ * This function is responsible for the size of the first response in in, 0
+ * while it is not all there. ok is whether it was a 2xx.
+ */
+static size_t response_size(const std::string &in, bool *ok) {
+  size_t head_end = in.find("\r\n\r\n");
+  if (head_end == std::string::npos) {
+    return 0;
+  }
+  size_t length = 0;
+  for (size_t line = in.find("\r\n") + 2; line < head_end;) {
+    size_t next = in.find("\r\n", line);
+    if (strncasecmp(in.c_str() + line, "Content-Length:", 15) == 0) {
+      length = strtoul(in.c_str() + line + 15, NULL, 10);
+    }
+    line = next + 2;
+  }
+  if (in.size() < head_end + 4 + length) {
+    return 0;
+  }
+  *ok = in.compare(0, 10, "HTTP/1.1 2") == 0 ||
+        in.compare(0, 10, "HTTP/1.0 2") == 0;
+  return head_end + 4 + length;
+}
+
+/**
+ * This function is responsible for sending a batch in one go and reading
+ * every response to it. Returns false if the connection failed on the way;
+ * answered counts the responses read, ok the 2xx ones among them.
+ */
+bool Uploader::flush(const std::deque<std::string> &batch, size_t *answered,
+                     size_t *ok) {
+  std::string out;
+  for (const std::string &request : batch) {
+    out += request;
+  }
+  for (size_t done = 0; done < out.size();) {
+    ssize_t n = send(fd, out.data() + done, out.size() - done, MSG_NOSIGNAL);
+    if (n <= 0) {
+      return false;
+    }
+    done += n;
+  }
+
+  std::string in;
+  char buffer[4096];
+  for (*answered = 0, *ok = 0; *answered < batch.size();) {
+    bool success = false;
+    size_t size = response_size(in, &success);
+    if (size > 0) {
+      in.erase(0, size);
+      *ok += success;
+      (*answered)++;
+      continue;
+    }
+    struct pollfd p = {fd, POLLIN, 0};
+    if (poll(&p, 1, UPLOAD_TIMEOUT_MS) <= 0) {
+      return false;
+    }
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n <= 0) {
+      return false;
+    }
+    in.append(buffer, n);
+  }
+  return true;
+}
+
+void Uploader::run() {
+  std::unique_lock<std::mutex> guard(lock);
+  while (true) {
+    changed.wait(guard, [&] { return stopping || !queue.empty(); });
+    if (queue.empty()) {
+      return;
+    }
+
+    size_t n = queue.size() < UPLOAD_BATCH ? queue.size() : UPLOAD_BATCH;
+    std::deque<std::string> batch(queue.begin(), queue.begin() + n);
+    guard.unlock();
+
+    size_t answered = 0, ok = 0;
+    bool sent = (fd >= 0 || connect()) && flush(batch, &answered, &ok);
+
+    // Only what was not answered is sent again
+    guard.lock();
+    queue.erase(queue.begin(), queue.begin() + answered);
+    posted += ok;
+    rejected += answered - ok;
+    if (sent) {
+      batches++;
+      continue;
+    }
+
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+    if (stopping) {
+      fprintf(stderr, "Upload failed, %zu forms not sent\n", queue.size());
+      dropped += queue.size();
+      queue.clear();
+      return;
+    }
+    changed.wait_for(guard, std::chrono::milliseconds(UPLOAD_RETRY_MS),
+                     [&] { return stopping; });
+  }
+}
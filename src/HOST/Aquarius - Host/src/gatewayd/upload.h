@@ -0,0 +1,58 @@
+#ifndef __GATEWAYD_UPLOAD__
+#define __GATEWAYD_UPLOAD__
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Uploads forms to the database server, or ingest, on a thread of its own:
+// whatever is queued when it gets to it goes out as one batch of pipelined
+// requests on a kept alive connection, formatted as post_form() does on the
+// CT. A batch that fails is retried, in order, after UPLOAD_RETRY_MS.
+
+#define UPLOAD_BATCH 256
+#define UPLOAD_QUEUE_MAX 100000 // forms kept while the server is down, newer
+                                // ones are dropped
+#define UPLOAD_RETRY_MS 1000
+#define UPLOAD_TIMEOUT_MS 5000
+
+class Uploader {
+private:
+  std::string address;
+  int port;
+  int fd;
+  bool stopping;
+  std::thread worker;
+  std::mutex lock;
+  std::condition_variable changed;
+  std::deque<std::string> queue;
+  uint64_t posted;
+  uint64_t rejected;
+  uint64_t dropped;
+  uint64_t batches;
+
+  bool connect();
+  bool flush(const std::deque<std::string> &batch, size_t *answered,
+             size_t *ok);
+  void run();
+
+public:
+  Uploader(const char *address, int port);
+  ~Uploader();
+
+  void start();
+  void stop();
+  void post(const char *request_line, const std::string &data);
+
+  size_t getPending();
+  uint64_t getPosted() { return posted; }
+  uint64_t getRejected() { return rejected; }
+  uint64_t getDropped() { return dropped; }
+  uint64_t getBatches() { return batches; }
+};
+
+#endif
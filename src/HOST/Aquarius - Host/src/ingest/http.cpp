@@ -0,0 +1,151 @@
+#include "http.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static const char *find(const char *from, const char *to, const char *what) {
+  size_t n = strlen(what);
+  for (const char *p = from; p + n <= to; p++) {
+    if (memcmp(p, what, n) == 0) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+static bool header_is(const char *line, const char *end, const char *name) {
+  size_t n = strlen(name);
+  return (size_t)(end - line) > n && strncasecmp(line, name, n) == 0 &&
+         line[n] == ':';
+}
+
+static const char *header_value(const char *line, const char *name) {
+  const char *v = line + strlen(name) + 1;
+  while (*v == ' ' || *v == '\t') {
+    v++;
+  }
+  return v;
+}
+
+/**
+ * This function is responsible for parsing the first request in the buffer.
+ * Returns the bytes it takes up, HTTP_INCOMPLETE if more are needed or
+ * HTTP_MALFORMED; body points into the buffer.
+ */
+long http_parse(const char *in, size_t length, http_request *request) {
+  const char *start = in;
+  const char *end = in + length;
+  while (start < end && (*start == '\r' || *start == '\n')) {
+    start++;
+  }
+
+  const char *limit =
+      end - start > HTTP_MAX_HEAD ? start + HTTP_MAX_HEAD : end;
+  const char *head_end = find(start, limit, "\r\n\r\n");
+  if (!head_end) {
+    return limit == end ? HTTP_INCOMPLETE : HTTP_MALFORMED;
+  }
+
+  // Request line
+  const char *line_end = find(start, head_end + 2, "\r\n");
+  const char *space = (const char *)memchr(start, ' ', line_end - start);
+  if (!space || (size_t)(space - start) >= sizeof(request->method)) {
+    return HTTP_MALFORMED;
+  }
+  memcpy(request->method, start, space - start);
+  request->method[space - start] = '\0';
+
+  const char *target = space + 1;
+  const char *target_end =
+      (const char *)memchr(target, ' ', line_end - target);
+  if (!target_end) {
+    return HTTP_MALFORMED;
+  }
+  const char *query = (const char *)memchr(target, '?', target_end - target);
+  const char *path_end = query ? query : target_end;
+  if ((size_t)(path_end - target) >= sizeof(request->path)) {
+    return HTTP_MALFORMED;
+  }
+  memcpy(request->path, target, path_end - target);
+  request->path[path_end - target] = '\0';
+  request->query = query ? query + 1 : target_end;
+  request->query_length = target_end - request->query;
+  request->close = find(target_end, line_end, "HTTP/1.0") != NULL;
+
+  // Headers
+  size_t body_length = 0;
+  for (const char *line = line_end + 2; line < head_end + 2;) {
+    const char *next = find(line, head_end + 2, "\r\n");
+    if (header_is(line, next, "Content-Length")) {
+      body_length = strtoul(header_value(line, "Content-Length"), NULL, 10);
+    } else if (header_is(line, next, "Connection")) {
+      const char *v = header_value(line, "Connection");
+      if (strncasecmp(v, "close", 5) == 0) {
+        request->close = true;
+      } else if (strncasecmp(v, "keep-alive", 10) == 0) {
+        request->close = false;
+      }
+    }
+    line = next + 2;
+  }
+  if (body_length > HTTP_MAX_BODY) {
+    return HTTP_MALFORMED;
+  }
+
+  const char *body = head_end + 4;
+  if ((size_t)(end - body) < body_length) {
+    return HTTP_INCOMPLETE;
+  }
+  request->body = body;
+  request->body_length = body_length;
+  return body + body_length - in;
+}
+
+static int hex_value(int c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/**
+ * This function is responsible for the decoded value of a form field. Returns
+ * false if the field is not there or does not fit.
+ */
+bool form_value(const char *body, size_t length, const char *key, char *out,
+                size_t size) {
+  size_t key_length = strlen(key);
+  const char *end = body + length;
+  for (const char *field = body; field < end;) {
+    const char *field_end = (const char *)memchr(field, '&', end - field);
+    if (!field_end) {
+      field_end = end;
+    }
+    if ((size_t)(field_end - field) > key_length &&
+        memcmp(field, key, key_length) == 0 && field[key_length] == '=') {
+      size_t n = 0;
+      for (const char *p = field + key_length + 1; p < field_end; p++) {
+        int c = *p;
+        if (c == '+') {
+          c = ' ';
+        } else if (c == '%' && field_end - p > 2 && hex_value(p[1]) >= 0 &&
+                   hex_value(p[2]) >= 0) {
+          c = hex_value(p[1]) * 16 + hex_value(p[2]);
+          p += 2;
+        }
+        if (n + 1 >= size) {
+          return false;
+        }
+        out[n++] = c;
+      }
+      out[n] = '\0';
+      return true;
+    }
+    field = field_end + 1;
+  }
+  return false;
+}
@@ -0,0 +1,34 @@
+#ifndef __INGEST_HTTP__
+#define __INGEST_HTTP__
+
+#include <stddef.h>
+
+// Just enough HTTP/1.1 for what the CT sends: pipelined POSTs with a
+// Content-Length and a form body, on one kept alive connection. The CT ends
+// every body with a CRLF Content-Length does not count; blank lines before a
+// request line are skipped for that.
+
+#define HTTP_MAX_HEAD 4096
+#define HTTP_MAX_BODY 4096
+#define HTTP_MAX_PATH 64
+
+typedef struct {
+  char method[8];
+  char path[HTTP_MAX_PATH]; // without the query
+  const char *query;
+  size_t query_length;
+  const char *body;
+  size_t body_length;
+  bool close;
+} http_request;
+
+// What http_parse returns besides the bytes it used
+#define HTTP_INCOMPLETE 0
+#define HTTP_MALFORMED -1
+
+long http_parse(const char *in, size_t length, http_request *request);
+
+bool form_value(const char *body, size_t length, const char *key, char *out,
+                size_t size);
+
+#endif
@@ -0,0 +1,532 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "http.h"
+#include "rollup.h"
+#include "store.h"
+
+// Stands in for the database server persist_data() talks to: takes the forms
+// the CT POSTs to /php/data.php and /php/batch.php and appends them to a
+// Store. Every other path is answered 404.
+//
+// What is stored is also rolled up for the dashboard, which reads it back
+// with GET /api/humidity?harvester=&pot=&from=&to=&points= as JSON:
+// {"harvester":1,"pot":2,"resolution":60,"step":300,"points":[[start, min,
+// max, mean, last, count], ...]}. The rollups are rebuilt from the Store on
+// start, minutes and hours only as far back as they are kept.
+//
+// Commits are grouped: every -c ms, or as soon as -b rows are pending. A
+// request is answered only once the commit that holds its rows is done, in
+// order per connection, so an answer means the rows are on disk.
+//
+// Usage: ingest [-p port] [-d dir] [-c commit_ms] [-b batch_rows]
+
+#define INGEST_PORT 8080
+#define INGEST_DIR "aquarius-data"
+#define INGEST_COMMIT_MS 5
+#define INGEST_BATCH_ROWS 8192
+#define INGEST_STATS_MS 10000
+#define INGEST_MAX_EVENTS 256
+#define INGEST_READ_BYTES 16384
+
+typedef struct {
+  uint64_t commit; // store commits needed before it can go out
+  std::string text;
+} reply;
+
+typedef struct {
+  int fd;
+  std::string in;
+  std::string out;
+  std::deque<reply> waiting;
+  bool closing;
+  uint32_t events;
+} connection;
+
+static volatile sig_atomic_t stopping = 0;
+
+static struct {
+  uint64_t requests;
+  uint64_t rejected;
+  uint64_t flagged;
+  uint64_t rows;
+  uint64_t commits;
+  uint64_t max_commit_us;
+} stats;
+
+static Store store;
+static Rollups rollups;
+static int epoll_fd;
+static std::unordered_map<int, connection *> connections;
+
+static uint64_t now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void on_signal(int) { stopping = 1; }
+
+/*******************************************************************************
+*********************************** Handlers ***********************************
+********************************************************************************/
+
+static bool form_number(const char *form, size_t length, const char *key,
+                        long *value) {
+  char text[16];
+  char *end;
+  if (!form_value(form, length, key, text, sizeof(text)) || !text[0]) {
+    return false;
+  }
+  *value = strtol(text, &end, 10);
+  return *end == '\0';
+}
+
+static bool append(const store_row &row) {
+  if (!store.append(row)) {
+    return false;
+  }
+  rollups.add(row);
+  return true;
+}
+
+/**
+ * This function is responsible for one live reading:
+ * harvester=&pot=&humidity=[&time=][&flags=]. Without a time it is stamped on
+ * arrival. A reading the CT flagged implausible is taken but not stored, so
+ * the dashboard does not chart a disconnected probe.
+ */
+static int post_data(const http_request &request, uint32_t now, int *rows) {
+  const char *form = request.body;
+  size_t length = request.body_length;
+  long harvester, pot, humidity, time = now;
+  if (!form_number(form, length, "harvester", &harvester) ||
+      !form_number(form, length, "pot", &pot) ||
+      !form_number(form, length, "humidity", &humidity)) {
+    return 400;
+  }
+  form_number(form, length, "time", &time);
+  long flags = 0;
+  if (form_number(form, length, "flags", &flags) && flags != 0) {
+    stats.flagged++;
+    return 200;
+  }
+
+  store_row row = {(uint32_t)time, STORE_LIVE, (uint16_t)harvester,
+                   (uint8_t)pot, (uint8_t)humidity};
+  if (!append(row)) {
+    return 500;
+  }
+  *rows = 1;
+  return 200;
+}
+
+/**
+ * This function is responsible for one history record:
+ * harvester=&seq=&time=|age=&humidity=h1,h2,... Each humidity is a pot, in
+ * order from pot 1.
+ */
+static int post_batch(const http_request &request, uint32_t now, int *rows) {
+  const char *form = request.body;
+  size_t length = request.body_length;
+  long harvester, seq, time, age;
+  char humidity[64];
+  if (!form_number(form, length, "harvester", &harvester) ||
+      !form_number(form, length, "seq", &seq) ||
+      !form_value(form, length, "humidity", humidity, sizeof(humidity))) {
+    return 400;
+  }
+  if (!form_number(form, length, "time", &time)) {
+    if (!form_number(form, length, "age", &age)) {
+      return 400;
+    }
+    time = now - age;
+  }
+
+  store_row row = {(uint32_t)time, (uint32_t)seq, (uint16_t)harvester, 1, 0};
+  for (char *p = humidity; *p; row.pot++) {
+    char *end;
+    row.humidity = strtol(p, &end, 10);
+    if (end == p || (*end && *end != ',')) {
+      return 400;
+    }
+    if (!append(row)) {
+      return 500;
+    }
+    (*rows)++;
+    p = *end ? end + 1 : end;
+  }
+  return 200;
+}
+
+/**
+ * This function is responsible for one dashboard series. Without a pot it is
+ * the whole harvester; to defaults to now and from to a day before it.
+ */
+static int get_humidity(const http_request &request, uint32_t now,
+                        std::string *body) {
+  const char *query = request.query;
+  size_t length = request.query_length;
+  long harvester, pot = ROLLUP_HARVESTER, to = now, from, points = 300;
+  if (!form_number(query, length, "harvester", &harvester)) {
+    return 400;
+  }
+  form_number(query, length, "pot", &pot);
+  form_number(query, length, "to", &to);
+  if (!form_number(query, length, "from", &from)) {
+    from = to - 86400;
+  }
+  form_number(query, length, "points", &points);
+  if (from >= to || points <= 0) {
+    return 400;
+  }
+
+  uint32_t step;
+  std::vector<rollup_point> series;
+  int level = rollups.query(harvester, pot, from, to, points, &step, series);
+
+  char text[96];
+  snprintf(text, sizeof(text),
+           "{\"harvester\":%ld,\"pot\":%ld,\"resolution\":%u,\"step\":%u,"
+           "\"points\":[",
+           harvester, pot, ROLLUP_WIDTHS[level], step);
+  *body = text;
+  for (size_t i = 0; i < series.size(); i++) {
+    const rollup_point &p = series[i];
+    snprintf(text, sizeof(text), "%s[%u,%u,%u,%.1f,%u,%u]", i ? "," : "",
+             p.start, p.min, p.max, p.mean, p.last, p.count);
+    *body += text;
+  }
+  *body += "]}\n";
+  return 200;
+}
+
+static int handle(const http_request &request, uint32_t now, int *rows,
+                  std::string *body) {
+  *rows = 0;
+  if (strcmp(request.path, "/api/humidity") == 0) {
+    return strcmp(request.method, "GET") == 0
+               ? get_humidity(request, now, body)
+               : 405;
+  }
+  bool data = strcmp(request.path, "/php/data.php") == 0;
+  bool batch = strcmp(request.path, "/php/batch.php") == 0;
+  if (!data && !batch) {
+    return 404;
+  }
+  if (strcmp(request.method, "POST") != 0) {
+    return 405;
+  }
+  return data ? post_data(request, now, rows) : post_batch(request, now, rows);
+}
+
+static std::string response(int status, bool close, const std::string &body) {
+  const char *reason = status == 200   ? "OK"
+                       : status == 400 ? "Bad Request"
+                       : status == 404 ? "Not Found"
+                       : status == 405 ? "Method Not Allowed"
+                                       : "Internal Server Error";
+  std::string content = body.empty() ? std::string(reason) + "\n" : body;
+  char text[160];
+  snprintf(text, sizeof(text),
+           "HTTP/1.1 %d %s\r\nContent-Type: %s\r\n"
+           "Content-Length: %zu\r\n%s\r\n",
+           status, reason, body.empty() ? "text/plain" : "application/json",
+           content.size(), close ? "Connection: close\r\n" : "");
+  return text + content;
+}
+
+/*******************************************************************************
+********************************* Connections **********************************
+********************************************************************************/
+
+static void drop(connection *c) {
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  connections.erase(c->fd);
+  delete c;
+}
+
+/**
+ * This function is responsible for sending what is ready, asking for EPOLLOUT
+ * only while the socket cannot take it all and for EPOLLIN only until the
+ * client is done. Returns false if the connection is gone.
+ */
+static bool flush(connection *c) {
+  while (!c->waiting.empty() &&
+         c->waiting.front().commit <= store.getCommits()) {
+    c->out += c->waiting.front().text;
+    c->waiting.pop_front();
+  }
+
+  size_t sent = 0;
+  while (sent < c->out.size()) {
+    ssize_t n = send(c->fd, c->out.data() + sent, c->out.size() - sent,
+                     MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;
+      }
+      drop(c);
+      return false;
+    }
+    sent += n;
+  }
+  c->out.erase(0, sent);
+
+  if (c->out.empty() && c->waiting.empty() && c->closing) {
+    drop(c);
+    return false;
+  }
+  uint32_t events = 0;
+  if (!c->closing) {
+    events |= EPOLLIN;
+  }
+  if (!c->out.empty()) {
+    events |= EPOLLOUT;
+  }
+  if (events != c->events) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = c;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = events;
+  }
+  return true;
+}
+
+/**
+ * This function is responsible for reading what came in and handling every
+ * complete request in it. Replies queue behind the ones before them.
+ */
+static void receive(connection *c, uint32_t now) {
+  char buffer[INGEST_READ_BYTES];
+  for (;;) {
+    ssize_t n = recv(c->fd, buffer, sizeof(buffer), 0);
+    if (n > 0) {
+      c->in.append(buffer, n);
+      continue;
+    }
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      // The CT closes as soon as it has sent; what it sent still counts
+      c->closing = true;
+    }
+    break;
+  }
+
+  size_t used = 0;
+  while (used < c->in.size()) {
+    http_request request;
+    long n = http_parse(c->in.data() + used, c->in.size() - used, &request);
+    if (n == HTTP_INCOMPLETE) {
+      break;
+    }
+    reply r;
+    if (n == HTTP_MALFORMED) {
+      r.commit = 0;
+      r.text = response(400, true, "");
+      c->waiting.push_back(r);
+      c->closing = true;
+      stats.rejected++;
+      used = c->in.size();
+      break;
+    }
+
+    int rows;
+    std::string body;
+    int status = handle(request, now, &rows, &body);
+    r.commit = rows ? store.getCommits() + 1 : 0;
+    r.text = response(status, request.close, body);
+    c->waiting.push_back(r);
+    stats.requests++;
+    stats.rows += rows;
+    stats.rejected += status != 200;
+    used += n;
+    if (request.close) {
+      c->closing = true;
+      used = c->in.size();
+      break;
+    }
+  }
+  c->in.erase(0, used);
+  flush(c);
+}
+
+static void accept_all(int listener) {
+  for (;;) {
+    int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK);
+    if (fd < 0) {
+      return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    connection *c = new connection();
+    c->fd = fd;
+    c->closing = false;
+    c->events = EPOLLIN;
+    connections[fd] = c;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = c;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+  }
+}
+
+/**
+ * This function is responsible for one group commit and the replies it
+ * frees. A store that cannot commit stops the server rather than answer for
+ * rows that are not on disk.
+ */
+static void commit() {
+  uint64_t start = now_us();
+  if (!store.commit()) {
+    fprintf(stderr, "Commit failed, stopping\n");
+    exit(1);
+  }
+  uint64_t took = now_us() - start;
+  stats.commits++;
+  stats.max_commit_us = took > stats.max_commit_us ? took : stats.max_commit_us;
+
+  std::vector<connection *> ready;
+  for (auto &entry : connections) {
+    if (!entry.second->waiting.empty()) {
+      ready.push_back(entry.second);
+    }
+  }
+  for (connection *c : ready) {
+    flush(c);
+  }
+}
+
+static void print_stats(uint64_t elapsed_us) {
+  double s = elapsed_us / 1e6;
+  printf("%.0f req/s, %.0f rows/s, %lu rejected, %lu flagged, %lu commits "
+         "(%.1f rows each, slowest %.2f ms), %zu connections\n",
+         stats.requests / s, stats.rows / s, stats.rejected, stats.flagged,
+         stats.commits,
+         stats.commits ? (double)stats.rows / stats.commits : 0.0,
+         stats.max_commit_us / 1000.0, connections.size());
+  fflush(stdout);
+  memset(&stats, 0, sizeof(stats));
+}
+
+/*******************************************************************************
+************************************* Main *************************************
+********************************************************************************/
+
+int main(int argc, char **argv) {
+  int port = INGEST_PORT;
+  const char *dir = INGEST_DIR;
+  uint64_t commit_us = INGEST_COMMIT_MS * 1000;
+  uint64_t batch_rows = INGEST_BATCH_ROWS;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "-p") == 0) {
+      port = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "-d") == 0) {
+      dir = argv[i + 1];
+    } else if (strcmp(argv[i], "-c") == 0) {
+      commit_us = atof(argv[i + 1]) * 1000;
+    } else if (strcmp(argv[i], "-b") == 0) {
+      batch_rows = atol(argv[i + 1]);
+    }
+  }
+
+  if (!store.open(dir)) {
+    return 1;
+  }
+  uint64_t started = now_us();
+  rollups.prune(time(NULL));
+  uint64_t rows = store.scan([](const store_row &row) { rollups.add(row); });
+  printf("Rolled up %lu rows into %lu buckets in %.0f ms\n", rows,
+         rollups.getBuckets(), (now_us() - started) / 1000.0);
+
+  int listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  int one = 1;
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(listener, SOMAXCONN) < 0) {
+    perror("listen");
+    return 1;
+  }
+
+  epoll_fd = epoll_create1(0);
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listener, &ev);
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  printf("Listening on %d, storing in %s, commit every %.1f ms or %lu rows\n",
+         port, dir, commit_us / 1000.0, batch_rows);
+  fflush(stdout);
+
+  struct epoll_event events[INGEST_MAX_EVENTS];
+  uint64_t first_pending_us = 0;
+  uint64_t stats_from = now_us();
+  while (!stopping) {
+    uint64_t now = now_us();
+    uint64_t due = store.getPending() ? first_pending_us + commit_us
+                                      : stats_from + INGEST_STATS_MS * 1000;
+    int timeout = due > now ? (due - now + 999) / 1000 : 0;
+
+    int n = epoll_wait(epoll_fd, events, INGEST_MAX_EVENTS, timeout);
+    uint32_t wall = time(NULL);
+    for (int i = 0; i < n; i++) {
+      connection *c = (connection *)events[i].data.ptr;
+      if (!c) {
+        accept_all(listener);
+        continue;
+      }
+      bool had_pending = store.getPending() > 0;
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        receive(c, wall);
+      } else if (events[i].events & EPOLLOUT) {
+        flush(c);
+      }
+      if (!had_pending && store.getPending()) {
+        first_pending_us = now_us();
+      }
+    }
+
+    now = now_us();
+    if (store.getPending() && (now - first_pending_us >= commit_us ||
+                               store.getPending() >= batch_rows)) {
+      commit();
+    }
+    if (now - stats_from >= INGEST_STATS_MS * 1000) {
+      rollups.prune(wall);
+      if (stats.requests) {
+        print_stats(now - stats_from);
+      }
+      stats_from = now;
+    }
+  }
+
+  commit();
+  printf("Stopped with %lu rows committed\n", store.getCommittedRows());
+  return 0;
+}
@@ -0,0 +1,142 @@
+#include "rollup.h"
+
+#include <algorithm>
+#include <iterator>
+
+const uint32_t ROLLUP_WIDTHS[ROLLUP_LEVELS] = {60, 3600, 86400};
+const uint32_t ROLLUP_KEEP_S[ROLLUP_LEVELS] = {7 * 86400, 180 * 86400, 0};
+
+static uint32_t key(uint16_t harvester, uint8_t pot) {
+  return (uint32_t)harvester << 8 | pot;
+}
+
+static bool before(const rollup_bucket &bucket, uint32_t start) {
+  return bucket.start < start;
+}
+
+Rollups::Rollups() : horizon(), buckets(0) {}
+
+/**
+ * This function is responsible for adding a reading to its bucket in one
+ * series. Readings mostly come in order and land at the back; late history
+ * is searched for.
+ */
+void Rollups::add(std::vector<rollup_bucket> &list, uint32_t width,
+                  const store_row &row) {
+  uint32_t start = row.time - row.time % width;
+  auto bucket = list.end();
+  if (!list.empty() && list.back().start == start) {
+    bucket = list.end() - 1;
+  } else if (!list.empty() && list.back().start > start) {
+    bucket = std::lower_bound(list.begin(), list.end(), start, before);
+  }
+
+  if (bucket == list.end() || bucket->start != start) {
+    rollup_bucket fresh = {start,        row.time,     0, 0,
+                           row.humidity, row.humidity, row.humidity};
+    bucket = list.insert(bucket, fresh);
+    buckets++;
+  }
+  bucket->min = std::min(bucket->min, row.humidity);
+  bucket->max = std::max(bucket->max, row.humidity);
+  bucket->sum += row.humidity;
+  bucket->count++;
+  if (row.time >= bucket->last_time) {
+    bucket->last_time = row.time;
+    bucket->last = row.humidity;
+  }
+}
+
+void Rollups::add(const store_row &row) {
+  for (int level = 0; level < ROLLUP_LEVELS; level++) {
+    if (row.time < horizon[level]) {
+      continue;
+    }
+    add(series[level][key(row.harvester, row.pot)], ROLLUP_WIDTHS[level], row);
+    add(series[level][key(row.harvester, ROLLUP_HARVESTER)],
+        ROLLUP_WIDTHS[level], row);
+  }
+}
+
+/**
+ * This function is responsible for dropping the buckets that fell out of
+ * their level's retention by now. Buckets are sorted, so each series loses
+ * a run off its front; one left empty goes with it.
+ */
+void Rollups::prune(uint32_t now) {
+  for (int level = 0; level < ROLLUP_LEVELS; level++) {
+    uint32_t width = ROLLUP_WIDTHS[level];
+    if (ROLLUP_KEEP_S[level] == 0 || now < ROLLUP_KEEP_S[level]) {
+      continue;
+    }
+    uint32_t cutoff = now - ROLLUP_KEEP_S[level];
+    cutoff -= cutoff % width;
+    if (cutoff <= horizon[level]) {
+      continue;
+    }
+    horizon[level] = cutoff;
+
+    for (auto s = series[level].begin(); s != series[level].end();) {
+      std::vector<rollup_bucket> &list = s->second;
+      auto keep = std::lower_bound(list.begin(), list.end(), cutoff, before);
+      buckets -= keep - list.begin();
+      list.erase(list.begin(), keep);
+      s = list.empty() ? series[level].erase(s) : std::next(s);
+    }
+  }
+}
+
+/**
+ * This function is responsible for the series of [from, to) in points step
+ * seconds wide. Points start at multiples of step, so a refreshed range
+ * gives the same points; the first and last can be partial, which makes at
+ * most points + 1. Returns the level it was read from.
+ */
+int Rollups::query(uint16_t harvester, uint8_t pot, uint32_t from, uint32_t to,
+                   uint16_t points, uint32_t *step,
+                   std::vector<rollup_point> &out) {
+  out.clear();
+  points = std::max<uint16_t>(1, std::min<uint16_t>(points, ROLLUP_MAX_POINTS));
+  uint32_t range = to > from ? to - from : 1;
+
+  int level = 0;
+  while (level < ROLLUP_LEVELS - 1 &&
+         (range / ROLLUP_WIDTHS[level] > ROLLUP_MAX_BUCKETS ||
+          from < horizon[level])) {
+    level++;
+  }
+  uint32_t width = ROLLUP_WIDTHS[level];
+  uint32_t first = from - from % width;
+  *step = std::max(width, (range + points - 1) / points);
+  *step = (*step + width - 1) / width * width;
+
+  auto found = series[level].find(key(harvester, pot));
+  if (found == series[level].end()) {
+    return level;
+  }
+  const std::vector<rollup_bucket> &list = found->second;
+
+  uint32_t sum = 0;
+  auto b = std::lower_bound(list.begin(), list.end(), first, before);
+  for (; b != list.end() && b->start < to; b++) {
+    uint32_t start = b->start - b->start % *step;
+    if (out.empty() || out.back().start != start) {
+      if (!out.empty()) {
+        out.back().mean = (float)sum / out.back().count;
+      }
+      rollup_point point = {start, 0, b->min, b->max, b->last, 0};
+      out.push_back(point);
+      sum = 0;
+    }
+    rollup_point &point = out.back();
+    point.count += b->count;
+    point.min = std::min(point.min, b->min);
+    point.max = std::max(point.max, b->max);
+    point.last = b->last;
+    sum += b->sum;
+  }
+  if (!out.empty()) {
+    out.back().mean = (float)sum / out.back().count;
+  }
+  return level;
+}
@@ -0,0 +1,73 @@
+#ifndef __INGEST_ROLLUP__
+#define __INGEST_ROLLUP__
+
+#include <stdint.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "store.h"
+
+// Humidity rolled up per pot and per harvester (pot 0) at one minute, one
+// hour and one day: min, max, mean and the last reading of every bucket that
+// has one. Buckets are kept sorted per series, so a range is one binary
+// search and a walk.
+//
+// A query walks the finest level that covers its range in at most
+// ROLLUP_MAX_BUCKETS buckets and merges them into about the points asked
+// for, so it costs the same with a week or years of data behind it.
+//
+// Minute buckets are kept ROLLUP_KEEP_S[0], hour buckets ROLLUP_KEEP_S[1] and
+// day buckets for good: prune drops what fell out, add leaves out readings
+// that would land there, and a query that reaches back past a level's
+// horizon reads the next one.
+
+#define ROLLUP_LEVELS 3
+#define ROLLUP_MAX_BUCKETS 2048
+#define ROLLUP_MAX_POINTS 1000
+#define ROLLUP_HARVESTER 0
+
+typedef struct {
+  uint32_t start;
+  uint32_t last_time;
+  uint32_t sum;
+  uint32_t count;
+  uint8_t min;
+  uint8_t max;
+  uint8_t last;
+} rollup_bucket;
+
+typedef struct {
+  uint32_t start;
+  uint32_t count;
+  uint8_t min;
+  uint8_t max;
+  uint8_t last;
+  float mean;
+} rollup_point;
+
+extern const uint32_t ROLLUP_WIDTHS[ROLLUP_LEVELS];
+extern const uint32_t ROLLUP_KEEP_S[ROLLUP_LEVELS]; // 0 keeps them for good
+
+class Rollups {
+private:
+  std::unordered_map<uint32_t, std::vector<rollup_bucket>>
+      series[ROLLUP_LEVELS];
+  uint32_t horizon[ROLLUP_LEVELS]; // buckets start at or after it
+  uint64_t buckets;
+
+  void add(std::vector<rollup_bucket> &list, uint32_t width,
+           const store_row &row);
+
+public:
+  Rollups();
+
+  void add(const store_row &row);
+  void prune(uint32_t now);
+  int query(uint16_t harvester, uint8_t pot, uint32_t from, uint32_t to,
+            uint16_t points, uint32_t *step, std::vector<rollup_point> &out);
+
+  uint64_t getBuckets() { return buckets; }
+};
+
+#endif
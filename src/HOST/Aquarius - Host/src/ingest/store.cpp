@@ -0,0 +1,312 @@
+#include "store.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+static const char *COLUMN_NAMES[STORE_COLUMNS] = {
+    "time.col", "seq.col", "harvester.col", "pot.col", "humidity.col"};
+static const size_t COLUMN_WIDTHS[STORE_COLUMNS] = {4, 4, 2, 1, 1};
+
+/*******************************************************************************
+********************************** Partition ***********************************
+********************************************************************************/
+
+StorePartition::StorePartition(uint32_t day)
+    : day(day), meta_fd(-1), capacity(0), rows(0), committed(0), used_at(0) {
+  for (int c = 0; c < STORE_COLUMNS; c++) {
+    fd[c] = -1;
+    map[c] = NULL;
+  }
+}
+
+StorePartition::~StorePartition() {
+  for (int c = 0; c < STORE_COLUMNS; c++) {
+    if (map[c]) {
+      munmap(map[c], capacity * COLUMN_WIDTHS[c]);
+    }
+    if (fd[c] >= 0) {
+      close(fd[c]);
+    }
+  }
+  if (meta_fd >= 0) {
+    close(meta_fd);
+  }
+}
+
+/**
+ * This function is responsible for opening the day's files, creating them if
+ * needed. Rows past the committed count of a previous run are overwritten.
+ */
+bool StorePartition::open(const std::string &dir) {
+  time_t t = (time_t)day * 86400;
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  char name[16];
+  strftime(name, sizeof(name), "%Y-%m-%d", &tm);
+  std::string path = dir + "/" + name;
+  if (mkdir(path.c_str(), 0755) < 0 && errno != EEXIST) {
+    perror(path.c_str());
+    return false;
+  }
+
+  meta_fd = ::open((path + "/meta").c_str(), O_RDWR | O_CREAT, 0644);
+  if (meta_fd < 0) {
+    perror(path.c_str());
+    return false;
+  }
+  store_meta meta;
+  if (pread(meta_fd, &meta, sizeof(meta), 0) == sizeof(meta)) {
+    if (meta.magic != STORE_MAGIC || meta.version != STORE_VERSION ||
+        meta.day != day) {
+      fprintf(stderr, "%s: not a version %d store for this day\n",
+              path.c_str(), STORE_VERSION);
+      return false;
+    }
+    rows = committed = meta.rows;
+  }
+
+  capacity = UINT64_MAX;
+  for (int c = 0; c < STORE_COLUMNS; c++) {
+    fd[c] = ::open((path + "/" + COLUMN_NAMES[c]).c_str(), O_RDWR | O_CREAT,
+                   0644);
+    struct stat st;
+    if (fd[c] < 0 || fstat(fd[c], &st) < 0) {
+      perror(path.c_str());
+      return false;
+    }
+    uint64_t fits = st.st_size / COLUMN_WIDTHS[c];
+    capacity = fits < capacity ? fits : capacity;
+  }
+  if (capacity < rows) {
+    fprintf(stderr, "%s: columns shorter than the committed rows\n",
+            path.c_str());
+    return false;
+  }
+
+  // Map what is there, grow() takes it from here
+  uint64_t have = capacity;
+  capacity = 0;
+  for (int c = 0; c < STORE_COLUMNS && have; c++) {
+    void *m = mmap(NULL, have * COLUMN_WIDTHS[c], PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd[c], 0);
+    if (m == MAP_FAILED) {
+      perror(path.c_str());
+      return false;
+    }
+    map[c] = (uint8_t *)m;
+  }
+  capacity = have;
+  return true;
+}
+
+/**
+ * This function is responsible for making room for STORE_GROW_ROWS more rows
+ * in every column.
+ */
+bool StorePartition::grow() {
+  uint64_t next = capacity + STORE_GROW_ROWS;
+  for (int c = 0; c < STORE_COLUMNS; c++) {
+    size_t old_size = capacity * COLUMN_WIDTHS[c];
+    size_t new_size = next * COLUMN_WIDTHS[c];
+    if (ftruncate(fd[c], new_size) < 0) {
+      perror("ftruncate");
+      return false;
+    }
+    void *m = map[c] ? mremap(map[c], old_size, new_size, MREMAP_MAYMOVE)
+                     : mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                            fd[c], 0);
+    if (m == MAP_FAILED) {
+      perror("mmap");
+      return false;
+    }
+    map[c] = (uint8_t *)m;
+  }
+  capacity = next;
+  return true;
+}
+
+void StorePartition::row(uint64_t i, store_row *row) {
+  memcpy(&row->time, map[COL_TIME] + i * 4, 4);
+  memcpy(&row->seq, map[COL_SEQ] + i * 4, 4);
+  memcpy(&row->harvester, map[COL_HARVESTER] + i * 2, 2);
+  row->pot = map[COL_POT][i];
+  row->humidity = map[COL_HUMIDITY][i];
+}
+
+void StorePartition::put(int column, const void *value) {
+  memcpy(map[column] + rows * COLUMN_WIDTHS[column], value,
+         COLUMN_WIDTHS[column]);
+}
+
+bool StorePartition::append(const store_row &row) {
+  if (rows == capacity && !grow()) {
+    return false;
+  }
+  put(COL_TIME, &row.time);
+  put(COL_SEQ, &row.seq);
+  put(COL_HARVESTER, &row.harvester);
+  put(COL_POT, &row.pot);
+  put(COL_HUMIDITY, &row.humidity);
+  rows++;
+  return true;
+}
+
+/**
+ * This function is responsible for making the rows appended since the last
+ * commit durable: the columns first, then the count that covers them.
+ */
+bool StorePartition::commit() {
+  if (!dirty()) {
+    return true;
+  }
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  for (int c = 0; c < STORE_COLUMNS; c++) {
+    uintptr_t from = (uintptr_t)map[c] + committed * COLUMN_WIDTHS[c];
+    uintptr_t to = (uintptr_t)map[c] + rows * COLUMN_WIDTHS[c];
+    from &= ~(page - 1);
+    if (msync((void *)from, to - from, MS_SYNC) < 0) {
+      perror("msync");
+      return false;
+    }
+  }
+
+  store_meta meta = {STORE_MAGIC, STORE_VERSION, day, rows};
+  if (pwrite(meta_fd, &meta, sizeof(meta), 0) != sizeof(meta) ||
+      fdatasync(meta_fd) < 0) {
+    perror("meta");
+    return false;
+  }
+  committed = rows;
+  return true;
+}
+
+/*******************************************************************************
+************************************ Store *************************************
+********************************************************************************/
+
+Store::Store() : tick(0), pending(0), commits(0), committed_rows(0) {}
+
+Store::~Store() {
+  commit();
+  for (auto &d : days) {
+    delete d.second;
+  }
+}
+
+bool Store::open(const char *path) {
+  dir = path;
+  if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+    perror(path);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * This function is responsible for the partition of a day, opening it if
+ * needed. Past STORE_OPEN_DAYS the least recently used clean one is closed;
+ * late history keeps old days in use for a while.
+ */
+StorePartition *Store::partition(uint32_t day) {
+  auto found = days.find(day);
+  if (found != days.end()) {
+    found->second->use(++tick);
+    return found->second;
+  }
+
+  if (days.size() >= STORE_OPEN_DAYS) {
+    auto oldest = days.end();
+    for (auto d = days.begin(); d != days.end(); d++) {
+      if (!d->second->dirty() &&
+          (oldest == days.end() ||
+           d->second->usedAt() < oldest->second->usedAt())) {
+        oldest = d;
+      }
+    }
+    if (oldest != days.end()) {
+      delete oldest->second;
+      days.erase(oldest);
+    }
+  }
+
+  StorePartition *p = new StorePartition(day);
+  if (!p->open(dir)) {
+    delete p;
+    return NULL;
+  }
+  p->use(++tick);
+  days[day] = p;
+  return p;
+}
+
+bool Store::append(const store_row &row) {
+  StorePartition *p = partition(row.time / 86400);
+  if (!p || !p->append(row)) {
+    return false;
+  }
+  pending++;
+  return true;
+}
+
+/**
+ * This function is responsible for going over every committed row, one day
+ * after the other. Returns how many there were.
+ */
+uint64_t Store::scan(const std::function<void(const store_row &)> &visit) {
+  DIR *d = opendir(dir.c_str());
+  if (!d) {
+    return 0;
+  }
+  std::vector<uint32_t> found;
+  struct dirent *entry;
+  while ((entry = readdir(d))) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(entry->d_name, "%Y-%m-%d", &tm);
+    if (end && !*end) {
+      found.push_back(timegm(&tm) / 86400);
+    }
+  }
+  closedir(d);
+  std::sort(found.begin(), found.end());
+
+  uint64_t rows = 0;
+  for (uint32_t day : found) {
+    StorePartition *p = partition(day);
+    if (!p) {
+      continue;
+    }
+    store_row row;
+    for (uint64_t i = 0; i < p->getRows(); i++) {
+      p->row(i, &row);
+      visit(row);
+    }
+    rows += p->getRows();
+  }
+  return rows;
+}
+
+bool Store::commit() {
+  if (!pending) {
+    return true;
+  }
+  for (auto &d : days) {
+    if (!d.second->commit()) {
+      return false;
+    }
+  }
+  commits++;
+  committed_rows += pending;
+  pending = 0;
+  return true;
+}
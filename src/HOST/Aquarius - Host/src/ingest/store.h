@@ -0,0 +1,102 @@
+#ifndef __INGEST_STORE__
+#define __INGEST_STORE__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <map>
+#include <string>
+
+// Append-only columnar store, one directory per UTC day:
+//
+//   <dir>/2024-05-17/time.col       uint32 unix seconds
+//                    seq.col        uint32 history seq, STORE_LIVE if none
+//                    harvester.col  uint16
+//                    pot.col        uint8
+//                    humidity.col   uint8
+//                    meta           store_meta
+//
+// Columns are memory mapped and grown STORE_GROW_ROWS at a time. Appends only
+// land in the mapping; commit() flushes every dirty range and then the row
+// count in meta, so after a crash a day holds exactly what was committed.
+
+#define STORE_MAGIC 0x5341 // "AS"
+#define STORE_VERSION 1
+#define STORE_GROW_ROWS 65536
+#define STORE_OPEN_DAYS 8
+#define STORE_LIVE 0xFFFFFFFF
+
+typedef struct {
+  uint32_t time;
+  uint32_t seq;
+  uint16_t harvester;
+  uint8_t pot;
+  uint8_t humidity;
+} store_row;
+
+typedef struct {
+  uint16_t magic;
+  uint16_t version;
+  uint32_t day;
+  uint64_t rows;
+} store_meta;
+
+enum { COL_TIME, COL_SEQ, COL_HARVESTER, COL_POT, COL_HUMIDITY, STORE_COLUMNS };
+
+class StorePartition {
+private:
+  uint32_t day;
+  int meta_fd;
+  int fd[STORE_COLUMNS];
+  uint8_t *map[STORE_COLUMNS];
+  uint64_t capacity;
+  uint64_t rows;
+  uint64_t committed;
+  uint64_t used_at;
+
+  bool grow();
+  void put(int column, const void *value);
+
+public:
+  StorePartition(uint32_t day);
+  ~StorePartition();
+
+  bool open(const std::string &dir);
+  bool append(const store_row &row);
+  bool commit();
+  void row(uint64_t i, store_row *row);
+
+  uint32_t getDay() { return day; }
+  uint64_t getRows() { return rows; }
+  bool dirty() { return rows != committed; }
+  uint64_t usedAt() { return used_at; }
+  void use(uint64_t tick) { used_at = tick; }
+};
+
+class Store {
+private:
+  std::string dir;
+  std::map<uint32_t, StorePartition *> days;
+  uint64_t tick;
+  uint64_t pending;
+  uint64_t commits;
+  uint64_t committed_rows;
+
+  StorePartition *partition(uint32_t day);
+
+public:
+  Store();
+  ~Store();
+
+  bool open(const char *dir);
+  bool append(const store_row &row);
+  bool commit();
+  uint64_t scan(const std::function<void(const store_row &)> &visit);
+
+  uint64_t getPending() { return pending; }
+  uint64_t getCommits() { return commits; }
+  uint64_t getCommittedRows() { return committed_rows; }
+};
+
+#endif
@@ -0,0 +1,354 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Load generator and benchmark for ingest. Every connection plays a CT: it
+// keeps -d requests in flight on one kept alive connection, formatted as
+// post_form() does. -b percent of them are history records for batch.php
+// (one row per pot), the rest live readings for data.php.
+//
+// History records are spread over the last -s days, to fill a store with
+// a long history quickly. -q percent of the requests are dashboard queries
+// instead, over ranges from an hour to a year.
+//
+// After -t seconds it reports throughput and the latency of the requests,
+// from sending one to its answer, which ingest only gives once the rows are
+// committed. Queries are reported apart.
+//
+// Usage: ingest_load [-a address] [-p port] [-n connections] [-d depth]
+//                    [-t seconds] [-b batch_percent] [-s days]
+//                    [-q query_percent] [-j threads]
+
+#define LOAD_PORT 8080
+#define LOAD_CONNECTIONS 64
+#define LOAD_DEPTH 4
+#define LOAD_SECONDS 10
+#define LOAD_BATCH_PERCENT 20
+#define LOAD_THREADS 4
+#define LOAD_POTS 8
+#define LOAD_GRACE_MS 5000
+#define LOAD_QUERY_POINTS 300
+
+static const uint32_t QUERY_RANGES[] = {3600, 86400, 7 * 86400, 30 * 86400,
+                                        365 * 86400};
+#define QUERY_RANGE_COUNT (sizeof(QUERY_RANGES) / sizeof(QUERY_RANGES[0]))
+
+// What a request in flight was, in connection.rows
+#define LOAD_QUERY -1
+
+typedef struct {
+  int fd;
+  int harvester;
+  uint32_t seq;
+  std::deque<uint64_t> sent_at;
+  std::deque<int> rows;
+  std::string in;
+} connection;
+
+typedef struct {
+  uint64_t requests;
+  uint64_t rows;
+  uint64_t errors;
+  std::vector<uint32_t> latency_us;
+  std::vector<uint32_t> query_latency_us;
+} results;
+
+static struct {
+  const char *address;
+  int port;
+  int connections;
+  int depth;
+  int seconds;
+  int batch_percent;
+  int days;
+  int query_percent;
+  int threads;
+} options = {"127.0.0.1",        LOAD_PORT, LOAD_CONNECTIONS, LOAD_DEPTH,
+             LOAD_SECONDS,       LOAD_BATCH_PERCENT,
+             0,                  0,         LOAD_THREADS};
+
+static uint64_t now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// Up to 30 bits from two steps of the LCG, its low bits are poor
+static uint32_t random_below(uint32_t *seed, uint32_t n) {
+  *seed = *seed * 1103515245 + 12345;
+  uint32_t high = *seed >> 17;
+  *seed = *seed * 1103515245 + 12345;
+  return (high << 15 | *seed >> 17) % n;
+}
+
+static void send_all(connection *c, const char *request, int length) {
+  c->sent_at.push_back(now_us());
+  if (send(c->fd, request, length, MSG_NOSIGNAL) != length) {
+    perror("send");
+    exit(1);
+  }
+}
+
+/**
+ * This function is responsible for one dashboard query, over one of
+ * QUERY_RANGES up to now.
+ */
+static void send_query(connection *c, uint32_t seed) {
+  uint32_t range = QUERY_RANGES[(seed >> 4) % QUERY_RANGE_COUNT];
+  char request[256];
+  int length = snprintf(request, sizeof(request),
+                        "GET /api/humidity?harvester=%d&pot=%u&from=%lu"
+                        "&points=%d HTTP/1.1\r\nHost: localhost\r\n\r\n",
+                        c->harvester, (seed >> 12) % (LOAD_POTS + 1),
+                        (unsigned long)time(NULL) - range, LOAD_QUERY_POINTS);
+  c->rows.push_back(LOAD_QUERY);
+  send_all(c, request, length);
+}
+
+/**
+ * This function is responsible for one request, byte for byte what the CT's
+ * post_form() writes, trailing CRLF included.
+ */
+static void send_request(connection *c, uint32_t *seed) {
+  char body[128];
+  const char *path;
+  int rows;
+
+  *seed = *seed * 1103515245 + 12345;
+  if ((int)((*seed >> 24) % 100) < options.query_percent) {
+    send_query(c, *seed);
+    return;
+  }
+  if ((int)((*seed >> 16) % 100) < options.batch_percent) {
+    uint32_t span = options.days ? options.days * 86400 : 3600;
+    path = "/php/batch.php";
+    int n = snprintf(body, sizeof(body), "harvester=%d&seq=%u&age=%u&humidity=",
+                     c->harvester, c->seq++, random_below(seed, span));
+    for (int p = 0; p < LOAD_POTS; p++) {
+      n += snprintf(body + n, sizeof(body) - n, p ? ",%u" : "%u",
+                    (*seed >> p) % 101);
+    }
+    rows = LOAD_POTS;
+  } else {
+    path = "/php/data.php";
+    snprintf(body, sizeof(body), "harvester=%d&pot=%u&humidity=%u",
+             c->harvester, (*seed >> 20) % LOAD_POTS + 1, (*seed >> 4) % 101);
+    rows = 1;
+  }
+
+  char request[512];
+  int length = snprintf(request, sizeof(request),
+                        "POST %s? HTTP/1.1\r\n"
+                        "Host: si-aquarius.go.ro\r\n"
+                        "Content-Type: application/x-www-form-urlencoded\r\n"
+                        "Content-Length: %zu\r\n\r\n%s\r\n",
+                        path, strlen(body), body);
+  c->rows.push_back(rows);
+  send_all(c, request, length);
+}
+
+/**
+ * This function is responsible for taking the next whole answer off the
+ * input. Returns its status, 0 if it is not all there yet.
+ */
+static int next_response(connection *c) {
+  size_t head_end = c->in.find("\r\n\r\n");
+  if (head_end == std::string::npos) {
+    return 0;
+  }
+  size_t length = 0;
+  size_t at = c->in.find("Content-Length:");
+  if (at != std::string::npos && at < head_end) {
+    length = strtoul(c->in.c_str() + at + 15, NULL, 10);
+  }
+  if (c->in.size() < head_end + 4 + length) {
+    return 0;
+  }
+  int status = atoi(c->in.c_str() + 9);
+  c->in.erase(0, head_end + 4 + length);
+  return status ? status : -1;
+}
+
+static int connect_to_ingest() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(options.port);
+  inet_pton(AF_INET, options.address, &addr.sin_addr);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    perror("connect");
+    exit(1);
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+/**
+ * This function is responsible for one thread's share of the connections:
+ * a new request goes out for every answer until the time is up, then what
+ * is in flight is waited for.
+ */
+static void run(int first, int count, uint64_t until, results *out) {
+  std::vector<connection> connections(count);
+  std::vector<struct pollfd> fds(count);
+  uint32_t seed = first + 1;
+
+  for (int i = 0; i < count; i++) {
+    connection &c = connections[i];
+    c.fd = connect_to_ingest();
+    c.harvester = (first + i) % 250 + 1;
+    c.seq = 0;
+    fds[i].fd = c.fd;
+    fds[i].events = POLLIN;
+    for (int d = 0; d < options.depth; d++) {
+      send_request(&c, &seed);
+    }
+  }
+
+  uint64_t give_up = until + LOAD_GRACE_MS * 1000ULL;
+  size_t in_flight = (size_t)count * options.depth;
+  char buffer[16384];
+  while (in_flight && now_us() < give_up) {
+    if (poll(fds.data(), count, 100) <= 0) {
+      continue;
+    }
+    for (int i = 0; i < count; i++) {
+      if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+        continue;
+      }
+      connection &c = connections[i];
+      ssize_t n = recv(c.fd, buffer, sizeof(buffer), 0);
+      if (n <= 0) {
+        fprintf(stderr, "ingest closed a connection\n");
+        exit(1);
+      }
+      c.in.append(buffer, n);
+
+      int status;
+      while ((status = next_response(&c))) {
+        uint64_t now = now_us();
+        bool query = c.rows.front() == LOAD_QUERY;
+        (query ? out->query_latency_us : out->latency_us)
+            .push_back(now - c.sent_at.front());
+        out->requests++;
+        if (status != 200) {
+          out->errors++;
+        } else if (!query) {
+          out->rows += c.rows.front();
+        }
+        c.sent_at.pop_front();
+        c.rows.pop_front();
+        in_flight--;
+        if (now < until) {
+          send_request(&c, &seed);
+          in_flight++;
+        }
+      }
+    }
+  }
+  for (connection &c : connections) {
+    close(c.fd);
+  }
+}
+
+static double percentile(const std::vector<uint32_t> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t i = (size_t)(p / 100 * (sorted.size() - 1) + 0.5);
+  return sorted[i] / 1000.0;
+}
+
+static void print_latency(const char *title, std::vector<uint32_t> &latency) {
+  if (latency.empty()) {
+    return;
+  }
+  std::sort(latency.begin(), latency.end());
+  printf("%s ms: p50 %.2f, p90 %.2f, p99 %.2f, p99.9 %.2f, max %.2f\n", title,
+         percentile(latency, 50), percentile(latency, 90),
+         percentile(latency, 99), percentile(latency, 99.9),
+         percentile(latency, 100));
+}
+
+int main(int argc, char **argv) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    int value = atoi(argv[i + 1]);
+    if (strcmp(argv[i], "-a") == 0) {
+      options.address = argv[i + 1];
+    } else if (strcmp(argv[i], "-p") == 0) {
+      options.port = value;
+    } else if (strcmp(argv[i], "-n") == 0) {
+      options.connections = value;
+    } else if (strcmp(argv[i], "-d") == 0) {
+      options.depth = value;
+    } else if (strcmp(argv[i], "-t") == 0) {
+      options.seconds = value;
+    } else if (strcmp(argv[i], "-b") == 0) {
+      options.batch_percent = value;
+    } else if (strcmp(argv[i], "-s") == 0) {
+      options.days = value;
+    } else if (strcmp(argv[i], "-q") == 0) {
+      options.query_percent = value;
+    } else if (strcmp(argv[i], "-j") == 0) {
+      options.threads = value;
+    }
+  }
+  if (options.threads > options.connections) {
+    options.threads = options.connections;
+  }
+
+  printf("%d connections, %d in flight each, %d%% batch, %d%% queries, %d "
+         "threads, %d s\n",
+         options.connections, options.depth, options.batch_percent,
+         options.query_percent, options.threads, options.seconds);
+
+  uint64_t start = now_us();
+  uint64_t until = start + options.seconds * 1000000ULL;
+  std::vector<results> shares(options.threads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < options.threads; t++) {
+    int first = options.connections * t / options.threads;
+    int last = options.connections * (t + 1) / options.threads;
+    threads.push_back(
+        std::thread(run, first, last - first, until, &shares[t]));
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  double elapsed = (now_us() - start) / 1e6;
+
+  results total = {0, 0, 0, {}, {}};
+  for (results &r : shares) {
+    total.requests += r.requests;
+    total.rows += r.rows;
+    total.errors += r.errors;
+    total.latency_us.insert(total.latency_us.end(), r.latency_us.begin(),
+                            r.latency_us.end());
+    total.query_latency_us.insert(total.query_latency_us.end(),
+                                  r.query_latency_us.begin(),
+                                  r.query_latency_us.end());
+  }
+
+  printf("requests %lu, rows %lu, errors %lu in %.2f s\n", total.requests,
+         total.rows, total.errors, elapsed);
+  printf("throughput: %.0f req/s, %.0f rows/s\n", total.requests / elapsed,
+         total.rows / elapsed);
+  print_latency("latency", total.latency_us);
+  print_latency("query latency", total.query_latency_us);
+  return total.errors ? 1 : 0;
+}
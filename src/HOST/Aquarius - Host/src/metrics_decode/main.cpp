@@ -0,0 +1,115 @@
+#include <AquariusMetrics.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+// Reads one CT metrics dump from stdin and prints it. The dump can be the raw
+// Serial capture (log lines around it are skipped) or the hex blob of an
+// upload, with or without the "blob=" in front.
+
+static const char *PHASE_NAMES[METRICS_PHASES] = {
+    "harvest", "persist", "refill", "patrol", "await", "cycle"};
+
+static int hex_value(int c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/**
+ * This function is responsible for decoding the input as hex, if all of it
+ * is hex apart from whitespace and a leading "blob=".
+ */
+static bool from_hex(const std::vector<uint8_t> &in, std::vector<uint8_t> &out) {
+  size_t i = 0;
+  if (in.size() >= 5 && memcmp(in.data(), "blob=", 5) == 0) {
+    i = 5;
+  }
+
+  int high = -1;
+  for (; i < in.size(); i++) {
+    if (isspace(in[i])) {
+      continue;
+    }
+    int v = hex_value(in[i]);
+    if (v < 0) {
+      return false;
+    }
+    if (high < 0) {
+      high = v;
+    } else {
+      out.push_back(high << 4 | v);
+      high = -1;
+    }
+  }
+  return high < 0 && !out.empty();
+}
+
+/**
+ * This function is responsible for finding the dump in a Serial capture: the
+ * first "AM" of the right version whose CRC checks out.
+ */
+static bool find_dump(const std::vector<uint8_t> &in, AquariusMetrics &m) {
+  for (size_t i = 0; i + METRICS_DUMP_SIZE <= in.size(); i++) {
+    if (in[i] == (METRICS_MAGIC & 0xFF) && in[i + 1] == (METRICS_MAGIC >> 8) &&
+        m.load(&in[i], METRICS_DUMP_SIZE)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void print_counters(const char *label, unsigned id,
+                           const metrics_counters &c) {
+  if (!c.attempts && !c.timeouts && !c.missed) {
+    return;
+  }
+  printf("%-6s %3u  attempts %5u  retries %5u  timeouts %5u  missed %5u\n",
+         label, id, c.attempts, c.retries, c.timeouts, c.missed);
+}
+
+int main() {
+  std::vector<uint8_t> in;
+  int c;
+  while ((c = getchar()) != EOF) {
+    in.push_back(c);
+  }
+
+  AquariusMetrics m;
+  std::vector<uint8_t> bytes;
+  if (!(from_hex(in, bytes) && m.load(bytes.data(), bytes.size())) &&
+      !find_dump(in, m)) {
+    fprintf(stderr, "No valid metrics dump (version %d) found\n",
+            METRICS_VERSION);
+    return 1;
+  }
+
+  const metrics_data &d = m.getData();
+  printf("uptime %.1f h, read timeouts %u, stack headroom %u bytes\n\n",
+         d.uptime_ms / 3600000.0, d.read_timeouts, d.stack_headroom);
+
+  printf("%-8s %6s %6s %9s %9s %9s %9s %9s %9s\n", "phase", "runs", "failed",
+         "min", "mean", "p50", "p90", "p99", "max");
+  for (int i = 0; i < METRICS_PHASES; i++) {
+    const metrics_phase &p = d.phases[i];
+    printf("%-8s %6u %6u %9u %9u %9u %9u %9u %9u\n", PHASE_NAMES[i], p.count,
+           p.failures, p.count ? p.min_ms : 0, m.mean(i), m.percentile(i, 50),
+           m.percentile(i, 90), m.percentile(i, 99), p.max_ms);
+  }
+
+  printf("\n");
+  for (int t = 0; t < METRICS_TYPES; t++) {
+    print_counters("signal", t, d.types[t]);
+  }
+  printf("\n");
+  for (int n = 0; n < d.nodes; n++) {
+    print_counters("node", d.node[n].id, d.node[n].counters);
+  }
+  return 0;
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+
+#include <vector>
+
+#include "../ingest/rollup.h"
+
+// Feeds ingest's Rollups with made up readings and checks what the dashboard
+// would read back: a harvester's day bucket holding more readings than 16
+// bits count, and minute and hour buckets dropped past their retention while
+// queries over that time fall back to a coarser level.
+//
+// Usage: rollup_check
+//
+// Exits with 1 if any check fails, so it can gate a CI run.
+
+#define CHECK_DAY 86400UL
+#define CHECK_START (1700000000UL - 1700000000UL % CHECK_DAY)
+#define CHECK_HARVESTER 1
+#define CHECK_DENSE_READINGS 10000 // per pot, in one day
+#define CHECK_RETENTION_DAYS 200   // a reading a minute
+
+static int checks;
+static int failed;
+
+static void check(const char *what, bool ok) {
+  checks++;
+  failed += !ok;
+  printf("%-56s %s\n", what, ok ? "ok" : "FAILED");
+}
+
+static void add(Rollups &rollups, uint32_t time, uint8_t pot,
+                uint8_t humidity) {
+  store_row row = {time, 0, CHECK_HARVESTER, pot, humidity};
+  rollups.add(row);
+}
+
+/**
+ * This function is responsible for a day of readings too dense for a 16 bit
+ * count: every pot of a harvester CHECK_DENSE_READINGS times.
+ */
+static void check_dense() {
+  Rollups rollups;
+  for (uint32_t i = 0; i < CHECK_DENSE_READINGS; i++) {
+    for (uint8_t pot = 1; pot <= 8; pot++) {
+      add(rollups, CHECK_START + i * 8, pot, i % 2 ? 30 : 20);
+    }
+  }
+
+  std::vector<rollup_point> points;
+  uint32_t step;
+  int level = rollups.query(CHECK_HARVESTER, ROLLUP_HARVESTER, CHECK_START,
+                            CHECK_START + 200 * CHECK_DAY, 200, &step, points);
+  check("dense day is read from the day level", level == ROLLUP_LEVELS - 1);
+  check("dense day counts every reading",
+        points.size() == 1 && points[0].count == 8 * CHECK_DENSE_READINGS);
+  check("dense day mean is right",
+        points.size() == 1 && points[0].mean > 24.99 && points[0].mean < 25.01);
+}
+
+/**
+ * This function is responsible for CHECK_RETENTION_DAYS of a reading a
+ * minute on one pot, pruned at the end of it.
+ */
+static void check_retention() {
+  Rollups rollups;
+  uint32_t end = CHECK_START + CHECK_RETENTION_DAYS * CHECK_DAY;
+  for (uint32_t time = CHECK_START; time < end; time += 60) {
+    add(rollups, time, 1, 40);
+  }
+  uint64_t before = rollups.getBuckets();
+  rollups.prune(end);
+  uint64_t after = rollups.getBuckets();
+
+  // Two series, the pot's and the harvester's
+  uint64_t kept = 2 * (ROLLUP_KEEP_S[0] / ROLLUP_WIDTHS[0] +
+                       ROLLUP_KEEP_S[1] / ROLLUP_WIDTHS[1] +
+                       CHECK_RETENTION_DAYS);
+  printf("%lu buckets, %lu after pruning\n", (unsigned long)before,
+         (unsigned long)after);
+  check("pruning keeps only what retention allows", after == kept);
+
+  std::vector<rollup_point> points;
+  uint32_t step;
+  uint32_t from = end - 3600;
+  int level = rollups.query(CHECK_HARVESTER, 1, from, end, 60, &step, points);
+  check("last hour is read by the minute",
+        level == 0 && points.size() == 60 && points[0].count == 1);
+
+  from = end - 30 * CHECK_DAY;
+  level = rollups.query(CHECK_HARVESTER, 1, from, from + 3600, 60, &step,
+                        points);
+  check("an hour a month ago falls back to the hour level",
+        level == 1 && points.size() == 1 && points[0].count == 60);
+
+  from = CHECK_START + 10 * CHECK_DAY;
+  level = rollups.query(CHECK_HARVESTER, 1, from, from + 3600, 60, &step,
+                        points);
+  check("an hour half a year ago falls back to the day level",
+        level == 2 && points.size() == 1 && points[0].count == 24 * 60);
+
+  add(rollups, end - 30 * CHECK_DAY, 1, 40);
+  check("late readings add no pruned buckets",
+        rollups.getBuckets() == after);
+}
+
+int main() {
+  check_dense();
+  check_retention();
+  printf("\n%d checks, %d failed\n", checks, failed);
+  return failed ? 1 : 0;
+}
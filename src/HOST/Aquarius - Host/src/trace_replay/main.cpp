@@ -0,0 +1,323 @@
+#include <Aquarius.h>
+#include <Aquarius_config.h>
+#include <AquariusTrace.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+// Replays a CT traffic trace against the CT's own AquariusNetworkCommunicator
+// on a virtual clock. The trace is turned back into the calls the CT made:
+// each run of write attempts is one writeTimeout, each frame read or read
+// timeout is one readTimeout. The radio answers every write as it did when
+// recorded and hands over every frame as long after the previous call as it
+// came then. Time the CT spent elsewhere (Ethernet, the car, delays) is
+// replayed as is.
+//
+// With the same Aquarius_config.h the replay retraces the recording; change
+// the timeouts or the communicator and it shows what the recorded traffic
+// would have done to the cycle.
+//
+// Usage: trace_replay [-v] < capture
+
+// Every pass of a communicator wait costs this much virtual time
+#define REPLAY_TICK_MS 1
+#define REPLAY_MAX_DIVERGENCES 20
+
+static const char *PHASE_NAMES[] = {"harvest", "persist", "refill", "patrol",
+                                    "await"};
+#define REPLAY_PHASES (sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0]))
+
+/*******************************************************************************
+******************************** Virtual clock *********************************
+********************************************************************************/
+
+static unsigned long clock_ms = 0;
+
+unsigned long millis() { return clock_ms; }
+
+void delay(unsigned long ms) { clock_ms += ms; }
+
+/*******************************************************************************
+******************************** Scripted radio ********************************
+********************************************************************************/
+
+// The frame the next read gets, once the clock reaches due
+static struct {
+  bool queued;
+  unsigned long due;
+  trace_frame frame;
+} inbound;
+
+// What the next writes answer and how long each takes
+static std::vector<bool> outcomes;
+static std::vector<uint32_t> costs;
+static size_t attempt;
+
+uint8_t RF24Network::update() {
+  clock_ms += REPLAY_TICK_MS;
+  return 0;
+}
+
+bool RF24Network::available() {
+  return inbound.queued && clock_ms >= inbound.due;
+}
+
+uint16_t RF24Network::peek(RF24NetworkHeader &header) {
+  header = RF24NetworkHeader(NODE_CT, inbound.frame.type);
+  header.from_node = inbound.frame.node;
+  return inbound.frame.size;
+}
+
+uint16_t RF24Network::read(RF24NetworkHeader &header, void *message,
+                           uint16_t maxlen) {
+  peek(header);
+  inbound.queued = false;
+  uint16_t size = inbound.frame.size < maxlen ? inbound.frame.size : maxlen;
+  if (message) {
+    memcpy(message, inbound.frame.payload,
+           size < TRACE_PAYLOAD_MAX ? size : TRACE_PAYLOAD_MAX);
+  }
+  return size;
+}
+
+/**
+ * This function is responsible for answering a write as the recorded attempt
+ * at the same position did. Past the recorded ones the link stays down.
+ */
+bool RF24Network::write(RF24NetworkHeader &header, const void *message,
+                        uint16_t len) {
+  bool delivered = false;
+  if (attempt < outcomes.size()) {
+    delivered = outcomes[attempt];
+    clock_ms += costs[attempt];
+  } else if (!costs.empty()) {
+    clock_ms += costs.back();
+  }
+  attempt++;
+  return delivered;
+}
+
+/*******************************************************************************
+************************************ Trace *************************************
+********************************************************************************/
+
+typedef enum { op_mark, op_write, op_read } op_kind;
+
+// One call the CT made, as recorded
+typedef struct {
+  op_kind kind;
+  uint32_t start_ms;
+  uint32_t end_ms;
+  trace_frame frame;
+  bool ok;
+  bool open;
+  std::vector<bool> outcomes;
+  std::vector<uint32_t> costs;
+} op;
+
+/**
+ * This function is responsible for finding the trace in a Serial capture: the
+ * first "AT" of the right version whose CRC checks out.
+ */
+static bool find_trace(const std::vector<uint8_t> &in, trace_info *info) {
+  for (size_t i = 0; i + 1 < in.size(); i++) {
+    if (in[i] == (TRACE_MAGIC & 0xFF) && in[i + 1] == (TRACE_MAGIC >> 8) &&
+        trace_parse(&in[i], in.size() - i, info)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool same_write(const op &o, const trace_frame &f) {
+  return o.kind == op_write && o.open && o.frame.node == f.node &&
+         o.frame.type == f.type && o.frame.size == f.size;
+}
+
+/**
+ * This function is responsible for turning the records back into calls. A
+ * delivered attempt's own duration is not recorded, it costs nothing.
+ */
+static std::vector<op> build_ops(const trace_info &info) {
+  std::vector<op> ops;
+  uint16_t offset = 0;
+  trace_frame f;
+
+  while (trace_next(info, &offset, &f)) {
+    uint8_t kind = f.kind & TRACE_KIND;
+    op o;
+    o.kind = op_read;
+    o.start_ms = o.end_ms = f.ms;
+    o.frame = f;
+    o.ok = true;
+    o.open = false;
+
+    if (kind == TRACE_TX) {
+      bool delivered = f.kind & TRACE_DELIVERED;
+      if (ops.empty() || !same_write(ops.back(), f)) {
+        o.kind = op_write;
+        o.open = true;
+        ops.push_back(o);
+      }
+      op &w = ops.back();
+      if (!w.costs.empty()) {
+        w.costs.back() = f.ms - w.end_ms;
+      }
+      w.outcomes.push_back(delivered);
+      w.costs.push_back(0);
+      w.end_ms = f.ms;
+      w.ok = delivered;
+      w.open = !delivered;
+    } else if (kind == TRACE_TIMEOUT && (f.kind & TRACE_WRITE)) {
+      if (!ops.empty() && same_write(ops.back(), f)) {
+        op &w = ops.back();
+        w.costs.back() = f.ms - w.end_ms;
+        w.end_ms = f.ms;
+        w.ok = false;
+        w.open = false;
+      }
+    } else if (kind == TRACE_TIMEOUT) {
+      o.ok = false;
+      ops.push_back(o);
+    } else if (kind == TRACE_RX) {
+      ops.push_back(o);
+    } else if (kind == TRACE_MARK) {
+      o.kind = op_mark;
+      ops.push_back(o);
+    }
+  }
+  return ops;
+}
+
+/*******************************************************************************
+************************************ Replay ************************************
+********************************************************************************/
+
+RF24Network network;
+AquariusNetworkCommunicator anc(network);
+
+static void print_op(const op &o, bool ok, unsigned long started) {
+  const char *what = o.kind == op_write ? "write" : "read ";
+  printf("%10lu %10u  %s node %o type %u size %u: recorded %s, replayed %s "
+         "(%lu ms)\n",
+         started, o.start_ms, what, o.frame.node, o.frame.type, o.frame.size,
+         o.ok ? "ok" : "timeout", ok ? "ok" : "timeout", clock_ms - started);
+}
+
+int main(int argc, char **argv) {
+  bool verbose = argc > 1 && strcmp(argv[1], "-v") == 0;
+
+  std::vector<uint8_t> in;
+  int c;
+  while ((c = getchar()) != EOF) {
+    in.push_back(c);
+  }
+
+  trace_info info;
+  if (!find_trace(in, &info)) {
+    fprintf(stderr, "No valid trace (version %d) found\n", TRACE_VERSION);
+    return 1;
+  }
+  std::vector<op> ops = build_ops(info);
+  if (ops.empty()) {
+    fprintf(stderr, "The trace is empty\n");
+    return 1;
+  }
+
+  printf("trace: %u bytes, %u records dropped, recorded with READ_TIMEOUT %u "
+         "and WRITE_TIMEOUT %u\n",
+         info.bytes, info.dropped, info.read_timeout, info.write_timeout);
+  printf("replay with READ_TIMEOUT %d and WRITE_TIMEOUT %d\n\n", READ_TIMEOUT,
+         WRITE_TIMEOUT);
+
+  uint32_t prev_end = ops.front().start_ms;
+  uint32_t recorded_phase_ms[REPLAY_PHASES] = {0};
+  unsigned long replayed_phase_ms[REPLAY_PHASES] = {0};
+  int phase = -1;
+  uint32_t phase_recorded_at = 0;
+  unsigned long phase_replayed_at = 0;
+  int divergences = 0, writes = 0, reads = 0;
+  size_t attempts_recorded = 0, attempts_replayed = 0;
+
+  for (size_t i = 0; i < ops.size(); i++) {
+    const op &o = ops[i];
+    uint32_t gap = o.start_ms - prev_end;
+    unsigned long started = clock_ms;
+    bool ok = true;
+
+    switch (o.kind) {
+    case op_mark:
+      clock_ms += gap;
+      if (phase >= 0 && phase < (int)REPLAY_PHASES) {
+        recorded_phase_ms[phase] += o.start_ms - phase_recorded_at;
+        replayed_phase_ms[phase] += clock_ms - phase_replayed_at;
+      }
+      phase = o.frame.type;
+      phase_recorded_at = o.start_ms;
+      phase_replayed_at = clock_ms;
+      prev_end = o.end_ms;
+      continue;
+
+    case op_write: {
+      clock_ms += gap;
+      started = clock_ms;
+      outcomes = o.outcomes;
+      costs = o.costs;
+      attempt = 0;
+      trace_frame frame = o.frame;
+      RF24NetworkHeader header(frame.node, frame.type);
+      ok = anc.writeTimeout(header, frame.payload, frame.size);
+      writes++;
+      attempts_recorded += o.outcomes.size();
+      attempts_replayed += attempt;
+      break;
+    }
+
+    case op_read:
+      if (o.ok) {
+        inbound.queued = true;
+        inbound.due = clock_ms + gap;
+        inbound.frame = o.frame;
+      } else if (gap > info.read_timeout) {
+        clock_ms += gap - info.read_timeout;
+      }
+      started = clock_ms;
+      {
+        uint8_t buffer[256];
+        ok = anc.readTimeout(buffer, o.ok ? o.frame.size : 1);
+      }
+      // A frame that came too late is lost to this replay
+      inbound.queued = false;
+      reads++;
+      break;
+    }
+
+    if (ok != o.ok) {
+      if (divergences < REPLAY_MAX_DIVERGENCES) {
+        printf("diverged: ");
+        print_op(o, ok, started);
+      }
+      divergences++;
+    } else if (verbose) {
+      print_op(o, ok, started);
+    }
+    prev_end = o.end_ms;
+  }
+  if (phase >= 0 && phase < (int)REPLAY_PHASES) {
+    recorded_phase_ms[phase] += prev_end - phase_recorded_at;
+    replayed_phase_ms[phase] += clock_ms - phase_replayed_at;
+  }
+
+  printf("\n%-8s %12s %12s\n", "phase", "recorded ms", "replayed ms");
+  for (size_t p = 0; p < REPLAY_PHASES; p++) {
+    printf("%-8s %12u %12lu\n", PHASE_NAMES[p], recorded_phase_ms[p],
+           replayed_phase_ms[p]);
+  }
+  printf("\nwrites %d (attempts recorded %zu, replayed %zu), reads %d, "
+         "diverged %d\n",
+         writes, attempts_recorded, attempts_replayed, reads, divergences);
+  printf("total: recorded %u ms, replayed %lu ms\n",
+         ops.back().end_ms - ops.front().start_ms, clock_ms);
+  return 0;
+}
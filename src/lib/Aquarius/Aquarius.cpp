@@ -0,0 +1,220 @@
+#include <RF24Network.h>
+#include <string.h>
+
+#include "Aquarius.h"
+#include "Aquarius_config.h"
+
+AquariusNetworkCommunicator::AquariusNetworkCommunicator(RF24Network &_network)
+    : network(_network), control_head(0), control_count(0), bulk_used(0),
+      bulk_dropped(0), on_update(NULL), on_write(NULL), on_timeout(NULL),
+      on_read(NULL) {}
+
+/**
+ * This function is responsible for letting the network, or the mesh on top of
+ * it, process what came in.
+ */
+void AquariusNetworkCommunicator::update() {
+  if (on_update) {
+    on_update();
+  } else {
+    network.update();
+  }
+  sort();
+}
+
+/**
+ * This function is responsible for moving every message the network holds
+ * into its lane, so a control message is never stuck behind bulk ones in the
+ * network's queue. Mesh control frames (system types, 128 and up) are
+ * dropped, and so is bulk that does not fit LANE_BULK_BYTES, and counted. The
+ * CT never has more bulk replies coming than fit: harvests are sent in
+ * HARVEST_WINDOW, history frames and link reports one at a time and switch
+ * confirmations in slots of LINK_CONFIRM_WINDOW. A link report dropped anyway
+ * is asked for again, the rest next cycle.
+ */
+void AquariusNetworkCommunicator::sort() {
+  while (network.available()) {
+    RF24NetworkHeader header;
+    uint16_t size = network.peek(header);
+    if (header.type >= 128) {
+      network.read(header, NULL, 0);
+      continue;
+    }
+
+    if (header.type == LANE_CONTROL && size <= CONTROL_MAX_SIZE) {
+      if (control_count == LANE_CONTROL_SLOTS) {
+        return;
+      }
+      lane_message &message =
+          control[(control_head + control_count) % LANE_CONTROL_SLOTS];
+      message.size =
+          network.read(message.header, message.data, sizeof(message.data));
+      control_count++;
+      continue;
+    }
+
+    uint16_t need = 1 + sizeof(header) + size;
+    if (size > 0xFF || bulk_used + need > LANE_BULK_BYTES) {
+      network.read(header, NULL, 0);
+      bulk_dropped++;
+      continue;
+    }
+    uint8_t *entry = bulk + bulk_used;
+    entry[0] = network.read(header, entry + 1 + sizeof(header), size);
+    memcpy(entry + 1, &header, sizeof(header));
+    bulk_used += 1 + sizeof(header) + entry[0];
+  }
+}
+
+/**
+ * This function is responsible for telling if there is an application message
+ * to read, in either lane.
+ */
+bool AquariusNetworkCommunicator::next() {
+  return control_count > 0 || bulk_used > 0;
+}
+
+/**
+ * This function is responsible for replacing network.update() in every wait,
+ * e.g. with one that also updates the mesh.
+ */
+void AquariusNetworkCommunicator::setUpdate(void (*_update)()) {
+  on_update = _update;
+}
+
+/**
+ * This function is responsible for reporting every write attempt, e.g. to
+ * keep link statistics.
+ */
+void AquariusNetworkCommunicator::setWriteHook(
+    void (*_on_write)(RF24NetworkHeader &header, const void *data,
+                      int data_size, bool delivered)) {
+  on_write = _on_write;
+}
+
+/**
+ * This function is responsible for reporting every read or write that timed
+ * out. Reads have no header or data to report.
+ */
+void AquariusNetworkCommunicator::setTimeoutHook(
+    void (*_on_timeout)(RF24NetworkHeader *header, const void *data,
+                        int data_size)) {
+  on_timeout = _on_timeout;
+}
+
+/**
+ * This function is responsible for reporting every message read, e.g. to
+ * record the traffic.
+ */
+void AquariusNetworkCommunicator::setReadHook(
+    void (*_on_read)(RF24NetworkHeader &header, const void *data,
+                     int data_size)) {
+  on_read = _on_read;
+}
+
+/**
+ * This function is responsible for reading the next message, the oldest
+ * control one if there is any, and reporting it. Like network.read, copies at
+ * most data_size bytes and drops the rest.
+ */
+int AquariusNetworkCommunicator::read(void *data, int data_size) {
+  int s;
+  if (control_count > 0) {
+    lane_message &message = control[control_head];
+    read_header = message.header;
+    s = message.size < data_size ? message.size : data_size;
+    memcpy(data, message.data, s);
+    control_head = (control_head + 1) % LANE_CONTROL_SLOTS;
+    control_count--;
+  } else {
+    uint8_t size = bulk[0];
+    memcpy(&read_header, bulk + 1, sizeof(read_header));
+    s = size < data_size ? size : data_size;
+    memcpy(data, bulk + 1 + sizeof(read_header), s);
+    uint16_t entry = 1 + sizeof(read_header) + size;
+    bulk_used -= entry;
+    memmove(bulk, bulk + entry, bulk_used);
+  }
+  if (on_read) {
+    on_read(read_header, data, s);
+  }
+  return s;
+}
+
+bool AquariusNetworkCommunicator::readTimeout(void *data, int data_size) {
+  int s = 0;
+  unsigned long current = millis();
+  while (millis() - current < READ_TIMEOUT) {
+    update();
+    if (next()) {
+      s += read(data, data_size);
+      if (s == data_size)
+        return true;
+    }
+  }
+  if (on_timeout) {
+    on_timeout(NULL, NULL, 0);
+  }
+  return false;
+}
+
+/**
+ * This function is responsible for reading one message of at most data_size
+ * bytes without blocking. Returns the size of the message read, 0 if there
+ * was none.
+ */
+int AquariusNetworkCommunicator::poll(void *data, int data_size) {
+  update();
+  if (!next())
+    return 0;
+  return read(data, data_size);
+}
+
+/**
+ * This function is responsible for reading one control message without
+ * blocking, leaving bulk ones for later. Returns the size of the message
+ * read, 0 if there was none.
+ */
+int AquariusNetworkCommunicator::pollControl(void *data, int data_size) {
+  update();
+  if (control_count == 0)
+    return 0;
+  return read(data, data_size);
+}
+
+/**
+ * This function is responsible for writing a message, in the control lane if
+ * it is small enough, retrying for WRITE_TIMEOUT. Messages that came in
+ * meanwhile are sorted into their lanes on every attempt.
+ */
+bool AquariusNetworkCommunicator::writeTimeout(RF24NetworkHeader &header,
+                                               void *data, int data_size) {
+  if (header.type == LANE_BULK || header.type == LANE_CONTROL) {
+    header.type = data_size <= CONTROL_MAX_SIZE ? LANE_CONTROL : LANE_BULK;
+  }
+  unsigned long current = millis();
+  while (millis() - current < WRITE_TIMEOUT) {
+    update();
+    bool delivered = network.write(header, data, data_size);
+    if (on_write) {
+      on_write(header, data, data_size, delivered);
+    }
+    if (delivered) {
+      return true;
+    }
+  }
+  if (on_timeout) {
+    on_timeout(&header, data, data_size);
+  }
+  return false;
+}
+
+RF24NetworkHeader AquariusNetworkCommunicator::getReadHeader() {
+  return read_header;
+}
+
+/**
+ * This function is responsible for how many bulk messages were dropped for
+ * want of room, since start.
+ */
+uint16_t AquariusNetworkCommunicator::getBulkDropped() { return bulk_dropped; }
@@ -0,0 +1,68 @@
+#ifndef __AQUARIUS__
+#define __AQUARIUS__
+
+#include <AquariusProtocol.h>
+#include <stdint.h>
+
+#include "Aquarius_config.h"
+
+// Network
+#include <RF24Network.h>
+
+// Messages are taken out of the network as soon as it is updated and kept in
+// two lanes: control messages are read first, bulk ones after them, in the
+// order each came in. Writes of at most CONTROL_MAX_SIZE bytes go out in the
+// control lane.
+typedef struct {
+  RF24NetworkHeader header;
+  uint8_t size;
+  uint8_t data[CONTROL_MAX_SIZE];
+} lane_message;
+
+class AquariusNetworkCommunicator {
+private:
+  RF24Network &network;
+  RF24NetworkHeader read_header;
+  lane_message control[LANE_CONTROL_SLOTS];
+  uint8_t control_head;
+  uint8_t control_count;
+  // Bulk messages back to back: size, header, data
+  uint8_t bulk[LANE_BULK_BYTES];
+  uint16_t bulk_used;
+  uint16_t bulk_dropped;
+  void (*on_update)();
+  void (*on_write)(RF24NetworkHeader &header, const void *data, int data_size,
+                   bool delivered);
+  void (*on_timeout)(RF24NetworkHeader *header, const void *data,
+                     int data_size);
+  void (*on_read)(RF24NetworkHeader &header, const void *data,
+                  int data_size);
+
+  void update();
+  void sort();
+  bool next();
+  int read(void *data, int data_size);
+
+public:
+  AquariusNetworkCommunicator(RF24Network &_network);
+  bool readTimeout(void *data, int data_size);
+
+  int poll(void *data, int data_size);
+  int pollControl(void *data, int data_size);
+
+  bool writeTimeout(RF24NetworkHeader &header, void *data, int data_size);
+
+  void setUpdate(void (*_update)());
+  void setWriteHook(void (*_on_write)(RF24NetworkHeader &header,
+                                      const void *data, int data_size,
+                                      bool delivered));
+  void setTimeoutHook(void (*_on_timeout)(RF24NetworkHeader *header,
+                                          const void *data, int data_size));
+  void setReadHook(void (*_on_read)(RF24NetworkHeader &header,
+                                    const void *data, int data_size));
+
+  RF24NetworkHeader getReadHeader();
+  uint16_t getBulkDropped();
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef __AQUARIUS_CONFIG_H__
+#define __AQUARIUS_CONFIG_H__
+
+// Communication, overridable from build_flags, e.g. to replay a trace with
+// other timeouts
+#ifndef READ_TIMEOUT
+#define READ_TIMEOUT 10000
+#endif
+#ifndef WRITE_TIMEOUT
+#define WRITE_TIMEOUT 5000
+#endif
+
+// Lanes: control messages kept for reading, and the bytes bulk messages kept
+// for reading may take up, headers included. Bulk that does not fit is
+// dropped, so it never holds a control message back in the network's queue.
+#ifndef LANE_CONTROL_SLOTS
+#define LANE_CONTROL_SLOTS 4
+#endif
+#ifndef LANE_BULK_BYTES
+#define LANE_BULK_BYTES 256
+#endif
+
+#endif
@@ -0,0 +1,152 @@
+#include "AquariusDrying.h"
+
+#include <AquariusFixed.h>
+#include <string.h>
+
+/**
+ * The pots are only bound here, so a model kept in memory that outlives a
+ * reset is not cleared before it can be checked; see reset.
+ */
+DryingModel::DryingModel(drying_pot *pots, uint8_t count)
+    : pots(pots), count(count) {}
+
+/**
+ * This function is responsible for starting every pot over, with no readings
+ * and the default gain.
+ */
+void DryingModel::reset() {
+  memset(pots, 0, sizeof(drying_pot) * count);
+  for (uint8_t i = 0; i < count; i++) {
+    pots[i].gain = DRYING_DEFAULT_GAIN;
+  }
+}
+
+static uint16_t log2_humidity(uint8_t humidity) {
+  return aq_log2_q8(humidity ? humidity : 1);
+}
+
+/**
+ * This function is responsible for fitting the rate from the anchor to a
+ * reading. The first fit is taken as is, later ones move the rate part of
+ * the way.
+ */
+void DryingModel::fit(drying_pot &p, uint32_t time, uint8_t humidity) {
+  uint16_t from = log2_humidity(p.anchor_humidity);
+  uint16_t to = log2_humidity(humidity);
+  // Fits 32 bits: at most log2(255) = 2040 in Q8, times 256 * 3600
+  uint32_t rate =
+      from > to ? (uint32_t)(from - to) * 256 * 3600 / (time - p.anchor_time)
+                : 0;
+  if (rate > 0xFFFF) {
+    rate = 0xFFFF;
+  }
+  if (p.fits == 0) {
+    p.rate = rate;
+  } else {
+    p.rate =
+        (int32_t)p.rate + (((int32_t)rate - p.rate) >> DRYING_WEIGHT_SHIFT);
+  }
+  if (p.fits < DRYING_MIN_FITS) {
+    p.fits++;
+  }
+}
+
+/**
+ * This function is responsible for taking in a new reading of a pot.
+ * Readings must come oldest first; one not newer than the last is ignored,
+ * so the same record seen twice, as history and as a snapshot, counts once.
+ */
+void DryingModel::observe(uint8_t pot, uint32_t time, uint8_t humidity) {
+  if (pot >= count || time == 0) {
+    return;
+  }
+  drying_pot &p = pots[pot];
+  if (p.time != 0 && time <= p.time) {
+    return;
+  }
+
+  bool anchor = p.time == 0;
+  if (p.watered && time >= p.watered_at) {
+    uint8_t gain = humidity > p.humidity ? humidity - p.humidity : 0;
+    p.gain = (int16_t)p.gain + (((int16_t)gain - p.gain) >> 1);
+    p.watered = false;
+    anchor = true;
+  } else if (humidity > p.anchor_humidity + DRYING_NOISE) {
+    // Watered by someone else, or rain: start over from here
+    anchor = true;
+  } else {
+    uint32_t span = time - p.anchor_time;
+    if (span >= DRYING_MIN_SPAN_S &&
+        (p.anchor_humidity >= humidity + DRYING_MIN_DROP ||
+         span >= DRYING_MAX_SPAN_S)) {
+      fit(p, time, humidity);
+      anchor = true;
+    }
+  }
+
+  if (anchor) {
+    p.anchor_time = time;
+    p.anchor_humidity = humidity;
+  }
+  p.time = time;
+  p.humidity = humidity;
+}
+
+/**
+ * This function is responsible for booking a watering. Until the next reading
+ * the pot is taken to be at its last reading plus gain from then on.
+ */
+void DryingModel::watered(uint8_t pot, uint32_t time) {
+  if (pot >= count || pots[pot].time == 0) {
+    return;
+  }
+  pots[pot].watered = true;
+  pots[pot].watered_at = time;
+}
+
+bool DryingModel::trusted(uint8_t pot) {
+  return pot < count && pots[pot].fits >= DRYING_MIN_FITS;
+}
+
+/**
+ * This function is responsible for when a pot will be at threshold: the time
+ * of its last reading if it already is, DRYING_NEVER if it does not dry or
+ * the model is not trusted yet.
+ */
+uint32_t DryingModel::crossing(uint8_t pot, uint8_t threshold) {
+  if (pot >= count || pots[pot].time == 0) {
+    return DRYING_NEVER;
+  }
+  drying_pot &p = pots[pot];
+  uint32_t from = p.time;
+  uint16_t humidity = p.humidity;
+  if (p.watered) {
+    from = p.watered_at;
+    humidity = humidity + p.gain > 100 ? 100 : humidity + p.gain;
+  }
+
+  if (humidity <= threshold) {
+    return from;
+  }
+  if (!trusted(pot) || p.rate == 0) {
+    return DRYING_NEVER;
+  }
+  uint32_t seconds =
+      (uint32_t)(log2_humidity(humidity) - log2_humidity(threshold)) * 256 *
+      3600 / p.rate;
+  return seconds >= DRYING_NEVER - from ? DRYING_NEVER : from + seconds;
+}
+
+/**
+ * This function is responsible for when the next pot will be at threshold,
+ * not before now. A pot the model is not trusted for yet makes it now, so
+ * until every pot is known they are read as often as without a model.
+ */
+uint32_t DryingModel::next(uint32_t now, uint8_t threshold) {
+  uint32_t first = DRYING_NEVER;
+  for (uint8_t i = 0; i < count; i++) {
+    uint32_t at = trusted(i) ? crossing(i, threshold) : now;
+    first = at < first ? at : first;
+  }
+  return first < now ? now : first;
+}
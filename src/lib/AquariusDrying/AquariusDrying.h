@@ -0,0 +1,57 @@
+#ifndef __AQUARIUS_DRYING__
+#define __AQUARIUS_DRYING__
+
+#include <stdint.h>
+
+// Per pot drying model. Between waterings humidity decays exponentially,
+// h(t) = h0 * 2^(-rate * t), and a watering adds about gain points. Both are
+// fitted as readings come in. Readings are whole percents, so rate is not
+// fitted reading to reading but from an anchor reading to the first one
+// DRYING_MIN_DROP below it, or DRYING_MAX_SPAN_S after it. gain is fitted
+// from the first reading after a watering.
+//
+// Rates are log2 units per hour in Q16: a pot losing 10% of its humidity a
+// day has a rate of 0.0063, stored as 415.
+#define DRYING_MIN_SPAN_S 600UL     // closer readings are not fitted
+#define DRYING_MAX_SPAN_S 172800UL  // fitted even without a drop
+#define DRYING_MIN_DROP 3           // points
+#define DRYING_NOISE 2              // rises up to this are still drying
+#define DRYING_WEIGHT_SHIFT 2       // each fit moves 1/4 of the way
+#define DRYING_MIN_FITS 3           // fits before a forecast is made
+#define DRYING_DEFAULT_GAIN 30      // until a watering has been seen
+#define DRYING_NEVER 0xFFFFFFFFUL
+
+typedef struct {
+  uint32_t time;       // of the last reading, unix s, 0 before the first
+  uint32_t anchor_time;
+  uint32_t watered_at; // unix s, if watered
+  uint16_t rate;       // log2 units per hour, Q16
+  uint8_t humidity;    // last reading
+  uint8_t anchor_humidity;
+  uint8_t gain;        // points a watering adds
+  uint8_t fits;        // drying fits so far, up to DRYING_MIN_FITS
+  bool watered;        // since the last reading
+} drying_pot;
+
+class DryingModel {
+private:
+  drying_pot *pots;
+  uint8_t count;
+
+  void fit(drying_pot &p, uint32_t time, uint8_t humidity);
+
+public:
+  DryingModel(drying_pot *pots, uint8_t count);
+
+  void reset();
+  void observe(uint8_t pot, uint32_t time, uint8_t humidity);
+  void watered(uint8_t pot, uint32_t time);
+
+  bool trusted(uint8_t pot);
+  uint32_t crossing(uint8_t pot, uint8_t threshold);
+  uint32_t next(uint32_t now, uint8_t threshold);
+
+  const drying_pot &getPot(uint8_t pot) { return pots[pot]; }
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "AquariusFixed.h"
+
+// Car battery divider: map(adc, 0, 1023, 0, 2500) + 20 centivolts
+const uint16_t AQ_VOLTAGE_CURVE_MV[AQ_CURVE_POINTS] PROGMEM = {
+    200,   1764,  3328,  4892,  6456,  8020,  9584,  11148, 12712,
+    14276, 15840, 17404, 18968, 20532, 22096, 23660, 25200};
+
+// Capacitive Soil Moisture Sensor v1.2 at 5V, humidity in Q8.8 percent:
+// ~576 in dry air, ~256 submerged
+const uint16_t AQ_MOISTURE_CURVE_Q8[AQ_CURVE_POINTS] PROGMEM = {
+    25600, 25600, 25600, 25600, 25600, 20480, 15360, 10240, 5120,
+    0,     0,     0,     0,     0,     0,     0,     0};
+
+// Car tank, sensor 30 mm above the brim: straight sides down to ~150 mm, then
+// the bottom tapers to the pump's inlet
+const uint16_t AQ_TANK_CURVE_ML[AQ_TANK_POINTS] PROGMEM = {
+    900, 900, 880, 790, 690, 590, 490, 390, 290,
+    195, 110, 45,  0,   0,   0,   0,   0};
+
+const uint16_t AQ_LOG2_FRACTION_Q8[(1 << AQ_LOG2_SHIFT) + 1] PROGMEM = {
+    0, 22, 44, 63, 82, 100, 118, 134, 150, 165, 179, 193, 207, 220, 232, 244,
+    256};
+
+static uint16_t curve_eval(const uint16_t *curve, uint8_t shift,
+                           uint16_t x) {
+  uint8_t i = x >> shift;
+  uint8_t frac = x & ((1 << shift) - 1);
+  uint16_t y0 = pgm_read_word(curve + i);
+  uint16_t y1 = pgm_read_word(curve + i + 1);
+
+  if (y1 >= y0)
+    return y0 + (uint16_t)(((uint32_t)(y1 - y0) * frac) >> shift);
+  return y0 - (uint16_t)(((uint32_t)(y0 - y1) * frac) >> shift);
+}
+
+uint16_t aq_curve_eval(const uint16_t *curve, uint16_t x) {
+  if (x > AQ_CURVE_MAX_X)
+    x = AQ_CURVE_MAX_X;
+  return curve_eval(curve, AQ_CURVE_SHIFT, x);
+}
+
+uint16_t aq_voltage_mv(uint16_t adc) {
+  return aq_curve_eval(AQ_VOLTAGE_CURVE_MV, adc);
+}
+
+uint16_t aq_voltage_mv(const uint16_t *curve, uint16_t adc) {
+  return aq_curve_eval(curve, adc);
+}
+
+uint16_t aq_echo_to_mm(uint16_t echo_us) {
+  return (uint16_t)(((uint32_t)echo_us * AQ_MM_PER_US_Q16) >> 16);
+}
+
+uint16_t aq_mm_to_echo_us(uint16_t mm) {
+  if (mm >= 0xFFFFFFFFUL / AQ_US_PER_MM_Q16)
+    return 0xFFFF;
+  return (uint16_t)(((uint32_t)mm * AQ_US_PER_MM_Q16) >> 16);
+}
+
+q8_8_t aq_moisture_q8(const uint16_t *curve, uint16_t adc) {
+  return (q8_8_t)aq_curve_eval(curve, adc);
+}
+
+uint8_t aq_moisture_percent(const uint16_t *curve, uint16_t adc) {
+  uint16_t q = aq_curve_eval(curve, adc) + Q8_8_ONE / 2;
+  uint8_t percent = q >> 8;
+  return percent > 100 ? 100 : percent;
+}
+
+uint16_t aq_tank_ml(uint16_t distance_mm) {
+  if (distance_mm > AQ_TANK_MAX_MM)
+    distance_mm = AQ_TANK_MAX_MM;
+  return curve_eval(AQ_TANK_CURVE_ML, AQ_TANK_SHIFT, distance_mm);
+}
+
+uint16_t aq_log2_q8(uint16_t x) {
+  if (x == 0)
+    return 0;
+
+  // Normalise to 1.xxx: the top bit is the integer part, the next
+  // AQ_LOG2_SHIFT bits pick the table entry, the rest interpolate
+  uint8_t exponent = 15;
+  while (!(x & 0x8000)) {
+    x <<= 1;
+    exponent--;
+  }
+  const uint8_t rest = 15 - AQ_LOG2_SHIFT;
+  uint8_t i = (x >> rest) & ((1 << AQ_LOG2_SHIFT) - 1);
+  uint16_t frac = x & ((1 << rest) - 1);
+  uint16_t y0 = pgm_read_word(AQ_LOG2_FRACTION_Q8 + i);
+  uint16_t y1 = pgm_read_word(AQ_LOG2_FRACTION_Q8 + i + 1);
+  return ((uint16_t)exponent << 8) + y0 +
+         (uint16_t)(((uint32_t)(y1 - y0) * frac) >> rest);
+}
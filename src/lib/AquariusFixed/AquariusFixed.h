@@ -0,0 +1,78 @@
+#ifndef __AQUARIUS_FIXED__
+#define __AQUARIUS_FIXED__
+
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#endif
+
+// Q formats
+typedef int16_t q8_8_t;   // 8.8 signed
+typedef int32_t q16_16_t; // 16.16 signed
+
+#define Q8_8_ONE 256
+#define Q16_16_ONE 65536L
+
+// Calibration curves
+//
+// A curve is a PROGMEM table of AQ_CURVE_POINTS values sampled every
+// (1 << AQ_CURVE_SHIFT) ADC counts, so looking up a 10 bit reading is a shift,
+// a mask and one 16x16 multiply, no division.
+#define AQ_CURVE_SHIFT 6
+#define AQ_CURVE_POINTS ((1024 >> AQ_CURVE_SHIFT) + 1)
+#define AQ_CURVE_MAX_X 1023
+
+// Ultrasonic ranging: 343 m/s round trip is 0.1715 mm/us
+#define AQ_MM_PER_US_Q16 11239UL
+#define AQ_US_PER_MM_Q16 382134UL
+
+// log2(1 + i / 16) in Q8.8, for i = 0..16
+#define AQ_LOG2_SHIFT 4
+extern const uint16_t AQ_LOG2_FRACTION_Q8[(1 << AQ_LOG2_SHIFT) + 1] PROGMEM;
+
+extern const uint16_t AQ_VOLTAGE_CURVE_MV[AQ_CURVE_POINTS] PROGMEM;
+extern const uint16_t AQ_MOISTURE_CURVE_Q8[AQ_CURVE_POINTS] PROGMEM;
+
+// Car tank: ml held with the water surface every (1 << AQ_TANK_SHIFT) mm
+// below the ultrasonic sensor, up to AQ_TANK_MAX_MM
+#define AQ_TANK_SHIFT 4
+#define AQ_TANK_POINTS 17
+#define AQ_TANK_MAX_MM 255
+extern const uint16_t AQ_TANK_CURVE_ML[AQ_TANK_POINTS] PROGMEM;
+
+/**
+ * This function is responsible for evaluating a PROGMEM curve at the given ADC
+ * reading, linearly interpolating between the two closest points.
+ */
+uint16_t aq_curve_eval(const uint16_t *curve, uint16_t x);
+
+/**
+ * These functions are responsible for converting raw readings into fixed point
+ * engineering units.
+ */
+uint16_t aq_voltage_mv(uint16_t adc);
+uint16_t aq_voltage_mv(const uint16_t *curve, uint16_t adc);
+
+uint16_t aq_echo_to_mm(uint16_t echo_us);
+uint16_t aq_mm_to_echo_us(uint16_t mm);
+
+q8_8_t aq_moisture_q8(const uint16_t *curve, uint16_t adc);
+uint8_t aq_moisture_percent(const uint16_t *curve, uint16_t adc);
+
+/**
+ * This function is responsible for the water in the car's tank, in ml, with
+ * the surface distance_mm below the sensor.
+ */
+uint16_t aq_tank_ml(uint16_t distance_mm);
+
+/**
+ * This function is responsible for log2(x) in Q8.8, within 2/256 of the real
+ * thing. log2(0) is taken as 0.
+ */
+uint16_t aq_log2_q8(uint16_t x);
+
+#endif
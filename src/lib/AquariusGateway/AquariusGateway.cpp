@@ -0,0 +1,96 @@
+#include "AquariusGateway.h"
+
+#include <AquariusRecord.h>
+
+static void head_bytes(const gateway_frame &frame, uint8_t *head) {
+  head[0] = frame.kind;
+  head[1] = frame.seq;
+  head[2] = frame.node & 0xFF;
+  head[3] = frame.node >> 8;
+  head[4] = frame.type;
+  head[5] = frame.size;
+}
+
+void gateway_write(const gateway_frame &frame, void (*emit)(uint8_t byte)) {
+  uint8_t head[GATEWAY_HEAD];
+  head_bytes(frame, head);
+  uint16_t crc = aq_crc16(0xFFFF, head, sizeof(head));
+  crc = aq_crc16(crc, frame.payload, frame.size);
+
+  emit(GATEWAY_MAGIC & 0xFF);
+  emit(GATEWAY_MAGIC >> 8);
+  for (uint8_t i = 0; i < sizeof(head); i++) {
+    emit(head[i]);
+  }
+  for (uint8_t i = 0; i < frame.size; i++) {
+    emit(frame.payload[i]);
+  }
+  emit(crc & 0xFF);
+  emit(crc >> 8);
+}
+
+GatewayDecoder::GatewayDecoder() : at(0), crc(0), errors(0) {}
+
+/**
+ * This function is responsible for taking in the next byte. Returns true when
+ * it completes a frame, which getFrame then holds until the next call.
+ */
+bool GatewayDecoder::feed(uint8_t byte) {
+  if (at == 0) {
+    at = byte == (GATEWAY_MAGIC & 0xFF) ? 1 : 0;
+    return false;
+  }
+  if (at == 1) {
+    at = byte == (GATEWAY_MAGIC >> 8) ? 2 : byte == (GATEWAY_MAGIC & 0xFF);
+    crc = 0xFFFF;
+    return false;
+  }
+
+  uint16_t end = 2 + GATEWAY_HEAD + frame.size;
+  if (at < 2 + GATEWAY_HEAD) {
+    switch (at - 2) {
+    case 0:
+      frame.kind = byte;
+      break;
+    case 1:
+      frame.seq = byte;
+      break;
+    case 2:
+      frame.node = byte;
+      break;
+    case 3:
+      frame.node |= (uint16_t)byte << 8;
+      break;
+    case 4:
+      frame.type = byte;
+      break;
+    case 5:
+      if (byte > GATEWAY_PAYLOAD_MAX) {
+        errors++;
+        at = 0;
+        return false;
+      }
+      frame.size = byte;
+      break;
+    }
+    crc = aq_crc16(crc, &byte, 1);
+  } else if (at < end) {
+    frame.payload[at - 2 - GATEWAY_HEAD] = byte;
+    crc = aq_crc16(crc, &byte, 1);
+  } else if (at == end) {
+    if (byte != (crc & 0xFF)) {
+      errors++;
+      at = 0;
+      return false;
+    }
+  } else {
+    at = 0;
+    if (byte != (crc >> 8)) {
+      errors++;
+      return false;
+    }
+    return true;
+  }
+  at++;
+  return false;
+}
@@ -0,0 +1,77 @@
+#ifndef __AQUARIUS_GATEWAY__
+#define __AQUARIUS_GATEWAY__
+
+#include <stdint.h>
+
+// Gateway mode: the CT bridges the mesh to a host on Serial, which runs the
+// phases instead. Frame: magic "AG", kind, seq, node (2), type, size, size
+// bytes of payload, then the CRC16 of everything after the magic. Multi-byte
+// fields are little endian. A reader skips whatever is not a frame, so the
+// CT's log lines and the 'M' and 'T' dumps share the port with them.
+#define GATEWAY_MAGIC 0x4741
+#define GATEWAY_VERSION 2
+#define GATEWAY_HEAD 6 // kind to size
+#define GATEWAY_PAYLOAD_MAX 144 // RF24Network's largest frame on AVR
+#define GATEWAY_BAUD 500000     // 0% error off the Mega's 16 MHz
+
+// The host says hello every GATEWAY_HEARTBEAT ms; after GATEWAY_HOST_TIMEOUT
+// without one the CT runs the phases on board again
+#define GATEWAY_HEARTBEAT 1000
+#define GATEWAY_HOST_TIMEOUT 5000
+
+// Frame kinds. The CT answers each host frame with one of the same kind and
+// seq, but a GATEWAY_TX, answered with a GATEWAY_TX_RESULT.
+#define GATEWAY_HELLO 1     // Answered with gateway_hello
+#define GATEWAY_TX 2        // One write attempt of payload to node, as type;
+                            // a lane is picked by size, as writeTimeout does
+#define GATEWAY_NODES 3     // Answered with the mesh: node ID, address (2)
+#define GATEWAY_PUMP 4      // payload[0] turns the pump on or off
+#define GATEWAY_RX 5        // CT -> host: a message read from node
+#define GATEWAY_TX_RESULT 6 // payload[0]: whether the write was acknowledged
+
+typedef struct {
+  uint8_t version;
+  uint8_t bridging; // 0 while a cycle runs on board
+  uint8_t pots;
+  uint8_t cars;
+  uint8_t pots_per_harvester;
+  uint8_t max_harvesters;
+  uint8_t protocol; // PROTOCOL_VERSION the CT and the host talk to nodes in
+} gateway_hello;
+
+typedef struct {
+  uint8_t kind;
+  uint8_t seq;
+  uint16_t node;
+  uint8_t type;
+  uint8_t size;
+  uint8_t payload[GATEWAY_PAYLOAD_MAX];
+} gateway_frame;
+
+/**
+ * This function is responsible for sending a frame one byte at a time.
+ */
+void gateway_write(const gateway_frame &frame, void (*emit)(uint8_t byte));
+
+/**
+ * This class is responsible for finding frames in a byte stream, one byte at
+ * a time. A frame with a bad CRC is dropped and counted.
+ */
+class GatewayDecoder {
+private:
+  gateway_frame frame;
+  uint16_t at; // bytes of the current frame seen, magic included
+  uint16_t crc;
+  uint32_t errors;
+
+public:
+  GatewayDecoder();
+
+  bool feed(uint8_t byte);
+  bool idle() { return at == 0; }
+
+  const gateway_frame &getFrame() { return frame; }
+  uint32_t getErrors() { return errors; }
+};
+
+#endif
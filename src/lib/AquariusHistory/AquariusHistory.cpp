@@ -0,0 +1,214 @@
+#include <string.h>
+
+#include "AquariusHistory.h"
+
+static void write_u32(uint8_t *dst, uint32_t value) {
+  for (uint8_t i = 0; i < 4; i++) {
+    dst[i] = value >> (8 * i);
+  }
+}
+
+static uint32_t read_u32(const uint8_t *src) {
+  uint32_t value = 0;
+  for (uint8_t i = 0; i < 4; i++) {
+    value |= (uint32_t)src[i] << (8 * i);
+  }
+  return value;
+}
+
+uint8_t history_decode(const uint8_t *entry, history_record *state) {
+  state->seq++;
+  if (entry[0] & HISTORY_KEY) {
+    state->time = read_u32(entry + 1);
+    memcpy(state->humidity, entry + 5, HISTORY_CHANNELS);
+    return HISTORY_KEY_SIZE;
+  }
+
+  state->time += entry[0];
+  for (uint8_t i = 0; i < HISTORY_CHANNELS; i++) {
+    uint8_t nibble = entry[1 + i / 2] >> (4 * (i & 1));
+    int8_t delta = (int8_t)(nibble << 4) >> 4;
+    state->humidity[i] += delta;
+  }
+  return HISTORY_DELTA_SIZE;
+}
+
+/*******************************************************************************
+********************************** HistoryRing *********************************
+********************************************************************************/
+
+HistoryRing::HistoryRing()
+    : head(0), tail(0), used(0), head_seq(0), tail_seq(0) {
+  memset(&oldest, 0, sizeof(oldest));
+  memset(&newest, 0, sizeof(newest));
+}
+
+uint8_t HistoryRing::at(uint16_t offset) {
+  return buffer[offset % HISTORY_BYTES];
+}
+
+void HistoryRing::put(uint8_t value) {
+  buffer[head] = value;
+  head = (head + 1) % HISTORY_BYTES;
+  used++;
+}
+
+uint8_t HistoryRing::entry_size(uint16_t offset) {
+  return (at(offset) & HISTORY_KEY) ? HISTORY_KEY_SIZE : HISTORY_DELTA_SIZE;
+}
+
+void HistoryRing::decode(uint16_t offset, history_record *state) {
+  uint8_t entry[HISTORY_KEY_SIZE];
+  uint8_t size = entry_size(offset);
+  for (uint8_t i = 0; i < size; i++) {
+    entry[i] = at(offset + i);
+  }
+  history_decode(entry, state);
+}
+
+/**
+ * This function is responsible for dropping the oldest entry. Its values are
+ * folded into oldest so the next entry can still be decoded.
+ */
+void HistoryRing::evict() {
+  uint8_t size = entry_size(tail);
+  decode(tail, &oldest);
+  tail = (tail + size) % HISTORY_BYTES;
+  used -= size;
+  tail_seq++;
+}
+
+/**
+ * This function is responsible for recording one reading, as a delta against
+ * the previous one when possible.
+ */
+void HistoryRing::append(uint32_t time, const uint8_t *humidity) {
+  bool key = used == 0 || time < newest.time ||
+             time - newest.time > HISTORY_MAX_DT;
+  uint8_t packed[HISTORY_CHANNELS / 2];
+  memset(packed, 0, sizeof(packed));
+
+  for (uint8_t i = 0; i < HISTORY_CHANNELS && !key; i++) {
+    int16_t delta = (int16_t)humidity[i] - newest.humidity[i];
+    if (delta < -8 || delta > 7) {
+      key = true;
+    } else {
+      packed[i / 2] |= (uint8_t)(delta & 0x0F) << (4 * (i & 1));
+    }
+  }
+
+  uint8_t size = key ? HISTORY_KEY_SIZE : HISTORY_DELTA_SIZE;
+  while (HISTORY_BYTES - used < size) {
+    evict();
+  }
+
+  if (key) {
+    uint8_t time_bytes[4];
+    write_u32(time_bytes, time);
+    put(HISTORY_KEY);
+    for (uint8_t i = 0; i < 4; i++) {
+      put(time_bytes[i]);
+    }
+    for (uint8_t i = 0; i < HISTORY_CHANNELS; i++) {
+      put(humidity[i]);
+    }
+  } else {
+    put(time - newest.time);
+    for (uint8_t i = 0; i < sizeof(packed); i++) {
+      put(packed[i]);
+    }
+  }
+
+  newest.seq = head_seq;
+  newest.time = time;
+  memcpy(newest.humidity, humidity, HISTORY_CHANNELS);
+  head_seq++;
+}
+
+/**
+ * This function is responsible for packing as many entries as fit into frame,
+ * starting at seq since. A since outside [tail_seq, head_seq] starts from the
+ * oldest entry. Returns false when there is nothing to send, i.e. since is
+ * head_seq and the CT is caught up.
+ */
+bool HistoryRing::fill(history_frame *frame, uint16_t since, uint32_t now) {
+  uint16_t stored = head_seq - tail_seq;
+  if ((uint16_t)(since - tail_seq) > stored) {
+    since = tail_seq;
+  }
+
+  frame->now = now;
+  frame->drift_ppm = 0;
+  frame->count = 0;
+  frame->more = 0;
+  frame->size = 0;
+  frame->first_seq = since;
+
+  if (since == head_seq) {
+    return false;
+  }
+
+  // Walk up to since, decoding as we go
+  history_record state = oldest;
+  state.seq = tail_seq - 1;
+  uint16_t offset = tail;
+  while (true) {
+    decode(offset, &state);
+    offset += entry_size(offset);
+    if (state.seq == since)
+      break;
+  }
+
+  frame->base_time = state.time;
+  memcpy(frame->base, state.humidity, HISTORY_CHANNELS);
+  frame->count = 1;
+
+  // The rest goes out as encoded
+  for (uint16_t seq = since + 1; seq != head_seq; seq++) {
+    uint8_t size = entry_size(offset);
+    if (frame->size + size > HISTORY_FRAME_DATA) {
+      frame->more = 1;
+      break;
+    }
+    for (uint8_t i = 0; i < size; i++) {
+      frame->data[frame->size++] = at(offset + i);
+    }
+    offset += size;
+    frame->count++;
+  }
+  return true;
+}
+
+uint16_t HistoryRing::count() { return head_seq - tail_seq; }
+
+uint16_t HistoryRing::nextSeq() { return head_seq; }
+
+/*******************************************************************************
+******************************** HistoryDecoder ********************************
+********************************************************************************/
+
+HistoryDecoder::HistoryDecoder(const history_frame *_frame)
+    : frame(_frame), index(0), offset(0) {
+  state.seq = frame->first_seq;
+  state.time = frame->base_time;
+  memcpy(state.humidity, frame->base, HISTORY_CHANNELS);
+}
+
+/**
+ * This function is responsible for returning the frame's records in order.
+ */
+bool HistoryDecoder::next(history_record *record) {
+  if (index >= frame->count)
+    return false;
+
+  if (index > 0) {
+    uint8_t size = (frame->data[offset] & HISTORY_KEY) ? HISTORY_KEY_SIZE
+                                                         : HISTORY_DELTA_SIZE;
+    if (offset + size > frame->size)
+      return false;
+    offset += history_decode(frame->data + offset, &state);
+  }
+  index++;
+  *record = state;
+  return true;
+}
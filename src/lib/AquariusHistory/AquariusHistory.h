@@ -0,0 +1,104 @@
+#ifndef __AQUARIUS_HISTORY__
+#define __AQUARIUS_HISTORY__
+
+#include <AquariusProtocol.h>
+#include <stdint.h>
+
+// Ring layout
+//
+// Entries are variable length. A delta entry is one byte holding the seconds
+// since the previous entry (0..127) followed by eight signed 4 bit humidity
+// deltas packed in 4 bytes. Anything that does not fit is stored as a key
+// entry: 0x80, the 32 bit time in seconds and the eight raw humidity bytes.
+#define HISTORY_BYTES 256
+#define HISTORY_CHANNELS 8
+#define HISTORY_KEY 0x80
+#define HISTORY_MAX_DT 0x7F
+#define HISTORY_DELTA_SIZE (1 + HISTORY_CHANNELS / 2)
+#define HISTORY_KEY_SIZE (1 + 4 + HISTORY_CHANNELS)
+
+// A reading is recorded every HISTORY_PERIOD_S, within HISTORY_MAX_DT so it
+// packs as a delta, and a ring of deltas then spans HISTORY_SPAN_S. The CT
+// must backfill more often than that or the oldest readings are lost.
+#define HISTORY_PERIOD_S 120
+#define HISTORY_SPAN_S (HISTORY_BYTES / HISTORY_DELTA_SIZE * HISTORY_PERIOD_S)
+
+// Largest encoded payload carried by one history_frame
+#define HISTORY_FRAME_DATA 100
+
+typedef struct {
+  uint16_t seq;
+  uint32_t time;
+  uint8_t humidity[HISTORY_CHANNELS];
+} history_record;
+
+// CT -> harvester: send everything recorded since seq
+typedef struct {
+  aq_signal signal;
+  uint16_t since;
+} AQ_MESSAGE history_request;
+
+// Harvester -> CT: the first record decoded, followed by the next count - 1
+// records exactly as they are encoded in the ring. Times are on the
+// harvester's own clock, which runs drift_ppm off true time.
+typedef struct {
+  aq_signal signal;
+  uint16_t first_seq;
+  uint8_t count;
+  uint8_t more;
+  uint32_t now;
+  int16_t drift_ppm;
+  uint32_t base_time;
+  uint8_t base[HISTORY_CHANNELS];
+  uint8_t size;
+  uint8_t data[HISTORY_FRAME_DATA];
+} AQ_MESSAGE history_frame;
+
+class HistoryRing {
+private:
+  uint8_t buffer[HISTORY_BYTES];
+  uint16_t head;
+  uint16_t tail;
+  uint16_t used;
+  uint16_t head_seq;
+  uint16_t tail_seq;
+
+  // State before the oldest entry and after the newest one
+  history_record oldest;
+  history_record newest;
+
+  uint8_t at(uint16_t offset);
+  void put(uint8_t value);
+  uint8_t entry_size(uint16_t offset);
+  void decode(uint16_t offset, history_record *state);
+  void evict();
+
+public:
+  HistoryRing();
+
+  void append(uint32_t time, const uint8_t *humidity);
+  bool fill(history_frame *frame, uint16_t since, uint32_t now);
+
+  uint16_t count();
+  uint16_t nextSeq();
+};
+
+class HistoryDecoder {
+private:
+  const history_frame *frame;
+  history_record state;
+  uint8_t index;
+  uint8_t offset;
+
+public:
+  HistoryDecoder(const history_frame *_frame);
+  bool next(history_record *record);
+};
+
+/**
+ * This function is responsible for decoding one ring entry starting at
+ * entry[0] on top of state. Returns the size of the entry.
+ */
+uint8_t history_decode(const uint8_t *entry, history_record *state);
+
+#endif
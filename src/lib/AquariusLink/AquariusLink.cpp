@@ -0,0 +1,222 @@
+#include "AquariusLink.h"
+
+const uint8_t LINK_CANDIDATE_CHANNELS[LINK_CANDIDATES] = {84,  90,  96,  102,
+                                                          108, 112, 118, 124};
+const rf24_datarate_e LINK_RATE_LADDER[LINK_RATES] = {RF24_250KBPS, RF24_1MBPS,
+                                                      RF24_2MBPS};
+
+// Rate ladder thresholds
+#define LINK_STEP_DOWN_PERMILLE 900
+#define LINK_STEP_UP_PERMILLE 990
+#define LINK_STEP_UP_RETRIES_X100 20
+
+LinkMonitor::LinkMonitor(RF24 &_radio, uint8_t _home_channel,
+                         uint8_t _home_rate)
+    : radio(_radio), home_channel(_home_channel), home_rate(_home_rate),
+      channel(_home_channel), rate(_home_rate), peer_count(0),
+      pending(false), confirming(false) {}
+
+/**
+ * This function is responsible for finding the stats of a peer, taking over
+ * the least used entry when the table is full.
+ */
+link_stats *LinkMonitor::peer(uint16_t node) {
+  uint8_t least = 0;
+  for (uint8_t i = 0; i < peer_count; i++) {
+    if (peers[i].node == node) {
+      return &peers[i];
+    }
+    if (peers[i].attempts < peers[least].attempts) {
+      least = i;
+    }
+  }
+
+  uint8_t i = peer_count < LINK_PEERS ? peer_count++ : least;
+  peers[i].node = node;
+  peers[i].attempts = 0;
+  peers[i].delivered = 0;
+  peers[i].retries = 0;
+  return &peers[i];
+}
+
+/**
+ * This function is responsible for booking one write attempt. The radio's
+ * retransmit count still holds the value for that attempt.
+ */
+void LinkMonitor::sent(uint16_t node, bool delivered) {
+  link_stats *s = peer(node);
+  if (s->attempts >= LINK_AGE_ATTEMPTS) {
+    s->attempts >>= 1;
+    s->delivered >>= 1;
+    s->retries >>= 1;
+  }
+  s->attempts++;
+  s->delivered += delivered ? 1 : 0;
+  s->retries += radio.getARC();
+}
+
+void LinkMonitor::reset() { peer_count = 0; }
+
+/**
+ * This function is responsible for sampling the received power detector on
+ * every candidate channel. It takes about LINK_CANDIDATES x LINK_SURVEY_SAMPLES
+ * x LINK_RPD_SETTLE_US, during which the node is deaf.
+ */
+void LinkMonitor::survey(uint8_t *busy) {
+  for (uint8_t c = 0; c < LINK_CANDIDATES; c++) {
+    radio.setChannel(LINK_CANDIDATE_CHANNELS[c]);
+    busy[c] = 0;
+    for (uint8_t s = 0; s < LINK_SURVEY_SAMPLES; s++) {
+      // The detector latches until the radio leaves RX
+      radio.stopListening();
+      radio.startListening();
+      delayMicroseconds(LINK_RPD_SETTLE_US);
+      busy[c] += radio.testRPD() ? 1 : 0;
+    }
+  }
+  radio.setChannel(channel);
+  radio.startListening();
+}
+
+/**
+ * This function is responsible for the node's side of a link_report, without
+ * the survey.
+ */
+void LinkMonitor::fillReport(link_report *report) {
+  report->channel = channel;
+  report->rate = rate;
+  // Through locals, as the report's fields need not be aligned
+  uint16_t attempts, delivered, retries;
+  totals(&attempts, &delivered, &retries);
+  report->attempts = attempts;
+  report->delivered = delivered;
+  report->retries = retries;
+  memset(report->busy, 0, sizeof(report->busy));
+}
+
+void LinkMonitor::apply(uint8_t _channel, uint8_t _rate) {
+  if (_rate >= LINK_RATES) {
+    _rate = home_rate;
+  }
+  channel = _channel;
+  rate = _rate;
+  pending = false;
+  confirming = false;
+  radio.setChannel(channel);
+  radio.setDataRate(LINK_RATE_LADDER[rate]);
+}
+
+void LinkMonitor::goHome() { apply(home_channel, home_rate); }
+
+bool LinkMonitor::isHome() {
+  return channel == home_channel && rate == home_rate;
+}
+
+void LinkMonitor::schedule(link_switch &message, unsigned long now) {
+  pending = true;
+  pending_channel = message.channel;
+  pending_rate = message.rate;
+  pending_at = now;
+  pending_delay = (unsigned long)message.delay_ticks * LINK_SWITCH_TICK_MS;
+  confirm_delay = (unsigned long)message.confirm_slot * LINK_CONFIRM_SLOT_MS;
+}
+
+/**
+ * This function is responsible for applying a scheduled switch once its delay
+ * ran out. Returns true once the node's confirmation slot after it came.
+ */
+bool LinkMonitor::due(unsigned long now) {
+  if (pending && now - pending_at >= pending_delay) {
+    apply(pending_channel, pending_rate);
+    confirming = true;
+    confirm_at = now;
+  }
+  if (!confirming || now - confirm_at < confirm_delay) {
+    return false;
+  }
+  confirming = false;
+  return true;
+}
+
+uint8_t LinkMonitor::getChannel() { return channel; }
+
+uint8_t LinkMonitor::getRate() { return rate; }
+
+uint8_t LinkMonitor::getPeerCount() { return peer_count; }
+
+const link_stats &LinkMonitor::getPeer(uint8_t i) { return peers[i]; }
+
+void LinkMonitor::totals(uint16_t *attempts, uint16_t *delivered,
+                         uint16_t *retries) {
+  uint32_t a = 0, d = 0, r = 0;
+  for (uint8_t i = 0; i < peer_count; i++) {
+    a += peers[i].attempts;
+    d += peers[i].delivered;
+    r += peers[i].retries;
+  }
+  // Keep the ratios when the sums do not fit
+  while (a > 0xFFFF || r > 0xFFFF) {
+    a >>= 1;
+    d >>= 1;
+    r >>= 1;
+  }
+  *attempts = a;
+  *delivered = d;
+  *retries = r;
+}
+
+void LinkMonitor::report() {
+  Serial.print("Link: channel ");
+  Serial.print(channel);
+  Serial.print(", rate ");
+  Serial.println(rate);
+  for (uint8_t i = 0; i < peer_count; i++) {
+    Serial.print("Node ");
+    Serial.print(peers[i].node, OCT);
+    Serial.print(": sent ");
+    Serial.print(peers[i].attempts);
+    Serial.print(", delivered (permille) ");
+    Serial.print(link_delivery_permille(peers[i].attempts, peers[i].delivered));
+    Serial.print(", retries ");
+    Serial.println(peers[i].retries);
+  }
+}
+
+uint16_t link_delivery_permille(uint16_t attempts, uint16_t delivered) {
+  if (attempts == 0) {
+    return 1000;
+  }
+  return (uint32_t)delivered * 1000 / attempts;
+}
+
+uint8_t link_pick_channel(const uint16_t *busy, uint8_t current,
+                          uint16_t margin) {
+  uint8_t best = 0;
+  int8_t now = -1;
+  for (uint8_t c = 0; c < LINK_CANDIDATES; c++) {
+    if (busy[c] < busy[best]) {
+      best = c;
+    }
+    if (LINK_CANDIDATE_CHANNELS[c] == current) {
+      now = c;
+    }
+  }
+
+  if (now >= 0 && busy[now] <= busy[best] + margin) {
+    return current;
+  }
+  return LINK_CANDIDATE_CHANNELS[best];
+}
+
+uint8_t link_pick_rate(uint8_t current, uint16_t delivery_permille,
+                       uint16_t retries_per_attempt_x100) {
+  if (delivery_permille < LINK_STEP_DOWN_PERMILLE && current > 0) {
+    return current - 1;
+  }
+  if (delivery_permille >= LINK_STEP_UP_PERMILLE &&
+      retries_per_attempt_x100 <= LINK_STEP_UP_RETRIES_X100 &&
+      current + 1 < LINK_RATES) {
+    return current + 1;
+  }
+  return current;
+}
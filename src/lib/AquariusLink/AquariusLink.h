@@ -0,0 +1,143 @@
+#ifndef __AQUARIUS_LINK__
+#define __AQUARIUS_LINK__
+
+#include <Arduino.h>
+#include <AquariusProtocol.h>
+#include <RF24.h>
+
+// Peers tracked per node; the CT overrides it to cover every node it talks to
+#ifndef LINK_PEERS
+#define LINK_PEERS 4
+#endif
+
+// Counters are halved once a peer reaches LINK_AGE_ATTEMPTS, so the ratios
+// follow current conditions
+#define LINK_AGE_ATTEMPTS 60000
+
+// Channel survey: every candidate is sampled LINK_SURVEY_SAMPLES times with
+// the received power detector (> -64 dBm). 84 and up is clear of Wi-Fi.
+#define LINK_CANDIDATES 8
+#define LINK_SURVEY_SAMPLES 64
+#define LINK_RPD_SETTLE_US 200
+
+// Data rates, slowest (longest range) first
+#define LINK_RATES 3
+#define LINK_RATE_250KBPS 0
+#define LINK_RATE_1MBPS 1
+#define LINK_RATE_2MBPS 2
+
+// Switch-over: nodes apply a switch after the delay it carries, in ticks of
+// LINK_SWITCH_TICK_MS, and confirm with a link_report in the slot it carries,
+// LINK_CONFIRM_SLOT_MS apart, so the CT has room for every confirmation; any
+// node that cannot goes back home
+#define LINK_SWITCH_TICK_MS 10
+#define LINK_CONFIRM_MS 10000
+#define LINK_CONFIRM_SLOT_MS 100
+
+typedef struct {
+  uint16_t node;
+  uint16_t attempts;
+  uint16_t delivered;
+  uint16_t retries; // hardware retransmits, summed
+} link_stats;
+
+// CT -> node: survey the candidates and send a link_report
+// node -> CT: its busy counts and its totals towards every peer
+typedef struct {
+  aq_signal signal;
+  uint8_t channel;
+  uint8_t rate;
+  uint16_t attempts;
+  uint16_t delivered;
+  uint16_t retries;
+  uint8_t busy[LINK_CANDIDATES];
+} AQ_MESSAGE link_report;
+
+// CT -> node: move to channel / rate in delay_ticks, confirm confirm_slot
+// slots after that. It travels in the control lane, so a car waiting for the
+// pump or at its hold still acts on it.
+typedef struct {
+  aq_signal signal;
+  uint8_t channel;
+  uint8_t rate;
+  uint16_t delay_ticks;
+  uint8_t confirm_slot;
+} AQ_MESSAGE link_switch;
+static_assert(sizeof(link_switch) <= CONTROL_MAX_SIZE,
+              "link_switch does not fit the control lane");
+
+extern const uint8_t LINK_CANDIDATE_CHANNELS[LINK_CANDIDATES];
+extern const rf24_datarate_e LINK_RATE_LADDER[LINK_RATES];
+
+/**
+ * Tracks delivery and retransmits towards each peer and owns the radio's
+ * channel and data rate, including a scheduled switch and the way back to the
+ * home settings every node boots with.
+ */
+class LinkMonitor {
+private:
+  RF24 &radio;
+  uint8_t home_channel;
+  uint8_t home_rate;
+  uint8_t channel;
+  uint8_t rate;
+
+  link_stats peers[LINK_PEERS];
+  uint8_t peer_count;
+
+  bool pending;
+  uint8_t pending_channel;
+  uint8_t pending_rate;
+  unsigned long pending_at;
+  unsigned long pending_delay;
+
+  bool confirming;
+  unsigned long confirm_at;
+  unsigned long confirm_delay;
+
+  link_stats *peer(uint16_t node);
+
+public:
+  LinkMonitor(RF24 &_radio, uint8_t _home_channel, uint8_t _home_rate);
+
+  void sent(uint16_t node, bool delivered);
+  void reset();
+
+  void survey(uint8_t *busy);
+  void fillReport(link_report *report);
+
+  void apply(uint8_t _channel, uint8_t _rate);
+  void goHome();
+  bool isHome();
+  void schedule(link_switch &message, unsigned long now);
+  bool due(unsigned long now);
+
+  uint8_t getChannel();
+  uint8_t getRate();
+  uint8_t getPeerCount();
+  const link_stats &getPeer(uint8_t i);
+  void totals(uint16_t *attempts, uint16_t *delivered, uint16_t *retries);
+  void report();
+};
+
+/**
+ * This function is responsible for the delivery ratio, in per mille, of the
+ * given counters; 1000 when nothing was sent.
+ */
+uint16_t link_delivery_permille(uint16_t attempts, uint16_t delivered);
+
+/**
+ * This function is responsible for picking the least busy candidate. The
+ * current channel is kept unless another one is quieter by more than margin.
+ */
+uint8_t link_pick_channel(const uint16_t *busy, uint8_t current,
+                          uint16_t margin);
+
+/**
+ * This function is responsible for moving one step down the rate ladder when
+ * delivery is poor and one step up when it is near perfect.
+ */
+uint8_t link_pick_rate(uint8_t current, uint16_t delivery_permille,
+                       uint16_t retries_per_attempt_x100);
+
+#endif
@@ -0,0 +1,182 @@
+#include <string.h>
+
+#include <AquariusRecord.h>
+
+#include "AquariusMetrics.h"
+
+#define METRICS_SATURATED 0xFFFF
+
+static void bump(uint16_t &counter) {
+  if (counter < METRICS_SATURATED) {
+    counter++;
+  }
+}
+
+AquariusMetrics::AquariusMetrics() { reset(); }
+
+void AquariusMetrics::reset() {
+  memset(&data, 0, sizeof(data));
+  data.magic = METRICS_MAGIC;
+  data.version = METRICS_VERSION;
+}
+
+uint8_t metrics_bucket(uint32_t ms) {
+  uint8_t bits = 0;
+  for (; ms && bits < METRICS_BUCKETS - 1; ms >>= 1) {
+    bits++;
+  }
+  return bits;
+}
+
+/**
+ * This function is responsible for booking one run of a phase. A phase that
+ * ran 65535 times has its count, sum and histogram halved, which keeps the
+ * mean and percentiles and leans them towards recent runs.
+ */
+void AquariusMetrics::phase(uint8_t phase, bool ok, uint32_t ms) {
+  if (phase >= METRICS_PHASES) {
+    return;
+  }
+
+  metrics_phase &p = data.phases[phase];
+  if (p.count == METRICS_SATURATED) {
+    p.count >>= 1;
+    p.sum_ms >>= 1;
+    for (uint8_t b = 0; b < METRICS_BUCKETS; b++) {
+      p.histogram[b] >>= 1;
+    }
+  }
+
+  if (!ok) {
+    bump(p.failures);
+  }
+  if (p.count == 0 || ms < p.min_ms) {
+    p.min_ms = ms;
+  }
+  if (ms > p.max_ms) {
+    p.max_ms = ms;
+  }
+  p.count++;
+  p.sum_ms = p.sum_ms + ms < p.sum_ms ? 0xFFFFFFFFUL : p.sum_ms + ms;
+  bump(p.histogram[metrics_bucket(ms)]);
+}
+
+/**
+ * This function is responsible for the counters of a node, taking a free
+ * slot the first time it is seen. Past METRICS_NODES nodes share the last one.
+ */
+metrics_counters *AquariusMetrics::counters(uint8_t node) {
+  for (uint8_t i = 0; i < data.nodes; i++) {
+    if (data.node[i].id == node) {
+      return &data.node[i].counters;
+    }
+  }
+  if (data.nodes < METRICS_NODES) {
+    data.node[data.nodes].id = node;
+    return &data.node[data.nodes++].counters;
+  }
+  return &data.node[METRICS_NODES - 1].counters;
+}
+
+metrics_counters *AquariusMetrics::type(int signal) {
+  if (signal < 0 || signal >= METRICS_TYPES) {
+    signal = 0;
+  }
+  return &data.types[signal];
+}
+
+void AquariusMetrics::attempt(uint8_t node, int signal, bool delivered) {
+  bump(counters(node)->attempts);
+  bump(type(signal)->attempts);
+  if (!delivered) {
+    bump(counters(node)->retries);
+    bump(type(signal)->retries);
+  }
+}
+
+void AquariusMetrics::timeout(uint8_t node, int signal) {
+  bump(counters(node)->timeouts);
+  bump(type(signal)->timeouts);
+}
+
+void AquariusMetrics::missed(uint8_t node, int signal) {
+  bump(counters(node)->missed);
+  bump(type(signal)->missed);
+}
+
+void AquariusMetrics::readTimeout() { bump(data.read_timeouts); }
+
+void AquariusMetrics::stackHeadroom(uint16_t bytes) {
+  data.stack_headroom = bytes;
+}
+
+uint32_t AquariusMetrics::mean(uint8_t phase) {
+  const metrics_phase &p = data.phases[phase];
+  return p.count ? p.sum_ms / p.count : 0;
+}
+
+/**
+ * This function is responsible for estimating a percentile from the
+ * histogram: the upper edge of the bucket it falls in, capped by the max.
+ */
+uint32_t AquariusMetrics::percentile(uint8_t phase, uint8_t pct) {
+  const metrics_phase &p = data.phases[phase];
+  uint32_t total = 0;
+  for (uint8_t b = 0; b < METRICS_BUCKETS; b++) {
+    total += p.histogram[b];
+  }
+  if (total == 0) {
+    return 0;
+  }
+
+  uint32_t rank = (total * pct + 99) / 100;
+  uint32_t seen = 0;
+  for (uint8_t b = 0; b < METRICS_BUCKETS; b++) {
+    seen += p.histogram[b];
+    if (seen >= rank) {
+      uint32_t edge = b == 0 ? 0 : (1UL << b) - 1;
+      return b == METRICS_BUCKETS - 1 || edge > p.max_ms ? p.max_ms : edge;
+    }
+  }
+  return p.max_ms;
+}
+
+void AquariusMetrics::dump(uint32_t uptime_ms, void (*emit)(uint8_t byte)) {
+  data.uptime_ms = uptime_ms;
+  const uint8_t *bytes = (const uint8_t *)&data;
+  for (size_t i = 0; i < sizeof(data); i++) {
+    emit(bytes[i]);
+  }
+  uint16_t crc = aq_crc16(0xFFFF, &data, sizeof(data));
+  emit(crc & 0xFF);
+  emit(crc >> 8);
+}
+
+/**
+ * This function is responsible for taking over a dump, e.g. to read it back
+ * on the host. The metrics are left untouched if it does not parse.
+ */
+bool AquariusMetrics::load(const uint8_t *dump, size_t size) {
+  metrics_data parsed;
+  if (!metrics_parse(dump, size, &parsed)) {
+    return false;
+  }
+  data = parsed;
+  return true;
+}
+
+const metrics_data &AquariusMetrics::getData() { return data; }
+
+bool metrics_parse(const uint8_t *dump, size_t size, metrics_data *out) {
+  if (size != METRICS_DUMP_SIZE) {
+    return false;
+  }
+  uint16_t crc = dump[sizeof(metrics_data)] |
+                 (uint16_t)dump[sizeof(metrics_data) + 1] << 8;
+  if (aq_crc16(0xFFFF, dump, sizeof(metrics_data)) != crc) {
+    return false;
+  }
+  memcpy(out, dump, sizeof(metrics_data));
+  return out->magic == METRICS_MAGIC && out->version == METRICS_VERSION &&
+         out->nodes <= METRICS_NODES;
+}
@@ -0,0 +1,106 @@
+#ifndef __AQUARIUS_METRICS__
+#define __AQUARIUS_METRICS__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Dump layout: the metrics_data image, little endian as on every target,
+// followed by a CRC-16/CCITT of it. Fields are laid out so that no target
+// pads them.
+#define METRICS_MAGIC 0x4D41 // "AM"
+#define METRICS_VERSION 1
+
+// Timers: one per CT phase plus the whole cycle. Histogram bucket b holds the
+// durations of b significant bits in ms, i.e. [2^(b-1), 2^b); the last one is
+// open ended (> 4 minutes).
+#define METRICS_PHASES 6
+#define METRICS_CYCLE (METRICS_PHASES - 1)
+#define METRICS_BUCKETS 20
+
+// Counters per node ID and per message type. A message's type is its signal;
+// payloads that do not start with one (e.g. the watering plan) land wherever
+// their first two bytes point, or in type 0.
+#define METRICS_NODES 40
+#define METRICS_TYPES 16
+
+typedef struct {
+  uint16_t count;
+  uint16_t failures;
+  uint32_t min_ms;
+  uint32_t max_ms;
+  uint32_t sum_ms;
+  uint16_t histogram[METRICS_BUCKETS];
+} metrics_phase;
+
+typedef struct {
+  uint16_t attempts; // write attempts
+  uint16_t retries;  // attempts that were not delivered
+  uint16_t timeouts; // writes given up on
+  uint16_t missed;   // requests that never got a reply
+} metrics_counters;
+
+typedef struct {
+  uint16_t id;
+  metrics_counters counters;
+} metrics_node;
+
+typedef struct {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t nodes;
+  uint32_t uptime_ms;
+  uint16_t read_timeouts;
+  uint16_t stack_headroom; // Untouched RAM, see AquariusStack
+  metrics_phase phases[METRICS_PHASES];
+  metrics_counters types[METRICS_TYPES];
+  metrics_node node[METRICS_NODES];
+} metrics_data;
+
+#define METRICS_DATA_SIZE 876
+#define METRICS_DUMP_SIZE (METRICS_DATA_SIZE + 2)
+static_assert(sizeof(metrics_data) == METRICS_DATA_SIZE,
+              "metrics_data must have the same layout on every target");
+
+/**
+ * Cycle time and reliability counters. Everything is saturating or halved
+ * before it overflows, so the CT can run for months without a reset.
+ */
+class AquariusMetrics {
+private:
+  metrics_data data;
+
+  metrics_counters *counters(uint8_t node);
+  metrics_counters *type(int signal);
+
+public:
+  AquariusMetrics();
+
+  void reset();
+
+  void phase(uint8_t phase, bool ok, uint32_t ms);
+  void attempt(uint8_t node, int signal, bool delivered);
+  void timeout(uint8_t node, int signal);
+  void missed(uint8_t node, int signal);
+  void readTimeout();
+  void stackHeadroom(uint16_t bytes);
+
+  uint32_t mean(uint8_t phase);
+  uint32_t percentile(uint8_t phase, uint8_t pct);
+
+  void dump(uint32_t uptime_ms, void (*emit)(uint8_t byte));
+  bool load(const uint8_t *dump, size_t size);
+  const metrics_data &getData();
+};
+
+/**
+ * This function is responsible for the histogram bucket of a duration.
+ */
+uint8_t metrics_bucket(uint32_t ms);
+
+/**
+ * This function is responsible for checking a dump and copying it out.
+ * Returns false if it is truncated, corrupted or of another version.
+ */
+bool metrics_parse(const uint8_t *dump, size_t size, metrics_data *out);
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef __AQUARIUS_PROTOCOL__
+#define __AQUARIUS_PROTOCOL__
+
+#include <stdint.h>
+
+// What every node has to agree on: signals, mesh IDs, sizes and message
+// layouts. The layouts of the bigger messages are in the libraries that use
+// them (AquariusHistory, AquariusLink, AquariusTime), built from these same
+// types. Bump PROTOCOL_VERSION with any change to one of them; the CT and
+// each node exchange it on first contact, see protocol_hello.
+#define PROTOCOL_VERSION 8
+#define PROTOCOL_UNKNOWN 0
+
+// Every message starts with its signal. Messages are laid out as on the AVR,
+// little endian with no padding, on whatever builds them.
+typedef int16_t aq_signal;
+#define AQ_MESSAGE __attribute__((packed))
+
+// Signals
+#define SIG_HARVEST_START 1
+#define SIG_REFILL_START 2
+#define SIG_REFILL_STOP 3
+#define SIG_REFILL_ACK 4
+#define SIG_PATROL_START 5
+#define SIG_PATROL_STOP 6
+#define SIG_HISTORY_REQUEST 8
+#define SIG_HISTORY_DATA 9
+#define SIG_TIME_SYNC 10
+#define SIG_LINK_SURVEY 11
+#define SIG_LINK_REPORT 12
+#define SIG_LINK_SWITCH 13
+#define SIG_HELLO 14
+#define SIG_PATROL_GO 15
+#define SIG_PATROL_LOST 16
+#define SIG_REFILL_FAULT 17
+
+// Lanes, as the RF24NetworkHeader type of a message. Signals and other
+// messages of at most CONTROL_MAX_SIZE bytes travel in the control lane and
+// are read before any bulk message that came in ahead of them; see
+// AquariusNetworkCommunicator.
+#define LANE_BULK 0
+#define LANE_CONTROL 1
+#define CONTROL_MAX_SIZE 8
+
+// Refilling: a car is refilled with what its package needs, POT_DOSE_ML for
+// each pot plus REFILL_MARGIN_ML. The CT runs its pump, REFILL_ML_PER_S, for
+// what the car lacks and MAX_REFILL_MILLIS at most. A car waters a pot by
+// running its own pump, WATERING_ML_PER_S, for WATERING_TIME ms; the dose is
+// what that pours, rounded up, so the two cannot drift apart.
+#define MAX_REFILL_MILLIS 5000
+#define REFILL_ML_PER_S 120
+#define REFILL_MARGIN_ML 60
+#define WATERING_TIME 4000UL
+#define WATERING_ML_PER_S 8
+#define POT_DOSE_ML                                                            \
+  ((uint16_t)((WATERING_TIME * WATERING_ML_PER_S + 999) / 1000))
+
+// Patrolling: a car gives up on a lap after MAX_PATROL_MILLIS and on telling
+// the CT it is back PATROL_FINISH_MILLIS later; the CT waits out both. A car
+// that gave up on its lap says SIG_PATROL_LOST instead of SIG_PATROL_STOP and
+// is left out of the fleet until someone brings it to the dock and resets it,
+// when it says SIG_PATROL_STOP.
+#define MAX_PATROL_MILLIS 300000UL
+#define PATROL_FINISH_MILLIS 60000UL
+
+// Network: the CT is the mesh master and hands out every other address at
+// runtime, so nodes are only known by their mesh node ID
+#define NODE_CT 0
+#define MESH_CHANNEL 90
+#define MESH_ID_CAR 1
+#define MESH_ID_HARVESTER 16
+#define MESH_CHECK_PERIOD 60000
+
+// Fleet: car k is MESH_ID_CAR + k
+#define MAX_CARS 8
+#ifndef CARS
+#define CARS 1
+#endif
+
+// Pot Mapping: harvester i is MESH_ID_HARVESTER + i and owns pots
+// i * POTS_PER_HARVESTER onwards. The track's POTS belong to the first
+// HARVESTERS; the others are only monitored. MAX_HARVESTERS can be raised
+// from build_flags, e.g. for ct_scale, as far as node IDs go.
+#ifndef MAX_HARVESTERS
+#define MAX_HARVESTERS 32
+#endif
+#define HARVESTERS 2
+#define POTS_PER_HARVESTER 8
+#define POTS POTS_PER_HARVESTER * HARVESTERS
+
+// Mesh node IDs run up to here. They are 8 bit and the CT keeps 255 for a
+// node it does not know.
+#define MESH_IDS (MESH_ID_HARVESTER + MAX_HARVESTERS)
+#if MESH_IDS > 255
+#error "MAX_HARVESTERS is more than mesh node IDs can tell apart"
+#endif
+
+// CT -> node, on first contact, and node -> CT in answer: the protocol each
+// one runs. A node answers whatever the CT's version is; either side that
+// sees another version than its own reports it and the CT leaves the node
+// out, instead of timing out on it cycle after cycle.
+typedef struct {
+  aq_signal signal;
+  uint8_t version;
+} AQ_MESSAGE protocol_hello;
+
+// CT -> car, ahead of its package: the marker the car waits at, once it has
+// worked it, until SIG_PATROL_GO says the cars sent to the farther packages
+// are back at the dock. The dock's marker if none of them is out.
+typedef struct {
+  aq_signal signal;
+  uint8_t hold_stop;
+} AQ_MESSAGE patrol_start;
+
+// CT -> car, with SIG_REFILL_START: the water the car's package needs. Car ->
+// CT: SIG_REFILL_ACK with the water the car holds, if that is less, else
+// SIG_REFILL_STOP, or SIG_REFILL_FAULT if it cannot read its water level. The
+// car sends SIG_REFILL_STOP again once it holds enough.
+typedef struct {
+  aq_signal signal;
+  uint16_t ml;
+} AQ_MESSAGE refill_message;
+
+// Harvest reply: filtered humidity of each pot and how long ago (ms) the
+// harvester sampled it
+typedef struct {
+  uint8_t humidity[POTS_PER_HARVESTER];
+  uint32_t age;
+} AQ_MESSAGE harvest_data;
+
+#endif
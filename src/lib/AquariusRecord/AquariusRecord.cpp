@@ -0,0 +1,104 @@
+#include <string.h>
+
+#include "AquariusRecord.h"
+
+#ifdef __AVR__
+#include <avr/eeprom.h>
+#else
+static uint8_t host_eeprom[HOST_EEPROM_SIZE];
+
+uint8_t *aq_host_eeprom() { return host_eeprom; }
+
+static void eeprom_read_block(void *dst, const void *src, size_t size) {
+  memcpy(dst, host_eeprom + (uintptr_t)src, size);
+}
+
+static void eeprom_update_block(const void *src, void *dst, size_t size) {
+  memcpy(host_eeprom + (uintptr_t)dst, src, size);
+}
+#endif
+
+/**
+ * This function is responsible for CRC-16/CCITT-FALSE, seeded with crc.
+ */
+uint16_t aq_crc16(uint16_t crc, const void *data, uint16_t size) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  while (size--) {
+    crc ^= (uint16_t)*bytes++ << 8;
+    for (uint8_t i = 0; i < 8; i++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static uint16_t record_crc(const record_header &header, const void *payload) {
+  uint16_t crc = aq_crc16(0xFFFF, &header, sizeof(header) - sizeof(header.crc));
+  return aq_crc16(crc, payload, header.size);
+}
+
+bool aq_record_load(uint16_t address, uint16_t magic, uint8_t version,
+                    void *payload, uint16_t size) {
+  record_header header;
+  eeprom_read_block(&header, (const void *)(uintptr_t)address, sizeof(header));
+  if (header.magic != magic || header.version != version ||
+      header.size != size) {
+    return false;
+  }
+
+  // Check before copying, so payload is left alone when the record is bad
+  uint16_t crc = aq_crc16(0xFFFF, &header, sizeof(header) - sizeof(header.crc));
+  for (uint16_t i = 0; i < size; i++) {
+    uint8_t value;
+    eeprom_read_block(&value,
+                      (const void *)(uintptr_t)(address + sizeof(header) + i),
+                      1);
+    crc = aq_crc16(crc, &value, 1);
+  }
+  if (crc != header.crc) {
+    return false;
+  }
+
+  eeprom_read_block(payload,
+                    (const void *)(uintptr_t)(address + sizeof(header)), size);
+  return true;
+}
+
+/**
+ * This function is responsible for writing a record. Only bytes that changed
+ * are written, to spare the EEPROM.
+ */
+void aq_record_store(uint16_t address, uint16_t magic, uint8_t version,
+                     const void *payload, uint16_t size) {
+  record_header header;
+  header.magic = magic;
+  header.version = version;
+  header.reserved = 0;
+  header.size = size;
+  header.crc = record_crc(header, payload);
+
+  eeprom_update_block(payload, (void *)(uintptr_t)(address + sizeof(header)),
+                      size);
+  eeprom_update_block(&header, (void *)(uintptr_t)address, sizeof(header));
+}
+
+void aq_record_erase(uint16_t address) {
+  record_header header;
+  memset(&header, 0xFF, sizeof(header));
+  eeprom_update_block(&header, (void *)(uintptr_t)address, sizeof(header));
+}
+
+void aq_record_seal(record_header *header, uint16_t magic, uint8_t version,
+                    const void *payload, uint16_t size) {
+  header->magic = magic;
+  header->version = version;
+  header->reserved = 0;
+  header->size = size;
+  header->crc = record_crc(*header, payload);
+}
+
+bool aq_record_valid(const record_header *header, uint16_t magic,
+                     uint8_t version, const void *payload, uint16_t size) {
+  return header->magic == magic && header->version == version &&
+         header->size == size && header->crc == record_crc(*header, payload);
+}
@@ -0,0 +1,46 @@
+#ifndef __AQUARIUS_RECORD__
+#define __AQUARIUS_RECORD__
+
+#include <stdint.h>
+
+// EEPROM record layout: header, then size bytes of payload. The CRC covers the
+// header's other fields and the payload, so a record written by other
+// firmware, of another version or half written, never loads. The reserved
+// byte is 0 and keeps the fields where they are on every target.
+typedef struct {
+  uint16_t magic;
+  uint16_t size;
+  uint8_t version;
+  uint8_t reserved;
+  uint16_t crc;
+} record_header;
+
+#define RECORD_SIZE(payload) (sizeof(record_header) + (payload))
+
+/**
+ * These functions are responsible for versioned, checksummed EEPROM records.
+ */
+bool aq_record_load(uint16_t address, uint16_t magic, uint8_t version,
+                    void *payload, uint16_t size);
+void aq_record_store(uint16_t address, uint16_t magic, uint8_t version,
+                     const void *payload, uint16_t size);
+void aq_record_erase(uint16_t address);
+
+/**
+ * These functions are responsible for the same records kept in RAM, e.g. in
+ * .noinit, where they outlive a reset but not a power cycle.
+ */
+void aq_record_seal(record_header *header, uint16_t magic, uint8_t version,
+                    const void *payload, uint16_t size);
+bool aq_record_valid(const record_header *header, uint16_t magic,
+                     uint8_t version, const void *payload, uint16_t size);
+
+uint16_t aq_crc16(uint16_t crc, const void *data, uint16_t size);
+
+#ifndef __AVR__
+// Off target the EEPROM is this array
+#define HOST_EEPROM_SIZE 4096
+uint8_t *aq_host_eeprom();
+#endif
+
+#endif
@@ -0,0 +1,106 @@
+#include "AquariusRoute.h"
+
+// Stops 0-3 only have pots on the left, 4-7 on both sides, 8-11 only on the
+// right; the pot index is the one the CT uses for needs_water
+const route_stop ROUTE_LAYOUT[ROUTE_STOPS] PROGMEM = {
+    {0, ROUTE_NO_POT},  {1, ROUTE_NO_POT},  {2, ROUTE_NO_POT},
+    {3, ROUTE_NO_POT},  {4, 8},             {5, 9},
+    {6, 10},            {7, 11},            {ROUTE_NO_POT, 12},
+    {ROUTE_NO_POT, 13}, {ROUTE_NO_POT, 14}, {ROUTE_NO_POT, 15}};
+
+uint8_t route_work(const bool *needs_water, int stop) {
+  if (stop < 0 || stop >= ROUTE_STOPS) {
+    return 0;
+  }
+
+  int8_t left = (int8_t)pgm_read_byte(&ROUTE_LAYOUT[stop].left);
+  int8_t right = (int8_t)pgm_read_byte(&ROUTE_LAYOUT[stop].right);
+
+  uint8_t work = 0;
+  if (left != ROUTE_NO_POT && needs_water[left]) {
+    work |= ROUTE_LEFT;
+  }
+  if (right != ROUTE_NO_POT && needs_water[right]) {
+    work |= ROUTE_RIGHT;
+  }
+  return work;
+}
+
+int route_last_stop(const bool *needs_water) {
+  for (int stop = ROUTE_STOPS - 1; stop >= 0; stop--) {
+    if (route_work(needs_water, stop)) {
+      return stop;
+    }
+  }
+  return ROUTE_NO_STOP;
+}
+
+uint8_t route_dry_pots(const bool *needs_water) {
+  uint8_t count = 0;
+  for (int stop = 0; stop < ROUTE_STOPS; stop++) {
+    uint8_t work = route_work(needs_water, stop);
+    count += (work & ROUTE_LEFT ? 1 : 0) + (work & ROUTE_RIGHT ? 1 : 0);
+  }
+  return count;
+}
+
+uint32_t route_stop_cost(const bool *needs_water, const uint16_t *dose_ms,
+                         int stop) {
+  uint8_t work = route_work(needs_water, stop);
+  if (!work) {
+    return 0;
+  }
+
+  uint32_t cost = ROUTE_STOP_MS;
+  if (work & ROUTE_LEFT) {
+    int8_t pot = (int8_t)pgm_read_byte(&ROUTE_LAYOUT[stop].left);
+    cost += ROUTE_ARM_MS + (dose_ms ? dose_ms[pot] : ROUTE_DOSE_MS);
+  }
+  if (work & ROUTE_RIGHT) {
+    int8_t pot = (int8_t)pgm_read_byte(&ROUTE_LAYOUT[stop].right);
+    cost += ROUTE_ARM_MS + (dose_ms ? dose_ms[pot] : ROUTE_DOSE_MS);
+  }
+  return cost;
+}
+
+/**
+ * Each cut goes where the running cost is closest to its share of the total,
+ * which for a dozen stops is as good as an exact min-max partition.
+ */
+void route_split(const bool *needs_water, const uint16_t *dose_ms, int cars,
+                 int *first_stop) {
+  uint32_t cost[ROUTE_STOPS];
+  uint32_t total = 0;
+  for (int stop = 0; stop < ROUTE_STOPS; stop++) {
+    cost[stop] = route_stop_cost(needs_water, dose_ms, stop);
+    total += cost[stop];
+  }
+
+  first_stop[0] = 0;
+  int stop = 0;
+  uint32_t done = 0;
+  for (int k = 1; k < cars; k++) {
+    uint32_t target = total * k / cars;
+    while (stop < ROUTE_STOPS && done + cost[stop] / 2 < target) {
+      done += cost[stop];
+      stop++;
+    }
+    first_stop[k] = stop;
+  }
+  first_stop[cars] = ROUTE_STOPS;
+}
+
+void route_mask(const bool *needs_water, int first_stop, int end_stop,
+                bool *package) {
+  for (int stop = 0; stop < ROUTE_STOPS; stop++) {
+    int8_t left = (int8_t)pgm_read_byte(&ROUTE_LAYOUT[stop].left);
+    int8_t right = (int8_t)pgm_read_byte(&ROUTE_LAYOUT[stop].right);
+    bool keep = stop >= first_stop && stop < end_stop;
+    if (left != ROUTE_NO_POT) {
+      package[left] = keep && needs_water[left];
+    }
+    if (right != ROUTE_NO_POT) {
+      package[right] = keep && needs_water[right];
+    }
+  }
+}
@@ -0,0 +1,82 @@
+#ifndef __AQUARIUS_ROUTE__
+#define __AQUARIUS_ROUTE__
+
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include <avr/pgmspace.h>
+#else
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#ifndef pgm_read_byte
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#endif
+#endif
+
+// The track is a single loop of markers: ROUTE_STOPS stops with pots beside
+// them, then the dock, where every patrol starts and ends
+#define ROUTE_STOPS 12
+#define ROUTE_DOCK ROUTE_STOPS
+#define ROUTE_NO_POT -1
+#define ROUTE_NO_STOP -1
+
+// Work at a stop
+#define ROUTE_LEFT 0x01
+#define ROUTE_RIGHT 0x02
+
+// Car time spent at a stop, used to balance the work between cars: stopping
+// and starting, each arm swing out and back (2 x 512 steps of 2 ms and the
+// pause after it) and the dose itself
+#define ROUTE_STOP_MS 1000
+#define ROUTE_ARM_MS 2548
+#define ROUTE_DOSE_MS 4000
+
+typedef struct {
+  int8_t left;  // pot on the left of the stop, or ROUTE_NO_POT
+  int8_t right; // pot on the right of the stop, or ROUTE_NO_POT
+} route_stop;
+
+extern const route_stop ROUTE_LAYOUT[ROUTE_STOPS] PROGMEM;
+
+/**
+ * This function is responsible for returning which arms have to water at the
+ * given stop, as a mask of ROUTE_LEFT and ROUTE_RIGHT.
+ */
+uint8_t route_work(const bool *needs_water, int stop);
+
+/**
+ * This function is responsible for finding the last stop with any work, or
+ * ROUTE_NO_STOP when nothing needs water.
+ */
+int route_last_stop(const bool *needs_water);
+
+/**
+ * This function is responsible for counting the pots the patrol will water.
+ */
+uint8_t route_dry_pots(const bool *needs_water);
+
+/**
+ * This function is responsible for estimating the time a car spends at a stop.
+ * dose_ms has the watering time of every pot; NULL means ROUTE_DOSE_MS each.
+ */
+uint32_t route_stop_cost(const bool *needs_water, const uint16_t *dose_ms,
+                         int stop);
+
+/**
+ * This function is responsible for splitting the stops into cars contiguous
+ * work packages of about the same cost. Package k is the stops from
+ * first_stop[k] up to, not including, first_stop[k + 1], so first_stop must
+ * hold cars + 1 entries. Packages can be empty.
+ */
+void route_split(const bool *needs_water, const uint16_t *dose_ms, int cars,
+                 int *first_stop);
+
+/**
+ * This function is responsible for keeping only the pots in one package of
+ * the plan, so a car can be sent the plan unchanged otherwise.
+ */
+void route_mask(const bool *needs_water, int first_stop, int end_stop,
+                bool *package);
+
+#endif
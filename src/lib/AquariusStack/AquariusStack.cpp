@@ -0,0 +1,61 @@
+#include "AquariusStack.h"
+
+#ifdef __AVR__
+
+#include <avr/io.h>
+
+extern uint8_t _end;
+extern uint8_t __heap_start;
+extern char *__brkval;
+
+/**
+ * This function is responsible for painting everything from the end of .bss
+ * to the top of RAM. It runs from .init1, before the stack is set up, so it
+ * can not use the stack nor the zero register.
+ */
+void stack_paint() __attribute__((naked, used, section(".init1")));
+void stack_paint() {
+  __asm volatile("    ldi r30, lo8(_end)\n"
+                 "    ldi r31, hi8(_end)\n"
+                 "    ldi r24, %0\n"
+                 "    ldi r25, hi8(__stack)\n"
+                 "    rjmp 2f\n"
+                 "1:  st Z+, r24\n"
+                 "2:  cpi r30, lo8(__stack)\n"
+                 "    cpc r31, r25\n"
+                 "    brlo 1b\n"
+                 "    breq 1b\n" ::"i"(STACK_CANARY));
+}
+
+static uint8_t *heap_top() {
+  return __brkval ? (uint8_t *)__brkval : &__heap_start;
+}
+
+/**
+ * This function is responsible for finding the lowest address the stack
+ * reached, scanning up from the heap for the first painted byte overwritten.
+ */
+static uint8_t *stack_low() {
+  uint8_t *p = heap_top();
+  uint8_t *sp = (uint8_t *)SP;
+  while (p <= sp && *p == STACK_CANARY) {
+    p++;
+  }
+  return p;
+}
+
+size_t stack_peak() { return (uint8_t *)RAMEND + 1 - stack_low(); }
+
+size_t stack_headroom() { return stack_low() - heap_top(); }
+
+size_t stack_free() { return (uint8_t *)SP - heap_top(); }
+
+#else
+
+size_t stack_peak() { return 0; }
+
+size_t stack_headroom() { return 0; }
+
+size_t stack_free() { return 0; }
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef __AQUARIUS_STACK__
+#define __AQUARIUS_STACK__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Free RAM is painted with this byte at boot, before main. The stack grows
+// down into it and the heap up into it; whatever still holds the pattern was
+// never touched.
+#define STACK_CANARY 0xC5
+
+/**
+ * These functions are responsible for reporting stack use against the
+ * painted RAM. Off target they all return 0.
+ *
+ * stack_peak: deepest the stack has been since boot, in bytes.
+ * stack_headroom: bytes between the heap and the deepest stack that were
+ *                 never touched, i.e. how much more the globals could grow.
+ * stack_free: gap between the heap and the stack right now.
+ */
+size_t stack_peak();
+size_t stack_headroom();
+size_t stack_free();
+
+#endif
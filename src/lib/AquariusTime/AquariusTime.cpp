@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "AquariusTime.h"
+
+int32_t aq_drift_correct(int32_t local_ms, int16_t drift_ppm) {
+  // local_ms * (1 + ppm / 1e6) in 32 bits, split to avoid overflow
+  int32_t k = local_ms / 1000, r = local_ms % 1000;
+  return local_ms + (k * drift_ppm) / 1000 + (r * drift_ppm) / 1000000L;
+}
+
+AquariusClock::AquariusClock()
+    : is_synced(false), base_local(0), base_unix(0), base_millis(0),
+      drift_ppm(0), syncs(0) {}
+
+int32_t AquariusClock::elapsed_ms(uint32_t local) {
+  return aq_drift_correct((int32_t)(local - base_local), drift_ppm);
+}
+
+/**
+ * This function is responsible for taking a sync: unix_s.unix_ms is the wall
+ * clock time at the node's local ms.
+ */
+void AquariusClock::sync(uint32_t unix_s, uint16_t unix_ms, uint32_t local) {
+  if (is_synced && synced(local)) {
+    uint32_t span_s = (local - base_local) / 1000;
+    int32_t error = (int32_t)(unix_s - unixTime(local)) * 1000 +
+                    ((int32_t)unix_ms - unixMillis(local));
+
+    if (span_s < CLOCK_MIN_DRIFT_SPAN_S) {
+      // Too soon to learn anything about the rate; keep the old base unless
+      // it is plainly wrong
+      if (error > -CLOCK_STEP_LIMIT_MS && error < CLOCK_STEP_LIMIT_MS)
+        return;
+    } else if (error > -CLOCK_MAX_ERROR_MS && error < CLOCK_MAX_ERROR_MS) {
+      int32_t change = error * 1000 / (int32_t)span_s;
+      // Take the first estimate whole, then average
+      int32_t ppm = drift_ppm + (syncs > 1 ? change / 2 : change);
+      if (ppm > CLOCK_MAX_DRIFT_PPM)
+        ppm = CLOCK_MAX_DRIFT_PPM;
+      if (ppm < -CLOCK_MAX_DRIFT_PPM)
+        ppm = -CLOCK_MAX_DRIFT_PPM;
+      drift_ppm = ppm;
+    }
+  }
+
+  if (syncs < 255)
+    syncs++;
+  is_synced = true;
+  base_local = local;
+  base_unix = unix_s;
+  base_millis = unix_ms;
+}
+
+bool AquariusClock::synced(uint32_t local) {
+  return is_synced && (local - base_local) / 1000 < CLOCK_STALE_S;
+}
+
+uint32_t AquariusClock::unixTime(uint32_t local) {
+  int32_t ms = elapsed_ms(local) + base_millis;
+  return base_unix + ms / 1000 - (ms % 1000 < 0 ? 1 : 0);
+}
+
+uint16_t AquariusClock::unixMillis(uint32_t local) {
+  int32_t ms = (elapsed_ms(local) + base_millis) % 1000;
+  return ms < 0 ? ms + 1000 : ms;
+}
+
+int16_t AquariusClock::driftPpm() { return drift_ppm; }
+
+void AquariusClock::toMessage(time_sync *message, uint32_t local) {
+  message->seconds = unixTime(local);
+  message->milliseconds = unixMillis(local);
+}
+
+/*******************************************************************************
+*********************************** Calendar ***********************************
+********************************************************************************/
+
+uint32_t aq_unix_from_civil(uint16_t year, uint8_t month, uint8_t day,
+                            uint8_t hour, uint8_t minute, uint8_t second) {
+  // Days from 1970-01-01, counting years from March so leap days come last
+  int32_t y = (int32_t)year - (month <= 2);
+  int32_t era = y / 400;
+  int32_t yoe = y - era * 400;
+  int32_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  int32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  int32_t days = era * 146097 + doe - 719468;
+  return (uint32_t)days * 86400UL + hour * 3600UL + minute * 60UL + second;
+}
+
+/**
+ * This function is responsible for parsing an RFC 7231 date, such as
+ * "Sun, 06 Nov 1994 08:49:37 GMT".
+ */
+bool aq_parse_http_date(const char *date, uint32_t *unix_s) {
+  static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+  const char *p = strchr(date, ',');
+  if (p == NULL)
+    return false;
+  p++;
+
+  char *end;
+  long day = strtol(p, &end, 10);
+  if (end == p || day < 1 || day > 31)
+    return false;
+  while (*end == ' ')
+    end++;
+
+  int month = 0;
+  while (month < 12 && strncmp(end, months + 3 * month, 3) != 0)
+    month++;
+  if (month == 12)
+    return false;
+
+  p = end + 3;
+  long year = strtol(p, &end, 10);
+  if (end == p || year < 1970)
+    return false;
+
+  p = end;
+  long hour = strtol(p, &end, 10);
+  if (*end != ':')
+    return false;
+  p = end + 1;
+  long minute = strtol(p, &end, 10);
+  if (*end != ':')
+    return false;
+  p = end + 1;
+  long second = strtol(p, &end, 10);
+  if (end == p)
+    return false;
+
+  *unix_s = aq_unix_from_civil(year, month + 1, day, hour, minute, second);
+  return true;
+}
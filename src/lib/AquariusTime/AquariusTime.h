@@ -0,0 +1,67 @@
+#ifndef __AQUARIUS_TIME__
+#define __AQUARIUS_TIME__
+
+#include <AquariusProtocol.h>
+#include <stdint.h>
+
+// Syncs closer together than CLOCK_MIN_DRIFT_SPAN_S are ignored unless they
+// are off by more than CLOCK_STEP_LIMIT_MS; rate is only estimated over spans
+// long enough for ms errors not to matter
+#define CLOCK_STEP_LIMIT_MS 2000
+#define CLOCK_MIN_DRIFT_SPAN_S 600
+#define CLOCK_MAX_ERROR_MS 2000000L
+// Ceramic resonators, as on the Nano, are good for about 0.5%
+#define CLOCK_MAX_DRIFT_PPM 20000
+// Past this the drift correction could overflow, so the clock needs a resync
+#define CLOCK_STALE_S 86400UL
+
+// CT -> every node: wall clock time when the message was sent
+typedef struct {
+  aq_signal signal;
+  uint32_t seconds;
+  uint16_t milliseconds;
+} AQ_MESSAGE time_sync;
+
+/**
+ * Wall clock kept on top of a node's own monotonic millisecond counter. Each
+ * sync both corrects the offset and refines the counter's rate error, so the
+ * clock stays accurate between syncs.
+ */
+class AquariusClock {
+private:
+  bool is_synced;
+  uint32_t base_local;
+  uint32_t base_unix;
+  uint16_t base_millis;
+  int16_t drift_ppm;
+  uint8_t syncs;
+
+  int32_t elapsed_ms(uint32_t local);
+
+public:
+  AquariusClock();
+
+  void sync(uint32_t unix_s, uint16_t unix_ms, uint32_t local);
+  bool synced(uint32_t local);
+
+  uint32_t unixTime(uint32_t local);
+  uint16_t unixMillis(uint32_t local);
+  int16_t driftPpm();
+
+  void toMessage(time_sync *message, uint32_t local);
+};
+
+/**
+ * These functions are responsible for calendar conversions, UTC only.
+ */
+uint32_t aq_unix_from_civil(uint16_t year, uint8_t month, uint8_t day,
+                            uint8_t hour, uint8_t minute, uint8_t second);
+bool aq_parse_http_date(const char *date, uint32_t *unix_s);
+
+/**
+ * This function is responsible for scaling a local duration from a node whose
+ * counter runs drift_ppm fast or slow into true milliseconds.
+ */
+int32_t aq_drift_correct(int32_t local_ms, int16_t drift_ppm);
+
+#endif
@@ -0,0 +1,186 @@
+#include <string.h>
+
+#include <AquariusRecord.h>
+
+#include "AquariusTrace.h"
+
+static void write16(uint8_t *p, uint16_t value) {
+  p[0] = value;
+  p[1] = value >> 8;
+}
+
+static void write32(uint8_t *p, uint32_t value) {
+  write16(p, value);
+  write16(p + 2, value >> 16);
+}
+
+static uint16_t read16(const uint8_t *p) { return p[0] | (uint16_t)p[1] << 8; }
+
+static uint32_t read32(const uint8_t *p) {
+  return read16(p) | (uint32_t)read16(p + 2) << 16;
+}
+
+/**
+ * This function is responsible for telling how many payload bytes a record
+ * keeps: only frames carry one, cut at TRACE_PAYLOAD_MAX.
+ */
+static uint8_t kept_size(uint8_t kind, uint8_t size) {
+  kind &= TRACE_KIND;
+  if (kind != TRACE_TX && kind != TRACE_RX) {
+    return 0;
+  }
+  return size < TRACE_PAYLOAD_MAX ? size : TRACE_PAYLOAD_MAX;
+}
+
+AquariusTrace::AquariusTrace() { reset(); }
+
+void AquariusTrace::reset() {
+  head = 0;
+  used = 0;
+  dropped = 0;
+}
+
+uint8_t AquariusTrace::at(uint16_t offset) {
+  return ring[(head + offset) % TRACE_BUFFER];
+}
+
+void AquariusTrace::put(uint8_t byte) {
+  ring[(head + used) % TRACE_BUFFER] = byte;
+  used++;
+}
+
+/**
+ * This function is responsible for appending one record, dropping the oldest
+ * ones until it fits.
+ */
+void AquariusTrace::record(uint32_t ms, uint8_t kind, uint8_t type,
+                           uint16_t node, const void *data, int size) {
+  uint8_t full = size < 0 ? 0 : size > 255 ? 255 : size;
+  uint8_t kept = kept_size(kind, full);
+
+  while (TRACE_BUFFER - used < TRACE_RECORD_HEAD + kept) {
+    uint16_t oldest = TRACE_RECORD_HEAD + kept_size(at(4), at(8));
+    head = (head + oldest) % TRACE_BUFFER;
+    used -= oldest;
+    dropped++;
+  }
+
+  for (uint8_t i = 0; i < 4; i++) {
+    put(ms >> (8 * i));
+  }
+  put(kind);
+  put(type);
+  put(node);
+  put(node >> 8);
+  put(full);
+  for (uint8_t i = 0; i < kept; i++) {
+    put(((const uint8_t *)data)[i]);
+  }
+}
+
+void AquariusTrace::sent(uint32_t ms, uint16_t to, uint8_t type,
+                         const void *data, int size, bool delivered) {
+  record(ms, TRACE_TX | (delivered ? TRACE_DELIVERED : 0), type, to, data,
+         size);
+}
+
+void AquariusTrace::received(uint32_t ms, uint16_t from, uint8_t type,
+                             const void *data, int size) {
+  record(ms, TRACE_RX, type, from, data, size);
+}
+
+void AquariusTrace::writeTimeout(uint32_t ms, uint16_t to, uint8_t type,
+                                 int size) {
+  record(ms, TRACE_TIMEOUT | TRACE_WRITE, type, to, NULL, size);
+}
+
+void AquariusTrace::readTimeout(uint32_t ms) {
+  record(ms, TRACE_TIMEOUT, 0, 0, NULL, 0);
+}
+
+void AquariusTrace::mark(uint32_t ms, uint8_t phase) {
+  record(ms, TRACE_MARK, phase, 0, NULL, 0);
+}
+
+uint16_t AquariusTrace::getUsed() { return used; }
+
+uint32_t AquariusTrace::getDropped() { return dropped; }
+
+/**
+ * This function is responsible for sending the trace out byte by byte, see
+ * TRACE_MAGIC for the layout. The trace is kept, dump it again to get it
+ * twice.
+ */
+void AquariusTrace::dump(uint32_t now_ms, uint16_t read_timeout,
+                         uint16_t write_timeout, void (*emit)(uint8_t byte)) {
+  uint8_t head_bytes[TRACE_DUMP_HEAD];
+  write16(head_bytes, TRACE_MAGIC);
+  head_bytes[2] = TRACE_VERSION;
+  head_bytes[3] = TRACE_PAYLOAD_MAX;
+  write32(head_bytes + 4, dropped);
+  write16(head_bytes + 8, read_timeout);
+  write16(head_bytes + 10, write_timeout);
+  write32(head_bytes + 12, now_ms);
+  write16(head_bytes + 16, used);
+
+  uint16_t crc = aq_crc16(0xFFFF, head_bytes, TRACE_DUMP_HEAD);
+  for (uint8_t i = 0; i < TRACE_DUMP_HEAD; i++) {
+    emit(head_bytes[i]);
+  }
+  for (uint16_t i = 0; i < used; i++) {
+    uint8_t byte = at(i);
+    crc = aq_crc16(crc, &byte, 1);
+    emit(byte);
+  }
+  emit(crc & 0xFF);
+  emit(crc >> 8);
+}
+
+bool trace_parse(const uint8_t *dump, size_t size, trace_info *info) {
+  if (size < TRACE_DUMP_HEAD + 2 || read16(dump) != TRACE_MAGIC ||
+      dump[2] != TRACE_VERSION) {
+    return false;
+  }
+  uint16_t bytes = read16(dump + 16);
+  if (size < (size_t)TRACE_DUMP_HEAD + bytes + 2) {
+    return false;
+  }
+  uint16_t crc = read16(dump + TRACE_DUMP_HEAD + bytes);
+  if (aq_crc16(0xFFFF, dump, TRACE_DUMP_HEAD + bytes) != crc) {
+    return false;
+  }
+
+  info->payload_max = dump[3];
+  info->dropped = read32(dump + 4);
+  info->read_timeout = read16(dump + 8);
+  info->write_timeout = read16(dump + 10);
+  info->dumped_ms = read32(dump + 12);
+  info->bytes = bytes;
+  info->records = dump + TRACE_DUMP_HEAD;
+  return info->payload_max == TRACE_PAYLOAD_MAX;
+}
+
+/**
+ * This function is responsible for reading the record at offset and moving
+ * offset to the next one. Returns false at the end of the records.
+ */
+bool trace_next(const trace_info &info, uint16_t *offset, trace_frame *out) {
+  if (*offset + TRACE_RECORD_HEAD > info.bytes) {
+    return false;
+  }
+  const uint8_t *p = info.records + *offset;
+  uint8_t kept = kept_size(p[4], p[8]);
+  if (*offset + TRACE_RECORD_HEAD + kept > info.bytes) {
+    return false;
+  }
+
+  out->ms = read32(p);
+  out->kind = p[4];
+  out->type = p[5];
+  out->node = read16(p + 6);
+  out->size = p[8];
+  memset(out->payload, 0, sizeof(out->payload));
+  memcpy(out->payload, p + TRACE_RECORD_HEAD, kept);
+  *offset += TRACE_RECORD_HEAD + kept;
+  return true;
+}
@@ -0,0 +1,93 @@
+#ifndef __AQUARIUS_TRACE__
+#define __AQUARIUS_TRACE__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Dump: magic "AT", version, payload limit, records dropped, the recorder's
+// read and write timeouts, time of the dump, record bytes, the records oldest
+// first, then the CRC16 of all of it. Multi-byte fields are little endian.
+#define TRACE_MAGIC 0x5441
+#define TRACE_VERSION 1
+#define TRACE_DUMP_HEAD 18
+
+#ifndef TRACE_BUFFER
+#define TRACE_BUFFER 1024
+#endif
+#define TRACE_PAYLOAD_MAX 32
+
+// Record kinds
+#define TRACE_TX 0      // One write attempt
+#define TRACE_RX 1      // One message read
+#define TRACE_TIMEOUT 2 // A write gave up, or a read timed out (no node)
+#define TRACE_MARK 3    // A phase started, type is the phase
+#define TRACE_KIND 0x0F
+#define TRACE_DELIVERED 0x80 // TRACE_TX that was acknowledged
+#define TRACE_WRITE 0x40     // TRACE_TIMEOUT of a write
+
+// Record: ms (4), kind (1), type (1), node (2), size (1), then at most
+// TRACE_PAYLOAD_MAX bytes of the payload
+#define TRACE_RECORD_HEAD 9
+
+typedef struct {
+  uint32_t ms;
+  uint8_t kind;
+  uint8_t type;
+  uint16_t node;
+  uint8_t size;
+  uint8_t payload[TRACE_PAYLOAD_MAX];
+} trace_frame;
+
+typedef struct {
+  uint8_t payload_max;
+  uint32_t dropped;
+  uint16_t read_timeout;
+  uint16_t write_timeout;
+  uint32_t dumped_ms;
+  uint16_t bytes;
+  const uint8_t *records;
+} trace_info;
+
+/**
+ * This class is responsible for recording radio traffic into a ring, the
+ * oldest records making room for new ones.
+ */
+class AquariusTrace {
+private:
+  uint8_t ring[TRACE_BUFFER];
+  uint16_t head;
+  uint16_t used;
+  uint32_t dropped;
+
+  uint8_t at(uint16_t offset);
+  void put(uint8_t byte);
+  void record(uint32_t ms, uint8_t kind, uint8_t type, uint16_t node,
+              const void *data, int size);
+
+public:
+  AquariusTrace();
+  void reset();
+
+  void sent(uint32_t ms, uint16_t to, uint8_t type, const void *data, int size,
+            bool delivered);
+  void received(uint32_t ms, uint16_t from, uint8_t type, const void *data,
+                int size);
+  void writeTimeout(uint32_t ms, uint16_t to, uint8_t type, int size);
+  void readTimeout(uint32_t ms);
+  void mark(uint32_t ms, uint8_t phase);
+
+  uint16_t getUsed();
+  uint32_t getDropped();
+
+  void dump(uint32_t now_ms, uint16_t read_timeout, uint16_t write_timeout,
+            void (*emit)(uint8_t byte));
+};
+
+/**
+ * These functions are responsible for reading a dump back: trace_parse checks
+ * it, trace_next walks its records.
+ */
+bool trace_parse(const uint8_t *dump, size_t size, trace_info *info);
+bool trace_next(const trace_info &info, uint16_t *offset, trace_frame *out);
+
+#endif
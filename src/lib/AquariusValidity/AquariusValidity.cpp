@@ -0,0 +1,110 @@
+#include "AquariusValidity.h"
+
+#include <string.h>
+
+ValidityModel::ValidityModel(validity_pot *pots, uint8_t count)
+    : pots(pots), count(count) {
+  memset(pots, 0, sizeof(validity_pot) * count);
+}
+
+uint8_t validity_range(uint8_t humidity) {
+  return humidity < VALIDITY_MIN || humidity > VALIDITY_MAX ? VALIDITY_RANGE
+                                                            : 0;
+}
+
+/**
+ * This function is responsible for the rate check against the last plausible
+ * reading: a drop faster than soil dries, or a rise no watering explains. Two
+ * readings in a row that agree with each other are taken as the new level,
+ * so a pot that was repotted or moved is not flagged for good.
+ */
+uint8_t ValidityModel::rate(validity_pot &p, uint32_t time, uint8_t humidity) {
+  bool dropped = false;
+  if (time != 0 && p.time != 0 && time > p.time) {
+    uint32_t allowed =
+        VALIDITY_NOISE + (time - p.time) / 3600 * VALIDITY_DROP_PER_H;
+    dropped = p.humidity > humidity &&
+              (uint32_t)(p.humidity - humidity) > allowed;
+  }
+  bool rose = !p.watered && humidity > p.humidity + VALIDITY_MAX_RISE;
+  if (!dropped && !rose) {
+    return 0;
+  }
+
+  uint8_t from = p.candidate;
+  p.candidate = humidity;
+  if (from + VALIDITY_NOISE >= humidity && humidity + VALIDITY_NOISE >= from) {
+    return 0;
+  }
+  return VALIDITY_RATE;
+}
+
+/**
+ * This function is responsible for checking a new reading of a pot taken at
+ * time, 0 if the wall clock is not known. Returns why it is implausible, 0
+ * if it is not; the pot's score counts in.
+ */
+uint8_t ValidityModel::check(uint8_t pot, uint32_t time, uint8_t humidity) {
+  if (pot >= count) {
+    return validity_range(humidity);
+  }
+  validity_pot &p = pots[pot];
+
+  uint8_t flags = validity_range(humidity);
+  if (!flags && p.seen) {
+    flags = rate(p, time, humidity);
+  }
+  if (!flags && p.seen && humidity == p.humidity) {
+    if (p.since == 0) {
+      p.since = time;
+    }
+    // A watering moves a probe that is in the soil
+    if (p.watered || (p.since != 0 && time > p.since &&
+                      time - p.since >= VALIDITY_STUCK_S)) {
+      flags = VALIDITY_STUCK;
+    }
+  } else if (!flags) {
+    p.seen = true;
+    p.since = time;
+  }
+  if (!flags) {
+    p.humidity = humidity;
+    p.time = time;
+  }
+  p.watered = false;
+
+  if (flags) {
+    p.score = p.score + VALIDITY_PENALTY > VALIDITY_MAX_SCORE
+                  ? VALIDITY_MAX_SCORE
+                  : p.score + VALIDITY_PENALTY;
+  } else if (p.score > 0) {
+    p.score--;
+  }
+  if (p.score >= VALIDITY_SUSPECT) {
+    flags |= VALIDITY_SCORE;
+  }
+  p.flags = flags;
+  return flags;
+}
+
+/**
+ * This function is responsible for noting that a pot was watered, so the
+ * next reading may rise and must move.
+ */
+void ValidityModel::watered(uint8_t pot) {
+  if (pot < count) {
+    pots[pot].watered = true;
+  }
+}
+
+/**
+ * This function is responsible for whether the last reading of a pot can be
+ * planned on. A pot not read yet can.
+ */
+bool ValidityModel::plausible(uint8_t pot) {
+  return pot >= count || pots[pot].flags == 0;
+}
+
+uint8_t ValidityModel::getFlags(uint8_t pot) {
+  return pot < count ? pots[pot].flags : 0;
+}
@@ -0,0 +1,68 @@
+#ifndef __AQUARIUS_VALIDITY__
+#define __AQUARIUS_VALIDITY__
+
+#include <stdint.h>
+
+// Per pot plausibility of humidity readings. Each reading is checked against
+// the range a connected probe can read, against how fast soil can dry since
+// the last plausible reading, and for a probe stuck on one value: through a
+// watering, or for VALIDITY_STUCK_S of wall time. Readings are whole percents
+// and cycles may run back to back, so how many readings agree says nothing
+// on its own; a healthy pot can read the same for hours. A failed
+// check raises the pot's score by VALIDITY_PENALTY, a passed one lowers it by
+// one; a pot whose score is VALIDITY_SUSPECT or more stays implausible until
+// it came down again, so one glitch costs one reading and a flaky probe more.
+//
+// The calibration curves clamp at 0 and 100, which is where a probe off its
+// pot, unplugged or shorted, reads.
+#define VALIDITY_MIN 1
+#define VALIDITY_MAX 99
+#define VALIDITY_NOISE 3         // points any two readings may differ by
+#define VALIDITY_DROP_PER_H 5    // soil does not dry faster, points
+#define VALIDITY_MAX_RISE 60     // points, without a watering seen
+#define VALIDITY_STUCK_S 259200UL // unchanged this long, three days
+#define VALIDITY_PENALTY 3
+#define VALIDITY_SUSPECT 3
+#define VALIDITY_MAX_SCORE 15
+
+// Why a reading is implausible, as uploaded
+#define VALIDITY_RANGE 0x01
+#define VALIDITY_RATE 0x02
+#define VALIDITY_STUCK 0x04
+#define VALIDITY_SCORE 0x08 // the pot's score, from readings before
+
+typedef struct {
+  uint32_t time;      // of the last plausible reading, unix s, 0 if unknown
+  uint32_t since;     // unix s humidity was first read at, 0 if unknown
+  uint8_t humidity;   // last plausible reading
+  uint8_t candidate;  // last reading that failed the rate check
+  bool seen;          // a plausible reading came in
+  uint8_t score;
+  uint8_t flags;      // of the last reading
+  bool watered;       // since the last reading
+} validity_pot;
+
+/**
+ * This function is responsible for the range check alone, for readings of
+ * pots without a validity_pot: VALIDITY_RANGE if it fails, else 0.
+ */
+uint8_t validity_range(uint8_t humidity);
+
+class ValidityModel {
+private:
+  validity_pot *pots;
+  uint8_t count;
+
+  uint8_t rate(validity_pot &p, uint32_t time, uint8_t humidity);
+
+public:
+  ValidityModel(validity_pot *pots, uint8_t count);
+
+  uint8_t check(uint8_t pot, uint32_t time, uint8_t humidity);
+  void watered(uint8_t pot);
+
+  bool plausible(uint8_t pot);
+  uint8_t getFlags(uint8_t pot);
+};
+
+#endif
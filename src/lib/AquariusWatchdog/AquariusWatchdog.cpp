@@ -0,0 +1,58 @@
+#include "AquariusWatchdog.h"
+
+#ifdef __AVR__
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/wdt.h>
+
+#define WATCHDOG_TICKS (WATCHDOG_TIMEOUT_MS / 1000)
+
+static uint8_t reset_cause AQ_NOINIT;
+static volatile uint8_t ticks_left;
+
+/**
+ * This function is responsible for keeping why the MCU reset and turning the
+ * watchdog off before a reset by it fires again, 15 ms in. It runs from
+ * .init3, before the constructors and the rest of setup.
+ */
+void watchdog_boot() __attribute__((naked, used, section(".init3")));
+void watchdog_boot() {
+  reset_cause = MCUSR;
+  MCUSR = 0;
+  wdt_disable();
+}
+
+/**
+ * This function is responsible for a watchdog tick. The hardware clears WDIE
+ * as it gets here, so the next timeout resets unless there are ticks left.
+ */
+ISR(WDT_vect) {
+  if (ticks_left > 0) {
+    ticks_left--;
+    WDTCSR |= _BV(WDIE);
+  }
+}
+
+void aq_watchdog_begin() {
+  ticks_left = WATCHDOG_TICKS;
+  wdt_enable(WDTO_1S);
+  WDTCSR |= _BV(WDIE);
+}
+
+void aq_watchdog_feed() {
+  ticks_left = WATCHDOG_TICKS;
+  wdt_reset();
+}
+
+bool aq_watchdog_fired() { return reset_cause & _BV(WDRF); }
+
+#else
+
+void aq_watchdog_begin() {}
+
+void aq_watchdog_feed() {}
+
+bool aq_watchdog_fired() { return false; }
+
+#endif
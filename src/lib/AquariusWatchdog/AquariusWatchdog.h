@@ -0,0 +1,37 @@
+#ifndef __AQUARIUS_WATCHDOG__
+#define __AQUARIUS_WATCHDOG__
+
+#include <stdint.h>
+
+// A node that is not fed for WATCHDOG_TIMEOUT_MS resets. It is only fed where
+// the node gets somewhere: a phase, a node or a car dealt with, a marker
+// passed. The waits on the radio do not feed it, so a loop that keeps waiting
+// without getting anywhere trips it as well as a hang. The hardware counts to
+// 8 s at most, so it ticks every second in interrupt mode and only resets once
+// the ticks run out, or within a second if interrupts are off. Needs a
+// bootloader that turns the watchdog off, as the Mega's and optiboot do; an
+// old one resets over and over once it has fired.
+#define WATCHDOG_TIMEOUT_MS 60000
+
+// Kept in RAM that is not cleared at boot: survives a watchdog or external
+// reset, holds garbage after a power cycle. Whatever is kept there needs a
+// checksum, see aq_record_seal().
+#ifdef __AVR__
+#define AQ_NOINIT __attribute__((section(".noinit")))
+#else
+#define AQ_NOINIT
+#endif
+
+/**
+ * These functions are responsible for the hardware watchdog. Off target they
+ * do nothing and aq_watchdog_fired() is false.
+ *
+ * aq_watchdog_begin: starts it, once setup() is through with its own waits.
+ * aq_watchdog_feed: restarts its count.
+ * aq_watchdog_fired: whether it caused the last reset.
+ */
+void aq_watchdog_begin();
+void aq_watchdog_feed();
+bool aq_watchdog_fired();
+
+#endif
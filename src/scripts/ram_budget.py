@@ -0,0 +1,98 @@
+# Post build step: reports the flash and RAM taken by the firmware, the
+# largest symbols of each, and fails the build when a budget is exceeded.
+#
+# In platformio.ini:
+#   extra_scripts = post:../../scripts/ram_budget.py
+#   custom_ram_budget = 1536      ; bytes of .data + .bss + .noinit
+#   custom_flash_budget = 30720   ; bytes of .text + .data
+#   custom_budget_symbols = 10    ; how many symbols to list, 0 for none
+#
+# The RAM budget is the static part only; what is left of the chip is for the
+# stack and the heap. AquariusStack reports how much of that is really used.
+
+import os
+import subprocess
+
+Import("env")
+
+RAM_SECTIONS = (".data", ".bss", ".noinit")
+FLASH_SECTIONS = (".text", ".data")
+RAM_TYPES = "dDbBvV"
+FLASH_TYPES = "tTrRwW"
+
+
+def option(name, default):
+    value = env.GetProjectOption(name, "")
+    return int(value) if value else default
+
+
+def tool(name):
+    return env.subst("$SIZETOOL").replace("size", name)
+
+
+def sections(elf):
+    """Returns the size of every section, from `size -A`."""
+    out = subprocess.check_output([tool("size"), "-A", elf]).decode()
+    sizes = {}
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) == 3 and fields[0].startswith("."):
+            sizes[fields[0]] = int(fields[1])
+    return sizes
+
+
+def symbols(elf):
+    """Returns (size, type, name) for every symbol with a size, largest first."""
+    out = subprocess.check_output(
+        [tool("nm"), "-S", "-C", "--size-sort", "-r", elf]).decode()
+    found = []
+    for line in out.splitlines():
+        fields = line.split(None, 3)
+        if len(fields) == 4:
+            found.append((int(fields[1], 16), fields[2], fields[3]))
+    return found
+
+
+def print_symbols(title, found, types, count):
+    listed = [s for s in found if s[1] in types][:count]
+    if not listed:
+        return
+    print(title)
+    for size, _, name in listed:
+        print("  %6d  %s" % (size, name))
+
+
+def check_budget(source, target, env):
+    elf = str(target[0])
+    sizes = sections(elf)
+    ram = sum(sizes.get(s, 0) for s in RAM_SECTIONS)
+    flash = sum(sizes.get(s, 0) for s in FLASH_SECTIONS)
+    ram_budget = option("custom_ram_budget", 0)
+    flash_budget = option("custom_flash_budget", 0)
+
+    print("Budget [%s]: .data %d, .bss %d, .noinit %d, .text %d" % (
+        env["PIOENV"], sizes.get(".data", 0), sizes.get(".bss", 0),
+        sizes.get(".noinit", 0), sizes.get(".text", 0)))
+    print("  RAM   %6d of %6s" % (ram, ram_budget or "-"))
+    print("  Flash %6d of %6s" % (flash, flash_budget or "-"))
+
+    count = option("custom_budget_symbols", 10)
+    if count:
+        found = symbols(elf)
+        print_symbols("Largest RAM symbols:", found, RAM_TYPES, count)
+        print_symbols("Largest flash symbols:", found, FLASH_TYPES, count)
+
+    over = []
+    if ram_budget and ram > ram_budget:
+        over.append("RAM %d > %d" % (ram, ram_budget))
+    if flash_budget and flash > flash_budget:
+        over.append("flash %d > %d" % (flash, flash_budget))
+    if over:
+        print("Error: over budget: " + ", ".join(over))
+        # Otherwise the next build finds the ELF up to date and passes
+        os.remove(elf)
+        return 1
+    return 0
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", check_budget)